@@ -0,0 +1,30 @@
+#!/bin/sh
+# Runs every benchmark natively (--run) and with the bytecode interpreter (--interpret)
+# and prints the wall clock time of both. The exit codes have to agree.
+ENT="${ENT:-./ent}"
+DIR="$(dirname "$0")"
+
+now() {
+    date +%s%N
+}
+
+status=0
+printf "%-12s %10s %12s %8s\n" "benchmark" "native ms" "interpret ms" "ratio"
+for program in "$DIR"/*.ent; do
+    start=$(now)
+    "$ENT" --run "$program"
+    native=$?
+    middle=$(now)
+    "$ENT" --interpret "$program"
+    interpreted=$?
+    end=$(now)
+    nativeMs=$(( (middle - start) / 1000000 ))
+    interpretMs=$(( (end - middle) / 1000000 ))
+    ratio=$(awk "BEGIN { printf \"%.1fx\", $interpretMs / ($nativeMs > 0 ? $nativeMs : 1) }")
+    printf "%-12s %10d %12d %8s\n" "$(basename "$program" .ent)" "$nativeMs" "$interpretMs" "$ratio"
+    if [ "$native" != "$interpreted" ]; then
+        echo "$(basename "$program"): native returned $native, interpreter returned $interpreted"
+        status=1
+    fi
+done
+exit $status
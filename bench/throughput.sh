@@ -0,0 +1,35 @@
+#!/bin/sh
+# Compiles the given programs with each compiler binary several times and prints how long a
+# pass over all of them took and how many source lines a second that is.
+# usage: throughput.sh <ent binary>... -- <program.ent>...
+ROUNDS="${ROUNDS:-5}"
+
+compilers=""
+while [ $# -gt 0 ] && [ "$1" != "--" ]; do
+    compilers="$compilers $1"
+    shift
+done
+shift
+
+lines=$(cat "$@" | wc -l)
+
+now() {
+    date +%s%N
+}
+
+printf "%-28s %12s %14s %12s\n" "compiler" "ms per pass" "lines per s" "size (KiB)"
+for compiler in $compilers; do
+    start=$(now)
+    round=0
+    while [ $round -lt "$ROUNDS" ]; do
+        for program in "$@"; do
+            "$compiler" "$program" > /dev/null || exit 1
+        done
+        round=$((round + 1))
+    done
+    end=$(now)
+    passMs=$(( (end - start) / 1000000 / ROUNDS ))
+    rate=$(awk "BEGIN { printf \"%d\", $lines * 1000 / ($passMs > 0 ? $passMs : 1) }")
+    size=$(( $(wc -c < "$compiler") / 1024 ))
+    printf "%-28s %12d %14s %12d\n" "$compiler" "$passMs" "$rate" "$size"
+done
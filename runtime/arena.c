@@ -0,0 +1,160 @@
+// Arena allocator for EntS programs. Allocations bump a pointer through chunks mapped with mmap
+// and are never freed one by one: ents_arena_reset hands everything back at once and keeps the
+// chunks for the next round, so an arena reused per request stops calling into the kernel once
+// it has grown to the size requests need. The arena itself lives at the start of its first chunk.
+#define _DEFAULT_SOURCE
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#define DEFAULT_CHUNK_SIZE ((size_t)64 << 10)
+#define MAX_CHUNK_SIZE ((size_t)16 << 20)
+#define PAGE_SIZE ((size_t)4096)
+#define ALIGNMENT 16
+
+struct ents_arena_chunk {
+    struct ents_arena_chunk* next; // chunks after the current one are free
+    size_t size;                   // bytes of the mapping, this header included
+};
+
+struct ents_arena {
+    struct ents_arena_chunk* first;
+    struct ents_arena_chunk* current;
+    uintptr_t cursor;
+    uintptr_t limit;
+    size_t chunk_size; // size of the next chunk mapped, doubles with every one
+};
+
+static uintptr_t align_up(uintptr_t value, size_t alignment) {
+    return (value + alignment - 1) & ~(uintptr_t)(alignment - 1);
+}
+
+// where allocations in a chunk start, after the arena in the first one
+static uintptr_t chunk_start(const struct ents_arena* arena, const struct ents_arena_chunk* chunk) {
+    uintptr_t start = (uintptr_t)(chunk + 1);
+    if (chunk == arena->first) {
+        start = (uintptr_t)(arena + 1);
+    }
+    return align_up(start, ALIGNMENT);
+}
+
+static uintptr_t chunk_end(const struct ents_arena_chunk* chunk) {
+    return (uintptr_t)chunk + chunk->size;
+}
+
+static struct ents_arena_chunk* map_chunk(size_t size) {
+    size = align_up(size, PAGE_SIZE);
+    void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return NULL;
+    }
+    struct ents_arena_chunk* chunk = memory;
+    chunk->next = NULL;
+    chunk->size = size;
+    return chunk;
+}
+
+static void enter_chunk(struct ents_arena* arena, struct ents_arena_chunk* chunk) {
+    arena->current = chunk;
+    arena->cursor = chunk_start(arena, chunk);
+    arena->limit = chunk_end(chunk);
+}
+
+// `chunk_size` is the size of the first chunk, 0 picks a default
+struct ents_arena* ents_arena_create(size_t chunk_size) {
+    if (chunk_size == 0) {
+        chunk_size = DEFAULT_CHUNK_SIZE;
+    }
+    struct ents_arena_chunk* chunk = map_chunk(chunk_size + sizeof(struct ents_arena_chunk) + sizeof(struct ents_arena));
+    if (!chunk) {
+        return NULL;
+    }
+    struct ents_arena* arena = (struct ents_arena*)(chunk + 1);
+    arena->first = chunk;
+    arena->chunk_size = chunk->size < MAX_CHUNK_SIZE ? chunk->size * 2 : MAX_CHUNK_SIZE;
+    enter_chunk(arena, chunk);
+    return arena;
+}
+
+// the current chunk is full: move on to a free one the request fits in or map a new one after it
+static void* grow(struct ents_arena* arena, size_t size, size_t alignment) {
+    for (struct ents_arena_chunk* chunk = arena->current->next; chunk; chunk = chunk->next) {
+        uintptr_t start = align_up(chunk_start(arena, chunk), alignment);
+        if (start + size <= chunk_end(chunk)) {
+            enter_chunk(arena, chunk);
+            arena->cursor = start + size;
+            return (void*)start;
+        }
+    }
+
+    size_t needed = sizeof(struct ents_arena_chunk) + ALIGNMENT + alignment + size;
+    struct ents_arena_chunk* chunk = map_chunk(needed > arena->chunk_size ? needed : arena->chunk_size);
+    if (!chunk) {
+        return NULL;
+    }
+    if (arena->chunk_size < MAX_CHUNK_SIZE) {
+        arena->chunk_size *= 2;
+    }
+    chunk->next = arena->current->next;
+    arena->current->next = chunk;
+    enter_chunk(arena, chunk);
+    uintptr_t start = align_up(arena->cursor, alignment);
+    arena->cursor = start + size;
+    return (void*)start;
+}
+
+// `alignment` is a power of two
+void* ents_arena_alloc_aligned(struct ents_arena* arena, size_t size, size_t alignment) {
+    if (alignment < ALIGNMENT) {
+        alignment = ALIGNMENT;
+    }
+    uintptr_t start = align_up(arena->cursor, alignment);
+    if (start + size <= arena->limit && start >= arena->cursor) {
+        arena->cursor = start + size;
+        return (void*)start;
+    }
+    return grow(arena, size, alignment);
+}
+
+void* ents_arena_alloc(struct ents_arena* arena, size_t size) {
+    return ents_arena_alloc_aligned(arena, size, ALIGNMENT);
+}
+
+// the point ents_arena_release goes back to, freeing what was allocated after it
+uintptr_t ents_arena_mark(const struct ents_arena* arena) {
+    return arena->cursor;
+}
+
+void ents_arena_release(struct ents_arena* arena, uintptr_t mark) {
+    for (struct ents_arena_chunk* chunk = arena->first; chunk != arena->current->next; chunk = chunk->next) {
+        if (mark >= chunk_start(arena, chunk) && mark <= chunk_end(chunk)) {
+            enter_chunk(arena, chunk);
+            arena->cursor = mark;
+            return;
+        }
+    }
+}
+
+// frees every allocation at once, the chunks stay mapped for what comes next
+void ents_arena_reset(struct ents_arena* arena) {
+    enter_chunk(arena, arena->first);
+}
+
+// bytes handed out since the last reset, alignment padding included
+size_t ents_arena_used(const struct ents_arena* arena) {
+    size_t used = 0;
+    for (struct ents_arena_chunk* chunk = arena->first; chunk != arena->current; chunk = chunk->next) {
+        used += chunk_end(chunk) - chunk_start(arena, chunk);
+    }
+    return used + (arena->cursor - chunk_start(arena, arena->current));
+}
+
+void ents_arena_destroy(struct ents_arena* arena) {
+    struct ents_arena_chunk* chunk = arena->first->next;
+    while (chunk) {
+        struct ents_arena_chunk* next = chunk->next;
+        munmap(chunk, chunk->size);
+        chunk = next;
+    }
+    munmap(arena->first, arena->first->size);
+}
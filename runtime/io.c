@@ -0,0 +1,544 @@
+// I/O for EntS programs without the C library: system call wrappers, buffered writers and readers
+// and number formatting. Small writes are gathered in the buffer, a write too big for it goes out
+// together with what is buffered in one writev, so output heavy programs make a system call per
+// buffer full rather than per print. Nothing here calls into libc, programs can be linked with
+// crt0.o alone, see sysroot/include/ents/io.ent.
+#define _DEFAULT_SOURCE
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#define BUFFER_SIZE ((size_t)64 << 10)
+#define EINTR 4
+
+struct ents_writer {
+    int fd;
+    int error;       // the last failed system call, as a negative errno
+    size_t used;
+    size_t capacity; // 0 writes through, for stderr
+    char* buffer;
+};
+
+struct ents_reader {
+    int fd;
+    int error;
+    size_t start; // next byte not handed out yet
+    size_t end;
+    char* buffer;
+};
+
+// ---- system calls, failures return the negative errno like the kernel does
+
+static long syscall1(long number, long a) {
+    long result;
+    __asm__ volatile("syscall" : "=a"(result) : "a"(number), "D"(a) : "rcx", "r11", "memory");
+    return result;
+}
+
+static long syscall3(long number, long a, long b, long c) {
+    long result;
+    __asm__ volatile("syscall" : "=a"(result) : "a"(number), "D"(a), "S"(b), "d"(c) : "rcx", "r11", "memory");
+    return result;
+}
+
+static long syscall4(long number, long a, long b, long c, long d) {
+    long result;
+    register long r10 __asm__("r10") = d;
+    __asm__ volatile("syscall" : "=a"(result) : "a"(number), "D"(a), "S"(b), "d"(c), "r"(r10) : "rcx", "r11", "memory");
+    return result;
+}
+
+static long syscall6(long number, long a, long b, long c, long d, long e, long f) {
+    long result;
+    register long r10 __asm__("r10") = d;
+    register long r8 __asm__("r8") = e;
+    register long r9 __asm__("r9") = f;
+    __asm__ volatile("syscall" : "=a"(result) : "a"(number), "D"(a), "S"(b), "d"(c), "r"(r10), "r"(r8), "r"(r9) : "rcx", "r11", "memory");
+    return result;
+}
+
+int64_t ents_sys_read(int64_t fd, void* buffer, int64_t size) {
+    return syscall3(SYS_read, fd, (long)buffer, size);
+}
+
+int64_t ents_sys_write(int64_t fd, const void* buffer, int64_t size) {
+    return syscall3(SYS_write, fd, (long)buffer, size);
+}
+
+int64_t ents_sys_writev(int64_t fd, const struct iovec* vectors, int64_t count) {
+    return syscall3(SYS_writev, fd, (long)vectors, count);
+}
+
+int64_t ents_sys_openat(int64_t directory, const char* path, int64_t flags, int64_t mode) {
+    return syscall4(SYS_openat, directory, (long)path, flags, mode);
+}
+
+int64_t ents_sys_close(int64_t fd) {
+    return syscall1(SYS_close, fd);
+}
+
+int64_t ents_sys_mmap(void* address, int64_t size, int64_t protection, int64_t flags, int64_t fd, int64_t offset) {
+    return syscall6(SYS_mmap, (long)address, size, protection, flags, fd, offset);
+}
+
+int64_t ents_sys_munmap(void* address, int64_t size) {
+    return syscall3(SYS_munmap, (long)address, size, 0);
+}
+
+__attribute__((noreturn)) void ents_sys_exit(int64_t code) {
+    for (;;) {
+        syscall1(SYS_exit_group, code);
+    }
+}
+
+// ---- number formatting, `out` needs room for 24 bytes for integers
+
+static const char digit_pairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// two digits per division, written backwards from the end of a scratch buffer
+size_t ents_format_uint(char* out, uint64_t value) {
+    char scratch[20];
+    char* cursor = scratch + sizeof(scratch);
+    while (value >= 100) {
+        const char* pair = digit_pairs + (value % 100) * 2;
+        value /= 100;
+        *--cursor = pair[1];
+        *--cursor = pair[0];
+    }
+    if (value >= 10) {
+        *--cursor = digit_pairs[value * 2 + 1];
+        *--cursor = digit_pairs[value * 2];
+    } else {
+        *--cursor = (char)('0' + value);
+    }
+    size_t length = scratch + sizeof(scratch) - cursor;
+    for (size_t i = 0; i < length; ++i) {
+        out[i] = cursor[i];
+    }
+    return length;
+}
+
+size_t ents_format_int(char* out, int64_t value) {
+    if (value >= 0) {
+        return ents_format_uint(out, (uint64_t)value);
+    }
+    out[0] = '-';
+    return 1 + ents_format_uint(out + 1, 0 - (uint64_t)value);
+}
+
+size_t ents_format_hex(char* out, uint64_t value) {
+    static const char digits[] = "0123456789abcdef";
+    int shift = 60;
+    while (shift > 0 && !(value >> shift)) {
+        shift -= 4;
+    }
+    size_t length = 0;
+    for (; shift >= 0; shift -= 4) {
+        out[length++] = digits[(value >> shift) & 15];
+    }
+    return length;
+}
+
+static const double powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+};
+
+// `value` scaled by 10^decimals and rounded to an integer, written as digits and fraction
+static size_t format_fixed(char* out, uint64_t scaled, int decimals) {
+    uint64_t unit = (uint64_t)powers_of_ten[decimals];
+    size_t length = ents_format_uint(out, scaled / unit);
+    if (decimals == 0) {
+        return length;
+    }
+    out[length++] = '.';
+    uint64_t fraction = scaled % unit;
+    for (int i = decimals - 1; i >= 0; --i) {
+        out[length + i] = (char)('0' + fraction % 10);
+        fraction /= 10;
+    }
+    return length + decimals;
+}
+
+// `decimals` digits after the point, 0 to 17. Values too big to scale into 64 bits are written
+// as a mantissa and exponent, `1.50e+20`. `out` needs room for 48 bytes.
+size_t ents_format_double(char* out, double value, int64_t decimals) {
+    if (decimals < 0) {
+        decimals = 0;
+    } else if (decimals > 17) {
+        decimals = 17;
+    }
+    size_t length = 0;
+    if (value != value) {
+        out[0] = 'n', out[1] = 'a', out[2] = 'n';
+        return 3;
+    }
+    if (__builtin_signbit(value)) {
+        out[length++] = '-';
+        value = -value;
+    }
+    if (value > 1.7976931348623157e308) {
+        out[length++] = 'i', out[length++] = 'n', out[length++] = 'f';
+        return length;
+    }
+
+    double scaled = value * powers_of_ten[decimals];
+    if (scaled < 1.8e19) {
+        return length + format_fixed(out + length, (uint64_t)(scaled + 0.5), decimals);
+    }
+
+    // one digit before the point, the power of ten is taken out in steps the table holds exactly
+    int exponent = 0;
+    while (value >= 1e16) {
+        value /= 1e16;
+        exponent += 16;
+    }
+    while (value >= 10) {
+        value /= 10;
+        exponent += 1;
+    }
+    uint64_t mantissa = (uint64_t)(value * powers_of_ten[decimals] + 0.5);
+    if (mantissa >= (uint64_t)powers_of_ten[decimals] * 10) {
+        mantissa /= 10;
+        exponent += 1;
+    }
+    length += format_fixed(out + length, mantissa, decimals);
+    out[length++] = 'e';
+    out[length++] = '+';
+    if (exponent < 10) {
+        out[length++] = '0';
+    }
+    return length + ents_format_uint(out + length, exponent);
+}
+
+// ---- writers
+
+static char stdout_buffer[BUFFER_SIZE];
+static struct ents_writer stdout_writer = {1, 0, 0, BUFFER_SIZE, stdout_buffer};
+static struct ents_writer stderr_writer = {2, 0, 0, 0, 0};
+
+struct ents_writer* ents_stdout(void) {
+    return &stdout_writer;
+}
+
+struct ents_writer* ents_stderr(void) {
+    return &stderr_writer;
+}
+
+// writes every vector, retrying after interruptions and short writes
+static int64_t write_all(struct ents_writer* writer, struct iovec* vectors, int count) {
+    while (count > 0) {
+        int64_t written = ents_sys_writev(writer->fd, vectors, count);
+        if (written == -EINTR) {
+            continue;
+        }
+        if (written < 0) {
+            writer->error = (int)written;
+            return written;
+        }
+        while (count > 0 && (size_t)written >= vectors->iov_len) {
+            written -= vectors->iov_len;
+            ++vectors;
+            --count;
+        }
+        if (count > 0) {
+            vectors->iov_base = (char*)vectors->iov_base + written;
+            vectors->iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+int64_t ents_flush(struct ents_writer* writer) {
+    if (writer->used == 0) {
+        return writer->error;
+    }
+    struct iovec vector = {writer->buffer, writer->used};
+    writer->used = 0;
+    return write_all(writer, &vector, 1);
+}
+
+int64_t ents_write(struct ents_writer* writer, const void* data, int64_t size) {
+    if (size <= 0) {
+        return writer->error;
+    }
+    if (writer->used + size <= writer->capacity) {
+        char* target = writer->buffer + writer->used;
+        const char* source = data;
+        for (int64_t i = 0; i < size; ++i) {
+            target[i] = source[i];
+        }
+        writer->used += size;
+        return 0;
+    }
+    // what is buffered and the new data leave in one system call, without a copy
+    struct iovec vectors[2] = {{writer->buffer, writer->used}, {(void*)data, size}};
+    int first = writer->used == 0;
+    writer->used = 0;
+    return write_all(writer, vectors + first, 2 - first);
+}
+
+// room for `size` more bytes in the buffer, false for writers that write through
+static int reserve(struct ents_writer* writer, size_t size) {
+    if (writer->capacity < size) {
+        return 0;
+    }
+    if (writer->used + size > writer->capacity) {
+        ents_flush(writer);
+    }
+    return 1;
+}
+
+int64_t ents_write_string(struct ents_writer* writer, const char* string) {
+    int64_t length = 0;
+    while (string[length]) {
+        ++length;
+    }
+    return ents_write(writer, string, length);
+}
+
+int64_t ents_write_char(struct ents_writer* writer, int64_t character) {
+    if (!reserve(writer, 1)) {
+        char byte = (char)character;
+        return ents_write(writer, &byte, 1);
+    }
+    writer->buffer[writer->used++] = (char)character;
+    return 0;
+}
+
+// numbers are formatted straight into the buffer when it has room
+int64_t ents_write_int(struct ents_writer* writer, int64_t value) {
+    if (reserve(writer, 24)) {
+        writer->used += ents_format_int(writer->buffer + writer->used, value);
+        return 0;
+    }
+    char text[24];
+    return ents_write(writer, text, ents_format_int(text, value));
+}
+
+int64_t ents_write_uint(struct ents_writer* writer, uint64_t value) {
+    if (reserve(writer, 24)) {
+        writer->used += ents_format_uint(writer->buffer + writer->used, value);
+        return 0;
+    }
+    char text[24];
+    return ents_write(writer, text, ents_format_uint(text, value));
+}
+
+int64_t ents_write_hex(struct ents_writer* writer, uint64_t value) {
+    if (reserve(writer, 24)) {
+        writer->used += ents_format_hex(writer->buffer + writer->used, value);
+        return 0;
+    }
+    char text[24];
+    return ents_write(writer, text, ents_format_hex(text, value));
+}
+
+int64_t ents_write_double(struct ents_writer* writer, double value, int64_t decimals) {
+    if (reserve(writer, 48)) {
+        writer->used += ents_format_double(writer->buffer + writer->used, value, decimals);
+        return 0;
+    }
+    char text[48];
+    return ents_write(writer, text, ents_format_double(text, value, decimals));
+}
+
+static void* map(size_t size) {
+    int64_t address = ents_sys_mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return address < 0 ? 0 : (void*)address;
+}
+
+// a writer with a buffer of its own, 0 when it cannot be mapped
+struct ents_writer* ents_writer_create(int64_t fd) {
+    struct ents_writer* writer = map(sizeof(struct ents_writer) + BUFFER_SIZE);
+    if (!writer) {
+        return 0;
+    }
+    writer->fd = (int)fd;
+    writer->capacity = BUFFER_SIZE;
+    writer->buffer = (char*)(writer + 1);
+    return writer;
+}
+
+// creates or truncates the file, 0 when that fails
+struct ents_writer* ents_writer_open(const char* path) {
+    int64_t fd = ents_sys_openat(AT_FDCWD, path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return 0;
+    }
+    struct ents_writer* writer = ents_writer_create(fd);
+    if (!writer) {
+        ents_sys_close(fd);
+    }
+    return writer;
+}
+
+// flushes, closes the file and frees the writer, the result is the first error seen
+int64_t ents_writer_close(struct ents_writer* writer) {
+    int64_t error = ents_flush(writer);
+    int64_t closed = ents_sys_close(writer->fd);
+    ents_sys_munmap(writer, sizeof(struct ents_writer) + BUFFER_SIZE);
+    return error ? error : closed < 0 ? closed : 0;
+}
+
+// ---- readers
+
+static char stdin_buffer[BUFFER_SIZE];
+static struct ents_reader stdin_reader = {0, 0, 0, 0, stdin_buffer};
+
+struct ents_reader* ents_stdin(void) {
+    return &stdin_reader;
+}
+
+struct ents_reader* ents_reader_create(int64_t fd) {
+    struct ents_reader* reader = map(sizeof(struct ents_reader) + BUFFER_SIZE);
+    if (!reader) {
+        return 0;
+    }
+    reader->fd = (int)fd;
+    reader->buffer = (char*)(reader + 1);
+    return reader;
+}
+
+struct ents_reader* ents_reader_open(const char* path) {
+    int64_t fd = ents_sys_openat(AT_FDCWD, path, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        return 0;
+    }
+    struct ents_reader* reader = ents_reader_create(fd);
+    if (!reader) {
+        ents_sys_close(fd);
+    }
+    return reader;
+}
+
+int64_t ents_reader_close(struct ents_reader* reader) {
+    int64_t closed = ents_sys_close(reader->fd);
+    ents_sys_munmap(reader, sizeof(struct ents_reader) + BUFFER_SIZE);
+    return closed < 0 ? closed : 0;
+}
+
+// reads into `target`, or the buffer when it is 0, retrying interrupted calls; 0 at the end
+static int64_t fill(struct ents_reader* reader, char* target, size_t size) {
+    for (;;) {
+        int64_t count = ents_sys_read(reader->fd, target, size);
+        if (count == -EINTR) {
+            continue;
+        }
+        if (count < 0) {
+            reader->error = (int)count;
+        }
+        return count;
+    }
+}
+
+static int refill(struct ents_reader* reader) {
+    int64_t count = fill(reader, reader->buffer, BUFFER_SIZE);
+    reader->start = 0;
+    reader->end = count > 0 ? count : 0;
+    return count > 0;
+}
+
+// up to `size` bytes, fewer only at the end of the input; requests bigger than the buffer
+// bypass it once what it holds is handed out
+int64_t ents_read(struct ents_reader* reader, void* data, int64_t size) {
+    char* target = data;
+    int64_t done = 0;
+    while (done < size) {
+        if (reader->start == reader->end) {
+            if (size - done >= (int64_t)BUFFER_SIZE) {
+                int64_t count = fill(reader, target + done, size - done);
+                if (count <= 0) {
+                    break;
+                }
+                done += count;
+                continue;
+            }
+            if (!refill(reader)) {
+                break;
+            }
+        }
+        size_t available = reader->end - reader->start;
+        size_t count = (size_t)(size - done) < available ? (size_t)(size - done) : available;
+        for (size_t i = 0; i < count; ++i) {
+            target[done + i] = reader->buffer[reader->start + i];
+        }
+        reader->start += count;
+        done += count;
+    }
+    return done > 0 ? done : reader->error;
+}
+
+// the next byte, -1 at the end of the input
+int64_t ents_read_byte(struct ents_reader* reader) {
+    if (reader->start == reader->end && !refill(reader)) {
+        return -1;
+    }
+    return (unsigned char)reader->buffer[reader->start++];
+}
+
+// a line without its newline, terminated with a zero. The length is returned, -1 at the end of the
+// input; a line longer than `capacity - 1` comes back in pieces.
+int64_t ents_read_line(struct ents_reader* reader, char* line, int64_t capacity) {
+    int64_t length = 0;
+    int any = 0;
+    while (length + 1 < capacity) {
+        if (reader->start == reader->end && !refill(reader)) {
+            break;
+        }
+        any = 1;
+        char c = reader->buffer[reader->start++];
+        if (c == '\n') {
+            break;
+        }
+        line[length++] = c;
+    }
+    if (capacity > 0) {
+        line[length] = 0;
+    }
+    return any ? length : -1;
+}
+
+// a decimal integer after any white space, 0 when there is none
+int64_t ents_read_int(struct ents_reader* reader) {
+    int64_t c = ents_read_byte(reader);
+    while (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+        c = ents_read_byte(reader);
+    }
+    int negative = c == '-';
+    if (negative) {
+        c = ents_read_byte(reader);
+    }
+    uint64_t value = 0;
+    while (c >= '0' && c <= '9') {
+        value = value * 10 + (c - '0');
+        c = ents_read_byte(reader);
+    }
+    // the byte after the number is not part of it
+    if (c >= 0) {
+        reader->start--;
+    }
+    return negative ? (int64_t)(0 - value) : (int64_t)value;
+}
+
+// ---- exit
+
+// the C library's exit when the program is linked with it, so its handlers still run
+extern void exit(int code) __attribute__((weak, noreturn));
+
+__attribute__((destructor)) static void flush_at_exit(void) {
+    ents_flush(&stdout_writer);
+}
+
+__attribute__((noreturn)) void ents_exit(int64_t code) {
+    ents_flush(&stdout_writer);
+    if (exit) {
+        exit((int)code);
+    }
+    ents_sys_exit(code);
+}
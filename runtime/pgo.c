@@ -0,0 +1,108 @@
+// Runtime side of -fprofile-generate. Every instrumented function leaves a record of its
+// counter table in the ents_pgo section, the tables are written out when the program exits.
+// Counts already in the profile file are added to, so several runs make up one profile, and the
+// records of other programs written to the same file are kept.
+#define _DEFAULT_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct ents_pgo_record {
+    const char* name;
+    uint64_t count;
+    uint64_t* counters;
+};
+
+extern struct ents_pgo_record __start_ents_pgo[] __attribute__((weak));
+extern struct ents_pgo_record __stop_ents_pgo[] __attribute__((weak));
+
+static struct ents_pgo_record* find(const char* name) {
+    for (struct ents_pgo_record* record = __start_ents_pgo; record != __stop_ents_pgo; ++record) {
+        if (strcmp(record->name, name) == 0) {
+            return record;
+        }
+    }
+    return NULL;
+}
+
+// Adds the counts of an earlier run, functions whose shape changed start over. Records of functions
+// this program does not have belong to other programs sharing the file and go to `kept` unchanged.
+static void merge(FILE* in, FILE* kept) {
+    char name[4096];
+    unsigned long long count;
+    while (fscanf(in, " %4095s", name) == 1) {
+        if (name[0] == '#') {
+            if (fscanf(in, "%*[^\n]") == EOF) {
+                return;
+            }
+            continue;
+        }
+        if (fscanf(in, " %llu", &count) != 1) {
+            return;
+        }
+        struct ents_pgo_record* record = find(name);
+        FILE* copy = record ? NULL : kept;
+        if (record && record->count != count) {
+            record = NULL;
+        }
+        if (copy) {
+            fprintf(copy, "%s %llu", name, count);
+        }
+        for (unsigned long long i = 0; i < count; ++i) {
+            unsigned long long value;
+            if (fscanf(in, " %llu", &value) != 1) {
+                return;
+            }
+            if (record) {
+                record->counters[i] += value;
+            }
+            if (copy) {
+                fprintf(copy, " %llu", value);
+            }
+        }
+        if (copy) {
+            fputc('\n', copy);
+        }
+    }
+}
+
+// global so instrumented objects can reference it and pull this file out of the archive
+__attribute__((destructor)) void __ents_pgo_dump(void) {
+    if (__stop_ents_pgo - __start_ents_pgo == 0) {
+        return;
+    }
+    const char* path = getenv("ENTS_PROFDATA");
+    if (!path) {
+        path = "ents.profdata";
+    }
+    char* others = NULL;
+    size_t others_size = 0;
+    FILE* kept = open_memstream(&others, &others_size);
+    FILE* in = fopen(path, "r");
+    if (in) {
+        merge(in, kept);
+        fclose(in);
+    }
+    if (kept) {
+        fclose(kept);
+    }
+    FILE* out = fopen(path, "w");
+    if (!out) {
+        free(others);
+        return;
+    }
+    fprintf(out, "# ents profile: function, counter count, counters\n");
+    for (const struct ents_pgo_record* record = __start_ents_pgo; record != __stop_ents_pgo; ++record) {
+        fprintf(out, "%s %llu", record->name, (unsigned long long)record->count);
+        for (uint64_t i = 0; i < record->count; ++i) {
+            fprintf(out, " %llu", (unsigned long long)record->counters[i]);
+        }
+        fputc('\n', out);
+    }
+    if (others) {
+        fputs(others, out);
+        free(others);
+    }
+    fclose(out);
+}
@@ -0,0 +1,260 @@
+// General purpose allocator for EntS programs. Blocks up to 8 KiB come from size class pools,
+// larger ones are mapped on their own. Pools carve 64 KiB spans mapped with mmap and aligned to
+// their size, the header at the base of a span tells ents_free what a block is, so blocks carry
+// no header of their own. Every thread keeps a free list per class and only takes the lock of
+// the shared pool to move a batch of blocks at a time.
+#define _DEFAULT_SOURCE
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define SPAN_SIZE ((size_t)64 << 10)
+#define SPAN_HEADER ((size_t)64)
+#define CLASS_COUNT 32
+#define LARGE_CLASS CLASS_COUNT
+#define MAX_SMALL_SIZE 8192
+#define CACHE_BYTES ((size_t)32 << 10)
+
+// four classes per doubling keep the waste of a block under a quarter
+static const uint32_t class_sizes[CLASS_COUNT] = {
+    16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 448, 512,
+    640, 768, 896, 1024, 1280, 1536, 1792, 2048, 2560, 3072, 3584, 4096, 5120, 6144, 7168, 8192,
+};
+
+struct span {
+    uint32_t size_class; // LARGE_CLASS for a block mapped on its own
+    size_t mapped;       // bytes of the mapping
+};
+
+struct free_block {
+    struct free_block* next;
+};
+
+struct pool {
+    pthread_mutex_t lock;
+    struct free_block* free; // blocks threads gave back
+    uintptr_t carve;         // the part of the newest span no block was cut from yet
+    uintptr_t carve_end;
+};
+
+struct cache {
+    struct free_block* free[CLASS_COUNT];
+    uint32_t count[CLASS_COUNT];
+    int registered; // the thread exit hook knows about this cache
+};
+
+static struct pool pools[CLASS_COUNT];
+static uint8_t class_of[MAX_SMALL_SIZE / 16 + 1]; // by size rounded up to 16 bytes
+static pthread_once_t initialized = PTHREAD_ONCE_INIT;
+static pthread_key_t cache_key;
+static _Thread_local struct cache cache;
+
+// blocks moved between a thread and the shared pool at once
+static uint32_t batch_size(int size_class) {
+    uint32_t count = CACHE_BYTES / 4 / class_sizes[size_class];
+    return count < 4 ? 4 : count > 64 ? 64 : count;
+}
+
+static void give_back(int size_class, struct free_block* first, struct free_block* last) {
+    struct pool* pool = &pools[size_class];
+    pthread_mutex_lock(&pool->lock);
+    last->next = pool->free;
+    pool->free = first;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// a thread that exits hands its cached blocks to the shared pools
+static void flush_cache(void* data) {
+    struct cache* exiting = data;
+    for (int size_class = 0; size_class < CLASS_COUNT; ++size_class) {
+        struct free_block* first = exiting->free[size_class];
+        if (!first) {
+            continue;
+        }
+        struct free_block* last = first;
+        while (last->next) {
+            last = last->next;
+        }
+        give_back(size_class, first, last);
+        exiting->free[size_class] = NULL;
+        exiting->count[size_class] = 0;
+    }
+}
+
+static void initialize(void) {
+    int size_class = 0;
+    for (size_t index = 0; index <= MAX_SMALL_SIZE / 16; ++index) {
+        while (class_sizes[size_class] < index * 16) {
+            ++size_class;
+        }
+        class_of[index] = size_class;
+    }
+    for (int i = 0; i < CLASS_COUNT; ++i) {
+        pthread_mutex_init(&pools[i].lock, NULL);
+    }
+    pthread_key_create(&cache_key, flush_cache);
+}
+
+// a mapping aligned to SPAN_SIZE, so the span of any block is its address rounded down
+static struct span* map_span(size_t size) {
+    size_t mapped = size + SPAN_SIZE;
+    char* memory = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return NULL;
+    }
+    char* start = (char*)(((uintptr_t)memory + SPAN_SIZE - 1) & ~(uintptr_t)(SPAN_SIZE - 1));
+    if (start > memory) {
+        munmap(memory, start - memory);
+    }
+    if (memory + mapped > start + size) {
+        munmap(start + size, memory + mapped - (start + size));
+    }
+    struct span* span = (struct span*)start;
+    span->mapped = size;
+    return span;
+}
+
+// moves up to a batch of blocks from the shared pool to this thread, cutting a new span if needed
+static int refill(int size_class) {
+    struct pool* pool = &pools[size_class];
+    uint32_t size = class_sizes[size_class];
+    uint32_t wanted = batch_size(size_class);
+    struct free_block* first = NULL;
+    uint32_t taken = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (taken < wanted && pool->free) {
+        struct free_block* block = pool->free;
+        pool->free = block->next;
+        block->next = first;
+        first = block;
+        ++taken;
+    }
+    while (taken < wanted) {
+        if (pool->carve + size > pool->carve_end) {
+            struct span* span = map_span(SPAN_SIZE);
+            if (!span) {
+                break;
+            }
+            span->size_class = size_class;
+            pool->carve = (uintptr_t)span + SPAN_HEADER;
+            pool->carve_end = (uintptr_t)span + SPAN_SIZE;
+        }
+        struct free_block* block = (struct free_block*)pool->carve;
+        pool->carve += size;
+        block->next = first;
+        first = block;
+        ++taken;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    cache.free[size_class] = first;
+    cache.count[size_class] = taken;
+    if (!cache.registered) {
+        pthread_setspecific(cache_key, &cache);
+        cache.registered = 1;
+    }
+    return taken > 0;
+}
+
+static void* alloc_large(size_t size) {
+    if (size > SIZE_MAX - SPAN_SIZE - SPAN_HEADER) {
+        return NULL;
+    }
+    struct span* span = map_span((size + SPAN_HEADER + 4095) & ~(size_t)4095);
+    if (!span) {
+        return NULL;
+    }
+    span->size_class = LARGE_CLASS;
+    return (char*)span + SPAN_HEADER;
+}
+
+// 16 byte aligned, NULL when the system is out of memory
+void* ents_alloc(size_t size) {
+    if (size > MAX_SMALL_SIZE) {
+        return alloc_large(size);
+    }
+    pthread_once(&initialized, initialize);
+    int size_class = class_of[(size + 15) / 16];
+    struct free_block* block = cache.free[size_class];
+    if (!block) {
+        if (!refill(size_class)) {
+            return NULL;
+        }
+        block = cache.free[size_class];
+    }
+    cache.free[size_class] = block->next;
+    cache.count[size_class]--;
+    return block;
+}
+
+void* ents_alloc_zeroed(size_t size) {
+    void* block = ents_alloc(size);
+    if (block) {
+        memset(block, 0, size);
+    }
+    return block;
+}
+
+static struct span* span_of(void* block) {
+    return (struct span*)((uintptr_t)block & ~(uintptr_t)(SPAN_SIZE - 1));
+}
+
+// bytes the block can hold, at least what it was allocated with
+size_t ents_alloc_size(void* block) {
+    struct span* span = span_of(block);
+    if (span->size_class == LARGE_CLASS) {
+        return span->mapped - SPAN_HEADER;
+    }
+    return class_sizes[span->size_class];
+}
+
+void ents_free(void* block) {
+    if (!block) {
+        return;
+    }
+    struct span* span = span_of(block);
+    if (span->size_class == LARGE_CLASS) {
+        munmap(span, span->mapped);
+        return;
+    }
+
+    int size_class = span->size_class;
+    struct free_block* freed = block;
+    freed->next = cache.free[size_class];
+    cache.free[size_class] = freed;
+    // a thread that frees more than it allocates passes the surplus on a batch at a time
+    uint32_t batch = batch_size(size_class);
+    if (++cache.count[size_class] < 2 * batch) {
+        return;
+    }
+    struct free_block* last = freed;
+    for (uint32_t i = 1; i < batch; ++i) {
+        last = last->next;
+    }
+    cache.free[size_class] = last->next;
+    cache.count[size_class] -= batch;
+    give_back(size_class, freed, last);
+    if (!cache.registered) {
+        pthread_setspecific(cache_key, &cache);
+        cache.registered = 1;
+    }
+}
+
+void* ents_realloc(void* block, size_t size) {
+    if (!block) {
+        return ents_alloc(size);
+    }
+    size_t capacity = ents_alloc_size(block);
+    if (size <= capacity) {
+        return block;
+    }
+    void* moved = ents_alloc(size);
+    if (moved) {
+        memcpy(moved, block, capacity);
+        ents_free(block);
+    }
+    return moved;
+}
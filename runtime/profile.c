@@ -0,0 +1,64 @@
+// Runtime side of -finstrument-functions. Instrumented functions count their calls and rdtsc
+// cycles in .bss, every function also leaves a record in the ents_prof section so the table
+// can be found here without a registration call. The table is written out when the program exits.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct ents_prof_counters {
+    uint64_t calls;
+    uint64_t inclusive;
+    uint64_t exclusive;
+};
+
+struct ents_prof_record {
+    const char* name;
+    struct ents_prof_counters* counters;
+};
+
+// cycles spent in calls that already returned, each function charges its callees through it
+uint64_t __ents_prof_children;
+
+// provided by the linker around the section, weak so a program without records still links
+extern const struct ents_prof_record __start_ents_prof[] __attribute__((weak));
+extern const struct ents_prof_record __stop_ents_prof[] __attribute__((weak));
+
+static int by_exclusive(const void* a, const void* b) {
+    uint64_t left = ((const struct ents_prof_record*)a)->counters->exclusive;
+    uint64_t right = ((const struct ents_prof_record*)b)->counters->exclusive;
+    return left < right ? 1 : left > right ? -1 : 0;
+}
+
+__attribute__((destructor)) static void ents_prof_dump(void) {
+    size_t count = __stop_ents_prof - __start_ents_prof;
+    if (count == 0) {
+        return;
+    }
+    struct ents_prof_record* records = malloc(count * sizeof(*records));
+    if (!records) {
+        return;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        records[i] = __start_ents_prof[i];
+    }
+    qsort(records, count, sizeof(*records), by_exclusive);
+
+    const char* path = getenv("ENTS_PROFILE");
+    FILE* out = fopen(path ? path : "ents-profile.txt", "w");
+    if (!out) {
+        free(records);
+        return;
+    }
+    // recursive functions count their inclusive cycles once per active call, like gprof
+    fprintf(out, "%20s %20s %20s  %s\n", "calls", "inclusive cycles", "exclusive cycles", "function");
+    for (size_t i = 0; i < count; ++i) {
+        const struct ents_prof_counters* c = records[i].counters;
+        if (c->calls == 0) {
+            continue;
+        }
+        fprintf(out, "%20llu %20llu %20llu  %s\n", (unsigned long long)c->calls, (unsigned long long)c->inclusive,
+                (unsigned long long)c->exclusive, records[i].name);
+    }
+    fclose(out);
+    free(records);
+}
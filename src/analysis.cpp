@@ -0,0 +1,585 @@
+#include "analysis.hpp"
+#include "ast.hpp"
+#include <cctype>
+
+namespace EntS {
+
+FunctionAnalysis::FunctionAnalysis(const FunctionNode* function) {
+    for (const auto& param : function->params) {
+        const auto* paramNode = dynamic_cast<const ParameterNode*>(param.get());
+        declare(paramNode->name, paramNode->type, true, false);
+    }
+    scan(function->body.get());
+}
+
+void FunctionAnalysis::declare(const std::string& name, const std::string& type, bool isParameter, bool byAddr) {
+    // sibling scopes may reuse a name, keep the first type and merge the flags
+    auto& info = variables[name];
+    if (info.type.empty()) {
+        info.type = type;
+        info.isParameter = isParameter;
+    }
+    info.byAddr = info.byAddr || byAddr;
+}
+
+void FunctionAnalysis::scan(const ASTNode* node) {
+    if (!node) {
+        return;
+    }
+    switch (node->getType()) {
+        case NodeType::VarDecl: {
+            const auto* decl = dynamic_cast<const VarDeclNode*>(node);
+            declare(decl->name, decl->type, false, decl->initByAddr);
+            break;
+        }
+        case NodeType::VarDeclAssign: {
+            const auto* decl = dynamic_cast<const VarDeclAssignNode*>(node);
+            declare(decl->name, decl->type, false, decl->initByAddr);
+            break;
+        }
+        case NodeType::MemoryAssign: {
+            const auto* assign = dynamic_cast<const MemoryAssignNode*>(node);
+            variables[assign->name].readdressed = true;
+            break;
+        }
+        case NodeType::MemoryAddress: {
+            const auto* address = dynamic_cast<const MemoryAddressNode*>(node);
+            variables[address->name].addressTaken = true;
+            break;
+        }
+        case NodeType::Index:
+            variables[dynamic_cast<const IndexNode*>(node)->name].indexed = true;
+            break;
+        case NodeType::IndexationAssign:
+            variables[dynamic_cast<const IndexationAssignNode*>(node)->name].indexed = true;
+            break;
+        default:
+            break;
+    }
+    forEachChild(node, [this](const ASTNode* child) { scan(child); });
+}
+
+const VariableInfo* FunctionAnalysis::lookup(const std::string& name) const {
+    auto it = variables.find(name);
+    if (it == variables.end() || it->second.type.empty()) {
+        return nullptr;
+    }
+    return &it->second;
+}
+
+bool FunctionAnalysis::isLocal(const std::string& name) const {
+    return lookup(name) != nullptr;
+}
+
+bool FunctionAnalysis::isMemoryResident(const std::string& name) const {
+    const VariableInfo* info = lookup(name);
+    return !info || info->byAddr || info->readdressed || info->addressTaken;
+}
+
+bool FunctionAnalysis::isPointerBacked(const std::string& name) const {
+    const VariableInfo* info = lookup(name);
+    return info && (info->byAddr || info->readdressed);
+}
+
+void forEachChild(const ASTNode* node, const std::function<void(const ASTNode*)>& callback) {
+    forEachChildSlot(const_cast<ASTNode*>(node), [&callback](ASTNodePtr& child) { callback(child.get()); });
+}
+
+void forEachChildSlot(ASTNode* node, const std::function<void(ASTNodePtr&)>& callback) {
+    auto visit = [&callback](ASTNodePtr& child) {
+        if (child) {
+            callback(child);
+        }
+    };
+
+    switch (node->getType()) {
+        case NodeType::Program:
+            for (auto& function : static_cast<ProgramNode*>(node)->functions) visit(function);
+            break;
+        case NodeType::Function:
+            visit(static_cast<FunctionNode*>(node)->body);
+            break;
+        case NodeType::Block:
+            for (auto& statement : static_cast<BlockNode*>(node)->statements) visit(statement);
+            break;
+        case NodeType::Header:
+            for (auto& prototype : static_cast<HeaderNode*>(node)->prototypes) visit(prototype);
+            break;
+        case NodeType::VarDeclAssign:
+            visit(static_cast<VarDeclAssignNode*>(node)->expression);
+            break;
+        case NodeType::GlobalVarDeclAssign:
+            visit(static_cast<GlobalVarDeclAssignNode*>(node)->expression);
+            break;
+        case NodeType::InitializerList:
+            for (auto& element : static_cast<InitializerListNode*>(node)->elements) visit(element);
+            break;
+        case NodeType::Assign:
+            visit(static_cast<AssignNode*>(node)->expression);
+            break;
+        case NodeType::IndexationAssign: {
+            auto* assign = static_cast<IndexationAssignNode*>(node);
+            visit(assign->expression);
+            visit(assign->index);
+            break;
+        }
+        case NodeType::MemoryAssign:
+            visit(static_cast<MemoryAssignNode*>(node)->expression);
+            break;
+        case NodeType::StructMemberAssign: {
+            auto* assign = static_cast<StructMemberAssignNode*>(node);
+            visit(assign->value);
+            visit(assign->memberAccess);
+            break;
+        }
+        case NodeType::Return:
+            visit(static_cast<ReturnNode*>(node)->expression);
+            break;
+        case NodeType::Expression: {
+            auto* expression = static_cast<ExpressionNode*>(node);
+            if (expression->left) visit(*expression->left);
+            if (expression->right) visit(*expression->right);
+            break;
+        }
+        case NodeType::If: {
+            auto* ifNode = static_cast<IfNode*>(node);
+            visit(ifNode->condition);
+            visit(ifNode->body);
+            visit(ifNode->else_);
+            break;
+        }
+        case NodeType::While: {
+            auto* whileNode = static_cast<WhileNode*>(node);
+            visit(whileNode->condition);
+            visit(whileNode->body);
+            break;
+        }
+        case NodeType::Switch: {
+            auto* switchNode = static_cast<SwitchNode*>(node);
+            visit(switchNode->condition);
+            for (auto& case_ : switchNode->cases) visit(case_);
+            break;
+        }
+        case NodeType::Case: {
+            auto* caseNode = static_cast<CaseNode*>(node);
+            visit(caseNode->case_);
+            visit(caseNode->body);
+            break;
+        }
+        case NodeType::Default:
+            visit(static_cast<DefaultNode*>(node)->body);
+            break;
+        case NodeType::FunctionCall: {
+            // arguments are evaluated right to left
+            auto& arguments = static_cast<FunctionCallNode*>(node)->arguments;
+            for (auto it = arguments.rbegin(); it != arguments.rend(); ++it) visit(*it);
+            break;
+        }
+        case NodeType::Index:
+            visit(static_cast<IndexNode*>(node)->index);
+            break;
+        case NodeType::StructMemberAccess:
+            visit(static_cast<StructMemberAccessNode*>(node)->base);
+            break;
+        default:
+            break;
+    }
+}
+
+bool containsCall(const ASTNode* node) {
+    if (!node) {
+        return false;
+    }
+    if (node->getType() == NodeType::FunctionCall) {
+        return true;
+    }
+    bool found = false;
+    forEachChild(node, [&found](const ASTNode* child) { found = found || containsCall(child); });
+    return found;
+}
+
+void collectSideEffects(const ASTNode* node, const FunctionAnalysis& analysis, SideEffects& effects) {
+    if (!node) {
+        return;
+    }
+    auto assignVariable = [&](const std::string& name) {
+        effects.assigned.insert(name);
+        if (analysis.isMemoryResident(name)) {
+            effects.writesMemory = true;
+        }
+    };
+
+    switch (node->getType()) {
+        case NodeType::VarDecl:
+            effects.assigned.insert(dynamic_cast<const VarDeclNode*>(node)->name);
+            break;
+        case NodeType::VarDeclAssign:
+            effects.assigned.insert(dynamic_cast<const VarDeclAssignNode*>(node)->name);
+            break;
+        case NodeType::Assign:
+            assignVariable(dynamic_cast<const AssignNode*>(node)->name);
+            break;
+        case NodeType::Increment:
+            assignVariable(dynamic_cast<const IncrementNode*>(node)->variable);
+            break;
+        case NodeType::Decrement:
+            assignVariable(dynamic_cast<const DecrementNode*>(node)->variable);
+            break;
+        case NodeType::MemoryAssign:
+            effects.assigned.insert(dynamic_cast<const MemoryAssignNode*>(node)->name);
+            break;
+        case NodeType::IndexationAssign:
+            // an index can reach past the variable's own storage
+            effects.assigned.insert(dynamic_cast<const IndexationAssignNode*>(node)->name);
+            effects.writesMemory = true;
+            break;
+        case NodeType::StructMemberAssign: {
+            const auto* assign = dynamic_cast<const StructMemberAssignNode*>(node);
+            assignVariable(memberAccessRoot(dynamic_cast<const StructMemberAccessNode*>(assign->memberAccess.get())));
+            break;
+        }
+        case NodeType::FunctionCall:
+            effects.calls = true;
+            effects.writesMemory = true;
+            break;
+        case NodeType::Asm:
+            for (const auto& name : dynamic_cast<const AsmNode*>(node)->outputs) {
+                assignVariable(name);
+            }
+            effects.writesMemory = true;
+            break;
+        default:
+            break;
+    }
+    forEachChild(node, [&](const ASTNode* child) { collectSideEffects(child, analysis, effects); });
+}
+
+std::string memberAccessRoot(const StructMemberAccessNode* node) {
+    const ASTNode* base = node->base.get();
+    while (base->getType() == NodeType::StructMemberAccess) {
+        base = dynamic_cast<const StructMemberAccessNode*>(base)->base.get();
+    }
+    return dynamic_cast<const IdentifierNode*>(base)->name;
+}
+
+std::string resolveTypeName(const std::string& type, const std::unordered_map<std::string, std::string>& typedefs, const StructDefinitions& structs) {
+    if (structs.count(type)) {
+        return type;
+    }
+    auto it = typedefs.find(type);
+    if (it != typedefs.end() && it->second != "struct") {
+        return it->second;
+    }
+    return type;
+}
+
+std::string memberAccessType(const StructMemberAccessNode* node, const std::string& rootType,
+                             const std::unordered_map<std::string, std::string>& typedefs, const StructDefinitions& structs) {
+    std::string baseType = rootType;
+    if (node->base->getType() == NodeType::StructMemberAccess) {
+        baseType = memberAccessType(dynamic_cast<const StructMemberAccessNode*>(node->base.get()), rootType, typedefs, structs);
+    }
+
+    auto structDef = structs.find(resolveTypeName(baseType, typedefs, structs));
+    if (structDef == structs.end()) {
+        return "";
+    }
+    for (const auto& member : structDef->second) {
+        if (member.second == node->memberName) {
+            return member.first;
+        }
+    }
+    return "";
+}
+
+void collectGlobalTypes(const ProgramNode* program, std::unordered_map<std::string, std::string>& types) {
+    for (const auto& statement : program->functions) {
+        if (const auto* global = dynamic_cast<const GlobalVarDeclNode*>(statement.get())) {
+            types[global->name] = global->type;
+        } else if (const auto* global = dynamic_cast<const GlobalVarDeclAssignNode*>(statement.get())) {
+            types[global->name] = global->type;
+        } else if (const auto* header = dynamic_cast<const HeaderNode*>(statement.get())) {
+            for (const auto& prototype : header->prototypes) {
+                if (const auto* global = dynamic_cast<const GlobalVarDeclNode*>(prototype.get())) {
+                    types[global->name] = global->type;
+                }
+            }
+        }
+    }
+}
+
+void collectReturnTypes(const ProgramNode* program, std::unordered_map<std::string, std::string>& types) {
+    for (const auto& statement : program->functions) {
+        if (const auto* function = dynamic_cast<const FunctionNode*>(statement.get())) {
+            types[function->name] = function->returnType;
+        } else if (const auto* header = dynamic_cast<const HeaderNode*>(statement.get())) {
+            for (const auto& prototype : header->prototypes) {
+                if (const auto* function = dynamic_cast<const FunctionPrototypeNode*>(prototype.get())) {
+                    types[function->name] = function->returnType;
+                }
+            }
+        }
+    }
+}
+
+void collectParameterTypes(const ProgramNode* program, std::unordered_map<std::string, std::vector<std::string>>& types) {
+    auto collect = [&types](const std::string& name, const std::vector<ASTNodePtr>& params) {
+        std::vector<std::string>& paramTypes = types[name];
+        paramTypes.clear();
+        for (const auto& param : params) {
+            paramTypes.push_back(dynamic_cast<const ParameterNode*>(param.get())->type);
+        }
+    };
+    for (const auto& statement : program->functions) {
+        if (const auto* function = dynamic_cast<const FunctionNode*>(statement.get())) {
+            collect(function->name, function->params);
+        } else if (const auto* header = dynamic_cast<const HeaderNode*>(statement.get())) {
+            for (const auto& prototype : header->prototypes) {
+                if (const auto* function = dynamic_cast<const FunctionPrototypeNode*>(prototype.get())) {
+                    collect(function->name, function->parameters);
+                }
+            }
+        }
+    }
+}
+
+bool isFloatingType(const std::string& type, const std::unordered_map<std::string, std::string>& typedefs, const StructDefinitions& structs) {
+    std::string resolvedType = resolveTypeName(type, typedefs, structs);
+    return resolvedType == "float" || resolvedType == "double";
+}
+
+bool isVectorType(const std::string& type, const std::unordered_map<std::string, std::string>& typedefs, const StructDefinitions& structs) {
+    return !vectorElementType(resolveTypeName(type, typedefs, structs)).empty();
+}
+
+std::string vectorElementType(const std::string& resolvedType) {
+    static const std::unordered_map<std::string, std::string> elements = {
+        {"int32x4", "int32"},
+        {"uint8x16", "uint8"},
+        {"int64x2", "int64"},
+        {"floatx4", "float"},
+    };
+    auto it = elements.find(resolvedType);
+    return it != elements.end() ? it->second : "";
+}
+
+bool isBuiltin(const std::string& name) {
+    return !builtinReturnType(name).empty() || name == "__builtin_lane" || name == "__builtin_shuffle";
+}
+
+std::string builtinReturnType(const std::string& name) {
+    static const std::unordered_map<std::string, std::string> builtins = {
+        {"__builtin_sqrt", "double"},
+        {"__builtin_sqrtf", "float"},
+        {"__builtin_memcpy", "int64"},
+        {"__builtin_memset", "int64"},
+        {"__builtin_memcmp", "int64"},
+        {"__builtin_strlen", "int64"},
+        {"__builtin_movemask", "int64"},
+    };
+    auto it = builtins.find(name);
+    return it != builtins.end() ? it->second : "";
+}
+
+std::string decodeStringLiteral(const std::string& text) {
+    std::string bytes;
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (text[i] != '\\' || i + 1 == text.size()) {
+            bytes += text[i];
+            continue;
+        }
+        char c = text[++i];
+        switch (c) {
+            case 'n': bytes += '\n'; break;
+            case 't': bytes += '\t'; break;
+            case 'r': bytes += '\r'; break;
+            case '0': bytes += '\0'; break;
+            case 'x': {
+                size_t digits = 0;
+                int value = 0;
+                while (digits < 2 && i + 1 < text.size() && std::isxdigit(static_cast<unsigned char>(text[i + 1]))) {
+                    char digit = static_cast<char>(std::tolower(static_cast<unsigned char>(text[++i])));
+                    value = value * 16 + (std::isdigit(static_cast<unsigned char>(digit)) ? digit - '0' : digit - 'a' + 10);
+                    ++digits;
+                }
+                bytes += static_cast<char>(value);
+                break;
+            }
+            default: bytes += c; break; // \\, \" and \'
+        }
+    }
+    return bytes;
+}
+
+std::optional<Constant> foldConstant(const ASTNode* node, const std::unordered_map<std::string, Constant>& named) {
+    switch (node->getType()) {
+        case NodeType::Literal: {
+            std::string value = dynamic_cast<const LiteralNode*>(node)->value;
+            Constant constant;
+            if (value.find('.') == std::string::npos) {
+                constant.integer = static_cast<int64_t>(std::stoull(value));
+                return constant;
+            }
+            constant.floating = true;
+            constant.single = value.back() == 'f';
+            constant.real = constant.single ? std::stof(value) : std::stod(value);
+            return constant;
+        }
+        case NodeType::Identifier: {
+            auto it = named.find(dynamic_cast<const IdentifierNode*>(node)->name);
+            if (it == named.end()) {
+                return std::nullopt;
+            }
+            return it->second;
+        }
+        case NodeType::Expression:
+            break;
+        default:
+            return std::nullopt;
+    }
+
+    const auto* expression = dynamic_cast<const ExpressionNode*>(node);
+    const std::string& op = expression->op;
+    if (!expression->right || !*expression->right) {
+        return std::nullopt;
+    }
+    std::optional<Constant> right = foldConstant(expression->right->get(), named);
+    if (!right) {
+        return std::nullopt;
+    }
+    Constant result;
+    if (!expression->left || !*expression->left) {
+        if (op == "!") {
+            result.integer = right->floating ? right->real == 0 : right->integer == 0;
+        } else if (right->floating) {
+            result = *right;
+            result.real = -right->real;
+        } else {
+            result.integer = static_cast<int64_t>(0 - static_cast<uint64_t>(right->integer));
+        }
+        return result;
+    }
+    std::optional<Constant> left = foldConstant(expression->left->get(), named);
+    if (!left) {
+        return std::nullopt;
+    }
+
+    if (op == "&&" || op == "||") {
+        bool a = left->asReal() != 0;
+        bool b = right->asReal() != 0;
+        result.integer = op == "&&" ? a && b : a || b;
+        return result;
+    }
+    if (left->floating || right->floating) {
+        double a = left->asReal();
+        double b = right->asReal();
+        if (op == "==") { result.integer = a == b; return result; }
+        if (op == "!=") { result.integer = a != b; return result; }
+        if (op == "<") { result.integer = a < b; return result; }
+        if (op == "<=") { result.integer = a <= b; return result; }
+        if (op == ">") { result.integer = a > b; return result; }
+        if (op == ">=") { result.integer = a >= b; return result; }
+        result.floating = true;
+        result.single = (!left->floating || left->single) && (!right->floating || right->single);
+        if (op == "+") result.real = a + b;
+        else if (op == "-") result.real = a - b;
+        else if (op == "*") result.real = a * b;
+        else if (op == "/") result.real = a / b;
+        else return std::nullopt;
+        if (result.single) {
+            result.real = static_cast<float>(result.real);
+        }
+        return result;
+    }
+
+    uint64_t a = left->integer;
+    uint64_t b = right->integer;
+    if (op == "+") result.integer = static_cast<int64_t>(a + b);
+    else if (op == "-") result.integer = static_cast<int64_t>(a - b);
+    else if (op == "*") result.integer = static_cast<int64_t>(a * b);
+    else if (op == "/") {
+        if (b == 0 || (left->integer == INT64_MIN && right->integer == -1)) {
+            return std::nullopt;
+        }
+        result.integer = left->integer / right->integer;
+    }
+    else if (op == "&") result.integer = static_cast<int64_t>(a & b);
+    else if (op == "|") result.integer = static_cast<int64_t>(a | b);
+    else if (op == "==") result.integer = left->integer == right->integer;
+    else if (op == "!=") result.integer = left->integer != right->integer;
+    else if (op == "<") result.integer = left->integer < right->integer;
+    else if (op == "<=") result.integer = left->integer <= right->integer;
+    else if (op == ">") result.integer = left->integer > right->integer;
+    else if (op == ">=") result.integer = left->integer >= right->integer;
+    else return std::nullopt;
+    return result;
+}
+
+std::string expressionType(const ASTNode* node, const TypeEnvironment& environment) {
+    auto floating = [&](const std::string& type) { return isFloatingType(type, environment.typedefs, environment.structs); };
+
+    switch (node->getType()) {
+        case NodeType::Literal: {
+            const std::string& value = dynamic_cast<const LiteralNode*>(node)->value;
+            if (value.find('.') == std::string::npos) {
+                return "int64";
+            }
+            return value.back() == 'f' ? "float" : "double";
+        }
+        case NodeType::Identifier:
+            return environment.variableType(dynamic_cast<const IdentifierNode*>(node)->name);
+        case NodeType::Index:
+            return environment.variableType(dynamic_cast<const IndexNode*>(node)->name);
+        case NodeType::StructMemberAccess: {
+            const auto* access = dynamic_cast<const StructMemberAccessNode*>(node);
+            return memberAccessType(access, environment.variableType(memberAccessRoot(access)), environment.typedefs, environment.structs);
+        }
+        case NodeType::FunctionCall: {
+            const auto* call = dynamic_cast<const FunctionCallNode*>(node);
+            const std::string& name = call->name;
+            if ((name == "__builtin_lane" || name == "__builtin_shuffle") && !call->arguments.empty()) {
+                std::string vector = expressionType(call->arguments[0].get(), environment);
+                if (name == "__builtin_shuffle") {
+                    return vector;
+                }
+                std::string element = vectorElementType(resolveTypeName(vector, environment.typedefs, environment.structs));
+                return element.empty() ? "int64" : element;
+            }
+            std::string type = builtinReturnType(name);
+            if (type.empty()) {
+                type = environment.returnType(name);
+            }
+            return type.empty() ? "int64" : type;
+        }
+        case NodeType::Expression: {
+            const auto* expression = dynamic_cast<const ExpressionNode*>(node);
+            const std::string& op = expression->op;
+            std::string left = expression->left && *expression->left ? expressionType(expression->left->get(), environment) : "";
+            std::string right = expression->right && *expression->right ? expressionType(expression->right->get(), environment) : "";
+            std::string vector = isVectorType(left, environment.typedefs, environment.structs) ? left
+                               : isVectorType(right, environment.typedefs, environment.structs) ? right : "";
+            if (!vector.empty() && op != "&&" && op != "||" && op != "!") {
+                bool compare = op == "==" || op == "!=" || op == "<" || op == "<=" || op == ">" || op == ">=";
+                if (compare && resolveTypeName(vector, environment.typedefs, environment.structs) == "floatx4") {
+                    return "int32x4";
+                }
+                return vector;
+            }
+            if (op != "+" && op != "-" && op != "*" && op != "/") {
+                return "int64"; // comparisons, logic and bit operations
+            }
+            bool leftFloating = floating(left);
+            bool rightFloating = floating(right);
+            if ((leftFloating && resolveTypeName(left, environment.typedefs, environment.structs) == "double") ||
+                (rightFloating && resolveTypeName(right, environment.typedefs, environment.structs) == "double")) {
+                return "double";
+            }
+            return leftFloating || rightFloating ? "float" : "int64";
+        }
+        default:
+            // addresses and string literals
+            return "int64";
+    }
+}
+
+} // namespace EntS
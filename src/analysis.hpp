@@ -0,0 +1,119 @@
+#ifndef ANALYSIS_HPP
+#define ANALYSIS_HPP
+
+#include "ast.hpp"
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <set>
+#include <string>
+#include <unordered_map>
+
+namespace EntS {
+
+struct VariableInfo {
+    std::string type;
+    bool isParameter = false;
+    bool byAddr = false;       // declared as `type [name]`, storage is a pointer slot
+    bool readdressed = false;  // target of `[name] = ...`
+    bool addressTaken = false; // `[name]` is read somewhere, the storage escapes
+    bool indexed = false;      // `name[i]` addresses memory relative to the variable
+};
+
+// Per function facts shared by the optimisation passes and the code generator.
+class FunctionAnalysis {
+public:
+    explicit FunctionAnalysis(const FunctionNode* function);
+
+    const VariableInfo* lookup(const std::string& name) const;
+    bool isLocal(const std::string& name) const;
+    // true when the variable may be read or written through memory we do not see (globals included)
+    bool isMemoryResident(const std::string& name) const;
+    // true when loads of the variable go through a pointer slot
+    bool isPointerBacked(const std::string& name) const;
+
+private:
+    void scan(const ASTNode* node);
+    void declare(const std::string& name, const std::string& type, bool isParameter, bool byAddr);
+
+    std::unordered_map<std::string, VariableInfo> variables;
+};
+
+struct SideEffects {
+    std::set<std::string> assigned; // variables whose value or address may change
+    bool writesMemory = false;      // stores that may reach memory-resident storage
+    bool calls = false;
+};
+
+// Visits the direct children of a node in evaluation order.
+void forEachChild(const ASTNode* node, const std::function<void(const ASTNode*)>& callback);
+void forEachChildSlot(ASTNode* node, const std::function<void(ASTNodePtr&)>& callback);
+
+bool containsCall(const ASTNode* node);
+void collectSideEffects(const ASTNode* node, const FunctionAnalysis& analysis, SideEffects& effects);
+
+// Root variable of a `a->b->c` chain.
+std::string memberAccessRoot(const StructMemberAccessNode* node);
+
+// Resolves typedef aliases, struct typedefs keep their own name.
+std::string resolveTypeName(const std::string& type, const std::unordered_map<std::string, std::string>& typedefs, const StructDefinitions& structs);
+
+// Declared type of a `a->b->c` chain given the type of its root, empty when it cannot be resolved.
+std::string memberAccessType(const StructMemberAccessNode* node, const std::string& rootType,
+                             const std::unordered_map<std::string, std::string>& typedefs, const StructDefinitions& structs);
+
+// Types of the globals declared at top level or in headers.
+void collectGlobalTypes(const ProgramNode* program, std::unordered_map<std::string, std::string>& types);
+
+// Return types of the functions defined or declared in headers.
+void collectReturnTypes(const ProgramNode* program, std::unordered_map<std::string, std::string>& types);
+
+// Parameter types of the functions defined or declared in headers.
+void collectParameterTypes(const ProgramNode* program, std::unordered_map<std::string, std::vector<std::string>>& types);
+
+struct TypeEnvironment {
+    const std::unordered_map<std::string, std::string>& typedefs;
+    const StructDefinitions& structs;
+    std::function<std::string(const std::string&)> variableType;
+    std::function<std::string(const std::string&)> returnType; // empty for unknown callees
+};
+
+bool isFloatingType(const std::string& type, const std::unordered_map<std::string, std::string>& typedefs, const StructDefinitions& structs);
+
+// `int32x4`, `uint8x16`, `int64x2` and `floatx4`, sixteen bytes held in one SSE register.
+bool isVectorType(const std::string& type, const std::unordered_map<std::string, std::string>& typedefs, const StructDefinitions& structs);
+
+// Type of one lane of a resolved vector type, empty for anything else.
+std::string vectorElementType(const std::string& resolvedType);
+
+// Type an expression evaluates to. Integers all widen to int64, `1.5` is a double and `1.5f` a float,
+// arithmetic mixing them takes the widest floating operand like C does. Operations on vectors keep the
+// vector type, comparing them gives a mask of all ones or all zeros per lane.
+std::string expressionType(const ASTNode* node, const TypeEnvironment& environment);
+
+bool isBuiltin(const std::string& name);
+
+// Return type of a compiler builtin, empty when `name` is not one or the type follows its operand.
+std::string builtinReturnType(const std::string& name);
+
+// Bytes of a string literal as the lexer kept it, escapes decoded and without the terminator.
+std::string decodeStringLiteral(const std::string& text);
+
+// A value worked out at compile time, integers wrap at 64 bits like the generated code.
+struct Constant {
+    bool floating = false;
+    bool single = false; // a float, arithmetic on two of them rounds like the generated code
+    int64_t integer = 0;
+    double real = 0;
+
+    double asReal() const { return floating ? real : static_cast<double>(integer); }
+    int64_t asInteger() const { return floating ? static_cast<int64_t>(real) : integer; }
+};
+
+// Value of an expression of literals, operators and the `named` constants, nothing when some part
+// of it is only known at run time or cannot be evaluated, such as a division by zero.
+std::optional<Constant> foldConstant(const ASTNode* node, const std::unordered_map<std::string, Constant>& named);
+
+} // namespace EntS
+
+#endif // ANALYSIS_HPP
@@ -5,6 +5,8 @@
 #include <memory>
 #include <string>
 #include <optional>
+#include <unordered_map>
+#include <utility>
 #include <variant>
 #include <vector>
 
@@ -49,6 +51,8 @@ enum class NodeType {
     MemoryAddress,
     StructMemberAccess,
     StructMemberAssign,
+    Asm,
+    InitializerList,
 };
 
 static inline std::string toString(NodeType type) {
@@ -91,6 +95,8 @@ static inline std::string toString(NodeType type) {
         case NodeType::MemoryAddress: return "MemoryAddress";
         case NodeType::StructMemberAccess: return "StructMemberAccess";
         case NodeType::StructMemberAssign: return "StructMemberAssign";
+        case NodeType::Asm: return "Asm";
+        case NodeType::InitializerList: return "InitializerList";
     }
     return "";
 }
@@ -102,6 +108,10 @@ public:
 
     NodeType getType() const { return type; }
 
+    // where the statement starts in the source file, 0 for nodes the compiler made up
+    int line = 0;
+    int column = 0;
+
     virtual void print(int indent = 0) const = 0;
 
 protected:
@@ -115,6 +125,9 @@ protected:
 
 using ASTNodePtr = std::shared_ptr<ASTNode>;
 
+// struct name -> ordered (type, name) members
+using StructDefinitions = std::unordered_map<std::string, std::vector<std::pair<std::string, std::string>>>;
+
 class ProgramNode : public ASTNode {
 public:
     ProgramNode(std::vector<ASTNodePtr> functions) : ASTNode(NodeType::Program), functions(std::move(functions)) {}
@@ -156,6 +169,7 @@ public:
     std::string returnType;
     std::vector<ASTNodePtr> params;
     ASTNodePtr body;
+    int file = 0; // index of the input file, several are linked into one program by -flto
 };
 
 class VarDeclNode : public ASTNode {
@@ -265,10 +279,10 @@ public:
     void print(int indent = 0) const override {
         printIndent(indent);
         std::cout << "Expression: " << op << std::endl;
-        if (left) {
+        if (left && *left) {
             left->get()->print(indent + 1);
         }
-        if (right) {
+        if (right && *right) {
             right->get()->print(indent + 1);
         }
     }
@@ -507,12 +521,12 @@ public:
 
 class GlobalVarDeclAssignNode : public ASTNode {
 public:
-    GlobalVarDeclAssignNode(std::string_view type, std::string_view name, ASTNodePtr expression, bool initByAddr = false)
-        : ASTNode(NodeType::GlobalVarDeclAssign), type(type), name(name), expression(std::move(expression)), initByAddr(initByAddr) {}
+    GlobalVarDeclAssignNode(std::string_view type, std::string_view name, ASTNodePtr expression, bool initByAddr = false, bool readOnly = false)
+        : ASTNode(NodeType::GlobalVarDeclAssign), type(type), name(name), expression(std::move(expression)), initByAddr(initByAddr), readOnly(readOnly) {}
 
     void print(int indent = 0) const override {
         printIndent(indent);
-        std::cout << "GlobalVarDeclAssign: " << type << ": " << name << (initByAddr ? " (Address initialised)" : "") << std::endl;
+        std::cout << "GlobalVarDeclAssign: " << type << ": " << name << (initByAddr ? " (Address initialised)" : "") << (readOnly ? " (Read only)" : "") << std::endl;
         expression->print(indent + 1);
     }
 
@@ -521,6 +535,25 @@ public:
     std::string name;
     ASTNodePtr expression;
     bool initByAddr;
+    bool readOnly; // `const`, the data goes to a read only section
+};
+
+// `{a, b, {c, d}}`, the members of a struct or the elements behind an address initialised global
+class InitializerListNode : public ASTNode {
+public:
+    InitializerListNode(std::vector<ASTNodePtr> elements)
+        : ASTNode(NodeType::InitializerList), elements(std::move(elements)) {}
+
+    void print(int indent = 0) const override {
+        printIndent(indent);
+        std::cout << "InitializerList" << std::endl;
+        for (const auto& element : elements) {
+            element->print(indent + 1);
+        }
+    }
+
+
+    std::vector<ASTNodePtr> elements;
 };
 
 class IncrementNode : public ASTNode {
@@ -740,6 +773,42 @@ public:
     ASTNodePtr value;
 };
 
+// `asm { in a; out b; clobber "rdx"; "popcnt {b}, {a}"; };`, the lines are emitted as written with
+// every `{name}` replaced by the register the operand is bound to
+class AsmNode : public ASTNode {
+public:
+    AsmNode(std::vector<std::string> lines, std::vector<std::string> inputs, std::vector<std::string> outputs, std::vector<std::string> clobbers)
+        : ASTNode(NodeType::Asm), lines(std::move(lines)), inputs(std::move(inputs)), outputs(std::move(outputs)), clobbers(std::move(clobbers)) {}
+
+    void print(int indent = 0) const override {
+        printIndent(indent);
+        std::cout << "Asm" << std::endl;
+        auto printList = [&](const std::string& label, const std::vector<std::string>& names) {
+            if (names.empty()) {
+                return;
+            }
+            printIndent(indent + 1);
+            std::cout << label << ":";
+            for (const auto& name : names) {
+                std::cout << " " << name;
+            }
+            std::cout << std::endl;
+        };
+        printList("In", inputs);
+        printList("Out", outputs);
+        printList("Clobber", clobbers);
+        for (const auto& line : lines) {
+            printIndent(indent + 1);
+            std::cout << line << std::endl;
+        }
+    }
+
+    std::vector<std::string> lines;
+    std::vector<std::string> inputs;
+    std::vector<std::string> outputs;
+    std::vector<std::string> clobbers;
+};
+
 } // namespace EntS
 
 #endif // AST_HPP
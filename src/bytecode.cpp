@@ -0,0 +1,731 @@
+#include "bytecode.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <dlfcn.h>
+
+extern void printFatal(const char* str);
+extern void printError(const char* str);
+extern void printWarning(const char* str);
+
+namespace EntS {
+
+BytecodeCompiler::BytecodeCompiler(const std::unordered_map<std::string, std::string>& typedefs, const StructDefinitions& structs)
+    : typedefs(typedefs), structDefinitions(structs) {}
+
+BytecodeProgram BytecodeCompiler::compile(const ASTNodePtr& root) {
+    const auto* node = dynamic_cast<const ProgramNode*>(root.get());
+    declareFunctions(node);
+    size_t index = 0;
+    for (const auto& statement : node->functions) {
+        if (const auto* function = dynamic_cast<const FunctionNode*>(statement.get())) {
+            compileFunction(function, program.functions[index++]);
+        }
+    }
+    return std::move(program);
+}
+
+// functions may be called before they are defined, every one gets its index up front
+void BytecodeCompiler::declareFunctions(const ProgramNode* node) {
+    collectReturnTypes(node, returnTypes);
+    for (const auto& statement : node->functions) {
+        switch (statement->getType()) {
+            case NodeType::Function: {
+                const auto* function = dynamic_cast<const FunctionNode*>(statement.get());
+                program.functionIndices[function->name] = program.functions.size();
+                program.functions.push_back({function->name, {}, {}});
+                program.functions.back().parameterCount = function->params.size();
+                break;
+            }
+            case NodeType::GlobalVarDecl: {
+                const auto* global = dynamic_cast<const GlobalVarDeclNode*>(statement.get());
+                globals[global->name] = {static_cast<uint16_t>(program.globalSlots++), checkedType(global->type), global->initByAddr, true};
+                break;
+            }
+            case NodeType::GlobalVarDeclAssign: {
+                const auto* global = dynamic_cast<const GlobalVarDeclAssignNode*>(statement.get());
+                globals[global->name] = {static_cast<uint16_t>(program.globalSlots++), checkedType(global->type), global->initByAddr, true};
+                program.globalValues.emplace_back(globals[global->name].slot, staticValue(global));
+                break;
+            }
+            case NodeType::Header:
+                for (const auto& prototype : dynamic_cast<const HeaderNode*>(statement.get())->prototypes) {
+                    if (const auto* global = dynamic_cast<const GlobalVarDeclNode*>(prototype.get())) {
+                        declareExternal(global);
+                    }
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// A global of another unit is looked up in this process like a native function, its slot holds the
+// address so it is read and written the way an address initialised global is.
+void BytecodeCompiler::declareExternal(const GlobalVarDeclNode* node) {
+    if (node->initByAddr) {
+        printFatal(("Address initialised header global " + node->name + " is not supported by the interpreter").c_str());
+    }
+    void* address = dlsym(RTLD_DEFAULT, node->name.c_str());
+    if (!address) {
+        printFatal(("undefined reference to '" + node->name + "'").c_str());
+    }
+    globals[node->name] = {static_cast<uint16_t>(program.globalSlots++), checkedType(node->type), true, true};
+    program.globalValues.emplace_back(globals[node->name].slot, reinterpret_cast<int64_t>(address));
+    externalGlobals.insert(node->name);
+}
+
+void BytecodeCompiler::compileFunction(const FunctionNode* node, BytecodeFunction& function) {
+    current = &function;
+    scopes = {{}};
+    loops.clear();
+    nextRegister = 0;
+    returnType = checkedType(node->returnType);
+    analysis.emplace(node);
+
+    for (const auto& param : node->params) {
+        const auto* parameter = dynamic_cast<const ParameterNode*>(param.get());
+        uint16_t reg = allocate();
+        scopes.back()[parameter->name] = {reg, checkedType(parameter->type), false, false};
+        emitExtend(reg, parameter->type);
+    }
+    // pointer backed parameters move their value into storage of their own once all are in place
+    for (const auto& param : node->params) {
+        const auto* parameter = dynamic_cast<const ParameterNode*>(param.get());
+        if (analysis->isPointerBacked(parameter->name)) {
+            Variable& variable = scopes.back()[parameter->name];
+            uint16_t pointer = allocate();
+            emit(Opcode::FrameAddress, pointer, variable.slot);
+            variable = {pointer, variable.type, true, false};
+        }
+    }
+
+    compileBlock(dynamic_cast<const BlockNode*>(node->body.get()));
+
+    // falling off the end returns zero
+    uint16_t zero = allocate();
+    emitWide(Opcode::LoadConst, zero, constant(0));
+    emit(Opcode::Return, zero);
+    analysis.reset();
+}
+
+void BytecodeCompiler::compileBlock(const BlockNode* node) {
+    if (!node) {
+        printFatal("BlockNode cannot be null");
+    }
+    scopes.emplace_back();
+    uint16_t saved = nextRegister;
+    for (const auto& statement : node->statements) {
+        // temporaries die with their statement, declarations keep the register they were given
+        uint16_t mark = nextRegister;
+        compileStatement(statement.get());
+        if (statement->getType() != NodeType::VarDecl && statement->getType() != NodeType::VarDeclAssign) {
+            nextRegister = mark;
+        }
+    }
+    scopes.pop_back();
+    nextRegister = saved;
+}
+
+void BytecodeCompiler::compileStatement(const ASTNode* node) {
+    switch (node->getType()) {
+        case NodeType::VarDecl: {
+            const auto* decl = dynamic_cast<const VarDeclNode*>(node);
+            declareLocal(decl->name, decl->type, decl->initByAddr);
+            break;
+        }
+        case NodeType::VarDeclAssign: {
+            const auto* decl = dynamic_cast<const VarDeclAssignNode*>(node);
+            const Variable& variable = declareLocal(decl->name, decl->type, decl->initByAddr);
+            uint16_t mark = nextRegister;
+            if (decl->initByAddr) {
+                compileExpression(decl->expression.get(), variable.slot);
+            } else if (!variable.byAddr) {
+                compileExpression(decl->expression.get(), variable.slot);
+                emitExtend(variable.slot, variable.type);
+            } else {
+                compileStore(decl->name, compileOperand(decl->expression.get(), true));
+            }
+            nextRegister = mark;
+            break;
+        }
+        case NodeType::Assign: {
+            const auto* assign = dynamic_cast<const AssignNode*>(node);
+            const Variable& variable = lookup(assign->name);
+            if (!variable.global && !variable.byAddr) {
+                compileExpression(assign->expression.get(), variable.slot);
+                emitExtend(variable.slot, variable.type);
+                break;
+            }
+            compileStore(assign->name, compileOperand(assign->expression.get(), true));
+            break;
+        }
+        case NodeType::IndexationAssign: {
+            const auto* assign = dynamic_cast<const IndexationAssignNode*>(node);
+            const Variable& variable = lookup(assign->name);
+            uint16_t value = compileOperand(assign->expression.get());
+            uint16_t address = compileElementAddress(variable, assign->index.get());
+            emit(storeOpcode(variable.type), address, value);
+            break;
+        }
+        case NodeType::MemoryAssign: {
+            const auto* assign = dynamic_cast<const MemoryAssignNode*>(node);
+            const Variable& variable = lookup(assign->name);
+            if (!variable.byAddr || (variable.global && externalGlobals.count(assign->name))) {
+                printError("Cannot change the address of a global variable that is not address initialised");
+            }
+            if (variable.global) {
+                uint16_t value = compileOperand(assign->expression.get());
+                emitWide(Opcode::StoreGlobal, value, variable.slot);
+            } else {
+                compileExpression(assign->expression.get(), variable.slot);
+            }
+            break;
+        }
+        case NodeType::Increment:
+        case NodeType::Decrement: {
+            bool increment = node->getType() == NodeType::Increment;
+            const std::string& name = increment ? dynamic_cast<const IncrementNode*>(node)->variable : dynamic_cast<const DecrementNode*>(node)->variable;
+            const Variable& variable = lookup(name);
+            bool inRegister = !variable.global && !variable.byAddr;
+            uint16_t value = inRegister ? variable.slot : allocate();
+            if (!inRegister) {
+                compileLoad(variable, value);
+            }
+            emit(Opcode::AddImmediate, value, value, static_cast<uint16_t>(increment ? 1 : -1));
+            if (inRegister) {
+                emitExtend(value, variable.type);
+            } else {
+                compileStore(name, value);
+            }
+            break;
+        }
+        case NodeType::Return: {
+            const auto* ret = dynamic_cast<const ReturnNode*>(node);
+            uint16_t value = allocate();
+            if (ret->expression) {
+                compileExpression(ret->expression.get(), value);
+                emitExtend(value, returnType);
+            } else {
+                emitWide(Opcode::LoadConst, value, constant(0));
+            }
+            emit(Opcode::Return, value);
+            break;
+        }
+        case NodeType::If:
+            compileIf(dynamic_cast<const IfNode*>(node));
+            break;
+        case NodeType::While:
+            compileWhile(dynamic_cast<const WhileNode*>(node));
+            break;
+        case NodeType::Switch:
+            compileSwitch(dynamic_cast<const SwitchNode*>(node));
+            break;
+        case NodeType::Break:
+            if (loops.empty()) {
+                printFatal("Break statement not within a loop");
+            }
+            loops.back().breaks.push_back(emitWide(Opcode::Jump, 0, 0));
+            break;
+        case NodeType::Continue:
+            if (loops.empty()) {
+                printFatal("Continue statement not within a loop");
+            }
+            loops.back().continues.push_back(emitWide(Opcode::Jump, 0, 0));
+            break;
+        case NodeType::FunctionCall:
+            compileCall(dynamic_cast<const FunctionCallNode*>(node), allocate());
+            break;
+        case NodeType::Expression:
+            compileExpression(node, allocate());
+            break;
+        case NodeType::StructMemberAssign:
+            printFatal("Structs are not supported by the interpreter");
+            break;
+        case NodeType::Asm:
+            printFatal("Inline assembly is not supported by the interpreter");
+            break;
+        default:
+            std::cout << std::endl << "Offender: " << toString(node->getType()) << std::endl;
+            printFatal("Unhandled node type in BlockNode");
+            break;
+    }
+}
+
+void BytecodeCompiler::compileIf(const IfNode* node) {
+    uint16_t mark = nextRegister;
+    size_t skip = emitWide(Opcode::JumpIfZero, compileOperand(node->condition.get()), 0);
+    nextRegister = mark;
+
+    compileBlock(dynamic_cast<const BlockNode*>(node->body.get()));
+    if (!node->else_) {
+        patch(skip, current->code.size());
+        return;
+    }
+    size_t end = emitWide(Opcode::Jump, 0, 0);
+    patch(skip, current->code.size());
+    if (node->else_->getType() == NodeType::Block) {
+        compileBlock(dynamic_cast<const BlockNode*>(node->else_.get()));
+    } else if (node->else_->getType() == NodeType::If) {
+        compileIf(dynamic_cast<const IfNode*>(node->else_.get()));
+    }
+    patch(end, current->code.size());
+}
+
+void BytecodeCompiler::compileWhile(const WhileNode* node) {
+    size_t start = current->code.size();
+    uint16_t mark = nextRegister;
+    size_t exit = emitWide(Opcode::JumpIfZero, compileOperand(node->condition.get()), 0);
+    nextRegister = mark;
+
+    loops.emplace_back();
+    compileBlock(dynamic_cast<const BlockNode*>(node->body.get()));
+    emitWide(Opcode::Jump, 0, start);
+
+    size_t end = current->code.size();
+    patch(exit, end);
+    for (size_t jump : loops.back().breaks) {
+        patch(jump, end);
+    }
+    for (size_t jump : loops.back().continues) {
+        patch(jump, start);
+    }
+    loops.pop_back();
+}
+
+// same shape as the native switch, cases fall through and the default body comes last
+void BytecodeCompiler::compileSwitch(const SwitchNode* node) {
+    uint16_t value = allocate();
+    compileExpression(node->condition.get(), value);
+
+    std::vector<size_t> jumps(node->cases.size(), 0);
+    for (size_t i = 0; i < node->cases.size(); ++i) {
+        const auto* caseNode = dynamic_cast<const CaseNode*>(node->cases[i].get());
+        if (!caseNode) {
+            continue;
+        }
+        uint16_t mark = nextRegister;
+        uint16_t equal = allocate();
+        emit(Opcode::Equal, equal, value, compileOperand(caseNode->case_.get()));
+        jumps[i] = emitWide(Opcode::JumpIfNotZero, equal, 0);
+        nextRegister = mark;
+    }
+    size_t toDefault = emitWide(Opcode::Jump, 0, 0);
+
+    loops.emplace_back();
+    for (size_t i = 0; i < node->cases.size(); ++i) {
+        if (const auto* caseNode = dynamic_cast<const CaseNode*>(node->cases[i].get())) {
+            patch(jumps[i], current->code.size());
+            compileBlock(dynamic_cast<const BlockNode*>(caseNode->body.get()));
+        }
+    }
+    patch(toDefault, current->code.size());
+    for (const auto& caseNode : node->cases) {
+        if (const auto* defaultNode = dynamic_cast<const DefaultNode*>(caseNode.get())) {
+            compileBlock(dynamic_cast<const BlockNode*>(defaultNode->body.get()));
+            break;
+        }
+    }
+
+    // break leaves the switch, continue still targets the enclosing loop
+    size_t end = current->code.size();
+    LoopContext context = std::move(loops.back());
+    loops.pop_back();
+    for (size_t jump : context.breaks) {
+        patch(jump, end);
+    }
+    for (size_t jump : context.continues) {
+        if (loops.empty()) {
+            patch(jump, end);
+        } else {
+            loops.back().continues.push_back(jump);
+        }
+    }
+}
+
+// `value` is a temporary, it may be narrowed in place
+void BytecodeCompiler::compileStore(const std::string& name, uint16_t value) {
+    const Variable& variable = lookup(name);
+    if (variable.byAddr) {
+        uint16_t pointer = variable.slot;
+        if (variable.global) {
+            pointer = allocate();
+            emitWide(Opcode::LoadGlobal, pointer, variable.slot);
+        }
+        emit(storeOpcode(variable.type), pointer, value);
+        return;
+    }
+    emitExtend(value, variable.type);
+    if (variable.global) {
+        emitWide(Opcode::StoreGlobal, value, variable.slot);
+    } else {
+        emit(Opcode::Move, variable.slot, value);
+    }
+}
+
+void BytecodeCompiler::compileLoad(const Variable& variable, uint16_t dest) {
+    if (!variable.global) {
+        if (variable.byAddr) {
+            emit(loadOpcode(variable.type), dest, variable.slot);
+        } else if (dest != variable.slot) {
+            emit(Opcode::Move, dest, variable.slot);
+        }
+        return;
+    }
+    emitWide(Opcode::LoadGlobal, dest, variable.slot);
+    if (variable.byAddr) {
+        emit(loadOpcode(variable.type), dest, dest);
+    }
+}
+
+// Register holding the address `name[index]` refers to, indexing a plain variable starts at its own storage
+uint16_t BytecodeCompiler::compileElementAddress(const Variable& variable, const ASTNode* index) {
+    uint16_t base = variable.slot;
+    if (variable.global) {
+        base = allocate();
+        emitWide(variable.byAddr ? Opcode::LoadGlobal : Opcode::GlobalAddress, base, variable.slot);
+    } else if (!variable.byAddr) {
+        base = allocate();
+        emit(Opcode::FrameAddress, base, variable.slot);
+    }
+    uint16_t offset = compileOperand(index);
+    uint16_t address = allocate();
+    emit(Opcode::Index, address, base, offset, typeSize(variable.type));
+    return address;
+}
+
+void BytecodeCompiler::compileExpression(const ASTNode* node, uint16_t dest) {
+    switch (node->getType()) {
+        case NodeType::Literal: {
+            const std::string& text = dynamic_cast<const LiteralNode*>(node)->value;
+            int64_t value = 0;
+            auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+            if (error != std::errc() || end != text.data() + text.size()) {
+                printFatal("Floating point values are not supported by the interpreter");
+            }
+            emitWide(Opcode::LoadConst, dest, constant(value));
+            break;
+        }
+        case NodeType::Identifier:
+            compileLoad(lookup(dynamic_cast<const IdentifierNode*>(node)->name), dest);
+            break;
+        case NodeType::Index: {
+            const auto* index = dynamic_cast<const IndexNode*>(node);
+            const Variable& variable = lookup(index->name);
+            emit(loadOpcode(variable.type), dest, compileElementAddress(variable, index->index.get()));
+            break;
+        }
+        case NodeType::MemoryAddress: {
+            const Variable& variable = lookup(dynamic_cast<const MemoryAddressNode*>(node)->name);
+            if (variable.global) {
+                emitWide(variable.byAddr ? Opcode::LoadGlobal : Opcode::GlobalAddress, dest, variable.slot);
+            } else {
+                emit(variable.byAddr ? Opcode::Move : Opcode::FrameAddress, dest, variable.slot);
+            }
+            break;
+        }
+        case NodeType::Expression: {
+            const auto* expression = dynamic_cast<const ExpressionNode*>(node);
+            const std::string& op = expression->op;
+            if (!expression->left || !*expression->left) {
+                uint16_t operand = compileOperand(expression->right->get());
+                emit(op == "-" ? Opcode::Negate : Opcode::Not, dest, operand);
+                break;
+            }
+            // small constants added or subtracted fold into the instruction
+            if (const auto* literal = dynamic_cast<const LiteralNode*>(expression->right->get()); literal && (op == "+" || op == "-")) {
+                int64_t value = 0;
+                const std::string& text = literal->value;
+                auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+                if (error == std::errc() && end == text.data() + text.size() && value >= -32767 && value <= 32767) {
+                    uint16_t left = compileOperand(expression->left->get());
+                    emit(Opcode::AddImmediate, dest, left, static_cast<uint16_t>(op == "+" ? value : -value));
+                    break;
+                }
+            }
+            static const std::unordered_map<std::string, Opcode> opcodes = {
+                {"+", Opcode::Add}, {"-", Opcode::Sub}, {"*", Opcode::Mul}, {"/", Opcode::Div},
+                {"&", Opcode::And}, {"|", Opcode::Or}, {"==", Opcode::Equal}, {"!=", Opcode::NotEqual},
+                {"<", Opcode::Less}, {"<=", Opcode::LessEqual}, {">", Opcode::Greater}, {">=", Opcode::GreaterEqual},
+                {"&&", Opcode::LogicalAnd}, {"||", Opcode::LogicalOr},
+            };
+            auto it = opcodes.find(op);
+            if (it == opcodes.end()) {
+                printFatal(("Operator " + op + " is not supported by the interpreter").c_str());
+            }
+            uint16_t left = compileOperand(expression->left->get());
+            uint16_t right = compileOperand(expression->right->get());
+            emit(it->second, dest, left, right);
+            break;
+        }
+        case NodeType::FunctionCall:
+            compileCall(dynamic_cast<const FunctionCallNode*>(node), dest);
+            break;
+        case NodeType::StructMemberAccess:
+            printFatal("Structs are not supported by the interpreter");
+            break;
+        case NodeType::StringLiteral: {
+            const std::string& text = dynamic_cast<const StringLiteralNode*>(node)->value;
+            emitWide(Opcode::LoadConst, dest, constant(stringAddress(decodeStringLiteral(text))));
+            break;
+        }
+        default:
+            std::cout << std::endl << "Offender: " << toString(node->getType()) << std::endl;
+            printFatal("Unhandled node type in expression");
+            break;
+    }
+}
+
+void BytecodeCompiler::compileCall(const FunctionCallNode* node, uint16_t dest) {
+    // the memory builtins are the C library routines they stand for, with the result type the library
+    // declares: size_t and pointers fill the register, memcmp's int has to be sign extended
+    static const std::unordered_map<std::string, std::pair<std::string, std::string>> builtins = {
+        {"__builtin_strlen", {"strlen", "uint64"}}, {"__builtin_memcpy", {"memcpy", "int64"}},
+        {"__builtin_memset", {"memset", "int64"}}, {"__builtin_memcmp", {"memcmp", "int32"}},
+    };
+    std::string name = node->name;
+    std::string resultType;
+    if (isBuiltin(name)) {
+        auto it = builtins.find(name);
+        if (it == builtins.end()) {
+            printFatal(("Builtin " + name + " is not supported by the interpreter").c_str());
+        }
+        name = it->second.first;
+        resultType = it->second.second;
+    }
+
+    uint16_t arguments = allocate(node->arguments.size());
+    for (size_t i = 0; i < node->arguments.size(); ++i) {
+        compileExpression(node->arguments[i].get(), arguments + i);
+    }
+
+    if (auto it = program.functionIndices.find(name); it != program.functionIndices.end()) {
+        if (program.functions[it->second].parameterCount != node->arguments.size()) {
+            printFatal(("Wrong number of arguments in call to " + name).c_str());
+        }
+        emit(Opcode::Call, dest, it->second, arguments);
+        return;
+    }
+    emit(Opcode::CallNative, dest, native(name, node->arguments.size()), arguments);
+    // only the declared part of the return register is defined
+    if (!resultType.empty()) {
+        emitExtend(dest, resultType);
+    } else if (auto it = returnTypes.find(name); it != returnTypes.end()) {
+        emitExtend(dest, checkedType(it->second));
+    }
+}
+
+// Evaluates `node` into a register, plain locals are used where they live unless `scratch` asks for a copy
+uint16_t BytecodeCompiler::compileOperand(const ASTNode* node, bool scratch) {
+    if (const auto* identifier = dynamic_cast<const IdentifierNode*>(node); identifier && !scratch) {
+        const Variable& variable = lookup(identifier->name);
+        if (!variable.global && !variable.byAddr) {
+            return variable.slot;
+        }
+    }
+    uint16_t reg = allocate();
+    compileExpression(node, reg);
+    return reg;
+}
+
+const BytecodeCompiler::Variable& BytecodeCompiler::declareLocal(const std::string& name, const std::string& type, bool byAddr) {
+    std::string resolved = checkedType(type);
+    uint16_t slot = allocate();
+    if (!byAddr && analysis->isPointerBacked(name)) {
+        // the variable gets re-addressed later on, start out pointing at its own storage
+        uint16_t pointer = allocate();
+        emit(Opcode::FrameAddress, pointer, slot);
+        return scopes.back()[name] = {pointer, resolved, true, false};
+    }
+    return scopes.back()[name] = {slot, resolved, byAddr, false};
+}
+
+uint16_t BytecodeCompiler::allocate(uint16_t count) {
+    if (nextRegister + count > UINT16_MAX) {
+        printFatal(("Function " + current->name + " needs too many registers").c_str());
+    }
+    uint16_t reg = nextRegister;
+    nextRegister += count;
+    current->frameSize = std::max(current->frameSize, nextRegister);
+    return reg;
+}
+
+size_t BytecodeCompiler::emit(Opcode op, uint16_t a, uint16_t b, uint16_t c, uint8_t width) {
+    current->code.push_back({op, width, a, b, c});
+    return current->code.size() - 1;
+}
+
+size_t BytecodeCompiler::emitWide(Opcode op, uint16_t a, uint32_t wide) {
+    Instruction instruction{op, 0, a};
+    instruction.setWide(wide);
+    current->code.push_back(instruction);
+    return current->code.size() - 1;
+}
+
+void BytecodeCompiler::patch(size_t instruction, size_t target) {
+    current->code[instruction].setWide(target);
+}
+
+void BytecodeCompiler::emitExtend(uint16_t reg, const std::string& type) {
+    bool isUnsignedType = isUnsigned(type);
+    switch (typeSize(type)) {
+        case 1: emit(isUnsignedType ? Opcode::ZeroExtend8 : Opcode::SignExtend8, reg, reg); break;
+        case 2: emit(isUnsignedType ? Opcode::ZeroExtend16 : Opcode::SignExtend16, reg, reg); break;
+        case 4: emit(isUnsignedType ? Opcode::ZeroExtend32 : Opcode::SignExtend32, reg, reg); break;
+        default: break;
+    }
+}
+
+Opcode BytecodeCompiler::loadOpcode(const std::string& type) const {
+    bool isUnsignedType = isUnsigned(type);
+    switch (typeSize(type)) {
+        case 1: return isUnsignedType ? Opcode::Load8u : Opcode::Load8s;
+        case 2: return isUnsignedType ? Opcode::Load16u : Opcode::Load16s;
+        case 4: return isUnsignedType ? Opcode::Load32u : Opcode::Load32s;
+        default: return Opcode::Load64;
+    }
+}
+
+Opcode BytecodeCompiler::storeOpcode(const std::string& type) const {
+    switch (typeSize(type)) {
+        case 1: return Opcode::Store8;
+        case 2: return Opcode::Store16;
+        case 4: return Opcode::Store32;
+        default: return Opcode::Store64;
+    }
+}
+
+uint32_t BytecodeCompiler::constant(int64_t value) {
+    auto& constants = current->constants;
+    auto it = std::find(constants.begin(), constants.end(), value);
+    if (it != constants.end()) {
+        return it - constants.begin();
+    }
+    constants.push_back(value);
+    return constants.size() - 1;
+}
+
+int64_t BytecodeCompiler::stringAddress(const std::string& bytes) {
+    if (auto it = stringAddresses.find(bytes); it != stringAddresses.end()) {
+        return it->second;
+    }
+    auto copy = std::make_unique<char[]>(bytes.size() + 1);
+    std::memcpy(copy.get(), bytes.data(), bytes.size());
+    int64_t address = reinterpret_cast<int64_t>(copy.get());
+    program.strings.push_back(std::move(copy));
+    return stringAddresses[bytes] = address;
+}
+
+// Initialisers are evaluated while compiling, like the native code does. A list behind an address
+// initialised global gets storage of its own, the slot holds its address.
+int64_t BytecodeCompiler::staticValue(const GlobalVarDeclAssignNode* node) {
+    std::string type = checkedType(node->type);
+    const auto* list = dynamic_cast<const InitializerListNode*>(node->expression.get());
+    if (!node->initByAddr) {
+        if (list) {
+            printFatal(("The initialiser of global " + node->name + " gives a list for the scalar type " + node->type).c_str());
+        }
+        int64_t value = staticScalar(node->expression.get(), type, node->name);
+        if (node->readOnly) {
+            staticConstants[node->name].integer = value;
+        }
+        return value;
+    }
+    if (const auto* literal = dynamic_cast<const StringLiteralNode*>(node->expression.get())) {
+        return stringAddress(decodeStringLiteral(literal->value));
+    }
+    if (!list) {
+        printFatal(("The initialiser of global " + node->name + " is not a constant address the interpreter supports").c_str());
+    }
+
+    int size = typeSize(type);
+    auto storage = std::make_unique<char[]>(std::max<size_t>(list->elements.size() * size, 1));
+    for (size_t i = 0; i < list->elements.size(); ++i) {
+        const ASTNode* element = list->elements[i].get();
+        int64_t value;
+        if (const auto* literal = dynamic_cast<const StringLiteralNode*>(element); literal && size == 8) {
+            value = stringAddress(decodeStringLiteral(literal->value));
+        } else {
+            value = staticScalar(element, type, node->name);
+        }
+        std::memcpy(storage.get() + i * size, &value, size);
+    }
+    int64_t address = reinterpret_cast<int64_t>(storage.get());
+    program.elements.push_back(std::move(storage));
+    return address;
+}
+
+// an integer initialiser wrapped to `type` and extended back to 64 bits, as the slots hold them
+int64_t BytecodeCompiler::staticScalar(const ASTNode* node, const std::string& type, const std::string& global) const {
+    std::optional<Constant> value = foldConstant(node, staticConstants);
+    if (!value) {
+        printFatal(("The initialiser of global " + global + " is not a constant").c_str());
+    }
+    int bits = 8 * typeSize(type);
+    uint64_t raw = static_cast<uint64_t>(value->asInteger());
+    if (bits < 64) {
+        raw &= (uint64_t(1) << bits) - 1;
+        if (!isUnsigned(type) && (raw >> (bits - 1)) & 1) {
+            raw |= ~uint64_t(0) << bits;
+        }
+    }
+    if (static_cast<int64_t>(raw) != value->asInteger()) {
+        printWarning(("The initialiser of global " + global + " is " + std::to_string(value->asInteger()) + ", out of range for " +
+                      type + ", stored as " + std::to_string(static_cast<int64_t>(raw))).c_str());
+    }
+    return static_cast<int64_t>(raw);
+}
+
+// functions the program does not define are looked up among those of this process
+uint16_t BytecodeCompiler::native(const std::string& name, size_t arity) {
+    if (arity > 6) {
+        printFatal(("Native function " + name + " takes more arguments than the interpreter passes in registers").c_str());
+    }
+    if (auto it = nativeIndices.find(name); it != nativeIndices.end()) {
+        return it->second;
+    }
+    void* address = dlsym(RTLD_DEFAULT, name.c_str());
+    if (!address) {
+        printFatal(("undefined reference to '" + name + "'").c_str());
+    }
+    program.natives.push_back({name, address, static_cast<uint16_t>(arity)});
+    return nativeIndices[name] = program.natives.size() - 1;
+}
+
+const BytecodeCompiler::Variable& BytecodeCompiler::lookup(const std::string& name) const {
+    for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope) {
+        if (auto it = scope->find(name); it != scope->end()) {
+            return it->second;
+        }
+    }
+    if (auto it = globals.find(name); it != globals.end()) {
+        return it->second;
+    }
+    printError("Variable not defined");
+    __builtin_unreachable();
+}
+
+std::string BytecodeCompiler::checkedType(const std::string& type) const {
+    std::string resolved = resolveTypeName(type, typedefs, structDefinitions);
+    if (structDefinitions.count(resolved)) {
+        printFatal("Structs are not supported by the interpreter");
+    }
+    if (isFloatingType(resolved, typedefs, structDefinitions) || isVectorType(resolved, typedefs, structDefinitions)) {
+        printFatal("Floating point and vector types are not supported by the interpreter");
+    }
+    return resolved;
+}
+
+int BytecodeCompiler::typeSize(const std::string& type) const {
+    if (type == "int8" || type == "uint8" || type == "char" || type == "bool") return 1;
+    if (type == "int16" || type == "uint16") return 2;
+    if (type == "int32" || type == "uint32") return 4;
+    return 8;
+}
+
+bool BytecodeCompiler::isUnsigned(const std::string& type) const {
+    return type.starts_with("uint") || type == "char" || type == "bool";
+}
+
+} // namespace EntS
@@ -0,0 +1,157 @@
+#ifndef BYTECODE_HPP
+#define BYTECODE_HPP
+
+#include "ast.hpp"
+#include "analysis.hpp"
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace EntS {
+
+// Register based bytecode run by the Interpreter. Every function has a frame of 64 bit registers,
+// parameters first, then locals and temporaries. Narrow integer types are kept sign or zero
+// extended in their register, so arithmetic is always done on the full 64 bits.
+enum class Opcode : uint8_t {
+    LoadConst,      // a = constants[wide]
+    Move,           // a = b
+    SignExtend8, SignExtend16, SignExtend32,
+    ZeroExtend8, ZeroExtend16, ZeroExtend32,
+    Add, Sub, Mul, Div, And, Or,
+    Equal, NotEqual, Less, LessEqual, Greater, GreaterEqual,
+    LogicalAnd, LogicalOr,
+    Negate, Not,    // a = op b
+    AddImmediate,   // a = b + (int16)c
+    Index,          // a = b + c * width
+    Load8s, Load8u, Load16s, Load16u, Load32s, Load32u, Load64, // a = *b
+    Store8, Store16, Store32, Store64, // *a = b
+    FrameAddress,   // a = address of register b
+    GlobalAddress,  // a = address of global slot wide
+    LoadGlobal,     // a = globals[wide]
+    StoreGlobal,    // globals[wide] = a
+    Jump,           // goto wide
+    JumpIfZero,     // if a == 0 goto wide
+    JumpIfNotZero,  // if a != 0 goto wide
+    Call,           // a = functions[b](registers c...)
+    CallNative,     // a = natives[b](registers c...)
+    Return,         // return a
+    Count
+};
+
+struct Instruction {
+    Opcode op;
+    uint8_t width = 0;
+    uint16_t a = 0;
+    uint16_t b = 0;
+    uint16_t c = 0;
+
+    // jump targets and pool indices take the b and c fields together
+    uint32_t wide() const { return uint32_t(b) << 16 | c; }
+    void setWide(uint32_t value) { b = value >> 16; c = value & 0xffff; }
+};
+
+struct BytecodeFunction {
+    std::string name;
+    std::vector<Instruction> code;
+    std::vector<int64_t> constants;
+    uint16_t parameterCount = 0;
+    uint16_t frameSize = 0;
+};
+
+struct NativeFunction {
+    std::string name;
+    void* address;
+    uint16_t arity;
+};
+
+struct BytecodeProgram {
+    std::vector<BytecodeFunction> functions;
+    std::vector<NativeFunction> natives;
+    std::unordered_map<std::string, uint32_t> functionIndices;
+    uint32_t globalSlots = 0;
+    std::vector<std::unique_ptr<char[]>> strings; // string literals, terminated, their addresses are constants
+    std::vector<std::unique_ptr<char[]>> elements; // what address initialised globals with a list point at
+    std::vector<std::pair<uint32_t, int64_t>> globalValues; // global slot, value it starts with
+};
+
+// Lowers the integer and pointer subset of EntS from the parsed AST, structs, floating point,
+// vectors and inline assembly are reported as unsupported. Functions and globals declared in
+// headers are resolved among those of this process.
+class BytecodeCompiler {
+public:
+    BytecodeCompiler(const std::unordered_map<std::string, std::string>& typedefs, const StructDefinitions& structs);
+    BytecodeProgram compile(const ASTNodePtr& root);
+
+private:
+    struct Variable {
+        uint16_t slot;      // register, or global slot when `global` is set
+        std::string type;   // resolved type, the element type for address initialised variables
+        bool byAddr;        // the slot holds an address
+        bool global;
+    };
+
+    struct LoopContext {
+        std::vector<size_t> breaks;
+        std::vector<size_t> continues;
+    };
+
+    void declareFunctions(const ProgramNode* program);
+    void declareExternal(const GlobalVarDeclNode* node);
+    void compileFunction(const FunctionNode* node, BytecodeFunction& function);
+    void compileBlock(const BlockNode* node);
+    void compileStatement(const ASTNode* node);
+    void compileIf(const IfNode* node);
+    void compileWhile(const WhileNode* node);
+    void compileSwitch(const SwitchNode* node);
+    void compileStore(const std::string& name, uint16_t value);
+    void compileLoad(const Variable& variable, uint16_t dest);
+    uint16_t compileElementAddress(const Variable& variable, const ASTNode* index);
+    void compileExpression(const ASTNode* node, uint16_t dest);
+    void compileCall(const FunctionCallNode* node, uint16_t dest);
+    uint16_t compileOperand(const ASTNode* node, bool scratch = false);
+    const Variable& declareLocal(const std::string& name, const std::string& type, bool byAddr);
+
+    uint16_t allocate(uint16_t count = 1);
+    size_t emit(Opcode op, uint16_t a = 0, uint16_t b = 0, uint16_t c = 0, uint8_t width = 0);
+    size_t emitWide(Opcode op, uint16_t a, uint32_t wide);
+    void patch(size_t instruction, size_t target);
+    void emitExtend(uint16_t reg, const std::string& type);
+    Opcode loadOpcode(const std::string& type) const;
+    Opcode storeOpcode(const std::string& type) const;
+    uint32_t constant(int64_t value);
+    uint16_t native(const std::string& name, size_t arity);
+    int64_t stringAddress(const std::string& bytes);
+    int64_t staticValue(const GlobalVarDeclAssignNode* node);
+    int64_t staticScalar(const ASTNode* node, const std::string& type, const std::string& global) const;
+
+    const Variable& lookup(const std::string& name) const;
+    std::string checkedType(const std::string& type) const;
+    int typeSize(const std::string& type) const;
+    bool isUnsigned(const std::string& type) const;
+
+    const std::unordered_map<std::string, std::string>& typedefs;
+    const StructDefinitions& structDefinitions;
+    BytecodeProgram program;
+    std::unordered_map<std::string, Variable> globals;
+    std::set<std::string> externalGlobals; // declared in a header, resolved in this process
+    std::unordered_map<std::string, std::string> returnTypes;
+    std::unordered_map<std::string, uint32_t> nativeIndices;
+    std::unordered_map<std::string, int64_t> stringAddresses; // equal literals share one copy
+    std::unordered_map<std::string, Constant> staticConstants; // scalar `const` globals, later initialisers may use them
+
+    // state of the function being compiled
+    BytecodeFunction* current = nullptr;
+    std::optional<FunctionAnalysis> analysis;
+    std::vector<std::unordered_map<std::string, Variable>> scopes;
+    std::vector<LoopContext> loops;
+    std::string returnType;
+    uint16_t nextRegister = 0;
+};
+
+} // namespace EntS
+
+#endif // BYTECODE_HPP
@@ -1,331 +1,1774 @@
 #include "codegenerator.hpp"
 #include "ast.hpp"
-#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <iterator>
+#include <set>
+#include <thread>
 
 extern void printFatal(const char* str);
 extern void printError(const char* str);
+extern void printWarning(const char* str);
 
 namespace EntS {
 
-CodeGenerator::CodeGenerator(const std::unordered_map<std::string, std::string>& typedefs, const std::unordered_map<std::string, std::vector<std::string>>& structs)
-    : typedefs(typedefs), localVarOffset(0), labelCounter(0), currentArgOffset(0), structDefinitions(structs), totalLocalVarOffset(0) {
+CodeGenerator::CodeGenerator(const std::unordered_map<std::string, std::string>& typedefs, const StructDefinitions& structs, unsigned jobs)
+    : hiddenReturnOffset(0), callResultOffset(0), localVarOffset(0), labelCounter(0), stackDepth(0), maxStackDepth(0), frameSize(0), currentFile(1), instrumentFunctions(false), profileOffset(0),
+      profileGenerate(false), counterCount(0), functionProfile(nullptr), emittingCold(false), jobs(jobs),
+      program(std::make_shared<ProgramSymbols>()), typedefs(typedefs), structDefinitions(structs) {
     // Initialize System V ABI argument registers
     argumentRegisters = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
 }
 
+CodeGenerator::CodeGenerator(const CodeGenerator& parent, const std::string& functionName)
+    : currentFunctionName(functionName), hiddenReturnOffset(0), callResultOffset(0), localVarOffset(0), labelCounter(0), stackDepth(0), maxStackDepth(0), frameSize(0),
+      debugFiles(parent.debugFiles), currentFile(1), instrumentFunctions(parent.instrumentFunctions), profileOffset(0),
+      profileGenerate(parent.profileGenerate), profileUse(parent.profileUse), counterCount(0), functionProfile(nullptr), emittingCold(false), jobs(1), argumentRegisters(parent.argumentRegisters), program(parent.program), typedefs(parent.typedefs), structDefinitions(parent.structDefinitions) {}
+
+void CodeGenerator::setDebugInfo(const std::vector<std::string>& sourceFiles) {
+    debugFiles = sourceFiles;
+}
+
+void CodeGenerator::setInstrumentFunctions(bool enabled) {
+    instrumentFunctions = enabled;
+}
+
+void CodeGenerator::setProfileGenerate(bool enabled) {
+    profileGenerate = enabled;
+}
+
+void CodeGenerator::setProfileUse(std::shared_ptr<const ProfileData> profile) {
+    profileUse = std::move(profile);
+}
+
 void CodeGenerator::generateCode(const ASTNodePtr& root) {
+    emit(".intel_syntax noprefix");
+    for (size_t i = 0; i < debugFiles.size(); ++i) {
+        emit(".file ", i + 1, " \"", debugFiles[i], "\"");
+    }
+    if (profileGenerate) {
+        // nothing calls the profile runtime, an undefined reference still pulls it out of intlibe.a
+        emit(".global __ents_pgo_dump");
+    }
     visitProgramNode(dynamic_cast<const ProgramNode*>(root.get()));
+    // nothing generated runs from the stack, without the note the linker makes it executable
+    emit(".section .note.GNU-stack,\"\",@progbits");
 }
 
 std::string CodeGenerator::getGeneratedCode() const {
-    std::stringstream ss;
-    for (const auto& line : generatedCode) {
-        ss << line << "\n";
+    return generatedCode.str();
+}
+
+bool CodeGenerator::writeGeneratedCode(int fd) const {
+    return generatedCode.writeTo(fd);
+}
+
+std::string CodeGenerator::Address::toString() const {
+    std::string result = "[" + base;
+    if (!index.empty()) {
+        result += "+" + index + "*" + std::to_string(scale);
+    }
+    if (!symbol.empty()) {
+        result += "+" + symbol;
+    }
+    if (displacement > 0) {
+        result += "+" + std::to_string(displacement);
+    } else if (displacement < 0) {
+        result += std::to_string(displacement);
+    }
+    return result + "]";
+}
+
+static int alignTo(int value, int alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// Known sizes up to this many bytes are expanded into vector moves
+static const int inlineVectorLimit = 64;
+// and up to this many into a single string instruction, larger ones go to the library routine
+static const int inlineStringLimit = 2048;
+
+// Stands in for the members an initializer list leaves out
+static const LiteralNode* zeroLiteral() {
+    static const LiteralNode zero("0");
+    return &zero;
+}
+
+// Suffix selecting the scalar single or double precision form of an SSE instruction
+static std::string precision(const std::string& resolvedType) {
+    return resolvedType == "float" ? "ss" : "sd";
+}
+
+// True when control never falls out of the end of the block
+static bool endsInJump(const ASTNode* node) {
+    const auto* block = dynamic_cast<const BlockNode*>(node);
+    if (!block || block->statements.empty()) {
+        return false;
+    }
+    NodeType last = block->statements.back()->getType();
+    return last == NodeType::Return || last == NodeType::Break || last == NodeType::Continue;
+}
+
+// Without a profile, blocks that end the program are taken to be the error paths
+static bool isUnlikelyBlock(const ASTNode* node) {
+    static const std::set<std::string> noReturn = {"exit", "_exit", "abort"};
+    const auto* block = dynamic_cast<const BlockNode*>(node);
+    if (!block) {
+        return false;
+    }
+    for (const auto& statement : block->statements) {
+        const auto* call = dynamic_cast<const FunctionCallNode*>(statement.get());
+        if (call && noReturn.count(call->name)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static std::string subRegister(const std::string& reg, int size) {
+    static const std::unordered_map<std::string, std::vector<std::string>> names = {
+        {"rax", {"al", "ax", "eax"}}, {"rbx", {"bl", "bx", "ebx"}}, {"rcx", {"cl", "cx", "ecx"}},
+        {"rdx", {"dl", "dx", "edx"}}, {"rsi", {"sil", "si", "esi"}}, {"rdi", {"dil", "di", "edi"}},
+    };
+    if (size == 8) {
+        return reg;
     }
-    return ss.str();
+    int index = size == 1 ? 0 : size == 2 ? 1 : 2;
+    auto it = names.find(reg);
+    if (it != names.end()) {
+        return it->second[index];
+    }
+    return reg + (index == 0 ? "b" : index == 1 ? "w" : "d"); // r8 - r15
 }
 
 int CodeGenerator::resolveTypeSize(const std::string& type) const {
     std::string resolvedType = resolveTypeName(type);
-    if (resolvedType == "int8" || resolvedType == "uint8" || resolvedType == "char") return 1;
+    if (resolvedType == "int8" || resolvedType == "uint8" || resolvedType == "char" || resolvedType == "bool") return 1;
     if (resolvedType == "int16" || resolvedType == "uint16") return 2;
     if (resolvedType == "int32" || resolvedType == "uint32" || resolvedType == "float") return 4;
     if (resolvedType == "int64" || resolvedType == "uint64" || resolvedType == "double") return 8;
+    if (!vectorElementType(resolvedType).empty()) return 16;
     auto it = structDefinitions.find(resolvedType);
     if (it != structDefinitions.end()) {
+        // laid out like C so aggregates can be shared with it
         int size = 0;
         for (const auto& member : it->second) {
-            size += resolveTypeSize(member);
+            size = alignTo(size, resolveTypeAlignment(member.first)) + resolveTypeSize(member.first);
         }
-        return size;
+        return alignTo(size, resolveTypeAlignment(resolvedType));
     }
     printFatal("Unknown type size");
     __builtin_unreachable();
 }
 
+int CodeGenerator::resolveTypeAlignment(const std::string& type) const {
+    std::string resolvedType = resolveTypeName(type);
+    auto it = structDefinitions.find(resolvedType);
+    if (it == structDefinitions.end()) {
+        return resolveTypeSize(resolvedType);
+    }
+    int alignment = 1;
+    for (const auto& member : it->second) {
+        alignment = std::max(alignment, resolveTypeAlignment(member.first));
+    }
+    return alignment;
+}
+
+void CodeGenerator::collectScalarFields(const std::string& type, int base, std::vector<std::pair<int, std::string>>& fields) const {
+    auto it = structDefinitions.find(resolveTypeName(type));
+    if (it == structDefinitions.end()) {
+        fields.emplace_back(base, type);
+        return;
+    }
+    int offset = 0;
+    for (const auto& member : it->second) {
+        offset = alignTo(offset, resolveTypeAlignment(member.first));
+        collectScalarFields(member.first, base + offset, fields);
+        offset += resolveTypeSize(member.first);
+    }
+}
+
+// Offset, type and value of every scalar of a struct built from an initializer list, members the
+// list leaves out have no value
+void CodeGenerator::collectAggregateElements(const ASTNode* value, const std::string& type, int base, std::vector<std::tuple<int, std::string, const ASTNode*>>& elements) const {
+    auto it = structDefinitions.find(resolveTypeName(type));
+    if (it == structDefinitions.end()) {
+        elements.emplace_back(base, type, value);
+        return;
+    }
+    const auto* list = dynamic_cast<const InitializerListNode*>(value);
+    if (value && !list) {
+        printFatal("A struct member of an initializer list needs a list of its own");
+    }
+    int offset = 0;
+    size_t index = 0;
+    for (const auto& member : it->second) {
+        offset = alignTo(offset, resolveTypeAlignment(member.first));
+        const ASTNode* element = list && index < list->elements.size() ? list->elements[index].get() : nullptr;
+        collectAggregateElements(element, member.first, base + offset, elements);
+        offset += resolveTypeSize(member.first);
+        index++;
+    }
+}
+
+// Classifies each eightbyte of an aggregate, an empty result means it is passed in memory
+std::vector<CodeGenerator::ArgumentClass> CodeGenerator::classifyAggregate(const std::string& type) const {
+    int size = resolveTypeSize(type);
+    if (size > 16 || size == 0) {
+        return {};
+    }
+
+    std::vector<std::pair<int, std::string>> fields;
+    collectScalarFields(type, 0, fields);
+    std::vector<ArgumentClass> classes((size + 7) / 8, ArgumentClass::Sse);
+    for (const auto& [offset, fieldType] : fields) {
+        if (isVectorType(fieldType)) {
+            return {}; // a vector member would need a whole register, keep such aggregates in memory
+        }
+        std::string resolvedType = resolveTypeName(fieldType);
+        if (resolvedType != "float" && resolvedType != "double") {
+            classes[offset / 8] = ArgumentClass::Integer;
+        }
+    }
+    return classes;
+}
+
+bool CodeGenerator::returnsInMemory(const std::string& type) const {
+    return isStructType(type) && classifyAggregate(type).empty();
+}
+
+// Assigns registers to the arguments of a call, `stackBytes` receives the size of the outgoing area
+std::vector<CodeGenerator::ArgumentLocation> CodeGenerator::planArguments(const std::vector<std::string>& types, bool hiddenReturn, int& stackBytes) const {
+    static const int sseRegisterCount = 8;
+    size_t integerUsed = hiddenReturn ? 1 : 0; // the hidden return buffer takes rdi
+    int sseUsed = 0;
+    stackBytes = 0;
+
+    std::vector<ArgumentLocation> locations;
+    for (const auto& type : types) {
+        ArgumentLocation location;
+        if (isStructType(type)) {
+            std::vector<ArgumentClass> classes = classifyAggregate(type);
+            size_t integerCount = std::count(classes.begin(), classes.end(), ArgumentClass::Integer);
+            int sseCount = classes.size() - integerCount;
+            // an aggregate goes entirely into registers or entirely onto the stack
+            if (!classes.empty() && integerUsed + integerCount <= argumentRegisters.size() && sseUsed + sseCount <= sseRegisterCount) {
+                for (ArgumentClass argumentClass : classes) {
+                    location.registers.push_back(argumentClass == ArgumentClass::Integer
+                        ? argumentRegisters[integerUsed++]
+                        : "xmm" + std::to_string(sseUsed++));
+                }
+            } else {
+                location.stackOffset = stackBytes;
+                stackBytes += alignTo(resolveTypeSize(type), 8);
+            }
+        } else if (isFloatingType(type) || isVectorType(type)) {
+            int size = isVectorType(type) ? 16 : 8;
+            if (sseUsed < sseRegisterCount) {
+                location.registers.push_back("xmm" + std::to_string(sseUsed++));
+            } else {
+                location.stackOffset = alignTo(stackBytes, size);
+                stackBytes = location.stackOffset + size;
+            }
+        } else if (integerUsed < argumentRegisters.size()) {
+            location.registers.push_back(argumentRegisters[integerUsed++]);
+        } else {
+            location.stackOffset = stackBytes;
+            stackBytes += 8;
+        }
+        locations.push_back(location);
+    }
+    return locations;
+}
+
 void CodeGenerator::enterFunction(const FunctionNode* function) {
     currentFunctionName = function->name;
+    currentReturnType = function->returnType;
+    currentFile = function->file + 1;
+    functionAnalysis.emplace(function);
+    allocateRegisters(function);
+    assignCounters(function);
     localVarOffset = 0;
-    totalLocalVarOffset = 0;
-    currentArgOffset = 16; // Arguments passed on the stack start at 16(%rbp)
+    stackDepth = 0;
+    maxStackDepth = 0;
     localVarStack.push_back({});
+    stackUsage.push_back({function->name, function->file, function->line, function->column, 0, {}});
+
+    std::vector<std::string> paramTypes;
+    for (const auto& param : function->params) {
+        paramTypes.push_back(dynamic_cast<const ParameterNode*>(param.get())->type);
+    }
+    int stackBytes;
+    bool hiddenReturn = returnsInMemory(currentReturnType);
+    parameterLocations = planArguments(paramTypes, hiddenReturn, stackBytes);
     emitFunctionPrologue(function);
 
-    int numParams = function->params.size();
-    for (int i = 0; i < numParams; ++i) {
+    if (hiddenReturn) {
+        localVarOffset -= 8;
+        hiddenReturnOffset = localVarOffset;
+        emit("mov QWORD PTR [rbp", hiddenReturnOffset, "], rdi");
+    }
+
+    for (size_t i = 0; i < function->params.size(); ++i) {
         const auto& paramNode = dynamic_cast<const ParameterNode*>(function->params[i].get());
         const std::string& paramName = paramNode->name;
+        const ArgumentLocation& location = parameterLocations[i];
+        // arguments passed on the stack start at 16(%rbp)
+        int stackOffset = 16 + location.stackOffset;
+
+        std::string reg = registerFor(paramName, paramNode->type);
+        if (!reg.empty()) {
+            if (!location.registers.empty()) {
+                emitRegisterStore(reg, location.registers[0], paramNode->type);
+            } else {
+                emitLoad({"rbp", "", 1, "", stackOffset}, paramNode->type);
+                emitRegisterStore(reg, "rax", paramNode->type);
+            }
+            localVarStack.back()[paramName] = {0, paramNode->type, false, reg};
+            continue;
+        }
+
+        int offset;
+        if (location.registers.empty()) {
+            offset = stackOffset;
+        } else if (isStructType(paramNode->type)) {
+            // reassemble the aggregate from its eightbytes
+            int size = resolveTypeSize(paramNode->type);
+            offset = reserveSlot(alignTo(size, 8), paramNode->type);
+            for (size_t k = 0; k < location.registers.size(); ++k) {
+                std::string source = location.registers[k];
+                if (source.starts_with("xmm")) {
+                    emit("movq rax, ", source);
+                    source = "rax";
+                }
+                emitStoreEightbyte(source, {"rbp", "", 1, "", offset + 8 * static_cast<int>(k)}, std::min(8, size - 8 * static_cast<int>(k)));
+            }
+        } else if (isVectorType(paramNode->type)) {
+            offset = reserveSlot(16, paramNode->type);
+            Address address = {"rbp", "", 1, "", offset};
+            emit(vectorMove(address, paramNode->type), " XMMWORD PTR ", address.toString(), ", ", location.registers[0]);
+        } else {
+            localVarOffset -= 8;
+            offset = localVarOffset;
+            std::string move = location.registers[0].starts_with("xmm") ? "movq" : "mov";
+            emit(move, " QWORD PTR [rbp", offset, "], ", location.registers[0]);
+        }
 
-        if (i < argumentRegisters.size()) {
-            emit("mov [rbp-" + std::to_string(8 * (i + 1)) + "], " + argumentRegisters[i]);
-            localVarStack.back()[paramName] = std::make_pair(-8 * (i + 1), paramNode->type);
+        if (functionAnalysis->isPointerBacked(paramName)) {
+            // re-addressed parameters start out pointing at their own value
+            localVarOffset -= 8;
+            emit("lea rax, [rbp", (offset < 0 ? "" : "+"), offset, "]");
+            emit("mov QWORD PTR [rbp", localVarOffset, "], rax");
+            localVarStack.back()[paramName] = {localVarOffset, paramNode->type, true, ""};
         } else {
-            localVarStack.back()[paramName] = std::make_pair(currentArgOffset, paramNode->type);
-            currentArgOffset += 8;
+            localVarStack.back()[paramName] = {offset, paramNode->type, false, ""};
         }
     }
 }
 
 void CodeGenerator::exitFunction() {
     emitFunctionEpilogue();
+    // the return address and the saved rbp sit above the frame
+    stackUsage.back().frameBytes = 16 + frameSize + 8 * maxStackDepth;
     localVarStack.pop_back();
+    functionAnalysis.reset();
+    registerVariables.clear();
+    savedRegisters.clear();
     currentFunctionName.clear();
 }
 
-int CodeGenerator::getLocalVariableOffset(const std::string& name) const {
-    for (auto it = localVarStack.rbegin(); it != localVarStack.rend(); ++it) {
-        auto varIt = it->find(name);
-        if (varIt != it->end()) {
-            return varIt->second.first;
+static const std::vector<std::string> calleeSavedRegisters = {"rbx", "r12", "r13", "r14", "r15"};
+
+// Keeps the most used scalars that never escape in registers, uses inside loops weigh more. Functions
+// that call nothing take caller saved registers first, which need no saving, and keep floating point
+// values in xmm8 - xmm15. Anywhere else those would be lost over a call, System V has no callee saved
+// vector registers, so floating point and vector variables stay in the frame and integers take
+// callee saved registers.
+void CodeGenerator::allocateRegisters(const FunctionNode* function) {
+    std::unordered_map<std::string, long> weights;
+    bool leaf = !containsCall(function->body.get());
+    std::function<void(const ASTNode*, int)> count = [&](const ASTNode* node, int depth) {
+        long weight = 1L << std::min(3 * depth, 30);
+        switch (node->getType()) {
+            case NodeType::Identifier: weights[dynamic_cast<const IdentifierNode*>(node)->name] += weight; break;
+            case NodeType::Assign: weights[dynamic_cast<const AssignNode*>(node)->name] += weight; break;
+            case NodeType::VarDeclAssign: weights[dynamic_cast<const VarDeclAssignNode*>(node)->name] += weight; break;
+            case NodeType::Increment: weights[dynamic_cast<const IncrementNode*>(node)->variable] += 2 * weight; break;
+            case NodeType::Decrement: weights[dynamic_cast<const DecrementNode*>(node)->variable] += 2 * weight; break;
+            case NodeType::Asm: leaf = false; break; // inline assembly binds operands to any register
+            default: break;
         }
+        int childDepth = node->getType() == NodeType::While ? depth + 1 : depth;
+        forEachChild(node, [&](const ASTNode* child) { count(child, childDepth); });
+    };
+    count(function->body.get(), 0);
+    for (const auto& param : function->params) {
+        weights[dynamic_cast<const ParameterNode*>(param.get())->name] += 1;
     }
-    printError("Variable not defined");
-    __builtin_unreachable();
-}
 
-void CodeGenerator::enterScope() {
-    localVarStack.push_back({});
+    std::vector<std::pair<std::string, long>> ranked;
+    for (const auto& [name, weight] : weights) {
+        const VariableInfo* info = functionAnalysis->lookup(name);
+        if (info && !functionAnalysis->isMemoryResident(name) && !info->indexed && !isStructType(info->type) &&
+            !isVectorType(info->type) && (leaf || !isFloatingType(info->type))) {
+            ranked.emplace_back(name, weight);
+        }
+    }
+    std::sort(ranked.begin(), ranked.end(), [](const auto& a, const auto& b) {
+        return a.second != b.second ? a.second > b.second : a.first < b.first;
+    });
+
+    // r8 and r9 only carry arguments, rdi, rsi and r10 also move aggregates. A parameter keeps the
+    // register it arrives in, the others are left alone until the prologue has read them.
+    std::vector<std::string> callerSaved;
+    std::unordered_map<std::string, std::string> arrivals;
+    if (leaf) {
+        std::vector<std::string> pool = {"r8", "r9"};
+        if (!movesAggregates(function)) {
+            pool.insert(pool.end(), {"rdi", "rsi", "r10"});
+        }
+        std::vector<std::string> paramTypes;
+        for (const auto& param : function->params) {
+            paramTypes.push_back(dynamic_cast<const ParameterNode*>(param.get())->type);
+        }
+        int stackBytes;
+        bool hiddenReturn = returnsInMemory(function->returnType);
+        std::vector<ArgumentLocation> locations = planArguments(paramTypes, hiddenReturn, stackBytes);
+        std::set<std::string> arrived;
+        if (hiddenReturn) {
+            arrived.insert("rdi");
+        }
+        for (size_t i = 0; i < locations.size(); ++i) {
+            for (const auto& reg : locations[i].registers) {
+                arrived.insert(reg);
+                if (std::find(pool.begin(), pool.end(), reg) != pool.end()) {
+                    arrivals[dynamic_cast<const ParameterNode*>(function->params[i].get())->name] = reg;
+                }
+            }
+        }
+        std::copy_if(pool.begin(), pool.end(), std::back_inserter(callerSaved), [&](const std::string& reg) { return !arrived.count(reg); });
+    }
+
+    size_t calleeSavedUsed = 0;
+    size_t callerSavedUsed = 0;
+    int vectorUsed = 8;
+    for (const auto& [name, weight] : ranked) {
+        if (isFloatingType(functionAnalysis->lookup(name)->type)) {
+            if (vectorUsed < 16) {
+                registerVariables[name] = "xmm" + std::to_string(vectorUsed++);
+            }
+        } else if (auto it = arrivals.find(name); it != arrivals.end()) {
+            registerVariables[name] = it->second;
+        } else if (callerSavedUsed < callerSaved.size()) {
+            registerVariables[name] = callerSaved[callerSavedUsed++];
+        } else if (calleeSavedUsed < calleeSavedRegisters.size()) {
+            registerVariables[name] = calleeSavedRegisters[calleeSavedUsed++];
+        }
+    }
 }
 
-void CodeGenerator::exitScope() {
-    localVarStack.pop_back();
+// Aggregate copies and the eightbytes of aggregates in registers go through rdi, rsi and r10
+bool CodeGenerator::movesAggregates(const FunctionNode* function) const {
+    for (const auto& param : function->params) {
+        if (isStructType(dynamic_cast<const ParameterNode*>(param.get())->type)) {
+            return true;
+        }
+    }
+    bool moves = false;
+    std::function<void(const ASTNode*)> visit = [&](const ASTNode* node) {
+        std::string name;
+        switch (node->getType()) {
+            case NodeType::Identifier: name = dynamic_cast<const IdentifierNode*>(node)->name; break;
+            case NodeType::Assign: name = dynamic_cast<const AssignNode*>(node)->name; break;
+            case NodeType::VarDecl: name = dynamic_cast<const VarDeclNode*>(node)->name; break;
+            case NodeType::VarDeclAssign: name = dynamic_cast<const VarDeclAssignNode*>(node)->name; break;
+            case NodeType::IndexationAssign: name = dynamic_cast<const IndexationAssignNode*>(node)->name; break;
+            case NodeType::Index: name = dynamic_cast<const IndexNode*>(node)->name; break;
+            case NodeType::Return: {
+                const auto* returnNode = dynamic_cast<const ReturnNode*>(node);
+                const std::string& type = function->returnType;
+                if (returnNode->expression && isStructType(type) && !returnsInMemory(type) && !returnsInRegisters(returnNode->expression.get(), type)) {
+                    moves = true;
+                }
+                break;
+            }
+            default: break;
+        }
+        if (!name.empty()) {
+            const VariableInfo* info = functionAnalysis->lookup(name);
+            auto globalIt = program->globalVariables.find(name);
+            if (info ? isStructType(info->type) : globalIt != program->globalVariables.end() && isStructType(globalIt->second.type)) {
+                moves = true;
+            }
+        }
+        forEachChild(node, visit);
+    };
+    visit(function->body.get());
+    return moves;
 }
 
-void CodeGenerator::addLocalVariable(const std::string& name, const std::string& type) {
-    int size = resolveTypeSize(type);
-    localVarOffset -= size;
-    totalLocalVarOffset += size;
-    localVarStack.back()[name] = std::make_pair(localVarOffset, type);
+std::string CodeGenerator::registerFor(const std::string& name, const std::string& type) const {
+    auto it = registerVariables.find(name);
+    if (it == registerVariables.end() || isStructType(type)) {
+        return "";
+    }
+    return it->second;
 }
 
-std::string CodeGenerator::getVariableType(const std::string& name) const {
+const CodeGenerator::LocalVariable* CodeGenerator::findLocalVariable(const std::string& name) const {
     for (auto it = localVarStack.rbegin(); it != localVarStack.rend(); ++it) {
         auto varIt = it->find(name);
         if (varIt != it->end()) {
-            return varIt->second.second;
+            return &varIt->second;
         }
     }
-    printError("Variable type not found");
-    __builtin_unreachable();
+    return nullptr;
 }
 
-void CodeGenerator::visitProgramNode(const ProgramNode* node) {
-    for (const auto& function : node->functions) {
-        visitFunctionNode(dynamic_cast<const FunctionNode*>(function.get()));
+int CodeGenerator::getLocalVariableOffset(const std::string& name) const {
+    const LocalVariable* variable = findLocalVariable(name);
+    if (!variable) {
+        printError("Variable not defined");
+        __builtin_unreachable();
     }
+    return variable->offset;
 }
 
-void CodeGenerator::visitFunctionNode(const FunctionNode* node) {
-    enterFunction(node);
-    visitBlockNode(dynamic_cast<const BlockNode*>(node->body.get()));
-    exitFunction();
+void CodeGenerator::enterScope() {
+    localVarStack.push_back({});
 }
 
-void CodeGenerator::visitVarDeclNode(const VarDeclNode* node) {
-    addLocalVariable(node->name, node->type);
+void CodeGenerator::exitScope() {
+    localVarStack.pop_back();
 }
 
-void CodeGenerator::visitVarDeclAssignNode(const VarDeclAssignNode* node) {
-    addLocalVariable(node->name, node->type);
-    visitExpressionNode(dynamic_cast<const ExpressionNode*>(node->expression.get()));
-    int offset = getLocalVariableOffset(node->name);
-    emit("mov [rbp" + std::to_string(offset) + "], rax");
+int CodeGenerator::localSlotSize(const std::string& name, const std::string& type, bool byAddr) const {
+    if (byAddr) {
+        return 8;
+    }
+    if (!registerFor(name, type).empty()) {
+        return 0;
+    }
+    int size = resolveTypeSize(type) + slotPadding(type);
+    if (functionAnalysis && functionAnalysis->isPointerBacked(name)) {
+        size += 8; // storage plus the address slot
+    }
+    return size;
 }
 
-void CodeGenerator::visitGlobalVarDeclNode(const GlobalVarDeclNode* node) {
-    std::string resolvedType = resolveTypeName(node->type);
-    int size = resolveTypeSize(resolvedType);
-
-    if (node->initByAddr) {
-        emit("section .bss");
-        emit(node->name + " resb " + std::to_string(size));
-    } else {
-        emit("section .data");
-        switch (size) {
-            case 1: emit(node->name + " db 0"); break;
-            case 2: emit(node->name + " dw 0"); break;
-            case 4: emit(node->name + " dd 0"); break;
-            case 8: emit(node->name + " dq 0"); break;
-        }
+// Moves the locals down by `size` bytes, vectors and aggregates holding them start on a 16 byte
+// boundary so they can be moved with aligned loads and stores, rbp itself is 16 byte aligned
+int CodeGenerator::reserveSlot(int size, const std::string& type) {
+    localVarOffset -= size;
+    if (resolveTypeAlignment(type) == 16) {
+        localVarOffset = -alignTo(-localVarOffset, 16);
     }
+    return localVarOffset;
 }
 
-// Illegal in ent
-// void CodeGenerator::visitGlobalVarDeclAssignNode(const GlobalVarDeclAssignNode* node) {
-// }
+// Bytes the frame needs on top of the size of `type` to align its slot
+int CodeGenerator::slotPadding(const std::string& type) const {
+    return resolveTypeAlignment(type) == 16 ? 16 : 0;
+}
 
-void CodeGenerator::visitAssignNode(const AssignNode* node) {
-    visitExpressionNode(dynamic_cast<const ExpressionNode*>(node->expression.get()));
-    int offset = getLocalVariableOffset(node->name);
-    if (offset < 0) {
-        emit("mov [rbp" + std::to_string(offset) + "], rax");
-    } else {
-        emit("mov [rbp+" + std::to_string(offset) + "], rax");
+void CodeGenerator::addLocalVariable(const std::string& name, const std::string& type, bool byAddr) {
+    if (byAddr) {
+        localVarOffset -= 8;
+        localVarStack.back()[name] = {localVarOffset, type, true, ""};
+        return;
     }
-}
 
-void CodeGenerator::visitExpressionNode(const ExpressionNode* node) {
-    if (node == nullptr) {
+    std::string reg = registerFor(name, type);
+    if (!reg.empty()) {
+        localVarStack.back()[name] = {0, type, false, reg};
         return;
     }
 
-    if (node->left && node->left.value()->getType() == NodeType::Literal) {
-        visitLiteralNode(dynamic_cast<const LiteralNode*>(node->left->get()));
-        emit("push rax");
-    } else if (node->left) {
-        visitExpressionNode(dynamic_cast<const ExpressionNode*>(node->left->get()));
-        emit("push rax");
+    int storage = reserveSlot(resolveTypeSize(type), type);
+    if (!functionAnalysis->isPointerBacked(name)) {
+        localVarStack.back()[name] = {storage, type, false, ""};
+        return;
     }
 
-    if (node->right && node->right.value()->getType() == NodeType::Literal) {
-        visitLiteralNode(dynamic_cast<const LiteralNode*>(node->right->get()));
-    } else if (node->right) {
-        visitExpressionNode(dynamic_cast<const ExpressionNode*>(node->right->get()));
+    // the variable gets re-addressed later on, start out pointing at its own storage
+    localVarOffset -= 8;
+    emit("lea rax, [rbp", storage, "]");
+    emit("mov QWORD PTR [rbp", localVarOffset, "], rax");
+    localVarStack.back()[name] = {localVarOffset, type, true, ""};
+}
+
+std::string CodeGenerator::getVariableType(const std::string& name) const {
+    if (const LocalVariable* variable = findLocalVariable(name)) {
+        return variable->type;
+    }
+    auto globalIt = program->globalVariables.find(name);
+    if (globalIt != program->globalVariables.end()) {
+        return globalIt->second.type;
     }
+    printError("Variable type not found");
+    __builtin_unreachable();
+}
 
-    if (node->left) {
-        emit("pop rbx");
+CodeGenerator::Address CodeGenerator::variableAddress(const std::string& name, const std::string& scratch) {
+    if (const LocalVariable* variable = findLocalVariable(name)) {
+        if (!variable->reg.empty()) {
+            printFatal("Register variable has no address");
+        }
+        if (variable->pointer) {
+            emit("mov ", scratch, ", QWORD PTR [rbp", (variable->offset < 0 ? "" : "+"), variable->offset, "]");
+            return {scratch, "", 1, "", 0};
+        }
+        return {"rbp", "", 1, "", variable->offset};
     }
 
-    if (node->op == "+") {
-        emit("add rax, rbx");
-    } else if (node->op == "-") {
-        if (!node->left && node->right) { // Unary negation case
-            emit("neg rax");
-        } else {
-            emit("sub rax, rbx");
+    auto globalIt = program->globalVariables.find(name);
+    if (globalIt == program->globalVariables.end()) {
+        printError("Variable not defined");
+        __builtin_unreachable();
+    }
+    if (program->externalGlobals.count(name)) {
+        // another unit's global may be out of rip relative reach, its address comes from the GOT
+        emit("mov ", scratch, ", QWORD PTR [rip+", name, "@GOTPCREL]");
+        if (globalIt->second.byAddr) {
+            emit("mov ", scratch, ", QWORD PTR [", scratch, "]");
         }
-    } else if (node->op == "*") {
-        emit("imul rax, rbx");
-    } else if (node->op == "/") {
-        emit("xor rdx, rdx");
-        emit("idiv rbx");
-    } else if (node->op == "==") {
-        emit("cmp rax, rbx");
-        emit("sete al");
-        emit("movzx rax, al");
-    } else if (node->op == "!=") {
-        emit("cmp rax, rbx");
-        emit("setne al");
-        emit("movzx rax, al");
-    } else if (node->op == "<") {
-        emit("cmp rax, rbx");
-        emit("setl al");
-        emit("movzx rax, al");
-    } else if (node->op == "<=") {
-        emit("cmp rax, rbx");
-        emit("setle al");
-        emit("movzx rax, al");
-    } else if (node->op == ">") {
-        emit("cmp rax, rbx");
-        emit("setg al");
-        emit("movzx rax, al");
-    } else if (node->op == ">=") {
-        emit("cmp rax, rbx");
-        emit("setge al");
-        emit("movzx rax, al");
-    } else if (node->op == "&") {
-        emit("and rax, rbx");
-    } else if (node->op == "|") {
-        emit("or rax, rbx");
-    } else if (node->op == "&&") {
-        emit("and rax, rbx");
-    } else if (node->op == "||") {
-        emit("or rax, rbx");
-    } else if (node->op == "!") {
-        emit("cmp rax, 0");
-        emit("sete al");
-        emit("movzx rax, al");
+        return {scratch, "", 1, "", 0};
+    }
+    if (globalIt->second.byAddr) {
+        emit("mov ", scratch, ", QWORD PTR [rip+", name, "]");
+        return {scratch, "", 1, "", 0};
     }
+    return {"rip", "", 1, name, 0};
 }
 
-void CodeGenerator::visitReturnNode(const ReturnNode* node) {
-    if (node->expression) {
-        visitExpressionNode(dynamic_cast<const ExpressionNode*>(node->expression.get()));
+// The index must already be in `indexReg`, `scratch` may be used for the base address.
+CodeGenerator::Address CodeGenerator::indexAddress(const std::string& name, const std::string& indexReg, const std::string& scratch) {
+    int elementSize = resolveTypeSize(getVariableType(name));
+    int scale = elementSize;
+    if (elementSize != 1 && elementSize != 2 && elementSize != 4 && elementSize != 8) {
+        emit("imul ", indexReg, ", ", indexReg, ", ", elementSize);
+        scale = 1;
     }
 
-    if (totalLocalVarOffset > 0) {
-        emit("add rsp, " + std::to_string(totalLocalVarOffset));
-        totalLocalVarOffset = 0;
+    Address address = variableAddress(name, scratch);
+    if (address.base == "rip") {
+        // rip relative operands cannot take an index register
+        emit("lea ", scratch, ", ", address.toString());
+        address = {scratch, "", 1, "", 0};
     }
-
-    emit("jmp .L_return_" + currentFunctionName);
+    address.index = indexReg;
+    address.scale = scale;
+    return address;
 }
 
-void CodeGenerator::visitIfNode(const IfNode* node) {
-    std::string elseLabel = generateUniqueLabel();
-    std::string endLabel = generateUniqueLabel();
-
-    visitExpressionNode(dynamic_cast<const ExpressionNode*>(node->condition.get()));
-    emit("cmp rax, 0");
-    emit("je " + elseLabel);
+CodeGenerator::MemberInfo CodeGenerator::resolveMemberAccess(const StructMemberAccessNode* node) const {
+    MemberInfo info;
+    if (node->base->getType() == NodeType::StructMemberAccess) {
+        info = resolveMemberAccess(dynamic_cast<const StructMemberAccessNode*>(node->base.get()));
+    } else {
+        info.root = dynamic_cast<const IdentifierNode*>(node->base.get())->name;
+        info.offset = 0;
+        info.type = getVariableType(info.root);
+    }
 
-    visitBlockNode(dynamic_cast<const BlockNode*>(node->body.get()));
-    emit("jmp " + endLabel);
+    std::string structType = resolveTypeName(info.type);
+    const auto& structDef = structDefinitions.find(structType);
+    if (structDef == structDefinitions.end()) {
+        printFatal("Struct type not found in definitions");
+        __builtin_unreachable();
+    }
 
-    emit(elseLabel + ":");
-    if (node->else_ && node->else_.get()) {
-        NodeType elseType = node->else_->getType();
-        if (elseType == NodeType::Block) {
-            visitBlockNode(dynamic_cast<const BlockNode*>(node->else_.get()));
-        } else if (elseType == NodeType::If) {
-            visitIfNode(dynamic_cast<const IfNode*>(node->else_.get()));
+    int memberOffset = 0;
+    for (const auto& member : structDef->second) {
+        memberOffset = alignTo(memberOffset, resolveTypeAlignment(member.first));
+        if (member.second == node->memberName) {
+            info.type = member.first;
+            info.offset += memberOffset;
+            return info;
         }
+        memberOffset += resolveTypeSize(member.first);
     }
 
-    emit(endLabel + ":");
+    printFatal("Struct member not found");
+    __builtin_unreachable();
 }
 
-void CodeGenerator::visitWhileNode(const WhileNode* node) {
-    std::string startLabel = generateUniqueLabel();
-    std::string endLabel = generateUniqueLabel();
-
-    loopContextStack.push_back({startLabel, endLabel});
-
-    emit(startLabel + ":");
-    visitExpressionNode(dynamic_cast<const ExpressionNode*>(node->condition.get()));
-    emit("cmp rax, 0");
-    emit("je " + endLabel);
-
-    visitBlockNode(dynamic_cast<const BlockNode*>(node->body.get()));
-    emit("jmp " + startLabel);
-
-    emit(endLabel + ":");
-
-    loopContextStack.pop_back();
+// Calls may precede the definition and functions are generated independently, so every signature
+// and global is known before the first function
+void CodeGenerator::collectSymbols(const ProgramNode* node) {
+    for (const auto& statement : node->functions) {
+        if (const auto* global = dynamic_cast<const GlobalVarDeclNode*>(statement.get())) {
+            program->globalVariables[global->name] = {global->type, false, global->initByAddr};
+        } else if (const auto* global = dynamic_cast<const GlobalVarDeclAssignNode*>(statement.get())) {
+            program->globalVariables[global->name] = {global->type, false, global->initByAddr};
+        } else if (const auto* function = dynamic_cast<const FunctionNode*>(statement.get())) {
+            FunctionSignature& signature = program->functionSignatures[function->name];
+            signature = {function->returnType, {}};
+            for (const auto& param : function->params) {
+                signature.paramTypes.push_back(dynamic_cast<const ParameterNode*>(param.get())->type);
+            }
+        } else if (const auto* header = dynamic_cast<const HeaderNode*>(statement.get())) {
+            for (const auto& prototype : header->prototypes) {
+                if (const auto* function = dynamic_cast<const FunctionPrototypeNode*>(prototype.get())) {
+                    FunctionSignature& signature = program->functionSignatures[function->name];
+                    signature = {function->returnType, {}};
+                    for (const auto& param : function->parameters) {
+                        signature.paramTypes.push_back(dynamic_cast<const ParameterNode*>(param.get())->type);
+                    }
+                } else if (const auto* global = dynamic_cast<const GlobalVarDeclNode*>(prototype.get())) {
+                    // globals declared in a header live in another unit, we only need their types
+                    program->globalVariables[global->name] = {global->type, false, global->initByAddr};
+                    program->externalGlobals.insert(global->name);
+                }
+            }
+        }
+    }
 }
 
-void CodeGenerator::visitBlockNode(const BlockNode* node) {
-    if (!node) {
-        std::cout << getGeneratedCode();
-        printFatal("BlockNode cannot be null");
+// Every literal of the unit gets its place before the functions are generated on several threads.
+// Equal strings share one copy and a string that ends another points into it, "lo" into "hello".
+// The rest go to a mergeable section, the linker folds them with equal ones of other units.
+void CodeGenerator::collectStringLiterals(const ProgramNode* node) {
+    std::set<std::string> literals;
+    std::function<void(const ASTNode*)> collect = [&](const ASTNode* child) {
+        if (const auto* literal = dynamic_cast<const StringLiteralNode*>(child)) {
+            literals.insert(decodeStringLiteral(literal->value));
+        }
+        forEachChild(child, collect);
+    };
+    collect(node);
+
+    // sorted by their reversed bytes a string is followed by the strings it is a suffix of
+    std::vector<std::string> reversed;
+    for (const auto& bytes : literals) {
+        reversed.emplace_back(bytes.rbegin(), bytes.rend());
     }
-    int localVarSize = calculateLocalVariableSize(node);
-
-    if (localVarSize % 16 != 0) {
-        localVarSize += 16 - (localVarSize % 16);
+    std::sort(reversed.begin(), reversed.end());
+
+    std::string container;
+    std::string label;
+    for (size_t i = reversed.size(); i-- > 0;) {
+        const std::string& current = reversed[i];
+        std::string bytes(current.rbegin(), current.rend());
+        if (label.empty() || !container.starts_with(current)) {
+            label = ".LS" + std::to_string(program->stringPool.size());
+            container = current;
+            program->stringPool.emplace_back(label, bytes);
+        }
+        size_t offset = container.size() - current.size();
+        program->stringAddresses[bytes] = offset ? label + "+" + std::to_string(offset) : label;
     }
+}
 
-    enterScope();
-    if (localVarSize > 0) {
-        emit("sub rsp, " + std::to_string(localVarSize));
-        totalLocalVarOffset += localVarSize;
+void CodeGenerator::emitStringPool() {
+    auto quoted = [](const std::string& bytes) {
+        std::string text;
+        for (unsigned char c : bytes) {
+            if (c >= 0x20 && c < 0x7f && c != '"' && c != '\\') {
+                text += static_cast<char>(c);
+            } else {
+                char escape[5];
+                std::snprintf(escape, sizeof(escape), "\\%03o", c);
+                text += escape;
+            }
+        }
+        return text;
+    };
+    // a terminator inside would split the string in a section of strings, those go to plain .rodata
+    for (bool terminated : {true, false}) {
+        bool started = false;
+        for (const auto& [label, bytes] : program->stringPool) {
+            if ((bytes.find('\0') == std::string::npos) != terminated) {
+                continue;
+            }
+            if (!started) {
+                emit(terminated ? ".section .rodata.str1.1,\"aMS\",@progbits,1" : ".section .rodata");
+                started = true;
+            }
+            emit(label, ": .string \"", quoted(bytes), "\"");
+        }
     }
+}
 
-    if (node->statements.empty()) {
-        return;
+// Compiles one function with a generator of its own, it only reads what the program shares
+OutputBuffer CodeGenerator::generateFunction(const FunctionNode* node, FunctionStackUsage& usage) const {
+    CodeGenerator generator(*this, node->name);
+    generator.visitFunctionNode(node);
+    generator.emitFloatConstants();
+    usage = std::move(generator.stackUsage.back());
+    return std::move(generator.generatedCode);
+}
+
+void CodeGenerator::visitProgramNode(const ProgramNode* node) {
+    collectSymbols(node);
+    collectStringLiterals(node);
+
+    // functions are spread over the threads, the pieces are joined in source order so the output
+    // is the same however many there are
+    std::vector<const FunctionNode*> functions;
+    for (const auto& statement : node->functions) {
+        if (const auto* function = dynamic_cast<const FunctionNode*>(statement.get())) {
+            functions.push_back(function);
+        }
     }
-    for (const auto& statement : node->statements) {
+    std::vector<OutputBuffer> pieces(functions.size());
+    stackUsage.resize(functions.size());
+    std::atomic<size_t> next = 0;
+    auto work = [&]() {
+        for (size_t i = next++; i < functions.size(); i = next++) {
+            pieces[i] = generateFunction(functions[i], stackUsage[i]);
+        }
+    };
+    size_t threads = std::min<size_t>(jobs, functions.size());
+    if (threads <= 1) {
+        work();
+    } else {
+        std::vector<std::jthread> workers;
+        for (size_t i = 0; i < threads; ++i) {
+            workers.emplace_back(work);
+        }
+    }
+
+    size_t piece = 0;
+    for (const auto& statement : node->functions) {
         switch (statement->getType()) {
-            case NodeType::VarDecl:
-                visitVarDeclNode(dynamic_cast<const VarDeclNode*>(statement.get()));
+            case NodeType::Function:
+                generatedCode.splice(std::move(pieces[piece]));
+                piece++;
                 break;
-            case NodeType::VarDeclAssign:
-                visitVarDeclAssignNode(dynamic_cast<const VarDeclAssignNode*>(statement.get()));
+            case NodeType::GlobalVarDecl:
+                visitGlobalVarDeclNode(dynamic_cast<const GlobalVarDeclNode*>(statement.get()));
+                break;
+            case NodeType::GlobalVarDeclAssign:
+                visitGlobalVarDeclAssignNode(dynamic_cast<const GlobalVarDeclAssignNode*>(statement.get()));
+                break;
+            case NodeType::Typedef:
+                visitTypedefNode(dynamic_cast<const TypedefNode*>(statement.get()));
+                break;
+            case NodeType::Header:
+                break;
+            default:
+                std::cout << std::endl << "Offender: " << toString(statement->getType()) << std::endl;
+                printFatal("Unhandled node type in ProgramNode");
+                break;
+        }
+    }
+    emitStringPool();
+}
+
+void CodeGenerator::visitFunctionNode(const FunctionNode* node) {
+    enterFunction(node);
+    visitBlockNode(dynamic_cast<const BlockNode*>(node->body.get()));
+    exitFunction();
+}
+
+void CodeGenerator::visitVarDeclNode(const VarDeclNode* node) {
+    addLocalVariable(node->name, node->type, node->initByAddr);
+}
+
+void CodeGenerator::visitVarDeclAssignNode(const VarDeclAssignNode* node) {
+    addLocalVariable(node->name, node->type, node->initByAddr);
+    if (node->initByAddr) {
+        // `type [name] = expr` initialises the address
+        visitOperand(node->expression.get());
+        emit("mov QWORD PTR [rbp", getLocalVariableOffset(node->name), "], rax");
+        return;
+    }
+    visitOperandAs(node->expression.get(), node->type);
+    if (const LocalVariable* variable = findLocalVariable(node->name); !variable->reg.empty()) {
+        emitRegisterStore(variable->reg, "rax", node->type);
+        return;
+    }
+    emitStore(variableAddress(node->name, "rcx"), node->type);
+}
+
+void CodeGenerator::visitGlobalVarDeclNode(const GlobalVarDeclNode* node) {
+    std::string resolvedType = resolveTypeName(node->type);
+    StaticData data;
+    padStaticData(data, node->initByAddr ? 8 : resolveTypeSize(resolvedType));
+    emitStaticData(node->name, node->initByAddr ? 8 : resolveTypeAlignment(resolvedType), data, ".bss");
+}
+
+// Initialisers are evaluated here and emitted as data, nothing runs before main to set globals up.
+// Zero data goes to .bss, `const` data to .rodata, or to .data.rel.ro when it holds addresses the
+// loader has to relocate.
+void CodeGenerator::visitGlobalVarDeclAssignNode(const GlobalVarDeclAssignNode* node) {
+    std::string resolvedType = resolveTypeName(node->type);
+    auto section = [&](const StaticData& data) -> std::string {
+        if (node->readOnly) {
+            return data.relocated ? ".section .data.rel.ro,\"aw\"" : ".section .rodata";
+        }
+        return data.zero ? ".bss" : ".data";
+    };
+
+    if (!node->initByAddr) {
+        StaticData data;
+        collectStaticData(node->expression.get(), node->type, data, node->name);
+        emitStaticData(node->name, resolveTypeAlignment(resolvedType), data, section(data));
+        // initialisers further down may use the value
+        if (node->readOnly && !data.relocated && !isStructType(resolvedType) && !isVectorType(resolvedType)) {
+            staticConstants[node->name] = staticScalar(node->expression.get(), node->type, node->name);
+        }
+        return;
+    }
+
+    // `type [name] = {...}` points at elements of its own, `type [name] = "..."` at existing data
+    StaticData pointer;
+    if (const auto* list = dynamic_cast<const InitializerListNode*>(node->expression.get())) {
+        StaticData elements;
+        for (const auto& element : list->elements) {
+            collectStaticData(element.get(), node->type, elements, node->name);
+        }
+        std::string label = ".L" + node->name + ".elements";
+        emitStaticData(label, resolveTypeAlignment(resolvedType), elements, section(elements));
+        appendStaticData(pointer, ".quad", label, 8, false);
+    } else if (std::optional<std::string> address = staticAddress(node->expression.get())) {
+        appendStaticData(pointer, ".quad", *address, 8, false);
+    } else {
+        printFatal(("The initialiser of global " + node->name + " is not a constant address").c_str());
+    }
+    pointer.relocated = true;
+    emitStaticData(node->name, 8, pointer, section(pointer));
+}
+
+// Appends the bytes of `node` as a value of `type`. Lists give the members of a struct or the lanes
+// of a vector in order, the ones left out are zero. A scalar for a vector fills every lane.
+void CodeGenerator::collectStaticData(const ASTNode* node, const std::string& type, StaticData& data, const std::string& global) const {
+    std::string resolvedType = resolveTypeName(type);
+    auto fail = [&](const std::string& problem) {
+        printFatal(("The initialiser of global " + global + " " + problem).c_str());
+    };
+    int start = data.size;
+    auto members = structDefinitions.find(resolvedType);
+    std::string element = vectorElementType(resolvedType);
+
+    if (const auto* list = dynamic_cast<const InitializerListNode*>(node)) {
+        if (members != structDefinitions.end()) {
+            if (list->elements.size() > members->second.size()) {
+                fail("has more values than " + type + " has members");
+            }
+            int offset = 0;
+            for (size_t i = 0; i < list->elements.size(); ++i) {
+                const std::string& memberType = members->second[i].first;
+                offset = alignTo(offset, resolveTypeAlignment(memberType));
+                padStaticData(data, start + offset);
+                collectStaticData(list->elements[i].get(), memberType, data, global);
+                offset += resolveTypeSize(memberType);
+            }
+        } else if (!element.empty()) {
+            if (list->elements.size() > static_cast<size_t>(16 / resolveTypeSize(element))) {
+                fail("has more values than " + type + " has lanes");
+            }
+            for (const auto& lane : list->elements) {
+                collectStaticData(lane.get(), element, data, global);
+            }
+        } else {
+            fail("gives a list for the scalar type " + type);
+        }
+        padStaticData(data, start + resolveTypeSize(resolvedType));
+        return;
+    }
+
+    if (members != structDefinitions.end()) {
+        fail("needs a list of values for the members of " + type);
+    }
+    if (!element.empty()) {
+        for (int lane = 0; lane < 16 / resolveTypeSize(element); ++lane) {
+            collectStaticData(node, element, data, global);
+        }
+        return;
+    }
+
+    int size = resolveTypeSize(resolvedType);
+    if (std::optional<std::string> address = staticAddress(node)) {
+        if (size != 8) {
+            fail("stores an address in the " + std::to_string(size) + " byte type " + type);
+        }
+        appendStaticData(data, ".quad", *address, 8, false);
+        data.relocated = true;
+        return;
+    }
+
+    Constant value = staticScalar(node, type, global);
+    char text[32];
+    if (value.floating) {
+        // the shortest text that reads back as the same value
+        bool single = size == 4;
+        char* end = single ? std::to_chars(text, text + sizeof(text), static_cast<float>(value.real)).ptr
+                           : std::to_chars(text, text + sizeof(text), value.real).ptr;
+        bool zero = single ? std::bit_cast<uint32_t>(static_cast<float>(value.real)) == 0 : std::bit_cast<uint64_t>(value.real) == 0;
+        if (!std::isfinite(value.real)) {
+            end = single ? std::to_chars(text, text + sizeof(text), std::bit_cast<uint32_t>(static_cast<float>(value.real))).ptr
+                         : std::to_chars(text, text + sizeof(text), std::bit_cast<uint64_t>(value.real)).ptr;
+            appendStaticData(data, single ? ".long" : ".quad", std::string(text, end), size, zero);
+            return;
+        }
+        appendStaticData(data, single ? ".float" : ".double", std::string(text, end), size, zero);
+        return;
+    }
+    switch (size) {
+        case 1: appendStaticData(data, ".byte", std::to_string(value.integer), 1, value.integer == 0); break;
+        case 2: appendStaticData(data, ".word", std::to_string(value.integer), 2, value.integer == 0); break;
+        case 4: appendStaticData(data, ".long", std::to_string(value.integer), 4, value.integer == 0); break;
+        default: appendStaticData(data, ".quad", std::to_string(value.integer), 8, value.integer == 0); break;
+    }
+}
+
+// Value of a scalar initialiser converted to `type`, integers wrap to its width like a store would and
+// a value that does not survive the wrap is warned about
+Constant CodeGenerator::staticScalar(const ASTNode* node, const std::string& type, const std::string& global) const {
+    std::optional<Constant> value = foldConstant(node, staticConstants);
+    if (!value) {
+        printFatal(("The initialiser of global " + global + " is not a constant").c_str());
+    }
+    std::string resolvedType = resolveTypeName(type);
+    Constant converted;
+    if (isFloatingType(resolvedType)) {
+        converted.floating = true;
+        converted.single = resolvedType == "float";
+        converted.real = converted.single ? static_cast<float>(value->asReal()) : value->asReal();
+        return converted;
+    }
+    int bits = 8 * resolveTypeSize(resolvedType);
+    uint64_t raw = static_cast<uint64_t>(value->asInteger());
+    if (bits < 64) {
+        raw &= (uint64_t(1) << bits) - 1;
+        if (!isUnsignedType(resolvedType) && (raw >> (bits - 1)) & 1) {
+            raw |= ~uint64_t(0) << bits;
+        }
+    }
+    converted.integer = static_cast<int64_t>(raw);
+    if (converted.integer != value->asInteger()) {
+        printWarning(("The initialiser of global " + global + " is " + std::to_string(value->asInteger()) + ", out of range for " +
+                      type + ", stored as " + std::to_string(converted.integer)).c_str());
+    }
+    return converted;
+}
+
+// Symbol an initialiser points at: a string literal in the pool or a global that is not itself a pointer
+std::optional<std::string> CodeGenerator::staticAddress(const ASTNode* node) const {
+    if (const auto* literal = dynamic_cast<const StringLiteralNode*>(node)) {
+        return program->stringAddresses.at(decodeStringLiteral(literal->value));
+    }
+    if (const auto* address = dynamic_cast<const MemoryAddressNode*>(node)) {
+        auto it = program->globalVariables.find(address->name);
+        if (it != program->globalVariables.end() && !it->second.byAddr) {
+            return address->name;
+        }
+    }
+    return std::nullopt;
+}
+
+// runs of the same directive share a line, a few values each
+void CodeGenerator::appendStaticData(StaticData& data, const std::string& directive, const std::string& operand, int bytes, bool zero) const {
+    if (!data.directives.empty() && data.directives.back().first == directive && directive != ".zero" &&
+        std::count(data.directives.back().second.begin(), data.directives.back().second.end(), ',') < 7) {
+        data.directives.back().second += ", " + operand;
+    } else {
+        data.directives.emplace_back(directive, operand);
+    }
+    data.size += bytes;
+    data.zero = data.zero && zero;
+}
+
+void CodeGenerator::padStaticData(StaticData& data, int size) const {
+    if (size <= data.size) {
+        return;
+    }
+    if (!data.directives.empty() && data.directives.back().first == ".zero") {
+        data.directives.back().second = std::to_string(std::stoi(data.directives.back().second) + size - data.size);
+    } else {
+        data.directives.emplace_back(".zero", std::to_string(size - data.size));
+    }
+    data.size = size;
+}
+
+void CodeGenerator::emitStaticData(const std::string& label, int alignment, const StaticData& data, const std::string& section) {
+    emit(section);
+    if (alignment > 1) {
+        emit(".balign ", alignment);
+    }
+    if (section == ".bss") {
+        // an empty list still gets its label, `.zero 0` would only draw a warning
+        if (data.size == 0) {
+            emit(label, ":");
+        } else {
+            emit(label, ": .zero ", data.size);
+        }
+        return;
+    }
+    if (data.directives.size() == 1) {
+        emit(label, ": ", data.directives[0].first, " ", data.directives[0].second);
+        return;
+    }
+    emit(label, ":");
+    for (const auto& [directive, operands] : data.directives) {
+        emit(directive, " ", operands);
+    }
+}
+
+void CodeGenerator::visitAssignNode(const AssignNode* node) {
+    std::string type = getVariableType(node->name);
+    visitOperandAs(node->expression.get(), type);
+    if (const LocalVariable* variable = findLocalVariable(node->name); variable && !variable->reg.empty()) {
+        emitRegisterStore(variable->reg, "rax", variable->type);
+        return;
+    }
+    emitStore(variableAddress(node->name, "rcx"), type);
+}
+
+void CodeGenerator::visitIndexationAssignNode(const IndexationAssignNode* node) {
+    std::string type = getVariableType(node->name);
+    visitOperandAs(node->expression.get(), type);
+    emitPushValue(type);
+    visitOperandAs(node->index.get(), "int64");
+    emit("mov rdx, rax");
+    emitPopValue(type);
+    emitStore(indexAddress(node->name, "rdx", "rcx"), type);
+}
+
+void CodeGenerator::visitMemoryAssignNode(const MemoryAssignNode* node) {
+    visitOperand(node->expression.get());
+    if (const LocalVariable* variable = findLocalVariable(node->name)) {
+        emit("mov QWORD PTR [rbp", (variable->offset < 0 ? "" : "+"), variable->offset, "], rax");
+        return;
+    }
+    auto globalIt = program->globalVariables.find(node->name);
+    if (globalIt == program->globalVariables.end() || !globalIt->second.byAddr) {
+        printError("Cannot change the address of a global variable that is not address initialised");
+    }
+    if (program->externalGlobals.count(node->name)) {
+        emit("mov rcx, QWORD PTR [rip+", node->name, "@GOTPCREL]");
+        emit("mov QWORD PTR [rcx], rax");
+        return;
+    }
+    emit("mov QWORD PTR [rip+", node->name, "], rax");
+}
+
+void CodeGenerator::visitStructMemberAssignNode(const StructMemberAssignNode* node) {
+    MemberInfo member = resolveMemberAccess(dynamic_cast<const StructMemberAccessNode*>(node->memberAccess.get()));
+    visitOperandAs(node->value.get(), member.type);
+    Address address = variableAddress(member.root, "rcx");
+    address.displacement += member.offset;
+    emitStore(address, member.type);
+}
+
+void CodeGenerator::visitIncrementNode(const IncrementNode* node) {
+    std::string type = getVariableType(node->variable);
+    if (isVectorType(type)) {
+        printFatal("Increment is not defined for vectors");
+    }
+    const LocalVariable* variable = findLocalVariable(node->variable);
+    if (variable && !variable->reg.empty() && isFloatingType(type)) {
+        emit("add", precision(resolveTypeName(type)), " ", variable->reg, ", ", floatConstant("1", type));
+        return;
+    }
+    if (isFloatingType(type)) {
+        Address address = variableAddress(node->variable, "rcx");
+        emitLoad(address, type);
+        emit("add", precision(resolveTypeName(type)), " xmm0, ", floatConstant("1", type));
+        emitStore(address, type);
+        return;
+    }
+    if (variable && !variable->reg.empty()) {
+        emit("add ", variable->reg, ", 1");
+        emitRegisterStore(variable->reg, variable->reg, type);
+        return;
+    }
+    emit("add ", sizeSpecifier(type), " ", variableAddress(node->variable, "rcx").toString(), ", 1");
+}
+
+void CodeGenerator::visitDecrementNode(const DecrementNode* node) {
+    std::string type = getVariableType(node->variable);
+    if (isVectorType(type)) {
+        printFatal("Decrement is not defined for vectors");
+    }
+    const LocalVariable* variable = findLocalVariable(node->variable);
+    if (variable && !variable->reg.empty() && isFloatingType(type)) {
+        emit("sub", precision(resolveTypeName(type)), " ", variable->reg, ", ", floatConstant("1", type));
+        return;
+    }
+    if (isFloatingType(type)) {
+        Address address = variableAddress(node->variable, "rcx");
+        emitLoad(address, type);
+        emit("sub", precision(resolveTypeName(type)), " xmm0, ", floatConstant("1", type));
+        emitStore(address, type);
+        return;
+    }
+    if (variable && !variable->reg.empty()) {
+        emit("sub ", variable->reg, ", 1");
+        emitRegisterStore(variable->reg, variable->reg, type);
+        return;
+    }
+    emit("sub ", sizeSpecifier(type), " ", variableAddress(node->variable, "rcx").toString(), ", 1");
+}
+
+// Evaluates any value producing node, floating point and vector values into xmm0 and everything else into rax
+void CodeGenerator::visitOperand(const ASTNode* node) {
+    if (!node) {
+        return;
+    }
+    switch (node->getType()) {
+        case NodeType::Expression:
+            visitExpressionNode(dynamic_cast<const ExpressionNode*>(node));
+            break;
+        case NodeType::Literal:
+            visitLiteralNode(dynamic_cast<const LiteralNode*>(node));
+            break;
+        case NodeType::Identifier:
+            visitIdentifierNode(dynamic_cast<const IdentifierNode*>(node));
+            break;
+        case NodeType::Index:
+            visitIndexNode(dynamic_cast<const IndexNode*>(node));
+            break;
+        case NodeType::MemoryAddress:
+            visitMemoryAddressNode(dynamic_cast<const MemoryAddressNode*>(node));
+            break;
+        case NodeType::StructMemberAccess:
+            visitStructMemberAccessNode(dynamic_cast<const StructMemberAccessNode*>(node));
+            break;
+        case NodeType::FunctionCall:
+            visitFunctionCallNode(dynamic_cast<const FunctionCallNode*>(node));
+            break;
+        case NodeType::StringLiteral: {
+            // the bytes sit in the pool, nothing is copied
+            const std::string& value = dynamic_cast<const StringLiteralNode*>(node)->value;
+            emit("lea rax, [rip+", program->stringAddresses.at(decodeStringLiteral(value)), "]");
+            break;
+        }
+        default:
+            std::cout << std::endl << "Offender: " << toString(node->getType()) << std::endl;
+            printFatal("Unhandled node type in expression");
+            break;
+    }
+}
+
+// Evaluates `node` converted to `type`
+void CodeGenerator::visitOperandAs(const ASTNode* node, const std::string& type) {
+    if (node->getType() == NodeType::Literal && isFloatingType(type)) {
+        // constants are pooled in the precision they are used at, no conversion at run time
+        std::string value = dynamic_cast<const LiteralNode*>(node)->value;
+        if (value.back() == 'f') {
+            value.pop_back();
+        }
+        emit("mov", precision(resolveTypeName(type)), " xmm0, ", floatConstant(value, type));
+        return;
+    }
+    if (node->getType() == NodeType::Literal && isVectorType(type) && dynamic_cast<const LiteralNode*>(node)->value == "0") {
+        emit("pxor xmm0, xmm0");
+        return;
+    }
+    visitOperand(node);
+    emitConvert(operandType(node), type);
+}
+
+// Evaluates a condition into rax, floating point values are true unless they compare equal to zero
+void CodeGenerator::visitCondition(const ASTNode* node) {
+    visitOperand(node);
+    std::string type = operandType(node);
+    if (isVectorType(type)) {
+        printFatal("A vector cannot be used as a condition, reduce it with __builtin_movemask");
+    }
+    if (!isFloatingType(type)) {
+        return;
+    }
+    emit("xorps xmm1, xmm1");
+    emit("ucomi", precision(resolveTypeName(type)), " xmm0, xmm1");
+    emit("setne al");
+    emit("setp cl"); // NaN is true as well
+    emit("or al, cl");
+    emit("movzx rax, al");
+}
+
+void CodeGenerator::visitExpressionNode(const ExpressionNode* node) {
+    if (node == nullptr) {
+        return;
+    }
+
+    bool binary = node->left && *node->left;
+    std::string type = operandType(node);
+    bool logical = node->op == "&&" || node->op == "||" || node->op == "!";
+    if (isVectorType(type)) {
+        visitVectorExpressionNode(node, type);
+        return;
+    }
+    if (isFloatingType(type) || (binary && !logical &&
+        (isFloatingType(operandType(node->left->get())) || isFloatingType(operandType(node->right->get()))))) {
+        visitFloatExpressionNode(node, type);
+        return;
+    }
+
+    // logical operators only care whether their operands are zero
+    auto evaluate = [&](const ASTNode* operand) {
+        if (logical) {
+            visitCondition(operand);
+        } else {
+            visitOperandAs(operand, "int64");
+        }
+    };
+    if (binary) {
+        evaluate(node->left->get());
+        emitPush("rax");
+    }
+
+    if (node->right && *node->right) {
+        evaluate(node->right->get());
+    }
+
+    // left operand in rax, right operand in rcx
+    if (binary) {
+        emit("mov rcx, rax");
+        emitPop("rax");
+    }
+
+    if (node->op == "+") {
+        emit("add rax, rcx");
+    } else if (node->op == "-") {
+        if (!binary) { // Unary negation case
+            emit("neg rax");
+        } else {
+            emit("sub rax, rcx");
+        }
+    } else if (node->op == "*") {
+        emit("imul rax, rcx");
+    } else if (node->op == "/") {
+        emit("cqo");
+        emit("idiv rcx");
+    } else if (node->op == "==") {
+        emit("cmp rax, rcx");
+        emit("sete al");
+        emit("movzx rax, al");
+    } else if (node->op == "!=") {
+        emit("cmp rax, rcx");
+        emit("setne al");
+        emit("movzx rax, al");
+    } else if (node->op == "<") {
+        emit("cmp rax, rcx");
+        emit("setl al");
+        emit("movzx rax, al");
+    } else if (node->op == "<=") {
+        emit("cmp rax, rcx");
+        emit("setle al");
+        emit("movzx rax, al");
+    } else if (node->op == ">") {
+        emit("cmp rax, rcx");
+        emit("setg al");
+        emit("movzx rax, al");
+    } else if (node->op == ">=") {
+        emit("cmp rax, rcx");
+        emit("setge al");
+        emit("movzx rax, al");
+    } else if (node->op == "&") {
+        emit("and rax, rcx");
+    } else if (node->op == "|") {
+        emit("or rax, rcx");
+    } else if (node->op == "&&") {
+        emit("test rax, rax");
+        emit("setne al");
+        emit("test rcx, rcx");
+        emit("setne cl");
+        emit("and al, cl");
+        emit("movzx rax, al");
+    } else if (node->op == "||") {
+        emit("or rax, rcx");
+        emit("setne al");
+        emit("movzx rax, al");
+    } else if (node->op == "!") {
+        emit("cmp rax, 0");
+        emit("sete al");
+        emit("movzx rax, al");
+    }
+}
+
+// Arithmetic in xmm0, comparisons of floating point operands produce an integer in rax
+void CodeGenerator::visitFloatExpressionNode(const ExpressionNode* node, const std::string& type) {
+    bool binary = node->left && *node->left;
+    if (!binary) {
+        // only negation yields a floating point value, flip the sign bit
+        visitOperandAs(node->right->get(), type);
+        emit("movq rax, xmm0");
+        emit(resolveTypeName(type) == "float" ? "btc rax, 31" : "btc rax, 63");
+        emit("movq xmm0, rax");
+        return;
+    }
+
+    // comparisons happen in the wider of the operand types
+    std::string operationType = type;
+    if (!isFloatingType(operationType)) {
+        std::string left = resolveTypeName(operandType(node->left->get()));
+        std::string right = resolveTypeName(operandType(node->right->get()));
+        operationType = left == "double" || right == "double" ? "double" : "float";
+    }
+    std::string suffix = precision(resolveTypeName(operationType));
+
+    // left operand in xmm0, right operand in xmm1
+    visitOperandAs(node->left->get(), operationType);
+    emitPushValue(operationType);
+    visitOperandAs(node->right->get(), operationType);
+    emit("movaps xmm1, xmm0");
+    emitPopValue(operationType);
+
+    if (node->op == "+") {
+        emit("add", suffix, " xmm0, xmm1");
+    } else if (node->op == "-") {
+        emit("sub", suffix, " xmm0, xmm1");
+    } else if (node->op == "*") {
+        emit("mul", suffix, " xmm0, xmm1");
+    } else if (node->op == "/") {
+        emit("div", suffix, " xmm0, xmm1");
+    } else {
+        // unordered operands set ZF, PF and CF, so `above` style conditions are false for NaN
+        std::string compare = "ucomi" + suffix;
+        if (node->op == "==") {
+            emit(compare, " xmm0, xmm1");
+            emit("sete al");
+            emit("setnp cl");
+            emit("and al, cl");
+        } else if (node->op == "!=") {
+            emit(compare, " xmm0, xmm1");
+            emit("setne al");
+            emit("setp cl");
+            emit("or al, cl");
+        } else if (node->op == ">") {
+            emit(compare, " xmm0, xmm1");
+            emit("seta al");
+        } else if (node->op == ">=") {
+            emit(compare, " xmm0, xmm1");
+            emit("setae al");
+        } else if (node->op == "<") {
+            emit(compare, " xmm1, xmm0");
+            emit("seta al");
+        } else if (node->op == "<=") {
+            emit(compare, " xmm1, xmm0");
+            emit("setae al");
+        } else {
+            printFatal("Operator not supported on floating point operands");
+        }
+        emit("movzx rax, al");
+    }
+}
+
+// Lane by lane arithmetic in xmm0, scalar operands are broadcast to every lane first. Comparisons
+// produce a mask with all bits of a lane set where it holds, floatx4 ones an int32x4 mask.
+void CodeGenerator::visitVectorExpressionNode(const ExpressionNode* node, const std::string& type) {
+    bool binary = node->left && *node->left;
+    std::string operationType = type;
+    if (binary && isVectorType(operandType(node->left->get()))) {
+        operationType = operandType(node->left->get());
+    } else if (isVectorType(operandType(node->right->get()))) {
+        operationType = operandType(node->right->get());
+    }
+    std::string element = vectorElementType(resolveTypeName(operationType));
+    bool single = element == "float";
+    std::string suffix = element == "uint8" ? "b" : element == "int32" ? "d" : "q";
+
+    if (!binary) {
+        if (node->op != "-") {
+            printFatal("Operator not supported on vector operands");
+        }
+        visitOperandAs(node->right->get(), operationType);
+        if (single) {
+            emit("pcmpeqd xmm1, xmm1");
+            emit("pslld xmm1, 31");
+            emit("xorps xmm0, xmm1");
+        } else {
+            emit("movdqa xmm1, xmm0");
+            emit("pxor xmm0, xmm0");
+            emit("psub", suffix, " xmm0, xmm1");
+        }
+        return;
+    }
+
+    // left operand in xmm0, right operand in xmm1
+    visitOperandAs(node->left->get(), operationType);
+    emitPushValue(operationType);
+    visitOperandAs(node->right->get(), operationType);
+    emit("movdqa xmm1, xmm0");
+    emitPopValue(operationType);
+
+    const std::string& op = node->op;
+    if (op == "+") {
+        emit(single ? "addps xmm0, xmm1" : "padd" + suffix + " xmm0, xmm1");
+    } else if (op == "-") {
+        emit(single ? "subps xmm0, xmm1" : "psub" + suffix + " xmm0, xmm1");
+    } else if (op == "*") {
+        if (single) {
+            emit("mulps xmm0, xmm1");
+        } else {
+            emitVectorMultiply(element);
+        }
+    } else if (op == "/") {
+        if (!single) {
+            printFatal("Integer vectors cannot be divided");
+        }
+        emit("divps xmm0, xmm1");
+    } else if (op == "&") {
+        emit("pand xmm0, xmm1");
+    } else if (op == "|") {
+        emit("por xmm0, xmm1");
+    } else if (single) {
+        // cmpps only knows equal, less and their negations, greater swaps the operands
+        static const std::unordered_map<std::string, std::string> predicates = {
+            {"==", "cmpeqps"}, {"!=", "cmpneqps"}, {"<", "cmpltps"}, {"<=", "cmpleps"}, {">", "cmpltps"}, {">=", "cmpleps"},
+        };
+        auto it = predicates.find(op);
+        if (it == predicates.end()) {
+            printFatal("Operator not supported on vector operands");
+        }
+        if (op == ">" || op == ">=") {
+            emit("movaps xmm2, xmm0");
+            emit("movaps xmm0, xmm1");
+            emit(it->second, " xmm0, xmm2");
+        } else {
+            emit(it->second, " xmm0, xmm1");
+        }
+    } else {
+        // integers only compare equal or greater, the rest swaps the operands or inverts the mask
+        if (op == "<" || op == ">=") {
+            emit("movdqa xmm2, xmm0");
+            emit("movdqa xmm0, xmm1");
+            emit("movdqa xmm1, xmm2");
+        }
+        if (op == "==" || op == "!=") {
+            emitVectorEqual(element);
+        } else if (op == "<" || op == "<=" || op == ">" || op == ">=") {
+            emitVectorGreater(element);
+        } else {
+            printFatal("Operator not supported on vector operands");
+        }
+        if (op == "!=" || op == "<=" || op == ">=") {
+            emit("pcmpeqd xmm1, xmm1");
+            emit("pxor xmm0, xmm1");
+        }
+    }
+}
+
+void CodeGenerator::visitReturnNode(const ReturnNode* node) {
+    // scalar replacement hands back the struct as a list of its members
+    bool built = node->expression && node->expression->getType() == NodeType::InitializerList;
+    if (built && returnsInMemory(currentReturnType)) {
+        // the members go straight into the buffer of the caller
+        std::vector<std::tuple<int, std::string, const ASTNode*>> elements;
+        collectAggregateElements(node->expression.get(), currentReturnType, 0, elements);
+        for (const auto& [offset, elementType, element] : elements) {
+            visitOperandAs(element ? element : zeroLiteral(), elementType);
+            emit("mov rcx, QWORD PTR [rbp", hiddenReturnOffset, "]");
+            emitStore({"rcx", "", 1, "", offset}, elementType);
+        }
+        emit("mov rax, QWORD PTR [rbp", hiddenReturnOffset, "]");
+        emit("jmp .L_return_", currentFunctionName);
+        return;
+    }
+    if (built && returnsInRegisters(node->expression.get(), currentReturnType)) {
+        emitRegisterReturn(node->expression.get(), currentReturnType);
+        emit("jmp .L_return_", currentFunctionName);
+        return;
+    }
+    if (built) {
+        emitPushAggregate(node->expression.get(), currentReturnType);
+        emit("mov rax, rsp");
+    } else if (node->expression && isStructType(currentReturnType)) {
+        visitOperand(node->expression.get());
+    } else if (node->expression) {
+        visitOperandAs(node->expression.get(), currentReturnType);
+        emitExtendResult(currentReturnType);
+    }
+
+    if (node->expression && isStructType(currentReturnType)) {
+        // rax holds the address of the aggregate we return
+        int size = resolveTypeSize(currentReturnType);
+        std::vector<ArgumentClass> classes = classifyAggregate(currentReturnType);
+        if (classes.empty()) {
+            emit("mov rsi, rax");
+            emit("mov rdi, QWORD PTR [rbp", hiddenReturnOffset, "]");
+            emit("mov ecx, ", size);
+            emit("rep movsb");
+            emit("mov rax, QWORD PTR [rbp", hiddenReturnOffset, "]");
+        } else {
+            static const std::vector<std::string> integerReturn = {"rax", "rdx"};
+            int integerUsed = 0;
+            int sseUsed = 0;
+            emit("mov r11, rax");
+            for (size_t k = 0; k < classes.size(); ++k) {
+                Address address = {"r11", "", 1, "", 8 * static_cast<int>(k)};
+                int bytes = std::min(8, size - 8 * static_cast<int>(k));
+                if (classes[k] == ArgumentClass::Integer) {
+                    emitLoadEightbyte(integerReturn[integerUsed++], address, bytes);
+                } else {
+                    emitLoadEightbyte("rcx", address, bytes);
+                    emit("movq xmm", sseUsed++, ", rcx");
+                }
+            }
+        }
+    }
+    if (built) {
+        int bytes = alignTo(resolveTypeSize(currentReturnType), 8);
+        emit("add rsp, ", bytes);
+        stackDepth -= bytes / 8;
+    }
+
+    emit("jmp .L_return_", currentFunctionName);
+}
+
+// Blocks are placed so the likely successor falls through. The profile decides when there is one,
+// otherwise a branch ending the program is unlikely. Unlikely blocks go out of line to .text.cold.
+void CodeGenerator::visitIfNode(const IfNode* node) {
+    std::string elseLabel = generateUniqueLabel();
+    std::string endLabel = generateUniqueLabel();
+    int counter = counterFor(node);
+    const ASTNode* elseNode = node->else_.get();
+    const BlockNode* thenBlock = dynamic_cast<const BlockNode*>(node->body.get());
+
+    auto visitThen = [&]() {
+        emitCounterIncrement(counter);
+        visitBlockNode(thenBlock);
+    };
+    auto visitElse = [&]() {
+        emitCounterIncrement(counter + 1);
+        if (elseNode) {
+            NodeType elseType = elseNode->getType();
+            if (elseType == NodeType::Block) {
+                visitBlockNode(dynamic_cast<const BlockNode*>(elseNode));
+            } else if (elseType == NodeType::If) {
+                visitIfNode(dynamic_cast<const IfNode*>(elseNode));
+            }
+        }
+    };
+
+    std::optional<uint64_t> thenCount = profileCount(counter);
+    std::optional<uint64_t> elseCount = profileCount(counter + 1);
+    bool profiled = thenCount && elseCount;
+    bool coldThen = !emittingCold && (profiled ? *thenCount == 0 && *elseCount > 0 : isUnlikelyBlock(thenBlock) && !isUnlikelyBlock(elseNode));
+    bool coldElse = !emittingCold && !coldThen && elseNode
+        && (profiled ? *elseCount == 0 && *thenCount > 0 : isUnlikelyBlock(elseNode) && !isUnlikelyBlock(thenBlock));
+
+    visitCondition(node->condition.get());
+    emit("cmp rax, 0");
+
+    if (coldThen) {
+        emit("jne ", elseLabel);
+        visitElse();
+        emit(endLabel, ":");
+        emitColdBlock(elseLabel, endsInJump(thenBlock) ? "" : endLabel, visitThen);
+        return;
+    }
+    if (coldElse) {
+        emit("je ", elseLabel);
+        visitThen();
+        emit(endLabel, ":");
+        emitColdBlock(elseLabel, endsInJump(elseNode) ? "" : endLabel, visitElse);
+        return;
+    }
+
+    // when the profile says the else branch is the common one it becomes the fall through
+    if (elseNode && profiled && *elseCount > *thenCount) {
+        emit("jne ", elseLabel);
+        visitElse();
+        if (!endsInJump(elseNode)) {
+            emit("jmp ", endLabel);
+        }
+        emit(elseLabel, ":");
+        visitThen();
+        emit(endLabel, ":");
+        return;
+    }
+
+    emit("je ", elseLabel);
+    visitThen();
+    if (elseNode && !endsInJump(thenBlock)) {
+        emit("jmp ", endLabel);
+    }
+    emit(elseLabel, ":");
+    visitElse();
+    emit(endLabel, ":");
+}
+
+void CodeGenerator::visitWhileNode(const WhileNode* node) {
+    std::string startLabel = generateUniqueLabel();
+    std::string endLabel = generateUniqueLabel();
+
+    int counter = counterFor(node);
+
+    loopContextStack.push_back({startLabel, endLabel});
+    emitCounterIncrement(counter);
+
+    // loops test at the bottom, one taken branch per iteration, unless the profile saw this one
+    // mostly skipped
+    std::optional<uint64_t> entries = profileCount(counter);
+    std::optional<uint64_t> iterations = profileCount(counter + 1);
+    if (!entries || !iterations || *iterations > *entries) {
+        std::string bodyLabel = generateUniqueLabel();
+        emit("jmp ", startLabel);
+        emit(bodyLabel, ":");
+        emitCounterIncrement(counter + 1);
+        visitBlockNode(dynamic_cast<const BlockNode*>(node->body.get()));
+        emit(startLabel, ":");
+        visitCondition(node->condition.get());
+        emit("cmp rax, 0");
+        emit("jne ", bodyLabel);
+        emit(endLabel, ":");
+        loopContextStack.pop_back();
+        return;
+    }
+
+    emit(startLabel, ":");
+    visitCondition(node->condition.get());
+    emit("cmp rax, 0");
+    emit("je ", endLabel);
+
+    emitCounterIncrement(counter + 1);
+    visitBlockNode(dynamic_cast<const BlockNode*>(node->body.get()));
+    emit("jmp ", startLabel);
+
+    emit(endLabel, ":");
+
+    loopContextStack.pop_back();
+}
+
+void CodeGenerator::visitBlockNode(const BlockNode* node) {
+    if (!node) {
+        std::cout << getGeneratedCode();
+        printFatal("BlockNode cannot be null");
+    }
+
+    // the frame is reserved by the prologue, sibling blocks reuse the same slots
+    int savedOffset = localVarOffset;
+    enterScope();
+
+    for (const auto& statement : node->statements) {
+        if (!debugFiles.empty() && statement->line > 0) {
+            emit(".loc ", currentFile, " ", statement->line, " ", statement->column);
+        }
+        switch (statement->getType()) {
+            case NodeType::VarDecl:
+                visitVarDeclNode(dynamic_cast<const VarDeclNode*>(statement.get()));
+                break;
+            case NodeType::VarDeclAssign:
+                visitVarDeclAssignNode(dynamic_cast<const VarDeclAssignNode*>(statement.get()));
                 break;
             case NodeType::Assign:
                 visitAssignNode(dynamic_cast<const AssignNode*>(statement.get()));
                 break;
+            case NodeType::IndexationAssign:
+                visitIndexationAssignNode(dynamic_cast<const IndexationAssignNode*>(statement.get()));
+                break;
+            case NodeType::MemoryAssign:
+                visitMemoryAssignNode(dynamic_cast<const MemoryAssignNode*>(statement.get()));
+                break;
+            case NodeType::StructMemberAssign:
+                visitStructMemberAssignNode(dynamic_cast<const StructMemberAssignNode*>(statement.get()));
+                break;
+            case NodeType::Increment:
+                visitIncrementNode(dynamic_cast<const IncrementNode*>(statement.get()));
+                break;
+            case NodeType::Decrement:
+                visitDecrementNode(dynamic_cast<const DecrementNode*>(statement.get()));
+                break;
             case NodeType::Return:
                 visitReturnNode(dynamic_cast<const ReturnNode*>(statement.get()));
                 break;
@@ -339,7 +1782,19 @@ void CodeGenerator::visitBlockNode(const BlockNode* node) {
                 visitFunctionCallNode(dynamic_cast<const FunctionCallNode*>(statement.get()));
                 break;
             case NodeType::Switch:
-                visitSwitchNode(dynamic_cast<const SwitchNode*>(statement.get())); 
+                visitSwitchNode(dynamic_cast<const SwitchNode*>(statement.get()));
+                break;
+            case NodeType::Break:
+                visitBreakNode(dynamic_cast<const BreakNode*>(statement.get()));
+                break;
+            case NodeType::Continue:
+                visitContinueNode(dynamic_cast<const ContinueNode*>(statement.get()));
+                break;
+            case NodeType::Asm:
+                visitAsmNode(dynamic_cast<const AsmNode*>(statement.get()));
+                break;
+            case NodeType::Expression:
+                visitExpressionNode(dynamic_cast<const ExpressionNode*>(statement.get()));
                 break;
             default:
                 std::cout << std::endl << "Offender: " << toString(statement->getType()) << std::endl;
@@ -348,191 +1803,1612 @@ void CodeGenerator::visitBlockNode(const BlockNode* node) {
         }
     }
 
-    if (localVarSize > 0) {
-        emit("add rsp, " + std::to_string(localVarSize));
-        totalLocalVarOffset -= localVarSize;
+    exitScope();
+    localVarOffset = savedOffset;
+}
+
+bool CodeGenerator::visitBuiltinCall(const FunctionCallNode* node) {
+    if (!isBuiltin(node->name)) {
+        return false;
+    }
+    std::string type = builtinReturnType(node->name);
+    static const std::unordered_map<std::string, size_t> arity = {
+        {"__builtin_sqrt", 1}, {"__builtin_sqrtf", 1}, {"__builtin_strlen", 1},
+        {"__builtin_memcpy", 3}, {"__builtin_memset", 3}, {"__builtin_memcmp", 3},
+        {"__builtin_movemask", 1}, {"__builtin_lane", 2},
+    };
+    auto arityIt = arity.find(node->name);
+    if (node->arguments.empty() || (arityIt != arity.end() && node->arguments.size() != arityIt->second)) {
+        printFatal("Wrong number of arguments to builtin");
+    }
+
+    if (node->name == "__builtin_sqrt" || node->name == "__builtin_sqrtf") {
+        visitOperandAs(node->arguments[0].get(), type);
+        emit("sqrt", precision(type), " xmm0, xmm0");
+    } else if (node->name == "__builtin_movemask" || node->name == "__builtin_lane" || node->name == "__builtin_shuffle") {
+        visitVectorBuiltin(node);
+    } else {
+        visitMemoryBuiltin(node);
+    }
+    return true;
+}
+
+// Small known sizes become straight line vector moves, medium ones a string instruction, and the
+// rest a call to the library routine of the same name
+void CodeGenerator::visitMemoryBuiltin(const FunctionCallNode* node) {
+    int size = -1;
+    if (node->arguments.size() == 3) {
+        const auto* literal = dynamic_cast<const LiteralNode*>(node->arguments[2].get());
+        if (literal && literal->value.find('.') == std::string::npos) {
+            size = std::stoi(literal->value);
+        }
+    }
+    const ASTNode* first = node->arguments[0].get();
+    const ASTNode* second = node->arguments.size() > 1 ? node->arguments[1].get() : nullptr;
+
+    if (node->name == "__builtin_memcpy" && size >= 0 && size <= inlineStringLimit) {
+        evaluateIntoRegisters({first, second});
+        if (size <= inlineVectorLimit) {
+            emitInlineCopy(size);
+        } else {
+            emit("mov rax, rdi");
+            emit("mov ecx, ", size);
+            emit("rep movsb");
+        }
+        return;
+    }
+    if (node->name == "__builtin_memset" && size >= 0 && size <= inlineStringLimit) {
+        // a constant fill byte needs no register
+        bool constant = second->getType() == NodeType::Literal;
+        evaluateIntoRegisters(constant ? std::vector<const ASTNode*>{first} : std::vector<const ASTNode*>{first, second});
+        if (size <= inlineVectorLimit) {
+            emitInlineFill(size, constant ? second : nullptr);
+        } else {
+            emit("mov r11, rdi");
+            emit(constant ? "mov eax, " + std::to_string(std::stoi(dynamic_cast<const LiteralNode*>(second)->value) & 0xff) : "movzx eax, sil");
+            emit("mov ecx, ", size);
+            emit("rep stosb");
+            emit("mov rax, r11");
+        }
+        return;
+    }
+    if (node->name == "__builtin_memcmp" && size >= 0 && size <= inlineVectorLimit) {
+        evaluateIntoRegisters({first, second});
+        emitInlineCompare(size);
+        return;
+    }
+
+    FunctionCallNode call(node->name.substr(std::string("__builtin_").size()), node->arguments);
+    visitFunctionCallNode(&call);
+    if (node->name == "__builtin_memcmp") {
+        emit("movsxd rax, eax"); // the library returns an int
+    }
+}
+
+// Lane access on the vector in the first argument, lane numbers have to be constants:
+//   __builtin_movemask(v)        top bit of every lane gathered into an integer
+//   __builtin_lane(v, k)         lane k as a scalar
+//   __builtin_shuffle(v, a, ...) lanes a, ... of v, one lane number for every lane
+void CodeGenerator::visitVectorBuiltin(const FunctionCallNode* node) {
+    std::string type = operandType(node->arguments[0].get());
+    if (!isVectorType(type)) {
+        printFatal("Builtin expects a vector operand");
+    }
+    std::string element = vectorElementType(resolveTypeName(type));
+    int lanes = 16 / resolveTypeSize(element);
+    std::vector<int> indices;
+    for (size_t i = 1; i < node->arguments.size(); ++i) {
+        const auto* literal = dynamic_cast<const LiteralNode*>(node->arguments[i].get());
+        if (!literal || literal->value.find('.') != std::string::npos || std::stoi(literal->value) < 0 || std::stoi(literal->value) >= lanes) {
+            printFatal("Lane numbers must be constants within the vector");
+        }
+        indices.push_back(std::stoi(literal->value));
+    }
+    visitOperand(node->arguments[0].get());
+
+    if (node->name == "__builtin_movemask") {
+        emit((element == "uint8" ? "pmovmskb" : element == "int64" ? "movmskpd" : "movmskps"), " eax, xmm0");
+    } else if (node->name == "__builtin_lane") {
+        int lane = indices[0];
+        if (element == "uint8") {
+            emit("pextrw eax, xmm0, ", lane / 2);
+            emit(lane % 2 ? "shr eax, 8" : "movzx eax, al");
+        } else if (element == "int64") {
+            if (lane) {
+                emit("pshufd xmm0, xmm0, 0xee");
+            }
+            emit("movq rax, xmm0");
+        } else {
+            if (lane) {
+                emit((element == "float" ? "shufps" : "pshufd"), " xmm0, xmm0, ", lane);
+            }
+            if (element == "int32") {
+                emit("movd eax, xmm0");
+                emit("movsxd rax, eax");
+            }
+        }
+    } else {
+        if (static_cast<int>(indices.size()) != lanes) {
+            printFatal("A shuffle needs one lane number per lane");
+        }
+        if (element == "uint8") {
+            // SSE2 has no byte shuffle, gather the bytes through the stack into two eightbytes
+            emit("sub rsp, 16");
+            growStack(2);
+            emit("movdqu XMMWORD PTR [rsp], xmm0");
+            for (int half = 0; half < 2; ++half) {
+                std::string reg = half ? "rdx" : "rax";
+                emit("movzx ", subRegister(reg, 4), ", BYTE PTR [rsp+", indices[8 * half + 7], "]");
+                for (int i = 6; i >= 0; --i) {
+                    emit("shl ", reg, ", 8");
+                    emit("mov ", subRegister(reg, 1), ", BYTE PTR [rsp+", indices[8 * half + i], "]");
+                }
+            }
+            emit("add rsp, 16");
+            stackDepth -= 2;
+            emit("movq xmm0, rax");
+            emit("movq xmm1, rdx");
+            emit("punpcklqdq xmm0, xmm1");
+        } else {
+            // pshufd picks doublewords, a quadword lane is a pair of them
+            int control = 0;
+            for (int i = 0; i < 4; ++i) {
+                int dword = element == "int64" ? 2 * indices[i / 2] + i % 2 : indices[i];
+                control |= dword << (2 * i);
+            }
+            emit("pshufd xmm0, xmm0, ", control);
+        }
+    }
+}
+
+// Evaluates pointer operands into rdi, rsi, rdx in that order
+void CodeGenerator::evaluateIntoRegisters(const std::vector<const ASTNode*>& operands) {
+    static const std::vector<std::string> registers = {"rdi", "rsi", "rdx"};
+    for (auto it = operands.rbegin(); it != operands.rend(); ++it) {
+        visitOperandAs(*it, "int64");
+        emitPush("rax");
+    }
+    for (size_t i = 0; i < operands.size(); ++i) {
+        emitPop(registers[i]);
+    }
+}
+
+void CodeGenerator::visitFunctionCallNode(const FunctionCallNode* node) {
+    if (visitBuiltinCall(node)) {
+        return;
+    }
+    emitCounterIncrement(counterFor(node));
+
+    // callees we know nothing about take 64 bit integers or doubles and return 64 bit integers
+    auto signatureIt = program->functionSignatures.find(node->name);
+    const FunctionSignature* signature = signatureIt != program->functionSignatures.end() ? &signatureIt->second : nullptr;
+    int numArgs = node->arguments.size();
+    std::vector<std::string> types;
+    for (int i = 0; i < numArgs; ++i) {
+        if (signature && i < static_cast<int>(signature->paramTypes.size())) {
+            types.push_back(signature->paramTypes[i]);
+        } else {
+            std::string type = operandType(node->arguments[i].get());
+            types.push_back(isFloatingType(type) ? "double" : isVectorType(type) ? type : "int64");
+        }
+    }
+    std::string returnType = signature ? signature->returnType : "int64";
+    bool aggregateReturn = isStructType(returnType);
+    bool hiddenReturn = returnsInMemory(returnType);
+
+    int stackBytes;
+    std::vector<ArgumentLocation> locations = planArguments(types, hiddenReturn, stackBytes);
+
+    // keep rsp 16 byte aligned at the call instruction, the outgoing area sits right above it
+    int padding = (stackDepth + stackBytes / 8) % 2;
+    int reserved = stackBytes + 8 * padding;
+    if (reserved > 0) {
+        emit("sub rsp, ", reserved);
+        growStack(reserved / 8);
+    }
+
+    // evaluate everything first, a later argument may clobber the argument registers. Structs are
+    // pushed as their address, or as a whole when scalar replacement built them from a list.
+    auto built = [&](int i) { return node->arguments[i]->getType() == NodeType::InitializerList; };
+    for (int i = numArgs - 1; i >= 0; --i) {
+        if (built(i)) {
+            emitPushAggregate(node->arguments[i].get(), types[i]);
+            continue;
+        }
+        visitOperandAs(node->arguments[i].get(), types[i]);
+        emitPushValue(types[i]);
+    }
+    // vectors take two slots, everything else one
+    std::vector<int> pushed(numArgs + 1, 0);
+    for (int i = 0; i < numArgs; ++i) {
+        int bytes = built(i) ? alignTo(resolveTypeSize(types[i]), 8) : isVectorType(types[i]) ? 16 : 8;
+        pushed[i + 1] = pushed[i] + bytes;
+    }
+
+    bool scalarsOnly = stackBytes == 0 && std::none_of(types.begin(), types.end(), [this](const std::string& type) {
+        return isStructType(type) || isFloatingType(type) || isVectorType(type);
+    });
+    int sseUsed = 0;
+    if (scalarsOnly) {
+        for (int i = 0; i < numArgs; ++i) {
+            emitPop(locations[i].registers[0]);
+        }
+    } else {
+        // argument i was pushed to [rsp+pushed[i]], aggregates as their address
+        for (int i = 0; i < numArgs; ++i) {
+            if (!locations[i].registers.empty()) {
+                continue;
+            }
+            Address source = {"rsp", "", 1, "", pushed[i]};
+            Address destination = {"rsp", "", 1, "", pushed[numArgs] + locations[i].stackOffset};
+            if (isVectorType(types[i])) {
+                emit("movdqu xmm0, XMMWORD PTR ", source.toString());
+                emit("movdqu XMMWORD PTR ", destination.toString(), ", xmm0");
+            } else if (isStructType(types[i])) {
+                emit((built(i) ? "lea rsi, " : "mov rsi, QWORD PTR "), source.toString());
+                emit("lea rdi, ", destination.toString());
+                emit("mov ecx, ", resolveTypeSize(types[i]));
+                emit("rep movsb");
+            } else {
+                emit("mov rax, QWORD PTR ", source.toString());
+                emit("mov QWORD PTR ", destination.toString(), ", rax");
+            }
+        }
+        for (int i = 0; i < numArgs; ++i) {
+            const ArgumentLocation& location = locations[i];
+            if (location.registers.empty()) {
+                continue;
+            }
+            Address source = {"rsp", "", 1, "", pushed[i]};
+            if (isVectorType(types[i])) {
+                emit("movdqu ", location.registers[0], ", XMMWORD PTR ", source.toString());
+                sseUsed++;
+                continue;
+            }
+            if (!isStructType(types[i])) {
+                bool sse = location.registers[0].starts_with("xmm");
+                emit((sse ? "movq " : "mov "), location.registers[0], ", QWORD PTR ", source.toString());
+                sseUsed += sse;
+                continue;
+            }
+            int size = resolveTypeSize(types[i]);
+            emit((built(i) ? "lea r11, " : "mov r11, QWORD PTR "), source.toString());
+            for (size_t k = 0; k < location.registers.size(); ++k) {
+                Address address = {"r11", "", 1, "", 8 * static_cast<int>(k)};
+                int bytes = std::min(8, size - 8 * static_cast<int>(k));
+                if (location.registers[k].starts_with("xmm")) {
+                    emitLoadEightbyte("rax", address, bytes);
+                    emit("movq ", location.registers[k], ", rax");
+                    sseUsed++;
+                } else {
+                    emitLoadEightbyte(location.registers[k], address, bytes);
+                }
+            }
+        }
+        emit("add rsp, ", pushed[numArgs]);
+        stackDepth -= pushed[numArgs] / 8;
+    }
+
+    int resultOffset = 0;
+    if (aggregateReturn) {
+        resultOffset = callResultOffset;
+        callResultOffset += alignTo(resolveTypeSize(returnType), 8);
+    }
+    if (hiddenReturn) {
+        emit("lea rdi, [rbp", resultOffset, "]");
+    }
+
+    // al tells variadic callees how many vector registers carry arguments
+    emit(sseUsed ? "mov eax, " + std::to_string(sseUsed) : "xor eax, eax");
+    emit("call ", node->name);
+    stackUsage.back().callees.insert(node->name);
+    if (reserved > 0) {
+        emit("add rsp, ", reserved);
+        stackDepth -= reserved / 8;
+    }
+    emitExtendResult(returnType);
+
+    if (aggregateReturn && !hiddenReturn) {
+        // spill rax:rdx (or xmm0:xmm1) into the buffer so the aggregate has an address like any other
+        int size = resolveTypeSize(returnType);
+        std::vector<ArgumentClass> classes = classifyAggregate(returnType);
+        static const std::vector<std::string> integerReturn = {"rax", "rdx"};
+        int integerUsed = 0;
+        int sseReturned = 0;
+        for (size_t k = 0; k < classes.size(); ++k) {
+            Address address = {"rbp", "", 1, "", resultOffset + 8 * static_cast<int>(k)};
+            int bytes = std::min(8, size - 8 * static_cast<int>(k));
+            if (classes[k] == ArgumentClass::Integer) {
+                emitStoreEightbyte(integerReturn[integerUsed++], address, bytes);
+            } else {
+                emit("movq r11, xmm", sseReturned++);
+                emitStoreEightbyte("r11", address, bytes);
+            }
+        }
+        emit("lea rax, [rbp", resultOffset, "]");
+    }
+}
+
+void CodeGenerator::visitLiteralNode(const LiteralNode* node) {
+    std::string type = operandType(node);
+    if (isFloatingType(type)) {
+        visitOperandAs(node, type);
+        return;
+    }
+    emit("mov rax, ", node->value);
+}
+
+void CodeGenerator::visitIdentifierNode(const IdentifierNode* node) {
+    if (const LocalVariable* variable = findLocalVariable(node->name); variable && !variable->reg.empty()) {
+        emit((variable->reg.starts_with("xmm") ? "movaps xmm0, " : "mov rax, "), variable->reg);
+        return;
+    }
+    emitLoad(variableAddress(node->name, "rax"), getVariableType(node->name));
+}
+
+void CodeGenerator::visitIndexNode(const IndexNode* node) {
+    visitOperandAs(node->index.get(), "int64");
+    emitLoad(indexAddress(node->name, "rax", "rcx"), getVariableType(node->name));
+}
+
+void CodeGenerator::visitMemoryAddressNode(const MemoryAddressNode* node) {
+    Address address = variableAddress(node->name, "rax");
+    if (address.base != "rax") {
+        emit("lea rax, ", address.toString());
+    }
+}
+
+void CodeGenerator::visitStructMemberAccessNode(const StructMemberAccessNode* node) {
+    // the whole chain folds into one constant displacement from the root variable
+    MemberInfo member = resolveMemberAccess(node);
+    Address address = variableAddress(member.root, "rax");
+    address.displacement += member.offset;
+    emitLoad(address, member.type);
+}
+
+bool CodeGenerator::hasLiteralCases(const SwitchNode* node) const {
+    return std::all_of(node->cases.begin(), node->cases.end(), [](const ASTNodePtr& case_) {
+        const auto* caseNode = dynamic_cast<const CaseNode*>(case_.get());
+        return !caseNode || caseNode->case_->getType() == NodeType::Literal;
+    });
+}
+
+void CodeGenerator::visitSwitchNode(const SwitchNode* node) {
+    std::string endLabel = generateUniqueLabel();
+    std::string defaultLabel = generateUniqueLabel();
+    std::vector<std::string> caseLabels;
+
+    for (size_t i = 0; i < node->cases.size(); ++i) {
+        caseLabels.push_back(generateUniqueLabel());
+    }
+
+    visitOperandAs(node->condition.get(), "int64");
+
+    // literal cases compare against rax directly, anything else needs the value kept in a slot
+    int savedOffset = localVarOffset;
+    bool literalCases = hasLiteralCases(node);
+    std::string conditionSlot;
+    if (!literalCases) {
+        localVarOffset -= 8;
+        conditionSlot = "QWORD PTR [rbp" + std::to_string(localVarOffset) + "]";
+        emit("mov ", conditionSlot, ", rax");
+    }
+
+    // instrumented dispatch goes through a stub per case, fall through would be counted otherwise
+    int counter = counterFor(node);
+    std::vector<std::string> targets = caseLabels;
+    std::string defaultTarget = defaultLabel;
+    if (profileGenerate && counter >= 0) {
+        for (auto& target : targets) {
+            target = generateUniqueLabel();
+        }
+        defaultTarget = generateUniqueLabel();
+    }
+
+    // literal comparisons have no side effects, the profile can put the common values first
+    std::vector<size_t> order(node->cases.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    if (literalCases && functionProfile && counter >= 0) {
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return *profileCount(counter + a) > *profileCount(counter + b);
+        });
+    }
+
+    bool hasDefault = false;
+    size_t defaultIndex = 0;
+    for (size_t i : order) {
+        const auto& caseNode = dynamic_cast<const CaseNode*>(node->cases[i].get());
+        if (!caseNode) {
+            hasDefault = true;
+            defaultIndex = i;
+            continue;
+        }
+        if (literalCases) {
+            emit("cmp rax, ", dynamic_cast<const LiteralNode*>(caseNode->case_.get())->value);
+        } else {
+            visitOperandAs(caseNode->case_.get(), "int64");
+            emit("cmp ", conditionSlot, ", rax");
+        }
+        emit("je ", targets[i]);
+    }
+
+    emit("jmp ", (hasDefault ? defaultTarget : endLabel));
+
+    if (profileGenerate && counter >= 0) {
+        for (size_t i = 0; i < node->cases.size(); ++i) {
+            if (dynamic_cast<const CaseNode*>(node->cases[i].get())) {
+                emit(targets[i], ":");
+                emitCounterIncrement(counter + i);
+                emit("jmp ", caseLabels[i]);
+            }
+        }
+        if (hasDefault) {
+            emit(defaultTarget, ":");
+            emitCounterIncrement(counter + defaultIndex);
+            emit("jmp ", defaultLabel);
+        }
+    }
+
+    // break leaves the switch, continue still targets the enclosing loop
+    std::string continueLabel = loopContextStack.empty() ? endLabel : loopContextStack.back().startLabel;
+    loopContextStack.push_back({continueLabel, endLabel});
+
+    // cases that never ran or end the program go out of line, falling into them becomes a jump
+    uint64_t executions = 0;
+    for (size_t i = 0; functionProfile && counter >= 0 && i < node->cases.size(); ++i) {
+        executions += *profileCount(counter + i);
+    }
+    bool fallsIn = false;
+    for (size_t i = 0; i < node->cases.size(); ++i) {
+        const auto& caseNode = dynamic_cast<const CaseNode*>(node->cases[i].get());
+        if (!caseNode) {
+            continue;
+        }
+        const BlockNode* body = dynamic_cast<const BlockNode*>(caseNode->body.get());
+        bool cold = !emittingCold && (executions > 0 ? *profileCount(counter + i) == 0 : isUnlikelyBlock(body));
+        if (!cold) {
+            emit(caseLabels[i], ":");
+            visitBlockNode(body);
+            fallsIn = !endsInJump(body);
+            continue;
+        }
+        if (fallsIn) {
+            emit("jmp ", caseLabels[i]);
+        }
+        std::string next = defaultLabel;
+        for (size_t j = i + 1; j < node->cases.size(); ++j) {
+            if (dynamic_cast<const CaseNode*>(node->cases[j].get())) {
+                next = caseLabels[j];
+                break;
+            }
+        }
+        emitColdBlock(caseLabels[i], endsInJump(body) ? "" : next, [&]() { visitBlockNode(body); });
+        fallsIn = false;
+    }
+
+    emit(defaultLabel, ":");
+    for (const auto& caseNode : node->cases) {
+        if (auto defaultNode = dynamic_cast<const DefaultNode*>(caseNode.get())) {
+            visitBlockNode(dynamic_cast<const BlockNode*>(defaultNode->body.get()));
+            break;
+        }
+    }
+
+    emit(endLabel, ":");
+    loopContextStack.pop_back();
+    localVarOffset = savedOffset;
+}
+
+void CodeGenerator::visitBreakNode(const BreakNode*) {
+    if (!loopContextStack.empty()) {
+        emit("jmp ", loopContextStack.back().endLabel);
+    } else {
+        printFatal("Break statement not within a loop");
+    }
+}
+
+void CodeGenerator::visitContinueNode(const ContinueNode*) {
+    if (!loopContextStack.empty()) {
+        emit("jmp ", loopContextStack.back().startLabel);
+    } else {
+        printFatal("Continue statement not within a loop");
+    }
+}
+
+// Binds every operand to a scratch register the clobber list leaves free, integers to general purpose
+// registers and floating point or vector values to xmm registers. Inputs are loaded before the
+// lines run and outputs stored back after, a name listed as both keeps its register.
+void CodeGenerator::visitAsmNode(const AsmNode* node) {
+    static const std::vector<std::string> generalRegisters = {"rax", "rcx", "rdx", "rsi", "rdi", "r8", "r9", "r10", "r11"};
+    static const std::vector<std::string> calleeSaved = {"rbx", "r12", "r13", "r14", "r15"};
+
+    std::set<std::string> clobbered;
+    for (const auto& clobber : node->clobbers) {
+        bool vector = clobber.starts_with("xmm") && clobber.size() > 3 && std::stoi(clobber.substr(3)) < 16;
+        bool general = std::find(generalRegisters.begin(), generalRegisters.end(), clobber) != generalRegisters.end();
+        bool saved = std::find(calleeSaved.begin(), calleeSaved.end(), clobber) != calleeSaved.end();
+        if (clobber == "rbp" || clobber == "rsp") {
+            printFatal("The frame and stack pointer cannot be clobbered by asm");
+        }
+        if (!vector && !general && !saved && clobber != "cc" && clobber != "memory") {
+            printFatal("Unknown register in asm clobber list");
+        }
+        clobbered.insert(clobber);
+    }
+
+    std::vector<std::string> operands = node->inputs;
+    for (const auto& name : node->outputs) {
+        if (std::find(operands.begin(), operands.end(), name) == operands.end()) {
+            operands.push_back(name);
+        }
+    }
+    std::map<std::string, std::string> bindings;
+    size_t nextGeneral = 0;
+    int nextVector = 0;
+    for (const auto& name : operands) {
+        if (bindings.count(name)) {
+            continue;
+        }
+        std::string type = getVariableType(name);
+        if (isStructType(type)) {
+            printFatal("Asm operands must be scalars or vectors");
+        }
+        std::string reg;
+        if (isFloatingType(type) || isVectorType(type)) {
+            while (nextVector < 16 && clobbered.count("xmm" + std::to_string(nextVector))) {
+                nextVector++;
+            }
+            reg = nextVector < 16 ? "xmm" + std::to_string(nextVector++) : "";
+        } else {
+            while (nextGeneral < generalRegisters.size() && clobbered.count(generalRegisters[nextGeneral])) {
+                nextGeneral++;
+            }
+            reg = nextGeneral < generalRegisters.size() ? generalRegisters[nextGeneral++] : "";
+        }
+        if (reg.empty()) {
+            printFatal("Not enough registers left for the asm operands");
+        }
+        bindings[name] = reg;
+    }
+
+    // callee saved registers may hold our variables, keep them around the block
+    std::vector<std::string> preserved;
+    for (const auto& reg : calleeSaved) {
+        if (clobbered.count(reg)) {
+            preserved.push_back(reg);
+            emitPush(reg);
+        }
+    }
+
+    // every input goes through the stack first, loading one must not overwrite another's register
+    std::vector<std::string> inputs;
+    for (const auto& name : node->inputs) {
+        if (std::find(inputs.begin(), inputs.end(), name) == inputs.end()) {
+            inputs.push_back(name);
+        }
+    }
+    for (const auto& name : inputs) {
+        IdentifierNode identifier(name);
+        visitIdentifierNode(&identifier);
+        emitPushValue(getVariableType(name));
+    }
+    for (auto it = inputs.rbegin(); it != inputs.rend(); ++it) {
+        std::string type = getVariableType(*it);
+        const std::string& reg = bindings[*it];
+        if (isVectorType(type)) {
+            emit("movdqu ", reg, ", XMMWORD PTR [rsp]");
+            emit("add rsp, 16");
+            stackDepth -= 2;
+        } else if (isFloatingType(type)) {
+            emit("movq ", reg, ", QWORD PTR [rsp]");
+            emit("add rsp, 8");
+            stackDepth--;
+        } else {
+            emitPop(reg);
+        }
+    }
+
+    for (const auto& line : node->lines) {
+        std::string text;
+        for (size_t i = 0; i < line.size(); ++i) {
+            if (line[i] != '{') {
+                text += line[i];
+                continue;
+            }
+            size_t end = line.find('}', i);
+            auto binding = end == std::string::npos ? bindings.end() : bindings.find(line.substr(i + 1, end - i - 1));
+            if (binding == bindings.end()) {
+                printFatal("Asm line refers to a name that is not an operand");
+            }
+            text += binding->second;
+            i = end;
+        }
+        emit(text);
     }
-    exitScope();
-}
 
-void CodeGenerator::visitFunctionCallNode(const FunctionCallNode* node) {
-    for (int i = node->arguments.size() - 1; i >= 0; --i) {
-        visitExpressionNode(dynamic_cast<const ExpressionNode*>(node->arguments[i].get()));
-        if (i < argumentRegisters.size()) {
-            emit("mov " + argumentRegisters[i] + ", rax");
+    // park the outputs before storing any, a store needs rax and rcx
+    int parked = 0;
+    for (const auto& name : node->outputs) {
+        std::string type = getVariableType(name);
+        const std::string& reg = bindings[name];
+        if (isVectorType(type)) {
+            emit("sub rsp, 16");
+            emit("movdqu XMMWORD PTR [rsp], ", reg);
+            growStack(2);
+            parked += 16;
+        } else if (isFloatingType(type)) {
+            emit("sub rsp, 8");
+            emit("movq QWORD PTR [rsp], ", reg);
+            growStack(1);
+            parked += 8;
+        } else {
+            emitPush(reg);
+            parked += 8;
+        }
+    }
+    // restore the callee saved registers first, an output may be a variable living in one of them
+    for (size_t i = 0; i < preserved.size(); ++i) {
+        int offset = parked + 8 * static_cast<int>(preserved.size() - 1 - i);
+        emit("mov ", preserved[i], ", QWORD PTR [rsp+", offset, "]");
+    }
+    for (auto it = node->outputs.rbegin(); it != node->outputs.rend(); ++it) {
+        std::string type = getVariableType(*it);
+        emitPopValue(type);
+        if (const LocalVariable* variable = findLocalVariable(*it); variable && !variable->reg.empty()) {
+            emitRegisterStore(variable->reg, "rax", type);
         } else {
-            emit("push rax");
+            emitStore(variableAddress(*it, "rcx"), type);
         }
     }
-    emit("call " + node->name);
-    emit("add rsp, " + std::to_string(8 * std::max(0, int(node->arguments.size()) - int(argumentRegisters.size()))));
+
+    if (!preserved.empty()) {
+        emit("add rsp, ", 8 * preserved.size());
+        stackDepth -= preserved.size();
+    }
 }
 
-void CodeGenerator::visitLiteralNode(const LiteralNode* node) {
-    emit("mov rax, " + node->value);
+void CodeGenerator::visitTypedefNode(const TypedefNode*) {
+    // we actually dont need to do anything as the parser provides all the necessary information
 }
 
-// StringLiteral
-// todo, allocate the string into .rodata and mov the addr of it into rax
+void CodeGenerator::visitStructNode(const StructNode*) {
+    // we actually dont need to do anything as the parser provides all the necessary information
+}
 
-void CodeGenerator::visitIdentifierNode(const IdentifierNode* node) {
-    int offset = getLocalVariableOffset(node->name);
-    emit("mov rax, [rbp" + std::to_string(offset) + "]");
+// Labels are numbered per function and carry its name, generators of different functions never clash
+std::string CodeGenerator::generateLabel(const std::string& prefix) {
+    return prefix + currentFunctionName + "." + std::to_string(labelCounter++);
 }
 
-void CodeGenerator::visitStructMemberAccessNode(const StructMemberAccessNode* node) {
-    visitIdentifierNode(dynamic_cast<const IdentifierNode*>(node->base.get()));
+std::string CodeGenerator::generateUniqueLabel() {
+    return generateLabel(".L");
+}
 
-    std::string structType = resolveTypeName(getVariableType(dynamic_cast<const IdentifierNode*>(node->base.get())->name));
-    
-    const auto& structDef = structDefinitions.find(structType);
-    if (structDef == structDefinitions.end()) {
-        printFatal("Struct type not found in definitions");
-        __builtin_unreachable();
+void CodeGenerator::emitPush(const std::string& reg) {
+    emit("push ", reg);
+    growStack(1);
+}
+
+void CodeGenerator::growStack(int slots) {
+    stackDepth += slots;
+    maxStackDepth = std::max(maxStackDepth, stackDepth);
+}
+
+void CodeGenerator::emitPop(const std::string& reg) {
+    emit("pop ", reg);
+    stackDepth--;
+}
+
+// Loads a value of `type` into rax (xmm0 for floating point and vectors), structs evaluate to their address
+void CodeGenerator::emitLoad(const Address& address, const std::string& type) {
+    if (isStructType(type)) {
+        emit("lea rax, ", address.toString());
+        return;
+    }
+    if (isVectorType(type)) {
+        emit(vectorMove(address, type), " xmm0, XMMWORD PTR ", address.toString());
+        return;
+    }
+    if (isFloatingType(type)) {
+        emit("mov", precision(resolveTypeName(type)), " xmm0, ", sizeSpecifier(type), " ", address.toString());
+        return;
     }
 
-    int memberOffset = 0;
-    bool memberFound = false;
-    for (const auto& member : structDef->second) {
-        if (member == node->memberName) {
-            memberFound = true;
-            break;
-        }
-        memberOffset += resolveTypeSize(member);
+    std::string operand = sizeSpecifier(type) + " " + address.toString();
+    bool isUnsigned = isUnsignedType(type);
+    switch (resolveTypeSize(type)) {
+        case 1: emit((isUnsigned ? "movzx eax, " : "movsx rax, "), operand); break;
+        case 2: emit((isUnsigned ? "movzx eax, " : "movsx rax, "), operand); break;
+        case 4: emit((isUnsigned ? "mov eax, " : "movsxd rax, "), operand); break;
+        default: emit("mov rax, ", operand); break;
     }
+}
 
-    if (!memberFound) {
-        printFatal("Struct member not found");
-        __builtin_unreachable();
+// Stores rax (xmm0 for floating point and vectors) into a value of `type`, for structs rax holds the source address
+void CodeGenerator::emitStore(const Address& address, const std::string& type) {
+    if (isStructType(type)) {
+        emit("mov rsi, rax");
+        emit("lea rdi, ", address.toString());
+        emit("mov ecx, ", resolveTypeSize(type));
+        emit("rep movsb");
+        return;
+    }
+    if (isVectorType(type)) {
+        emit(vectorMove(address, type), " XMMWORD PTR ", address.toString(), ", xmm0");
+        return;
+    }
+    if (isFloatingType(type)) {
+        emit("mov", precision(resolveTypeName(type)), " ", sizeSpecifier(type), " ", address.toString(), ", xmm0");
+        return;
     }
 
-    emit("add rax, " + std::to_string(memberOffset));
+    std::string operand = sizeSpecifier(type) + " " + address.toString();
+    switch (resolveTypeSize(type)) {
+        case 1: emit("mov ", operand, ", al"); break;
+        case 2: emit("mov ", operand, ", ax"); break;
+        case 4: emit("mov ", operand, ", eax"); break;
+        default: emit("mov ", operand, ", rax"); break;
+    }
 }
 
-void CodeGenerator::visitSwitchNode(const SwitchNode* node) {
-    std::string endLabel = generateUniqueLabel();
-    std::string defaultLabel = generateUniqueLabel();
-    std::vector<std::string> caseLabels;
+// Floating point values travel through rax when they have to be pushed, vectors take two slots
+void CodeGenerator::emitPushValue(const std::string& type) {
+    if (isVectorType(type)) {
+        emit("sub rsp, 16");
+        emit("movdqu XMMWORD PTR [rsp], xmm0");
+        growStack(2);
+        return;
+    }
+    if (isFloatingType(type)) {
+        emit("movq rax, xmm0");
+    }
+    emitPush("rax");
+}
 
-    for (size_t i = 0; i < node->cases.size(); ++i) {
-        caseLabels.push_back(generateUniqueLabel());
+// Builds a struct from an initializer list right on the stack, it is laid out at [rsp] afterwards
+void CodeGenerator::emitPushAggregate(const ASTNode* value, const std::string& type) {
+    int bytes = alignTo(resolveTypeSize(type), 8);
+    emit("sub rsp, ", bytes);
+    growStack(bytes / 8);
+
+    std::vector<std::tuple<int, std::string, const ASTNode*>> elements;
+    collectAggregateElements(value, type, 0, elements);
+    for (const auto& [offset, elementType, element] : elements) {
+        visitOperandAs(element ? element : zeroLiteral(), elementType);
+        emitStore({"rsp", "", 1, "", offset}, elementType);
     }
+}
 
-    visitExpressionNode(dynamic_cast<const ExpressionNode*>(node->condition.get()));
-    emit("mov rbx, rax");
-    
-    for (size_t i = 0; i < node->cases.size(); ++i) {
-        const auto& caseNode = dynamic_cast<const CaseNode*>(node->cases[i].get());
-        if (caseNode) {
-            visitBlockNode(dynamic_cast<const BlockNode*>(caseNode->body.get()));
-            emit("cmp rbx, rax");
-            emit("je " + caseLabels[i]);
-        } else if (dynamic_cast<const DefaultNode*>(node->cases[i].get())) {
-            emit("jmp " + defaultLabel);
+// True when a list returned in registers only holds constants and variables, those are evaluated
+// into rax or xmm0 without touching the registers the eightbytes are assembled in
+bool CodeGenerator::returnsInRegisters(const ASTNode* value, const std::string& type) const {
+    if (value->getType() != NodeType::InitializerList || classifyAggregate(type).empty()) {
+        return false;
+    }
+    std::vector<std::tuple<int, std::string, const ASTNode*>> elements;
+    collectAggregateElements(value, type, 0, elements);
+    return std::all_of(elements.begin(), elements.end(), [this](const auto& entry) {
+        const auto& [offset, elementType, element] = entry;
+        bool simple = !element || element->getType() == NodeType::Literal || element->getType() == NodeType::Identifier;
+        return simple && !isStructType(elementType) && !isVectorType(elementType) && offset % 8 + resolveTypeSize(elementType) <= 8;
+    });
+}
+
+// Builds the eightbytes of a returned list in rcx and rdx or xmm2 and xmm3 and moves them into the
+// return registers, the members never pass through memory
+void CodeGenerator::emitRegisterReturn(const ASTNode* value, const std::string& type) {
+    std::vector<ArgumentClass> classes = classifyAggregate(type);
+    std::vector<std::string> accumulators;
+    int integerUsed = 0;
+    int sseUsed = 0;
+    for (ArgumentClass argumentClass : classes) {
+        accumulators.push_back(argumentClass == ArgumentClass::Integer ? (integerUsed++ ? "rdx" : "rcx") : "xmm" + std::to_string(2 + sseUsed++));
+    }
+
+    std::vector<std::tuple<int, std::string, const ASTNode*>> elements;
+    collectAggregateElements(value, type, 0, elements);
+    for (const auto& [offset, elementType, element] : elements) {
+        visitOperandAs(element ? element : zeroLiteral(), elementType);
+        const std::string& accumulator = accumulators[offset / 8];
+        int shift = 8 * (offset % 8);
+        if (accumulator.starts_with("xmm")) {
+            // only floats share an sse eightbyte, the second one goes into the upper half
+            emit((shift ? "unpcklps " : "movaps "), accumulator, ", xmm0");
+            continue;
+        }
+        // the members are zero extended so they do not spill into their neighbours
+        std::string target = shift ? "rax" : accumulator;
+        int size = resolveTypeSize(elementType);
+        if (isFloatingType(elementType)) {
+            emit("movd ", subRegister(target, 4), ", xmm0");
+        } else if (size == 4) {
+            emit("mov ", subRegister(target, 4), ", eax");
+        } else if (size < 4) {
+            emit("movzx ", subRegister(target, 4), ", ", subRegister("rax", size));
+        } else if (target != "rax") {
+            emit("mov ", target, ", rax");
+        }
+        if (shift) {
+            emit("shl rax, ", shift);
+            emit("or ", accumulator, ", rax");
         }
     }
 
-    emit("jmp " + endLabel);
+    if (integerUsed) {
+        emit("mov rax, rcx");
+    }
+    for (int k = 0; k < sseUsed; ++k) {
+        emit("movaps xmm", k, ", xmm", 2 + k);
+    }
+}
 
-    for (size_t i = 0; i < node->cases.size(); ++i) {
-        const auto& caseNode = dynamic_cast<const CaseNode*>(node->cases[i].get());
-        emit(caseLabels[i] + ":");
-        if (caseNode) {
-            visitBlockNode(dynamic_cast<const BlockNode*>(caseNode->body.get()));
+void CodeGenerator::emitPopValue(const std::string& type) {
+    if (isVectorType(type)) {
+        emit("movdqu xmm0, XMMWORD PTR [rsp]");
+        emit("add rsp, 16");
+        stackDepth -= 2;
+        return;
+    }
+    emitPop("rax");
+    if (isFloatingType(type)) {
+        emit("movq xmm0, rax");
+    }
+}
+
+// Converts the value just evaluated from `from` to `to`, integers are already 64 bits wide
+void CodeGenerator::emitConvert(const std::string& from, const std::string& to) {
+    if (isVectorType(from) || isVectorType(to)) {
+        emitBroadcast(from, to);
+        return;
+    }
+    bool fromFloating = isFloatingType(from);
+    bool toFloating = isFloatingType(to);
+    if (!fromFloating && !toFloating) {
+        return;
+    }
+    std::string source = fromFloating ? resolveTypeName(from) : "";
+    std::string target = toFloating ? resolveTypeName(to) : "";
+    if (fromFloating && toFloating) {
+        if (source != target) {
+            emit("cvt", precision(source), "2", precision(target), " xmm0, xmm0");
+        }
+    } else if (toFloating) {
+        std::string integer = resolveTypeName(from);
+        emit("pxor xmm0, xmm0"); // cvtsi2s* only writes the low lane, do not depend on the old value
+        if (integer == "uint32") {
+            emit("mov eax, eax");
         }
+        if (integer != "uint64") {
+            emit("cvtsi2", precision(target), " xmm0, rax");
+            return;
+        }
+        // the conversion is signed, above 2^63 halve the value keeping the low bit for rounding and double it back
+        std::string large = generateUniqueLabel();
+        std::string done = generateUniqueLabel();
+        emit("test rax, rax");
+        emit("js ", large);
+        emit("cvtsi2", precision(target), " xmm0, rax");
+        emit("jmp ", done);
+        emit(large, ":");
+        emit("mov r11, rax");
+        emit("shr r11, 1");
+        emit("and eax, 1");
+        emit("or r11, rax");
+        emit("cvtsi2", precision(target), " xmm0, r11");
+        emit("add", precision(target), " xmm0, xmm0");
+        emit(done, ":");
+    } else if (resolveTypeName(to) != "uint64") {
+        emit("cvtt", precision(source), "2si rax, xmm0");
+    } else {
+        // values from 2^63 up are out of range for the signed conversion, they are converted less 2^63
+        std::string large = generateUniqueLabel();
+        std::string done = generateUniqueLabel();
+        std::string bias = floatConstant("9223372036854775808.0", source);
+        emit("comi", precision(source), " xmm0, ", bias);
+        emit("jae ", large);
+        emit("cvtt", precision(source), "2si rax, xmm0");
+        emit("jmp ", done);
+        emit(large, ":");
+        emit("sub", precision(source), " xmm0, ", bias);
+        emit("cvtt", precision(source), "2si rax, xmm0");
+        emit("btc rax, 63");
+        emit(done, ":");
     }
+}
 
-    emit(defaultLabel + ":");
-    for (const auto& caseNode : node->cases) {
-        if (auto defaultNode = dynamic_cast<const DefaultNode*>(caseNode.get())) {
-            visitBlockNode(dynamic_cast<const BlockNode*>(defaultNode->body.get()));
-            break;
+// Scalars become vectors by repeating them in every lane, vectors of a different type keep their bits
+void CodeGenerator::emitBroadcast(const std::string& from, const std::string& to) {
+    if (isVectorType(from)) {
+        if (!isVectorType(to)) {
+            printFatal("A vector cannot be converted to a scalar, use __builtin_lane");
         }
+        return;
+    }
+    std::string element = vectorElementType(resolveTypeName(to));
+    if (element == "float") {
+        emitConvert(from, "float");
+        emit("shufps xmm0, xmm0, 0");
+        return;
     }
+    emitConvert(from, "int64");
+    if (element == "int64") {
+        emit("movq xmm0, rax");
+        emit("punpcklqdq xmm0, xmm0");
+        return;
+    }
+    emit("movd xmm0, eax");
+    if (element == "uint8") {
+        emit("punpcklbw xmm0, xmm0");
+        emit("pshuflw xmm0, xmm0, 0");
+    }
+    emit("pshufd xmm0, xmm0, 0");
+}
 
-    emit(endLabel + ":");
+// xmm0 * xmm1 lane by lane, SSE2 only multiplies words and the even doublewords so the rest is
+// assembled from partial products
+void CodeGenerator::emitVectorMultiply(const std::string& element) {
+    if (element == "uint8") {
+        // even bytes from the low half of each word product, odd ones from the products of the high bytes
+        emit("movdqa xmm2, xmm0");
+        emit("pmullw xmm2, xmm1");
+        emit("pcmpeqw xmm3, xmm3");
+        emit("psrlw xmm3, 8");
+        emit("pand xmm2, xmm3");
+        emit("psrlw xmm0, 8");
+        emit("psrlw xmm1, 8");
+        emit("pmullw xmm0, xmm1");
+        emit("psllw xmm0, 8");
+        emit("por xmm0, xmm2");
+    } else if (element == "int32") {
+        // lanes 0 and 2, then 1 and 3 shifted down, interleaved back together
+        emit("movdqa xmm2, xmm0");
+        emit("pmuludq xmm0, xmm1");
+        emit("psrlq xmm2, 32");
+        emit("psrlq xmm1, 32");
+        emit("pmuludq xmm2, xmm1");
+        emit("pshufd xmm0, xmm0, 8");
+        emit("pshufd xmm2, xmm2, 8");
+        emit("punpckldq xmm0, xmm2");
+    } else {
+        // lo * lo + ((hi * lo + lo * hi) << 32)
+        emit("movdqa xmm2, xmm0");
+        emit("psrlq xmm2, 32");
+        emit("pmuludq xmm2, xmm1");
+        emit("movdqa xmm3, xmm1");
+        emit("psrlq xmm3, 32");
+        emit("pmuludq xmm3, xmm0");
+        emit("paddq xmm2, xmm3");
+        emit("psllq xmm2, 32");
+        emit("pmuludq xmm0, xmm1");
+        emit("paddq xmm0, xmm2");
+    }
 }
 
-void CodeGenerator::visitBreakNode(const BreakNode* node) {
-    if (!loopContextStack.empty()) {
-        emit("jmp " + loopContextStack.back().endLabel);
+// xmm0 == xmm1 lane by lane into a mask in xmm0
+void CodeGenerator::emitVectorEqual(const std::string& element) {
+    if (element == "uint8") {
+        emit("pcmpeqb xmm0, xmm1");
+    } else if (element == "int32") {
+        emit("pcmpeqd xmm0, xmm1");
     } else {
-        printFatal("Break statement not within a loop");
+        // both halves of a quadword have to match
+        emit("pcmpeqd xmm0, xmm1");
+        emit("pshufd xmm1, xmm0, 0xb1");
+        emit("pand xmm0, xmm1");
     }
 }
 
-void CodeGenerator::visitContinueNode(const ContinueNode* node) {
-    if (!loopContextStack.empty()) {
-        emit("jmp " + loopContextStack.back().startLabel);
+// xmm0 > xmm1 lane by lane into a mask in xmm0, SSE2 only compares signed bytes and doublewords
+void CodeGenerator::emitVectorGreater(const std::string& element) {
+    if (element == "int32") {
+        emit("pcmpgtd xmm0, xmm1");
+        return;
+    }
+    if (element == "uint8") {
+        // flipping the top bit orders unsigned bytes like signed ones
+        emit("mov eax, 0x80808080");
+        emit("movd xmm2, eax");
+        emit("pshufd xmm2, xmm2, 0");
+        emit("pxor xmm0, xmm2");
+        emit("pxor xmm1, xmm2");
+        emit("pcmpgtb xmm0, xmm1");
+        return;
+    }
+    // high doublewords decide unless they are equal, then the low ones compared unsigned do
+    emit("movdqa xmm2, xmm0");
+    emit("pcmpgtd xmm2, xmm1");
+    emit("movdqa xmm3, xmm0");
+    emit("pcmpeqd xmm3, xmm1");
+    emit("mov eax, 0x80000000");
+    emit("movd xmm4, eax");
+    emit("pshufd xmm4, xmm4, 0");
+    emit("pxor xmm0, xmm4");
+    emit("pxor xmm1, xmm4");
+    emit("pcmpgtd xmm0, xmm1");
+    emit("pshufd xmm0, xmm0, 0xa0");
+    emit("pshufd xmm3, xmm3, 0xf5");
+    emit("pshufd xmm2, xmm2, 0xf5");
+    emit("pand xmm0, xmm3");
+    emit("por xmm0, xmm2");
+}
+
+// Widest move that fits `size`, a size that is not a multiple of it ends with one overlapping move
+static int chunkWidth(int size) {
+    return size >= 16 ? 16 : size >= 8 ? 8 : size >= 4 ? 4 : size >= 2 ? 2 : 1;
+}
+
+static std::vector<int> chunkOffsets(int size, int width) {
+    std::vector<int> offsets;
+    for (int offset = 0; offset + width <= size; offset += width) {
+        offsets.push_back(offset);
+    }
+    if (size % width != 0) {
+        offsets.push_back(size - width);
+    }
+    return offsets;
+}
+
+static std::string chunkSpecifier(int width) {
+    switch (width) {
+        case 1: return "BYTE PTR";
+        case 2: return "WORD PTR";
+        case 4: return "DWORD PTR";
+        case 8: return "QWORD PTR";
+        default: return "XMMWORD PTR";
+    }
+}
+
+// Copies `size` bytes from rsi to rdi, rax receives the destination
+void CodeGenerator::emitInlineCopy(int size) {
+    int width = chunkWidth(size);
+    std::string reg = width == 16 ? "xmm0" : subRegister("rcx", width);
+    std::string load = width == 16 ? "movdqu " : "mov ";
+    for (int offset : chunkOffsets(size, width)) {
+        emit(load, reg, ", ", chunkSpecifier(width), " ", Address{"rsi", "", 1, "", offset}.toString());
+        emit(load, chunkSpecifier(width), " ", Address{"rdi", "", 1, "", offset}.toString(), ", ", reg);
+    }
+    emit("mov rax, rdi");
+}
+
+// Fills `size` bytes at rdi with `value`, or with the low byte of rsi when it is not a constant
+void CodeGenerator::emitInlineFill(int size, const ASTNode* value) {
+    int width = chunkWidth(size);
+    bool zero = false;
+    if (value) {
+        uint64_t byte = std::stoi(dynamic_cast<const LiteralNode*>(value)->value) & 0xff;
+        zero = byte == 0;
+        emit(zero ? "xor ecx, ecx" : "mov rcx, " + std::to_string(byte * 0x0101010101010101ULL));
     } else {
-        printFatal("Continue statement not within a loop");
+        emit("movzx ecx, sil");
+        emit("mov rdx, 0x0101010101010101");
+        emit("imul rcx, rdx");
+    }
+    if (width == 16) {
+        if (zero) {
+            emit("pxor xmm0, xmm0");
+        } else {
+            emit("movq xmm0, rcx");
+            emit("punpcklqdq xmm0, xmm0");
+        }
+    }
+    std::string reg = width == 16 ? "xmm0" : subRegister("rcx", width);
+    std::string store = width == 16 ? "movdqu " : "mov ";
+    for (int offset : chunkOffsets(size, width)) {
+        emit(store, chunkSpecifier(width), " ", Address{"rdi", "", 1, "", offset}.toString(), ", ", reg);
     }
+    emit("mov rax, rdi");
 }
 
-void CodeGenerator::visitTypedefNode(const TypedefNode* node) {
-    // we actually dont need to do anything as the parser provides all the necessary information
+// Compares `size` bytes at rdi and rsi, rax receives the difference of the first unequal pair
+void CodeGenerator::emitInlineCompare(int size) {
+    std::string endLabel = generateUniqueLabel();
+    if (size < 16) {
+        emit("xor eax, eax");
+        for (int offset = 0; offset < size; ++offset) {
+            emit("movzx eax, BYTE PTR ", Address{"rdi", "", 1, "", offset}.toString());
+            emit("movzx ecx, BYTE PTR ", Address{"rsi", "", 1, "", offset}.toString());
+            emit("sub eax, ecx");
+            emit("jnz ", endLabel);
+        }
+    } else {
+        // sixteen bytes at a time, the mask of unequal bytes locates the first difference
+        std::string differLabel = generateUniqueLabel();
+        for (int offset : chunkOffsets(size, 16)) {
+            emit("movdqu xmm0, XMMWORD PTR ", Address{"rdi", "", 1, "", offset}.toString());
+            emit("movdqu xmm1, XMMWORD PTR ", Address{"rsi", "", 1, "", offset}.toString());
+            emit("pcmpeqb xmm0, xmm1");
+            emit("pmovmskb eax, xmm0");
+            emit("mov edx, ", offset);
+            emit("xor eax, 0xffff");
+            emit("jnz ", differLabel);
+        }
+        emit("xor eax, eax");
+        emit("jmp ", endLabel);
+        emit(differLabel, ":");
+        emit("bsf eax, eax");
+        emit("add eax, edx");
+        emit("movzx ecx, BYTE PTR [rdi+rax*1]");
+        emit("movzx eax, BYTE PTR [rsi+rax*1]");
+        emit("sub ecx, eax");
+        emit("mov eax, ecx");
+    }
+    emit(endLabel, ":");
+    emit("movsxd rax, eax");
 }
 
-void CodeGenerator::visitStructNode(const StructNode* node) {
-    // we actually dont need to do anything as the parser provides all the necessary information
+// Moves `source` into a register variable, kept sign or zero extended to 64 bits like a load would
+// The ABI leaves the bits of rax above a narrow integer result undefined, callers extend it again
+// and callees return it extended like any other value
+void CodeGenerator::emitExtendResult(const std::string& type) {
+    if (resolveTypeName(type) == "void" || isStructType(type) || isFloatingType(type) || isVectorType(type)) {
+        return;
+    }
+    if (resolveTypeSize(type) < 8) {
+        emitRegisterStore("rax", "rax", type);
+    }
 }
 
-std::string CodeGenerator::generateLabel(const std::string& prefix) {
-    return prefix + std::to_string(labelCounter++);
+void CodeGenerator::emitRegisterStore(const std::string& reg, const std::string& source, const std::string& type) {
+    if (reg.starts_with("xmm")) {
+        // floating point values are evaluated into xmm0 where integers go to rax
+        std::string value = source.starts_with("xmm") ? source : "xmm0";
+        if (reg != value) {
+            emit("movaps ", reg, ", ", value);
+        }
+        return;
+    }
+    int size = resolveTypeSize(type);
+    bool isUnsigned = isUnsignedType(type);
+    switch (size) {
+        case 1:
+        case 2:
+            emit((isUnsigned ? "movzx " + subRegister(reg, 4) : "movsx " + reg), ", ", subRegister(source, size));
+            break;
+        case 4:
+            emit((isUnsigned ? "mov " + subRegister(reg, 4) : "movsxd " + reg), ", ", subRegister(source, 4));
+            break;
+        default:
+            if (reg != source) {
+                emit("mov ", reg, ", ", source);
+            }
+            break;
+    }
 }
 
-std::string CodeGenerator::generateUniqueLabel() {
-    return "L" + std::to_string(labelCounter++);
+// Loads `bytes` (at most 8) from `address` zero extended into `reg`, without reading past the aggregate
+void CodeGenerator::emitLoadEightbyte(const std::string& reg, const Address& address, int bytes) {
+    static const std::unordered_map<int, std::string> specifiers = {{1, "BYTE PTR"}, {2, "WORD PTR"}, {4, "DWORD PTR"}};
+    if (bytes == 8) {
+        emit("mov ", reg, ", QWORD PTR ", address.toString());
+        return;
+    }
+
+    // split into naturally sized pieces and assemble them from the highest one down
+    std::vector<std::pair<int, int>> pieces; // offset, size
+    for (int offset = 0; offset < bytes;) {
+        int size = bytes - offset >= 4 ? 4 : bytes - offset >= 2 ? 2 : 1;
+        pieces.emplace_back(offset, size);
+        offset += size;
+    }
+    for (auto it = pieces.rbegin(); it != pieces.rend(); ++it) {
+        Address piece = address;
+        piece.displacement += it->first;
+        std::string target = it == pieces.rbegin() ? reg : "r10";
+        std::string load = it->second == 4 ? "mov " + subRegister(target, 4) + ", " : "movzx " + subRegister(target, 4) + ", ";
+        emit(load, specifiers.at(it->second), " ", piece.toString());
+        if (it != pieces.rbegin()) {
+            emit("shl ", reg, ", ", 8 * it->second);
+            emit("or ", reg, ", r10");
+        }
+    }
 }
 
-void CodeGenerator::emit(const std::string& code) {
-    generatedCode.push_back(code);
+// Stores the low `bytes` (at most 8) of `reg` to `address`
+void CodeGenerator::emitStoreEightbyte(const std::string& reg, const Address& address, int bytes) {
+    static const std::unordered_map<int, std::string> specifiers = {{1, "BYTE PTR"}, {2, "WORD PTR"}, {4, "DWORD PTR"}, {8, "QWORD PTR"}};
+    if (specifiers.count(bytes)) {
+        emit("mov ", specifiers.at(bytes), " ", address.toString(), ", ", subRegister(reg, bytes));
+        return;
+    }
+
+    emit("mov r10, ", reg);
+    for (int offset = 0; offset < bytes;) {
+        int size = bytes - offset >= 4 ? 4 : bytes - offset >= 2 ? 2 : 1;
+        Address piece = address;
+        piece.displacement += offset;
+        emit("mov ", specifiers.at(size), " ", piece.toString(), ", ", subRegister("r10", size));
+        emit("shr r10, ", 8 * size);
+        offset += size;
+    }
 }
 
 int CodeGenerator::calculateLocalVariableSize(const BlockNode* block) {
     int totalSize = 0;
+    int nestedSize = 0;
 
     for (const auto& statement : block->statements) {
         switch (statement->getType()) {
             case NodeType::VarDecl: {
                 const auto* varDeclNode = dynamic_cast<const VarDeclNode*>(statement.get());
-                totalSize += resolveTypeSize(varDeclNode->type);
+                totalSize += localSlotSize(varDeclNode->name, varDeclNode->type, varDeclNode->initByAddr);
                 break;
             }
             case NodeType::VarDeclAssign: {
                 const auto* varDeclAssignNode = dynamic_cast<const VarDeclAssignNode*>(statement.get());
-                totalSize += resolveTypeSize(varDeclAssignNode->type);
+                totalSize += localSlotSize(varDeclAssignNode->name, varDeclAssignNode->type, varDeclAssignNode->initByAddr);
                 break;
             }
-            // each block handles its own local variables
             default:
+                // nested blocks are never live at the same time, they share the space after ours
+                nestedSize = std::max(nestedSize, calculateNestedSize(statement.get()));
                 break;
         }
     }
 
-    return totalSize;
+    return totalSize + nestedSize;
+}
+
+int CodeGenerator::calculateNestedSize(const ASTNode* node) {
+    if (node->getType() == NodeType::Block) {
+        return calculateLocalVariableSize(dynamic_cast<const BlockNode*>(node));
+    }
+
+    int size = 0;
+    forEachChild(node, [this, &size](const ASTNode* child) {
+        size = std::max(size, calculateNestedSize(child));
+    });
+    if (node->getType() == NodeType::Switch && !hasLiteralCases(dynamic_cast<const SwitchNode*>(node))) {
+        size += 8; // the switch condition slot
+    }
+    return size;
+}
+
+int CodeGenerator::callResultSize(const ASTNode* node) const {
+    int size = 0;
+    if (const auto* call = dynamic_cast<const FunctionCallNode*>(node)) {
+        auto signature = program->functionSignatures.find(call->name);
+        if (signature != program->functionSignatures.end() && isStructType(signature->second.returnType)) {
+            size += alignTo(resolveTypeSize(signature->second.returnType), 8);
+        }
+    }
+    forEachChild(node, [this, &size](const ASTNode* child) { size += callResultSize(child); });
+    return size;
 }
 
 void CodeGenerator::emitFunctionPrologue(const FunctionNode* node) {
-    emit("section .text");
-    emit(".global " + currentFunctionName);
-    emit(currentFunctionName + ":");
+    frameSize = returnsInMemory(currentReturnType) ? 8 : 0;
+    for (size_t i = 0; i < node->params.size(); ++i) {
+        const auto* param = dynamic_cast<const ParameterNode*>(node->params[i].get());
+        if (!registerFor(param->name, param->type).empty()) {
+            continue;
+        }
+        if (!parameterLocations[i].registers.empty()) {
+            frameSize += isStructType(param->type) || isVectorType(param->type) ? alignTo(resolveTypeSize(param->type), 8) : 8;
+            frameSize += slotPadding(param->type);
+        }
+        if (functionAnalysis->isPointerBacked(param->name)) {
+            frameSize += 8;
+        }
+    }
+    frameSize += calculateLocalVariableSize(dynamic_cast<const BlockNode*>(node->body.get()));
+
+    // every call returning an aggregate gets its own buffer, results of nested calls stay live
+    frameSize += callResultSize(node->body.get());
+    callResultOffset = -frameSize;
+
+    // callee saved registers we hand out are preserved below the locals
+    std::set<std::string> usedRegisters;
+    for (const auto& [name, reg] : registerVariables) {
+        if (std::find(calleeSavedRegisters.begin(), calleeSavedRegisters.end(), reg) != calleeSavedRegisters.end()) {
+            usedRegisters.insert(reg);
+        }
+    }
+    if (!usedRegisters.empty()) {
+        frameSize = (frameSize + 7) & ~7;
+    }
+    for (const auto& reg : usedRegisters) {
+        frameSize += 8;
+        savedRegisters.emplace_back(reg, -frameSize);
+    }
+    if (instrumentFunctions) {
+        frameSize = alignTo(frameSize, 8) + 16;
+        profileOffset = -frameSize;
+    }
+
+    if (frameSize % 16 != 0) {
+        frameSize += 16 - (frameSize % 16);
+    }
+
+    emit(functionSection());
+    emit(".global ", currentFunctionName);
+    emit(".type ", currentFunctionName, ", @function");
+    emit(currentFunctionName, ":");
+    bool debug = !debugFiles.empty();
+    if (debug) {
+        emit(".loc ", currentFile, " ", node->line, " ", node->column);
+        emit(".cfi_startproc");
+    }
     emit("push rbp");
+    if (debug) {
+        emit(".cfi_def_cfa_offset 16");
+        emit(".cfi_offset rbp, -16");
+    }
     emit("mov rbp, rsp");
+    if (debug) {
+        emit(".cfi_def_cfa_register rbp");
+    }
+    if (frameSize > 0) {
+        emit("sub rsp, ", frameSize);
+    }
+    for (const auto& [reg, offset] : savedRegisters) {
+        emit("mov QWORD PTR [rbp", offset, "], ", reg);
+    }
+    if (instrumentFunctions) {
+        // the arguments are still in their registers, rdx is one of them
+        emit("mov QWORD PTR [rbp", profileOffset, "], rdx");
+        emit("rdtsc");
+        emit("shl rdx, 32");
+        emit("or rax, rdx");
+        emit("mov rdx, QWORD PTR [rbp", profileOffset, "]");
+        emit("mov QWORD PTR [rbp", profileOffset, "], rax");
+        emit("mov rax, QWORD PTR [rip+__ents_prof_children]");
+        emit("mov QWORD PTR [rbp", profileOffset + 8, "], rax");
+        emit("inc QWORD PTR [rip+.L_prof_", currentFunctionName, "]");
+    }
+    emitCounterIncrement(0);
+}
+
+// Numbers the counters from the AST rather than while generating code, so a profiled build
+// and the build using its profile agree on them whatever order the code is laid out in.
+void CodeGenerator::assignCounters(const FunctionNode* function) {
+    counterIndices.clear();
+    counterCount = 1;
+    std::function<void(const ASTNode*)> visit = [&](const ASTNode* node) {
+        if (!node) {
+            return;
+        }
+        switch (node->getType()) {
+            case NodeType::If:
+            case NodeType::While:
+                counterIndices[node] = counterCount;
+                counterCount += 2; // then and else edge, loop entry and body
+                break;
+            case NodeType::Switch:
+                counterIndices[node] = counterCount;
+                counterCount += dynamic_cast<const SwitchNode*>(node)->cases.size();
+                break;
+            case NodeType::FunctionCall:
+                counterIndices[node] = counterCount++;
+                break;
+            default:
+                break;
+        }
+        forEachChild(node, visit);
+    };
+    visit(function->body.get());
+
+    functionProfile = nullptr;
+    if (profileUse) {
+        functionProfile = profileUse->counters(function->name);
+        if (functionProfile && functionProfile->size() != static_cast<size_t>(counterCount)) {
+            printWarning(("profile of " + function->name + " does not match its source, ignoring it").c_str());
+            functionProfile = nullptr;
+        }
+    }
+}
+
+int CodeGenerator::counterFor(const ASTNode* node) const {
+    auto it = counterIndices.find(node);
+    return it == counterIndices.end() ? -1 : it->second;
+}
+
+void CodeGenerator::emitCounterIncrement(int counter) {
+    if (profileGenerate && counter >= 0) {
+        emit("inc QWORD PTR [rip+.L_pgo_", currentFunctionName, "+", 8 * counter, "]");
+    }
+}
+
+std::optional<uint64_t> CodeGenerator::profileCount(int counter) const {
+    if (!functionProfile || counter < 0) {
+        return std::nullopt;
+    }
+    return (*functionProfile)[counter];
+}
+
+// Emits `body` out of line at `label`, it jumps back to `resume` unless that is empty. Blocks
+// nested in a cold block are already out of line and are laid out in place by the caller.
+void CodeGenerator::emitColdBlock(const std::string& label, const std::string& resume, const std::function<void()>& body) {
+    std::swap(generatedCode, coldCode);
+    emittingCold = true;
+    emit(label, ":");
+    body();
+    if (!resume.empty()) {
+        emit("jmp ", resume);
+    }
+    emittingCold = false;
+    std::swap(generatedCode, coldCode);
+}
+
+// The cold part is a function symbol of its own with its own unwind entry, like gcc's foo.cold,
+// entered with the frame already set up.
+void CodeGenerator::emitColdCode() {
+    if (coldCode.size() == 0) {
+        return;
+    }
+    std::string name = currentFunctionName + ".cold";
+    emit(".section .text.cold,\"ax\",@progbits");
+    emit(".type ", name, ", @function");
+    emit(name, ":");
+    if (!debugFiles.empty()) {
+        emit(".cfi_startproc");
+        emit(".cfi_def_cfa rbp, 16");
+        emit(".cfi_offset rbp, -16");
+    }
+    generatedCode.splice(std::move(coldCode));
+    coldCode = OutputBuffer();
+    if (!debugFiles.empty()) {
+        emit(".cfi_endproc");
+    }
+    emit(".size ", name, ", .-", name);
+    emit(".text");
+}
+
+// Functions that never ran go to .text.unlikely and the busiest ones to .text.hot, the linker
+// groups both so the code that matters shares pages and cache lines.
+std::string CodeGenerator::functionSection() const {
+    std::optional<uint64_t> entries = profileCount(0);
+    if (!entries) {
+        return ".text";
+    }
+    if (*entries == 0) {
+        return ".section .text.unlikely,\"ax\",@progbits";
+    }
+    if (*entries * 100 >= profileUse->maxEntryCount()) {
+        return ".section .text.hot,\"ax\",@progbits";
+    }
+    return ".text";
+}
+
+// Constants of one width share a mergeable section, the linker folds equal ones across functions
+void CodeGenerator::emitFloatConstants() {
+    for (int width : {4, 8}) {
+        bool started = false;
+        for (const auto& [directive, label] : floatConstants) {
+            if (directive.starts_with(".float") != (width == 4)) {
+                continue;
+            }
+            if (!started) {
+                emit(".section .rodata.cst", width, ",\"aM\",@progbits,", width);
+                emit(".align ", width);
+                started = true;
+            }
+            emit(label, ": ", directive);
+        }
+    }
 }
 
 void CodeGenerator::emitFunctionEpilogue() {
-    emit(".L_return_" + currentFunctionName + ":");
+    emit(".L_return_", currentFunctionName, ":");
+    if (instrumentFunctions) {
+        // rax and rdx hold the result, the cycles of callees are whatever the shared counter grew by
+        emit("mov rcx, rax");
+        emit("mov rsi, rdx");
+        emit("rdtsc");
+        emit("shl rdx, 32");
+        emit("or rax, rdx");
+        emit("sub rax, QWORD PTR [rbp", profileOffset, "]");
+        emit("add QWORD PTR [rip+.L_prof_", currentFunctionName, "+8], rax");
+        emit("mov rdx, QWORD PTR [rbp", profileOffset + 8, "]");
+        emit("mov rdi, QWORD PTR [rip+__ents_prof_children]");
+        emit("sub rdi, rdx");
+        emit("add rdx, rax");
+        emit("mov QWORD PTR [rip+__ents_prof_children], rdx");
+        emit("sub rax, rdi");
+        emit("add QWORD PTR [rip+.L_prof_", currentFunctionName, "+16], rax");
+        emit("mov rax, rcx");
+        emit("mov rdx, rsi");
+    }
+    for (const auto& [reg, offset] : savedRegisters) {
+        emit("mov ", reg, ", QWORD PTR [rbp", offset, "]");
+    }
     emit("leave");
+    if (!debugFiles.empty()) {
+        emit(".cfi_def_cfa rsp, 8");
+    }
     emit("ret");
+    if (!debugFiles.empty()) {
+        emit(".cfi_endproc");
+    }
+    // sized symbols let profilers and debuggers attribute every address to its function
+    emit(".size ", currentFunctionName, ", .-", currentFunctionName);
+    emitColdCode();
+
+    if (instrumentFunctions) {
+        // calls, inclusive and exclusive cycles, found by the runtime through the ents_prof section
+        emit(".bss");
+        emit(".align 8");
+        emit(".L_prof_", currentFunctionName, ": .zero 24");
+        emit(".section .rodata");
+        emit(".L_prof_name_", currentFunctionName, ": .string \"", currentFunctionName, "\"");
+        emit(".section ents_prof,\"aw\",@progbits");
+        emit(".align 8");
+        emit(".quad .L_prof_name_", currentFunctionName, ", .L_prof_", currentFunctionName);
+        emit(".text");
+    }
+    if (profileGenerate) {
+        // the runtime finds every table through the ents_pgo section and writes them out at exit
+        emit(".bss");
+        emit(".align 8");
+        emit(".L_pgo_", currentFunctionName, ": .zero ", 8 * counterCount);
+        emit(".section .rodata");
+        emit(".L_pgo_name_", currentFunctionName, ": .string \"", currentFunctionName, "\"");
+        emit(".section ents_pgo,\"aw\",@progbits");
+        emit(".align 8");
+        emit(".quad .L_pgo_name_", currentFunctionName, ", ", counterCount, ", .L_pgo_", currentFunctionName);
+        emit(".text");
+    }
 }
 
 std::string CodeGenerator::resolveTypeName(const std::string& type) const {
-    auto it = typedefs.find(type);
-    if (it != typedefs.end()) {
-        return it->second;
+    return EntS::resolveTypeName(type, typedefs, structDefinitions);
+}
+
+bool CodeGenerator::isStructType(const std::string& type) const {
+    return structDefinitions.count(resolveTypeName(type)) != 0;
+}
+
+bool CodeGenerator::isFloatingType(const std::string& type) const {
+    return EntS::isFloatingType(type, typedefs, structDefinitions);
+}
+
+bool CodeGenerator::isVectorType(const std::string& type) const {
+    return EntS::isVectorType(type, typedefs, structDefinitions);
+}
+
+// Frame and data slots of vectors are 16 byte aligned, anything reached through a pointer may not be
+std::string CodeGenerator::vectorMove(const Address& address, const std::string& type) const {
+    bool aligned = (address.base == "rbp" || address.base == "rip") && address.index.empty() && address.displacement % 16 == 0;
+    if (resolveTypeName(type) == "floatx4") {
+        return aligned ? "movaps" : "movups";
+    }
+    return aligned ? "movdqa" : "movdqu";
+}
+
+std::string CodeGenerator::operandType(const ASTNode* node) const {
+    TypeEnvironment environment{typedefs, structDefinitions,
+        [this](const std::string& name) { return getVariableType(name); },
+        [this](const std::string& name) -> std::string {
+            auto it = program->functionSignatures.find(name);
+            return it != program->functionSignatures.end() ? it->second.returnType : "";
+        }};
+    return expressionType(node, environment);
+}
+
+// Memory operand of a constant in .rodata, equal constants share one entry
+std::string CodeGenerator::floatConstant(const std::string& value, const std::string& type) {
+    bool single = resolveTypeName(type) == "float";
+    std::string directive = (single ? ".float " : ".double ") + value;
+    auto it = floatConstants.find(directive);
+    if (it == floatConstants.end()) {
+        it = floatConstants.emplace(directive, ".LC" + currentFunctionName + "." + std::to_string(floatConstants.size())).first;
+    }
+    return (single ? "DWORD PTR [rip+" : "QWORD PTR [rip+") + it->second + "]";
+}
+
+bool CodeGenerator::isUnsignedType(const std::string& type) const {
+    std::string resolvedType = resolveTypeName(type);
+    return resolvedType.starts_with("uint") || resolvedType == "char" || resolvedType == "bool";
+}
+
+std::string CodeGenerator::sizeSpecifier(const std::string& type) const {
+    switch (resolveTypeSize(type)) {
+        case 1: return "BYTE PTR";
+        case 2: return "WORD PTR";
+        case 4: return "DWORD PTR";
+        default: return "QWORD PTR";
     }
-    return type;
 }
 
 } // namespace EntS
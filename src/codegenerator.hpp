@@ -2,8 +2,17 @@
 #define CODE_GENERATOR_HPP
 
 #include "ast.hpp"
+#include "analysis.hpp"
+#include "outputbuffer.hpp"
+#include "profile.hpp"
+#include "stackusage.hpp"
+#include <functional>
 #include <map>
+#include <memory>
+#include <optional>
+#include <set>
 #include <string>
+#include <tuple>
 #include <vector>
 #include <unordered_map>
 
@@ -11,28 +20,113 @@ namespace EntS {
 
 class CodeGenerator {
 public:
-    explicit CodeGenerator(const std::unordered_map<std::string, std::string>& typedefs, const std::unordered_map<std::string, std::vector<std::string>>& structs);
+    // functions are compiled on up to `jobs` threads, the output does not depend on the count
+    explicit CodeGenerator(const std::unordered_map<std::string, std::string>& typedefs, const StructDefinitions& structs, unsigned jobs = 1);
+    // emits .file/.loc line information and call frame information, functions name their file by index
+    void setDebugInfo(const std::vector<std::string>& sourceFiles);
+    // counts calls and rdtsc cycles of every function, the runtime in intlibe.a dumps them at exit
+    void setInstrumentFunctions(bool enabled);
+    // counts branch edges, calls and function entries for -fprofile-generate
+    void setProfileGenerate(bool enabled);
+    // lays out branches, loops, switches and functions by the counts of an earlier run
+    void setProfileUse(std::shared_ptr<const ProfileData> profile);
     void generateCode(const ASTNodePtr& root);
     std::string getGeneratedCode() const;
+    // frame sizes and direct callees of every generated function, in program order
+    const std::vector<FunctionStackUsage>& getStackUsage() const { return stackUsage; }
+    bool writeGeneratedCode(int fd) const;
 
 private:
+    struct LocalVariable {
+        int offset;       // rbp relative slot, holds the address for pointer backed variables
+        std::string type;
+        bool pointer;     // loads and stores go through the address kept in the slot
+        std::string reg;  // register holding the value, empty when it lives in the frame
+    };
+
+    // A memory operand of the form [base + index * scale + symbol + displacement]
+    struct Address {
+        std::string base;
+        std::string index;
+        int scale = 1;
+        std::string symbol;
+        int displacement = 0;
+
+        std::string toString() const;
+    };
+
+    struct MemberInfo {
+        std::string root;
+        int offset;
+        std::string type;
+    };
+
+    // System V eightbyte classes, aggregates that get none are passed in memory
+    enum class ArgumentClass { Integer, Sse };
+
+    struct ArgumentLocation {
+        std::vector<std::string> registers; // one per eightbyte, empty when passed on the stack
+        int stackOffset = -1;               // offset into the outgoing argument area
+    };
+
+    struct FunctionSignature {
+        std::string returnType;
+        std::vector<std::string> paramTypes;
+    };
+
+    // Everything known about the program before any function is generated, shared read only
+    struct ProgramSymbols {
+        std::unordered_map<std::string, FunctionSignature> functionSignatures;
+        std::unordered_map<std::string, VariableInfo> globalVariables;
+        std::set<std::string> externalGlobals; // declared in a header, may live in a shared library
+        std::unordered_map<std::string, std::string> stringAddresses; // literal bytes -> label and offset in the pool
+        std::vector<std::pair<std::string, std::string>> stringPool;   // label, bytes of every string emitted
+    };
+
+    // Generator for a single function of the program `parent` generates, with labels and constants of its own
+    CodeGenerator(const CodeGenerator& parent, const std::string& functionName);
+
     void enterFunction(const FunctionNode* function);
     void exitFunction();
+    void allocateRegisters(const FunctionNode* function);
+    bool movesAggregates(const FunctionNode* function) const;
+    std::string registerFor(const std::string& name, const std::string& type) const;
+    std::vector<ArgumentClass> classifyAggregate(const std::string& type) const;
+    std::vector<ArgumentLocation> planArguments(const std::vector<std::string>& types, bool hiddenReturn, int& stackBytes) const;
+    bool returnsInMemory(const std::string& type) const;
 
     void enterScope();
     void exitScope();
 
     std::string getVariableType(const std::string& name) const;
-    void addLocalVariable(const std::string& name);
+    const LocalVariable* findLocalVariable(const std::string& name) const;
 
     int getLocalVariableOffset(const std::string& name) const;
 
+    void collectSymbols(const ProgramNode* node);
+    void collectStringLiterals(const ProgramNode* node);
+    void emitStringPool();
+    OutputBuffer generateFunction(const FunctionNode* node, FunctionStackUsage& usage) const;
     void visitProgramNode(const ProgramNode* node);
     void visitFunctionNode(const FunctionNode* node);
     void visitVarDeclNode(const VarDeclNode* node);
     void visitVarDeclAssignNode(const VarDeclAssignNode* node);
     void visitAssignNode(const AssignNode* node);
+    void visitIndexationAssignNode(const IndexationAssignNode* node);
+    void visitMemoryAssignNode(const MemoryAssignNode* node);
+    void visitStructMemberAssignNode(const StructMemberAssignNode* node);
+    void visitIncrementNode(const IncrementNode* node);
+    void visitDecrementNode(const DecrementNode* node);
+    void visitOperand(const ASTNode* node);
+    void visitOperandAs(const ASTNode* node, const std::string& type);
+    void visitCondition(const ASTNode* node);
     void visitExpressionNode(const ExpressionNode* node);
+    void visitFloatExpressionNode(const ExpressionNode* node, const std::string& type);
+    void visitVectorExpressionNode(const ExpressionNode* node, const std::string& type);
+    bool visitBuiltinCall(const FunctionCallNode* node);
+    void visitMemoryBuiltin(const FunctionCallNode* node);
+    void visitVectorBuiltin(const FunctionCallNode* node);
+    void evaluateIntoRegisters(const std::vector<const ASTNode*>& operands);
     void visitReturnNode(const ReturnNode* node);
     void visitIfNode(const IfNode* node);
     void visitWhileNode(const WhileNode* node);
@@ -40,39 +134,139 @@ private:
     void visitFunctionCallNode(const FunctionCallNode* node);
     void visitLiteralNode(const LiteralNode* node);
     void visitIdentifierNode(const IdentifierNode* node);
+    void visitIndexNode(const IndexNode* node);
+    void visitMemoryAddressNode(const MemoryAddressNode* node);
     void visitStructMemberAccessNode(const StructMemberAccessNode* node);
 	void visitBreakNode(const BreakNode* node);
 	void visitContinueNode(const ContinueNode* node);
+    void visitAsmNode(const AsmNode* node);
     void visitGlobalVarDeclNode(const GlobalVarDeclNode* node);
+    void visitGlobalVarDeclAssignNode(const GlobalVarDeclAssignNode* node);
     void visitStructNode(const StructNode* node);
     void visitTypedefNode(const TypedefNode* node);
     void visitSwitchNode(const SwitchNode* node);
 
+    // bytes of a global worked out at compile time, as data directives
+    struct StaticData {
+        std::vector<std::pair<std::string, std::string>> directives; // directive, operands
+        int size = 0;
+        bool zero = true;       // nothing but zero bytes, the global can go to .bss
+        bool relocated = false; // holds addresses the loader fills in
+    };
+
+    void collectStaticData(const ASTNode* node, const std::string& type, StaticData& data, const std::string& global) const;
+    Constant staticScalar(const ASTNode* node, const std::string& type, const std::string& global) const;
+    std::optional<std::string> staticAddress(const ASTNode* node) const;
+    void appendStaticData(StaticData& data, const std::string& directive, const std::string& operand, int bytes, bool zero) const;
+    void padStaticData(StaticData& data, int size) const;
+    void emitStaticData(const std::string& label, int alignment, const StaticData& data, const std::string& section);
+
     std::string generateLabel(const std::string& prefix);
     std::string generateUniqueLabel();
     int resolveTypeSize(const std::string& type) const;
-    void addLocalVariable(const std::string& name, const std::string& type);
+    int resolveTypeAlignment(const std::string& type) const;
+    void collectScalarFields(const std::string& type, int base, std::vector<std::pair<int, std::string>>& fields) const;
+    void collectAggregateElements(const ASTNode* value, const std::string& type, int base, std::vector<std::tuple<int, std::string, const ASTNode*>>& elements) const;
+    void addLocalVariable(const std::string& name, const std::string& type, bool byAddr = false);
+    int reserveSlot(int size, const std::string& type);
+    int slotPadding(const std::string& type) const;
 
-    void emit(const std::string& code);
+    // one line of assembly, the parts are strings or integers and are formatted straight into the buffer
+    template <typename... Parts>
+    void emit(const Parts&... parts) {
+        generatedCode.line(parts...);
+    }
+    void emitPush(const std::string& reg);
+    void emitPop(const std::string& reg);
+    // accounts for `slots` more 8 byte pushes, the deepest point goes into the stack usage
+    void growStack(int slots);
+    void emitLoad(const Address& address, const std::string& type);
+    void emitStore(const Address& address, const std::string& type);
+    void emitPushValue(const std::string& type);
+    void emitPushAggregate(const ASTNode* value, const std::string& type);
+    bool returnsInRegisters(const ASTNode* value, const std::string& type) const;
+    void emitRegisterReturn(const ASTNode* value, const std::string& type);
+    void emitPopValue(const std::string& type);
+    void emitConvert(const std::string& from, const std::string& to);
+    void emitBroadcast(const std::string& from, const std::string& to);
+    void emitVectorMultiply(const std::string& element);
+    void emitVectorEqual(const std::string& element);
+    void emitVectorGreater(const std::string& element);
+    void emitInlineCopy(int size);
+    void emitInlineFill(int size, const ASTNode* value);
+    void emitInlineCompare(int size);
+    void emitRegisterStore(const std::string& reg, const std::string& source, const std::string& type);
+    void emitExtendResult(const std::string& type);
+    void emitLoadEightbyte(const std::string& reg, const Address& address, int bytes);
+    void emitStoreEightbyte(const std::string& reg, const Address& address, int bytes);
     void emitFunctionPrologue(const FunctionNode* node);
     void emitFunctionEpilogue();
+    void emitFloatConstants();
+    void assignCounters(const FunctionNode* function);
+    int counterFor(const ASTNode* node) const;
+    void emitCounterIncrement(int counter);
+    std::optional<uint64_t> profileCount(int counter) const;
+    std::string functionSection() const;
+    void emitColdBlock(const std::string& label, const std::string& resume, const std::function<void()>& body);
+    void emitColdCode();
+
+    Address variableAddress(const std::string& name, const std::string& scratch);
+    Address indexAddress(const std::string& name, const std::string& indexReg, const std::string& scratch);
+    MemberInfo resolveMemberAccess(const StructMemberAccessNode* node) const;
 
     std::string resolveTypeName(const std::string& type) const;
+    bool isStructType(const std::string& type) const;
+    bool isUnsignedType(const std::string& type) const;
+    bool isFloatingType(const std::string& type) const;
+    bool isVectorType(const std::string& type) const;
+    std::string vectorMove(const Address& address, const std::string& type) const;
+    std::string operandType(const ASTNode* node) const;
+    std::string floatConstant(const std::string& value, const std::string& type);
+    std::string sizeSpecifier(const std::string& type) const;
     int calculateLocalVariableSize(const BlockNode* block);
+    int calculateNestedSize(const ASTNode* node);
+    int callResultSize(const ASTNode* node) const;
+    int localSlotSize(const std::string& name, const std::string& type, bool byAddr) const;
+    bool hasLiteralCases(const SwitchNode* node) const;
 
     // Variables to keep track of context
-    std::vector<std::map<std::string, std::pair<int, std::string>>> localVarStack; // Stack of local variable offsets
+    std::vector<std::map<std::string, LocalVariable>> localVarStack; // Stack of local variable offsets
     std::string currentFunctionName;
+    std::string currentReturnType;
+    std::vector<ArgumentLocation> parameterLocations;
+    int hiddenReturnOffset; // slot holding the caller's buffer for aggregates returned in memory
+    int callResultOffset;   // next frame buffer receiving an aggregate returned by a call
+    std::optional<FunctionAnalysis> functionAnalysis;
+    std::unordered_map<std::string, std::string> registerVariables; // non escaping scalars kept in registers
+    std::vector<std::pair<std::string, int>> savedRegisters; // register, frame slot it is preserved in
     int localVarOffset; // Current stack offset for local variables
-    int labelCounter; // For generating unique labels
-    std::vector<std::string> generatedCode; // To store generated assembly code
+    int labelCounter; // For generating unique labels, numbered per function
+    int stackDepth; // Number of 8 byte pushes outstanding, used to align calls
+    int maxStackDepth; // the most pushes outstanding at any point of the current function
+    int frameSize; // bytes the prologue reserves below the saved rbp
+    std::vector<FunctionStackUsage> stackUsage; // one per function, the child generator has just its own
+    OutputBuffer generatedCode; // To store generated assembly code
+    std::map<std::string, std::string> floatConstants; // data directive -> .rodata label
+    std::unordered_map<std::string, Constant> staticConstants; // values of the scalar `const` globals initialised so far
+    std::vector<std::string> debugFiles; // empty unless line information is wanted
+    int currentFile; // .file number of the current function
+    bool instrumentFunctions;
+    int profileOffset; // entry timestamp, the caller's child cycles above it
+    bool profileGenerate;
+    std::shared_ptr<const ProfileData> profileUse;
+    std::unordered_map<const ASTNode*, int> counterIndices; // first counter of each branch, loop, switch and call
+    int counterCount; // counters of the current function, counter 0 counts its entries
+    const std::vector<uint64_t>* functionProfile; // counts of the current function, nullptr without a usable profile
+    OutputBuffer coldCode; // unlikely blocks of the current function, emitted after it in .text.cold
+    bool emittingCold;
+    unsigned jobs;
 
     // System V ABI specifics
     std::vector<std::string> argumentRegisters; // System V ABI argument registers
-    int currentArgOffset; // Offset for arguments passed on the stack
+    std::shared_ptr<ProgramSymbols> program;
 
-	std::unordered_map<std::string, std::string> typedefs;
-    std::unordered_map<std::string, std::vector<std::string>> structDefinitions;
+    const std::unordered_map<std::string, std::string>& typedefs;
+    const StructDefinitions& structDefinitions;
 
     struct LoopContext {
         std::string startLabel;
@@ -80,8 +274,6 @@ private:
     };
 
     std::vector<LoopContext> loopContextStack;
-
-    int totalLocalVarOffset;
 };
 
 } // namespace EntS
@@ -0,0 +1,443 @@
+#include "costmodel.hpp"
+#include <algorithm>
+#include <iomanip>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace EntS {
+
+namespace {
+
+struct Timing {
+    double latency;
+    double throughput; // reciprocal, cycles per instruction when nothing else competes
+};
+
+// register forms, roughly Skylake as measured by Agner Fog; memory operands are added on top
+const std::unordered_map<std::string_view, Timing> timings = {
+    {"mov", {1, 0.25}}, {"movzx", {1, 0.25}}, {"movsx", {1, 0.25}}, {"movsxd", {1, 0.25}},
+    {"lea", {1, 0.5}},
+    {"add", {1, 0.25}}, {"sub", {1, 0.25}}, {"and", {1, 0.25}}, {"or", {1, 0.25}}, {"xor", {1, 0.25}},
+    {"cmp", {1, 0.25}}, {"test", {1, 0.25}}, {"inc", {1, 0.25}}, {"dec", {1, 0.25}},
+    {"neg", {1, 0.25}}, {"not", {1, 0.25}},
+    {"shl", {1, 0.5}}, {"shr", {1, 0.5}}, {"sar", {1, 0.5}},
+    {"imul", {3, 1}}, {"mul", {3, 1}}, {"idiv", {42, 24}}, {"div", {35, 21}},
+    {"cqo", {1, 0.5}}, {"cdq", {1, 0.5}}, {"bsf", {3, 1}},
+    {"push", {1, 1}}, {"pop", {0, 0.5}}, {"leave", {3, 1}},
+    {"jmp", {0, 1}}, {"call", {3, 2}}, {"ret", {0, 1}},
+    {"movq", {2, 1}}, {"movd", {2, 1}},
+    {"movsd", {1, 0.33}}, {"movss", {1, 0.33}}, {"movaps", {1, 0.33}}, {"movups", {1, 0.33}},
+    {"movdqa", {1, 0.33}}, {"movdqu", {1, 0.33}},
+    {"addsd", {4, 0.5}}, {"subsd", {4, 0.5}}, {"mulsd", {4, 0.5}}, {"divsd", {14, 4}},
+    {"addss", {4, 0.5}}, {"subss", {4, 0.5}}, {"mulss", {4, 0.5}}, {"divss", {11, 3}},
+    {"addps", {4, 0.5}}, {"subps", {4, 0.5}}, {"mulps", {4, 0.5}}, {"divps", {11, 5}},
+    {"sqrtsd", {18, 6}}, {"sqrtss", {12, 3}},
+    {"cvtsi2sd", {4, 1}}, {"cvtsi2ss", {4, 1}}, {"cvttsd2si", {6, 1}}, {"cvttss2si", {6, 1}},
+    {"cvtss2sd", {5, 1}}, {"cvtsd2ss", {5, 1}},
+    {"ucomisd", {3, 1}}, {"ucomiss", {3, 1}}, {"comisd", {3, 1}}, {"comiss", {3, 1}},
+    {"pxor", {1, 0.33}}, {"xorps", {1, 0.33}}, {"pand", {1, 0.33}}, {"por", {1, 0.33}},
+    {"paddq", {1, 0.33}}, {"paddd", {1, 0.33}}, {"pmuludq", {5, 0.5}}, {"pmullw", {5, 0.5}},
+    {"pcmpeqb", {1, 0.5}}, {"pcmpeqw", {1, 0.5}}, {"pcmpeqd", {1, 0.5}}, {"pcmpgtb", {1, 0.5}}, {"pcmpgtd", {1, 0.5}},
+    {"pshufd", {1, 1}}, {"pshuflw", {1, 1}}, {"shufps", {1, 1}},
+    {"punpcklbw", {1, 1}}, {"punpckldq", {1, 1}}, {"punpcklqdq", {1, 1}},
+    {"psllw", {1, 0.5}}, {"pslld", {1, 0.5}}, {"psllq", {1, 0.5}}, {"psrlw", {1, 0.5}}, {"psrlq", {1, 0.5}},
+    {"pmovmskb", {2, 1}}, {"pextrw", {3, 1}},
+    // microcoded string operations, the start up cost of a short copy
+    {"rep", {35, 16}},
+};
+
+constexpr Timing unknownTiming = {1, 1};
+constexpr double loadLatency = 5;   // an L1 hit, also what forwarding a store in flight costs
+constexpr double loadThroughput = 0.5;
+constexpr double storeThroughput = 1;
+
+Timing timingOf(const std::string& mnemonic) {
+    if (auto it = timings.find(mnemonic); it != timings.end()) {
+        return it->second;
+    }
+    if (mnemonic.starts_with("set") || mnemonic.starts_with("cmov")) {
+        return {1, 0.5};
+    }
+    if (mnemonic[0] == 'j') {
+        return {0, 0.5};
+    }
+    return unknownTiming;
+}
+
+// the 64 bit register an operand names, "" when it is not a register
+std::string registerOf(std::string_view operand) {
+    static const std::unordered_map<std::string_view, std::string_view> aliases = [] {
+        std::unordered_map<std::string_view, std::string_view> map;
+        static const char* const legacy[][5] = {
+            {"rax", "eax", "ax", "al", "ah"}, {"rbx", "ebx", "bx", "bl", "bh"},
+            {"rcx", "ecx", "cx", "cl", "ch"}, {"rdx", "edx", "dx", "dl", "dh"},
+            {"rsi", "esi", "si", "sil", ""}, {"rdi", "edi", "di", "dil", ""},
+            {"rbp", "ebp", "bp", "bpl", ""}, {"rsp", "esp", "sp", "spl", ""},
+        };
+        for (const auto& names : legacy) {
+            for (const char* name : names) {
+                if (*name) {
+                    map[name] = names[0];
+                }
+            }
+        }
+        static const std::vector<std::string> numbered = [] {
+            std::vector<std::string> names;
+            for (int i = 8; i < 16; ++i) {
+                std::string base = "r" + std::to_string(i);
+                names.insert(names.end(), {base, base + "d", base + "w", base + "b"});
+            }
+            for (int i = 0; i < 16; ++i) {
+                names.insert(names.end(), {"xmm" + std::to_string(i), "ymm" + std::to_string(i)});
+            }
+            return names;
+        }();
+        for (size_t i = 0; i < 32; i += 4) {
+            for (size_t j = 0; j < 4; ++j) {
+                map[numbered[i + j]] = numbered[i];
+            }
+        }
+        for (size_t i = 32; i < numbered.size(); i += 2) {
+            map[numbered[i]] = numbered[i];
+            map[numbered[i + 1]] = numbered[i];
+        }
+        return map;
+    }();
+    auto it = aliases.find(operand);
+    return it != aliases.end() ? std::string(it->second) : std::string();
+}
+
+std::string_view trim(std::string_view text) {
+    size_t begin = text.find_first_not_of(" \t");
+    if (begin == std::string_view::npos) {
+        return {};
+    }
+    size_t end = text.find_last_not_of(" \t\r");
+    return text.substr(begin, end - begin + 1);
+}
+
+struct Instruction {
+    std::string mnemonic;
+    std::vector<std::string> operands;
+};
+
+Instruction parseInstruction(std::string_view line) {
+    Instruction instruction;
+    size_t space = line.find_first_of(" \t");
+    instruction.mnemonic = std::string(line.substr(0, space));
+    std::string_view rest = space == std::string_view::npos ? std::string_view() : trim(line.substr(space));
+    while (!rest.empty()) {
+        size_t comma = rest.find(',');
+        instruction.operands.emplace_back(trim(rest.substr(0, comma)));
+        rest = comma == std::string_view::npos ? std::string_view() : trim(rest.substr(comma + 1));
+    }
+    return instruction;
+}
+
+// the registers an address is computed from
+std::vector<std::string> addressRegisters(const std::string& operand) {
+    std::vector<std::string> registers;
+    size_t open = operand.find('[');
+    size_t close = operand.find(']', open);
+    std::string_view inside = std::string_view(operand).substr(open + 1, close - open - 1);
+    size_t start = 0;
+    while (start <= inside.size()) {
+        size_t end = inside.find_first_of("+-*", start);
+        std::string reg = registerOf(trim(inside.substr(start, end - start)));
+        if (!reg.empty()) {
+            registers.push_back(reg);
+        }
+        if (end == std::string_view::npos) {
+            break;
+        }
+        start = end + 1;
+    }
+    return registers;
+}
+
+bool isMemory(const std::string& operand) {
+    return operand.find('[') != std::string::npos;
+}
+
+bool endsBlock(const std::string& mnemonic) {
+    return mnemonic[0] == 'j' || mnemonic == "ret";
+}
+
+// the first operand is only written, not read
+bool writesOnly(const std::string& mnemonic) {
+    static const std::unordered_set<std::string_view> moves = {
+        "mov", "movzx", "movsx", "movsxd", "lea", "movq", "movd", "movaps", "movups", "movdqa", "movdqu",
+        "pshufd", "pshuflw", "pmovmskb", "pextrw", "bsf", "cvtsi2sd", "cvtsi2ss", "cvttsd2si", "cvttss2si",
+    };
+    // movsd and movss between registers merge into the destination, loads and stores do not
+    return moves.count(mnemonic) || mnemonic.starts_with("set");
+}
+
+// only sets the flags
+bool compares(const std::string& mnemonic) {
+    return mnemonic == "cmp" || mnemonic == "test" || mnemonic.ends_with("comisd") || mnemonic.ends_with("comiss");
+}
+
+bool readsFlags(const std::string& mnemonic) {
+    return (mnemonic[0] == 'j' && mnemonic != "jmp") || mnemonic.starts_with("set") || mnemonic.starts_with("cmov") ||
+           mnemonic == "adc" || mnemonic == "sbb";
+}
+
+// Walks one basic block keeping the cycle each register, the flags and each stored address are
+// ready in. Values live on entry are taken to be ready at cycle 0.
+class BlockModel {
+public:
+    explicit BlockModel(CostModel::FunctionCost& function) : function(function) {}
+
+    void add(const Instruction& instruction, CostModel::BlockCost& block);
+
+private:
+    double readyAt(const std::string& reg) const {
+        auto it = ready.find(reg);
+        return it != ready.end() ? it->second : 0;
+    }
+
+    CostModel::FunctionCost& function;
+    std::unordered_map<std::string, double> ready;
+    std::unordered_map<std::string, double> stored; // address text -> cycle the stored value is ready
+    std::vector<double> pushed;                     // values on the stack the evaluator will pop again
+};
+
+void BlockModel::add(const Instruction& instruction, CostModel::BlockCost& block) {
+    const std::string& mnemonic = instruction.mnemonic;
+    const auto& operands = instruction.operands;
+    Timing timing = timingOf(mnemonic);
+    double throughput = timing.throughput;
+
+    std::vector<std::string> reads;
+    std::vector<std::string> writes;
+    double start = 0;
+    double latency = timing.latency;
+    std::string storeTo;
+
+    auto readOperand = [&](const std::string& operand, bool load) {
+        if (isMemory(operand)) {
+            for (auto& reg : addressRegisters(operand)) {
+                reads.push_back(reg);
+            }
+            if (load) {
+                if (auto it = stored.find(operand.substr(operand.find('['))); it != stored.end()) {
+                    start = std::max(start, it->second);
+                }
+                latency += loadLatency;
+                throughput = std::max(throughput, loadThroughput);
+                ++function.memoryAccesses;
+            }
+        } else if (std::string reg = registerOf(operand); !reg.empty()) {
+            reads.push_back(reg);
+        }
+    };
+    auto writeOperand = [&](const std::string& operand) {
+        if (isMemory(operand)) {
+            storeTo = operand.substr(operand.find('['));
+            throughput = std::max(throughput, storeThroughput);
+            ++function.memoryAccesses;
+        } else if (std::string reg = registerOf(operand); !reg.empty()) {
+            writes.push_back(reg);
+        }
+    };
+
+    if (mnemonic == "push") {
+        // the stack engine tracks rsp, only the pushed value is a dependency
+        if (operands[0] != "rbp") {
+            ++function.spills;
+        }
+        readOperand(operands[0], false);
+        double value = 0;
+        for (const auto& reg : reads) {
+            value = std::max(value, readyAt(reg));
+        }
+        pushed.push_back(value);
+        block.criticalPath = std::max(block.criticalPath, value + latency);
+        block.throughput += throughput;
+        return;
+    }
+    if (mnemonic == "pop") {
+        if (operands[0] != "rbp") {
+            ++function.reloads;
+        }
+        double value = 0;
+        if (!pushed.empty()) {
+            value = pushed.back();
+            pushed.pop_back();
+        }
+        double done = value + loadLatency;
+        if (std::string reg = registerOf(operands[0]); !reg.empty()) {
+            ready[reg] = done;
+        }
+        block.criticalPath = std::max(block.criticalPath, done);
+        block.throughput += throughput;
+        return;
+    }
+
+    if (mnemonic == "call") {
+        // everything the callee may use has to be ready, its results come back together
+        for (const auto& [reg, cycle] : ready) {
+            start = std::max(start, cycle);
+        }
+        writes = {"rax", "rdx", "xmm0", "xmm1", "flags"};
+    } else if (mnemonic == "rep") {
+        reads = {"rcx", "rsi", "rdi", "rax"};
+        writes = {"rcx", "rsi", "rdi"};
+        function.memoryAccesses += 2;
+    } else if (mnemonic == "leave") {
+        reads = {"rbp"};
+        writes = {"rbp", "rsp"};
+        latency += loadLatency;
+        ++function.memoryAccesses;
+    } else if (mnemonic == "cqo" || mnemonic == "cdq") {
+        reads = {"rax"};
+        writes = {"rdx"};
+    } else if ((mnemonic == "idiv" || mnemonic == "div" || mnemonic == "mul" || mnemonic == "imul") && operands.size() == 1) {
+        reads = {"rax", "rdx"};
+        readOperand(operands[0], true);
+        writes = {"rax", "rdx", "flags"};
+    } else if (operands.size() == 2 && operands[0] == operands[1] &&
+               (mnemonic == "xor" || mnemonic == "sub" || mnemonic == "pxor" || mnemonic == "xorps")) {
+        // zeroing idiom, renamed away without waiting for the old value
+        writeOperand(operands[0]);
+        latency = 0;
+        if (mnemonic == "xor" || mnemonic == "sub") {
+            writes.push_back("flags");
+        }
+    } else if (compares(mnemonic)) {
+        for (const auto& operand : operands) {
+            readOperand(operand, true);
+        }
+        writes.push_back("flags");
+    } else if (!operands.empty()) {
+        bool readsDestination = !writesOnly(mnemonic) &&
+                                !((mnemonic == "movsd" || mnemonic == "movss") && (isMemory(operands[0]) || isMemory(operands[1])));
+        for (size_t i = 1; i < operands.size(); ++i) {
+            readOperand(operands[i], mnemonic != "lea");
+        }
+        if (readsDestination) {
+            readOperand(operands[0], true);
+        } else if (isMemory(operands[0])) {
+            readOperand(operands[0], false);
+        }
+        if (mnemonic[0] != 'j') {
+            writeOperand(operands[0]);
+        }
+        // the three operand imul only writes its destination
+        if (mnemonic == "imul" && operands.size() == 3) {
+            std::erase(reads, registerOf(operands[0]));
+        }
+        if (!writesOnly(mnemonic) && mnemonic[0] != 'j' && !mnemonic.starts_with("cmov") && !mnemonic.starts_with("mov")) {
+            writes.push_back("flags");
+        }
+    }
+    if (readsFlags(mnemonic)) {
+        reads.push_back("flags");
+    }
+
+    for (const auto& reg : reads) {
+        start = std::max(start, readyAt(reg));
+    }
+    double done = start + latency;
+    for (const auto& reg : writes) {
+        ready[reg] = done;
+    }
+    if (!storeTo.empty()) {
+        stored[storeTo] = done;
+    }
+    block.criticalPath = std::max(block.criticalPath, done);
+    block.throughput += throughput;
+}
+
+} // namespace
+
+void CostModel::analyze(std::string_view assembly) {
+    std::string pendingFunction;
+    FunctionCost* function = nullptr;
+    std::optional<BlockModel> model;
+    int instructionIndex = 0;
+
+    auto startBlock = [&](const std::string& label) {
+        function->blocks.push_back({label});
+        model.emplace(*function);
+    };
+
+    while (!assembly.empty()) {
+        size_t newline = assembly.find('\n');
+        std::string_view line = trim(assembly.substr(0, newline));
+        assembly = newline == std::string_view::npos ? std::string_view() : assembly.substr(newline + 1);
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        if (line.back() == ':') {
+            std::string label(line.substr(0, line.size() - 1));
+            if (!function && label == pendingFunction) {
+                functions.push_back({label, {}});
+                function = &functions.back();
+                instructionIndex = 0;
+                startBlock(label);
+            } else if (function) {
+                // a label right after a branch names the block the branch already opened
+                if (function->blocks.back().instructions == 0 && function->blocks.back().label.find('+') != std::string::npos) {
+                    function->blocks.back().label = label;
+                } else {
+                    startBlock(label);
+                }
+            }
+            continue;
+        }
+        if (line[0] == '.') {
+            if (line.starts_with(".type ") && line.ends_with("@function")) {
+                pendingFunction = std::string(trim(line.substr(6, line.find(',') - 6)));
+            } else if (line.starts_with(".size ") && function) {
+                std::erase_if(function->blocks, [](const BlockCost& block) { return block.instructions == 0; });
+                for (const auto& block : function->blocks) {
+                    function->cycles += block.cycles();
+                    function->criticalPath = std::max(function->criticalPath, block.criticalPath);
+                }
+                function = nullptr;
+                pendingFunction.clear();
+            }
+            continue;
+        }
+        if (!function) {
+            continue;
+        }
+
+        Instruction instruction = parseInstruction(line);
+        BlockCost& block = function->blocks.back();
+        model->add(instruction, block);
+        ++block.instructions;
+        ++function->instructions;
+        ++instructionIndex;
+        if (endsBlock(instruction.mnemonic)) {
+            startBlock(function->name + "+" + std::to_string(instructionIndex));
+        }
+    }
+}
+
+// written field by field, a long function or block label widens its line instead of cutting it short
+void CostModel::print(std::ostream& out) const {
+    std::ios_base::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::fixed;
+    for (const auto& function : functions) {
+        out << function.name << ": " << function.instructions << " instructions, " << function.blocks.size() << " blocks, "
+            << std::setprecision(2) << function.cycles << " cycles, critical path " << std::setprecision(0) << function.criticalPath << ", "
+            << function.spills << " spills, " << function.reloads << " reloads, " << function.memoryAccesses << " memory accesses\n";
+        out << "  " << std::left << std::setw(32) << "block" << std::right << ' ' << std::setw(12) << "instructions" << ' '
+            << std::setw(10) << "throughput" << ' ' << std::setw(10) << "latency" << ' ' << std::setw(10) << "cycles" << '\n';
+        for (const auto& block : function.blocks) {
+            out << "  " << std::left << std::setw(32) << block.label << std::right << ' ' << std::setw(12) << block.instructions << ' '
+                << std::setprecision(2) << std::setw(10) << block.throughput << ' ' << std::setprecision(0) << std::setw(10)
+                << block.criticalPath << ' ' << std::setprecision(2) << std::setw(10) << block.cycles() << '\n';
+        }
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
+
+} // namespace EntS
@@ -0,0 +1,51 @@
+#ifndef COST_MODEL_HPP
+#define COST_MODEL_HPP
+
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace EntS {
+
+// Static cost estimate of generated assembly, for --cost-report.
+//
+// Every instruction gets a latency and a reciprocal throughput from a table modelled on a recent
+// out of order x86-64 core. A basic block costs whichever bound is higher: the throughput bound,
+// the sum of the reciprocal throughputs, or the critical path through register, flag and memory
+// dependencies. Blocks are costed once each, loops and branch frequencies are not weighed in.
+// Temporaries the expression evaluator pushes and pops count as spills and reloads.
+class CostModel {
+public:
+    struct BlockCost {
+        std::string label;
+        int instructions = 0;
+        double throughput = 0;   // cycles if nothing depended on anything
+        double criticalPath = 0; // cycles of the longest dependency chain
+        double cycles() const { return throughput > criticalPath ? throughput : criticalPath; }
+    };
+
+    struct FunctionCost {
+        std::string name;
+        std::vector<BlockCost> blocks;
+        int instructions = 0;
+        int spills = 0;
+        int reloads = 0;
+        int memoryAccesses = 0; // other loads and stores, frame resident variables included
+        double cycles = 0;
+        double criticalPath = 0; // longest of the blocks
+    };
+
+    // reads the assembly of a whole program, functions are found by their .type directives
+    void analyze(std::string_view assembly);
+    void print(std::ostream& out) const;
+
+    const std::vector<FunctionCost>& getFunctions() const { return functions; }
+
+private:
+    std::vector<FunctionCost> functions;
+};
+
+} // namespace EntS
+
+#endif // COST_MODEL_HPP
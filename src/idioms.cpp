@@ -0,0 +1,257 @@
+#include "idioms.hpp"
+#include "ast.hpp"
+
+namespace EntS {
+
+static ASTNodePtr copyLeaf(const ASTNode* node) {
+    if (const auto* literal = dynamic_cast<const LiteralNode*>(node)) {
+        return std::make_shared<LiteralNode>(literal->value);
+    }
+    return std::make_shared<IdentifierNode>(dynamic_cast<const IdentifierNode*>(node)->name);
+}
+
+// `a[i]` indexed by a plain variable, `counter` receives its name
+static bool isCounterIndex(const IndexNode* index, std::string& counter) {
+    if (index->index->getType() != NodeType::Identifier) {
+        return false;
+    }
+    counter = dynamic_cast<const IdentifierNode*>(index->index.get())->name;
+    return true;
+}
+
+static bool isZero(const ASTNode* node) {
+    const auto* literal = dynamic_cast<const LiteralNode*>(node);
+    return literal && literal->value == "0";
+}
+
+IdiomRecognition::IdiomRecognition(const std::unordered_map<std::string, std::string>& typedefs, const StructDefinitions& structs)
+    : typedefs(typedefs), structDefinitions(structs) {}
+
+void IdiomRecognition::run(const ASTNodePtr& root) {
+    auto* program = dynamic_cast<ProgramNode*>(root.get());
+    collectGlobalTypes(program, globalTypes);
+
+    for (const auto& statement : program->functions) {
+        if (auto* function = dynamic_cast<FunctionNode*>(statement.get())) {
+            visitFunction(function);
+        }
+    }
+}
+
+void IdiomRecognition::visitFunction(FunctionNode* node) {
+    functionAnalysis.emplace(node);
+    visitBlock(dynamic_cast<BlockNode*>(node->body.get()));
+    functionAnalysis.reset();
+}
+
+void IdiomRecognition::visitBlock(BlockNode* node) {
+    if (!node) {
+        return;
+    }
+    for (auto& statement : node->statements) {
+        visitStatement(statement);
+    }
+}
+
+void IdiomRecognition::visitStatement(ASTNodePtr& statement) {
+    switch (statement->getType()) {
+        case NodeType::Block:
+            visitBlock(dynamic_cast<BlockNode*>(statement.get()));
+            break;
+        case NodeType::If: {
+            auto* ifNode = dynamic_cast<IfNode*>(statement.get());
+            visitStatement(ifNode->body);
+            if (ifNode->else_) {
+                visitStatement(ifNode->else_);
+            }
+            break;
+        }
+        case NodeType::Switch:
+            for (auto& case_ : dynamic_cast<SwitchNode*>(statement.get())->cases) {
+                if (auto* caseNode = dynamic_cast<CaseNode*>(case_.get())) {
+                    visitStatement(caseNode->body);
+                } else if (auto* defaultNode = dynamic_cast<DefaultNode*>(case_.get())) {
+                    visitStatement(defaultNode->body);
+                }
+            }
+            break;
+        case NodeType::While: {
+            auto* whileNode = dynamic_cast<WhileNode*>(statement.get());
+            visitStatement(whileNode->body);
+            ASTNodePtr replacement = matchStrlen(whileNode);
+            if (!replacement) {
+                replacement = matchFill(statement);
+            }
+            if (replacement) {
+                statement = replacement;
+                rewritten++;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// while (a[i] != 0) { i++; }
+ASTNodePtr IdiomRecognition::matchStrlen(const WhileNode* node) const {
+    const auto* body = dynamic_cast<const BlockNode*>(node->body.get());
+    if (!body || body->statements.size() != 1) {
+        return nullptr;
+    }
+    const auto* increment = dynamic_cast<const IncrementNode*>(body->statements[0].get());
+    if (!increment) {
+        return nullptr;
+    }
+
+    const ASTNode* load = node->condition.get();
+    if (const auto* expression = dynamic_cast<const ExpressionNode*>(load)) {
+        if (expression->op != "!=" || !expression->left || !*expression->left) {
+            return nullptr;
+        }
+        const ASTNode* left = expression->left->get();
+        const ASTNode* right = expression->right->get();
+        load = isZero(right) ? left : isZero(left) ? right : nullptr;
+    }
+    const auto* index = dynamic_cast<const IndexNode*>(load);
+    std::string counter;
+    if (!index || !isCounterIndex(index, counter) || counter != increment->variable ||
+        counter == index->name || !isCounter(counter) || elementSize(index->name) != 1) {
+        return nullptr;
+    }
+
+    auto length = std::make_shared<FunctionCallNode>("__builtin_strlen", std::vector<ASTNodePtr>{elementAddress(index->name, counter, 1)});
+    auto sum = std::make_shared<ExpressionNode>(std::make_shared<IdentifierNode>(counter), "+", length);
+    return std::make_shared<AssignNode>(counter, sum);
+}
+
+// while (i < n) { a[i] = v; i++; } and while (i < n) { a[i] = b[i]; i++; }
+ASTNodePtr IdiomRecognition::matchFill(const ASTNodePtr& loop) const {
+    const auto* node = dynamic_cast<const WhileNode*>(loop.get());
+    const auto* condition = dynamic_cast<const ExpressionNode*>(node->condition.get());
+    if (!condition || condition->op != "<" || !condition->left || !*condition->left ||
+        (*condition->left)->getType() != NodeType::Identifier) {
+        return nullptr;
+    }
+    std::string counter = dynamic_cast<const IdentifierNode*>(condition->left->get())->name;
+    const ASTNode* bound = condition->right->get();
+    if (!isCounter(counter) || !isFixed(bound, counter)) {
+        return nullptr;
+    }
+
+    const auto* body = dynamic_cast<const BlockNode*>(node->body.get());
+    if (!body || body->statements.size() != 2) {
+        return nullptr;
+    }
+    const auto* store = dynamic_cast<const IndexationAssignNode*>(body->statements[0].get());
+    const auto* increment = dynamic_cast<const IncrementNode*>(body->statements[1].get());
+    if (!store || !increment || increment->variable != counter || store->name == counter ||
+        store->index->getType() != NodeType::Identifier ||
+        dynamic_cast<const IdentifierNode*>(store->index.get())->name != counter) {
+        return nullptr;
+    }
+
+    int size = elementSize(store->name);
+    if (size == 0) {
+        return nullptr;
+    }
+
+    // bytes from the counter up to the bound, rebuilt for every use since later passes rewrite in place
+    auto count = [&]() {
+        ASTNodePtr bytes = std::make_shared<ExpressionNode>(copyLeaf(bound), "-", std::make_shared<IdentifierNode>(counter));
+        if (size != 1) {
+            bytes = std::make_shared<ExpressionNode>(bytes, "*", std::make_shared<LiteralNode>(std::to_string(size)));
+        }
+        return bytes;
+    };
+
+    ASTNodePtr call;
+    ASTNodePtr disjoint; // runtime check the copy needs before it may replace the loop
+    const auto* load = dynamic_cast<const IndexNode*>(store->expression.get());
+    std::string loadCounter;
+    if (load && isCounterIndex(load, loadCounter) && loadCounter == counter) {
+        const std::string& from = load->name;
+        if (from == store->name || from == counter ||
+            resolveTypeName(variableType(from), typedefs, structDefinitions) != resolveTypeName(variableType(store->name), typedefs, structDefinitions)) {
+            return nullptr;
+        }
+        call = std::make_shared<FunctionCallNode>("__builtin_memcpy", std::vector<ASTNodePtr>{
+            elementAddress(store->name, counter, size), elementAddress(from, counter, size), count()});
+
+        // variables owning their storage never overlap, pointers may, and then the loop has to stay
+        bool ownStorage = functionAnalysis->isLocal(store->name) && functionAnalysis->isLocal(from) &&
+                          !functionAnalysis->isPointerBacked(store->name) && !functionAnalysis->isPointerBacked(from);
+        if (!ownStorage) {
+            auto before = std::make_shared<ExpressionNode>(
+                std::make_shared<ExpressionNode>(elementAddress(store->name, counter, size), "+", count()), "<=",
+                elementAddress(from, counter, size));
+            auto after = std::make_shared<ExpressionNode>(
+                std::make_shared<ExpressionNode>(elementAddress(from, counter, size), "+", count()), "<=",
+                elementAddress(store->name, counter, size));
+            disjoint = std::make_shared<ExpressionNode>(before, "||", after);
+        }
+    } else if (isFixed(store->expression.get(), counter)) {
+        // wider elements can only be filled with a byte pattern when every byte is zero
+        const auto* literal = dynamic_cast<const LiteralNode*>(store->expression.get());
+        if (size != 1 && !(literal && literal->value == "0")) {
+            return nullptr;
+        }
+        call = std::make_shared<FunctionCallNode>("__builtin_memset", std::vector<ASTNodePtr>{
+            elementAddress(store->name, counter, size), copyLeaf(store->expression.get()), count()});
+    } else {
+        return nullptr;
+    }
+
+    ASTNodePtr replacement = std::make_shared<BlockNode>(std::vector<ASTNodePtr>{call, std::make_shared<AssignNode>(counter, copyLeaf(bound))});
+    if (disjoint) {
+        replacement = std::make_shared<BlockNode>(std::vector<ASTNodePtr>{
+            std::make_shared<IfNode>(disjoint, replacement, std::make_shared<BlockNode>(std::vector<ASTNodePtr>{loop}))});
+    }
+    // the loop may not run at all, the guard keeps the count from going negative
+    auto guard = std::make_shared<ExpressionNode>(std::make_shared<IdentifierNode>(counter), "<", copyLeaf(bound));
+    return std::make_shared<IfNode>(guard, replacement, nullptr);
+}
+
+// The induction variable, the stores in the loop must not be able to reach it.
+bool IdiomRecognition::isCounter(const std::string& name) const {
+    const VariableInfo* info = functionAnalysis->lookup(name);
+    return info && !functionAnalysis->isMemoryResident(name) && !info->indexed && elementSize(name) != 0 &&
+           !isFloatingType(info->type, typedefs, structDefinitions);
+}
+
+// Values that stay the same for the whole loop: constants and integers the loop's stores cannot reach.
+bool IdiomRecognition::isFixed(const ASTNode* node, const std::string& counter) const {
+    if (const auto* literal = dynamic_cast<const LiteralNode*>(node)) {
+        return literal->value.find('.') == std::string::npos;
+    }
+    const auto* identifier = dynamic_cast<const IdentifierNode*>(node);
+    return identifier && identifier->name != counter && isCounter(identifier->name);
+}
+
+int IdiomRecognition::elementSize(const std::string& name) const {
+    std::string type = resolveTypeName(variableType(name), typedefs, structDefinitions);
+    if (type == "int8" || type == "uint8" || type == "char" || type == "bool") return 1;
+    if (type == "int16" || type == "uint16") return 2;
+    if (type == "int32" || type == "uint32" || type == "float") return 4;
+    if (type == "int64" || type == "uint64" || type == "double") return 8;
+    return 0;
+}
+
+std::string IdiomRecognition::variableType(const std::string& name) const {
+    if (const VariableInfo* info = functionAnalysis->lookup(name)) {
+        return info->type;
+    }
+    auto it = globalTypes.find(name);
+    return it != globalTypes.end() ? it->second : "";
+}
+
+// `[a] + i * size`, the address `a[i]` reads from
+ASTNodePtr IdiomRecognition::elementAddress(const std::string& name, const std::string& counter, int size) const {
+    ASTNodePtr offset = std::make_shared<IdentifierNode>(counter);
+    if (size != 1) {
+        offset = std::make_shared<ExpressionNode>(offset, "*", std::make_shared<LiteralNode>(std::to_string(size)));
+    }
+    return std::make_shared<ExpressionNode>(std::make_shared<MemoryAddressNode>(name), "+", offset);
+}
+
+} // namespace EntS
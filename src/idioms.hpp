@@ -0,0 +1,53 @@
+#ifndef IDIOMS_HPP
+#define IDIOMS_HPP
+
+#include "ast.hpp"
+#include "analysis.hpp"
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+namespace EntS {
+
+// Loop idiom recognition.
+//
+// Byte loops that measure, fill or copy memory are replaced by the matching builtin, which the code
+// generator lowers to wide moves, string instructions or the library routine depending on the size:
+//
+//   while (a[i] != 0) { i++; }                ->  i = i + __builtin_strlen([a] + i);
+//   while (i < n) { a[i] = v; i++; }           ->  if (i < n) { __builtin_memset(...); i = n; }
+//   while (i < n) { a[i] = b[i]; i++; }        ->  if (i < n) { __builtin_memcpy(...); i = n; }
+//
+// Only loops whose bound and stored value cannot change while the loop runs are rewritten. A copy
+// through pointers is guarded by a check that the ranges are disjoint, overlapping ones keep the loop.
+class IdiomRecognition {
+public:
+    IdiomRecognition(const std::unordered_map<std::string, std::string>& typedefs, const StructDefinitions& structs);
+    void run(const ASTNodePtr& root);
+    int getRewrittenCount() const { return rewritten; }
+
+private:
+    void visitFunction(FunctionNode* node);
+    void visitStatement(ASTNodePtr& statement);
+    void visitBlock(BlockNode* node);
+
+    ASTNodePtr matchStrlen(const WhileNode* node) const;
+    ASTNodePtr matchFill(const ASTNodePtr& loop) const;
+
+    bool isCounter(const std::string& name) const;
+    bool isFixed(const ASTNode* node, const std::string& counter) const;
+    int elementSize(const std::string& name) const;
+    std::string variableType(const std::string& name) const;
+    ASTNodePtr elementAddress(const std::string& name, const std::string& counter, int size) const;
+
+    const std::unordered_map<std::string, std::string>& typedefs;
+    const StructDefinitions& structDefinitions;
+    std::unordered_map<std::string, std::string> globalTypes;
+    std::optional<FunctionAnalysis> functionAnalysis;
+
+    int rewritten = 0;
+};
+
+} // namespace EntS
+
+#endif // IDIOMS_HPP
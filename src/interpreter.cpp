@@ -0,0 +1,184 @@
+#include "interpreter.hpp"
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#ifdef __SANITIZE_ADDRESS__
+#include <sanitizer/lsan_interface.h>
+#endif
+
+extern void printFatal(const char* str);
+
+namespace EntS {
+
+namespace {
+
+template <typename T>
+int64_t load(int64_t address) {
+    T value;
+    std::memcpy(&value, reinterpret_cast<const void*>(address), sizeof(T));
+    return value;
+}
+
+template <typename T>
+void store(int64_t address, int64_t value) {
+    T narrowed = static_cast<T>(value);
+    std::memcpy(reinterpret_cast<void*>(address), &narrowed, sizeof(T));
+}
+
+// wrapping arithmetic, like the native code
+int64_t wrap(uint64_t value) {
+    return static_cast<int64_t>(value);
+}
+
+} // namespace
+
+Interpreter::Interpreter(const BytecodeProgram& program, size_t stackSlots, size_t maxDepth)
+    : program(program), stack(std::make_unique<int64_t[]>(stackSlots)), stackSlots(stackSlots),
+      globals(std::make_unique<int64_t[]>(std::max<size_t>(program.globalSlots, 1))), frames(maxDepth) {
+    for (const auto& [slot, value] : program.globalValues) {
+        globals[slot] = value;
+    }
+}
+
+int64_t Interpreter::run(const std::string& function, const std::vector<int64_t>& args) {
+    auto it = program.functionIndices.find(function);
+    if (it == program.functionIndices.end()) {
+        printFatal(("the program has no " + function + " function").c_str());
+    }
+    const BytecodeFunction& entry = program.functions[it->second];
+    if (entry.frameSize > stackSlots) {
+        printFatal("interpreter stack overflow");
+    }
+    for (size_t i = 0; i < entry.parameterCount; ++i) {
+        stack[i] = i < args.size() ? args[i] : 0;
+    }
+#ifdef __SANITIZE_ADDRESS__
+    // what the program allocates and never frees is its own business, not a leak in the compiler
+    __lsan::ScopedDisabler disabler;
+#endif
+    return execute(&entry, stack.get());
+}
+
+int64_t Interpreter::execute(const BytecodeFunction* function, int64_t* registers) {
+    // one label per opcode, in the order of the enum
+    static const void* const labels[] = {
+        &&LoadConst, &&Move,
+        &&SignExtend8, &&SignExtend16, &&SignExtend32,
+        &&ZeroExtend8, &&ZeroExtend16, &&ZeroExtend32,
+        &&Add, &&Sub, &&Mul, &&Div, &&And, &&Or,
+        &&Equal, &&NotEqual, &&Less, &&LessEqual, &&Greater, &&GreaterEqual,
+        &&LogicalAnd, &&LogicalOr,
+        &&Negate, &&Not,
+        &&AddImmediate, &&Index,
+        &&Load8s, &&Load8u, &&Load16s, &&Load16u, &&Load32s, &&Load32u, &&Load64,
+        &&Store8, &&Store16, &&Store32, &&Store64,
+        &&FrameAddress, &&GlobalAddress, &&LoadGlobal, &&StoreGlobal,
+        &&Jump, &&JumpIfZero, &&JumpIfNotZero,
+        &&Call, &&CallNative, &&Return,
+    };
+    static_assert(std::size(labels) == static_cast<size_t>(Opcode::Count), "every opcode needs a label");
+
+    const Instruction* ip = function->code.data();
+    const int64_t* constants = function->constants.data();
+    int64_t* const stackEnd = stack.get() + stackSlots;
+    size_t depth = 0;
+    int64_t* R = registers;
+
+#define DISPATCH() goto *labels[static_cast<uint8_t>(ip->op)]
+#define NEXT() do { ++ip; DISPATCH(); } while (0)
+
+    DISPATCH();
+
+LoadConst:     R[ip->a] = constants[ip->wide()]; NEXT();
+Move:          R[ip->a] = R[ip->b]; NEXT();
+SignExtend8:   R[ip->a] = static_cast<int8_t>(R[ip->b]); NEXT();
+SignExtend16:  R[ip->a] = static_cast<int16_t>(R[ip->b]); NEXT();
+SignExtend32:  R[ip->a] = static_cast<int32_t>(R[ip->b]); NEXT();
+ZeroExtend8:   R[ip->a] = static_cast<uint8_t>(R[ip->b]); NEXT();
+ZeroExtend16:  R[ip->a] = static_cast<uint16_t>(R[ip->b]); NEXT();
+ZeroExtend32:  R[ip->a] = static_cast<uint32_t>(R[ip->b]); NEXT();
+Add:           R[ip->a] = wrap(uint64_t(R[ip->b]) + uint64_t(R[ip->c])); NEXT();
+Sub:           R[ip->a] = wrap(uint64_t(R[ip->b]) - uint64_t(R[ip->c])); NEXT();
+Mul:           R[ip->a] = wrap(uint64_t(R[ip->b]) * uint64_t(R[ip->c])); NEXT();
+Div:           R[ip->a] = R[ip->b] / R[ip->c]; NEXT();
+And:           R[ip->a] = R[ip->b] & R[ip->c]; NEXT();
+Or:            R[ip->a] = R[ip->b] | R[ip->c]; NEXT();
+Equal:         R[ip->a] = R[ip->b] == R[ip->c]; NEXT();
+NotEqual:      R[ip->a] = R[ip->b] != R[ip->c]; NEXT();
+Less:          R[ip->a] = R[ip->b] < R[ip->c]; NEXT();
+LessEqual:     R[ip->a] = R[ip->b] <= R[ip->c]; NEXT();
+Greater:       R[ip->a] = R[ip->b] > R[ip->c]; NEXT();
+GreaterEqual:  R[ip->a] = R[ip->b] >= R[ip->c]; NEXT();
+LogicalAnd:    R[ip->a] = R[ip->b] != 0 && R[ip->c] != 0; NEXT();
+LogicalOr:     R[ip->a] = R[ip->b] != 0 || R[ip->c] != 0; NEXT();
+Negate:        R[ip->a] = wrap(-uint64_t(R[ip->b])); NEXT();
+Not:           R[ip->a] = R[ip->b] == 0; NEXT();
+AddImmediate:  R[ip->a] = wrap(uint64_t(R[ip->b]) + uint64_t(static_cast<int16_t>(ip->c))); NEXT();
+Index:         R[ip->a] = wrap(uint64_t(R[ip->b]) + uint64_t(R[ip->c]) * ip->width); NEXT();
+Load8s:        R[ip->a] = load<int8_t>(R[ip->b]); NEXT();
+Load8u:        R[ip->a] = load<uint8_t>(R[ip->b]); NEXT();
+Load16s:       R[ip->a] = load<int16_t>(R[ip->b]); NEXT();
+Load16u:       R[ip->a] = load<uint16_t>(R[ip->b]); NEXT();
+Load32s:       R[ip->a] = load<int32_t>(R[ip->b]); NEXT();
+Load32u:       R[ip->a] = load<uint32_t>(R[ip->b]); NEXT();
+Load64:        R[ip->a] = load<int64_t>(R[ip->b]); NEXT();
+Store8:        store<uint8_t>(R[ip->a], R[ip->b]); NEXT();
+Store16:       store<uint16_t>(R[ip->a], R[ip->b]); NEXT();
+Store32:       store<uint32_t>(R[ip->a], R[ip->b]); NEXT();
+Store64:       store<uint64_t>(R[ip->a], R[ip->b]); NEXT();
+FrameAddress:  R[ip->a] = reinterpret_cast<int64_t>(&R[ip->b]); NEXT();
+GlobalAddress: R[ip->a] = reinterpret_cast<int64_t>(&globals[ip->wide()]); NEXT();
+LoadGlobal:    R[ip->a] = globals[ip->wide()]; NEXT();
+StoreGlobal:   globals[ip->wide()] = R[ip->a]; NEXT();
+Jump:          ip = function->code.data() + ip->wide(); DISPATCH();
+JumpIfZero:    ip = R[ip->a] == 0 ? function->code.data() + ip->wide() : ip + 1; DISPATCH();
+JumpIfNotZero: ip = R[ip->a] != 0 ? function->code.data() + ip->wide() : ip + 1; DISPATCH();
+
+Call: {
+    const BytecodeFunction* callee = &program.functions[ip->b];
+    int64_t* base = R + function->frameSize;
+    if (depth == frames.size() || base + callee->frameSize > stackEnd) {
+        printFatal("interpreter stack overflow");
+    }
+    for (size_t i = 0; i < callee->parameterCount; ++i) {
+        base[i] = R[ip->c + i];
+    }
+    frames[depth++] = {ip + 1, R, function, ip->a};
+    R = base;
+    function = callee;
+    constants = callee->constants.data();
+    ip = callee->code.data();
+    DISPATCH();
+}
+
+CallNative: {
+    const NativeFunction& native = program.natives[ip->b];
+    int64_t args[6] = {};
+    for (size_t i = 0; i < native.arity; ++i) {
+        args[i] = R[ip->c + i];
+    }
+    // everything is passed as a 64 bit integer, extra registers are ignored by the callee
+    auto target = reinterpret_cast<int64_t (*)(int64_t, int64_t, int64_t, int64_t, int64_t, int64_t)>(native.address);
+    R[ip->a] = target(args[0], args[1], args[2], args[3], args[4], args[5]);
+    NEXT();
+}
+
+Return: {
+    int64_t value = R[ip->a];
+    if (depth == 0) {
+        return value;
+    }
+    const Frame& frame = frames[--depth];
+    R = frame.registers;
+    function = frame.function;
+    constants = function->constants.data();
+    R[frame.dest] = value;
+    ip = frame.returnAddress;
+    DISPATCH();
+}
+
+#undef NEXT
+#undef DISPATCH
+}
+
+} // namespace EntS
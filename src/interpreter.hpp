@@ -0,0 +1,40 @@
+#ifndef INTERPRETER_HPP
+#define INTERPRETER_HPP
+
+#include "bytecode.hpp"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace EntS {
+
+// Runs a BytecodeProgram with computed goto dispatch. Register frames are carved out of one
+// preallocated stack and calls between bytecode functions never recurse on the C++ stack.
+class Interpreter {
+public:
+    explicit Interpreter(const BytecodeProgram& program, size_t stackSlots = 1 << 20, size_t maxDepth = 1 << 16);
+
+    // calls `function` with as many of `args` as it has parameters and returns its result
+    int64_t run(const std::string& function, const std::vector<int64_t>& args);
+
+private:
+    struct Frame {
+        const Instruction* returnAddress;
+        int64_t* registers;
+        const BytecodeFunction* function;
+        uint16_t dest;
+    };
+
+    int64_t execute(const BytecodeFunction* function, int64_t* registers);
+
+    const BytecodeProgram& program;
+    std::unique_ptr<int64_t[]> stack;
+    size_t stackSlots;
+    std::unique_ptr<int64_t[]> globals;
+    std::vector<Frame> frames;
+};
+
+} // namespace EntS
+
+#endif // INTERPRETER_HPP
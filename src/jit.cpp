@@ -0,0 +1,313 @@
+#include "jit.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <dlfcn.h>
+#include <elf.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef __SANITIZE_ADDRESS__
+#include <sanitizer/lsan_interface.h>
+#endif
+
+extern char** environ;
+extern void printFatal(const char* str);
+
+namespace EntS {
+
+namespace {
+
+size_t alignTo(size_t value, size_t alignment) {
+    return alignment > 1 ? (value + alignment - 1) / alignment * alignment : value;
+}
+
+bool fitsSigned32(int64_t value) {
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+} // namespace
+
+Jit::Jit(const CodeGenerator& generator) {
+    load(assemble(generator));
+}
+
+Jit::~Jit() {
+    if (image) {
+        munmap(image, imageSize);
+    }
+}
+
+// the assembly and the object both live in memfds, `as` reaches them through /proc/self/fd
+std::vector<unsigned char> Jit::assemble(const CodeGenerator& generator) {
+    int source = memfd_create("ents-asm", 0);
+    int object = memfd_create("ents-obj", 0);
+    if (source < 0 || object < 0) {
+        printFatal("could not create in memory files for the assembler");
+    }
+    if (!generator.writeGeneratedCode(source)) {
+        printFatal("could not hand the generated assembly to the assembler");
+    }
+
+    std::string input = "/proc/self/fd/" + std::to_string(source);
+    std::string output = "/proc/self/fd/" + std::to_string(object);
+    std::vector<char*> arguments = {
+        const_cast<char*>("as"), const_cast<char*>("--64"), const_cast<char*>("-o"),
+        output.data(), input.data(), nullptr
+    };
+    pid_t pid;
+    int status = 0;
+    if (posix_spawnp(&pid, "as", nullptr, nullptr, arguments.data(), environ) != 0 || waitpid(pid, &status, 0) < 0) {
+        printFatal("could not run the assembler");
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        printFatal("the assembler rejected the generated code");
+    }
+
+    struct stat info;
+    fstat(object, &info);
+    std::vector<unsigned char> bytes(info.st_size);
+    for (size_t done = 0; done < bytes.size();) {
+        ssize_t count = pread(object, bytes.data() + done, bytes.size() - done, done);
+        if (count <= 0) {
+            printFatal("could not read the assembled object");
+        }
+        done += count;
+    }
+    close(source);
+    close(object);
+    return bytes;
+}
+
+uint64_t Jit::makeStub(uint64_t target) {
+    if (stubCount == stubCapacity) {
+        printFatal("ran out of call stubs while loading the program");
+    }
+    // jmp QWORD PTR [rip+0] followed by the target, the target also serves as its GOT entry
+    unsigned char* stub = stubs + 16 * stubCount++;
+    const unsigned char jump[] = {0xff, 0x25, 0x00, 0x00, 0x00, 0x00};
+    std::memcpy(stub, jump, sizeof(jump));
+    std::memcpy(stub + sizeof(jump), &target, sizeof(target));
+    return reinterpret_cast<uint64_t>(stub);
+}
+
+void Jit::load(const std::vector<unsigned char>& object) {
+    const auto* header = reinterpret_cast<const Elf64_Ehdr*>(object.data());
+    if (object.size() < sizeof(Elf64_Ehdr) || std::memcmp(header->e_ident, ELFMAG, SELFMAG) != 0
+        || header->e_ident[EI_CLASS] != ELFCLASS64 || header->e_type != ET_REL || header->e_machine != EM_X86_64) {
+        printFatal("the assembler did not produce an x86-64 relocatable object");
+    }
+    const auto* sections = reinterpret_cast<const Elf64_Shdr*>(object.data() + header->e_shoff);
+    size_t sectionCount = header->e_shnum;
+
+    const Elf64_Shdr* symbolTable = nullptr;
+    for (size_t i = 0; i < sectionCount; ++i) {
+        if (sections[i].sh_type == SHT_SYMTAB) {
+            symbolTable = &sections[i];
+        }
+    }
+    if (!symbolTable) {
+        printFatal("the assembled object has no symbol table");
+    }
+    const auto* symbolEntries = reinterpret_cast<const Elf64_Sym*>(object.data() + symbolTable->sh_offset);
+    size_t symbolCount = symbolTable->sh_size / sizeof(Elf64_Sym);
+    const char* names = reinterpret_cast<const char*>(object.data() + sections[symbolTable->sh_link].sh_offset);
+
+    // code first, then the stubs, then data on pages of their own so the code can be made read only
+    std::vector<size_t> offsets(sectionCount, 0);
+    size_t size = 0;
+    for (bool executable : {true, false}) {
+        for (size_t i = 0; i < sectionCount; ++i) {
+            const auto& section = sections[i];
+            if (!(section.sh_flags & SHF_ALLOC) || bool(section.sh_flags & SHF_EXECINSTR) != executable) {
+                continue;
+            }
+            size = alignTo(size, section.sh_addralign);
+            offsets[i] = size;
+            size += section.sh_size;
+        }
+        if (executable) {
+            size = alignTo(size, 16);
+            stubCapacity = symbolCount;
+            size_t stubOffset = size;
+            size += 16 * stubCapacity;
+            executableSize = alignTo(size, getpagesize());
+            size = executableSize;
+            offsets.push_back(stubOffset);
+        }
+    }
+    imageSize = alignTo(std::max<size_t>(size, 1), getpagesize());
+
+    // below 2GB absolute 32 bit relocations resolve as they would in a non PIE executable
+    void* memory = mmap(nullptr, imageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+    if (memory == MAP_FAILED) {
+        memory = mmap(nullptr, imageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (memory == MAP_FAILED) {
+        printFatal("could not map memory for the program");
+    }
+    image = static_cast<unsigned char*>(memory);
+    stubs = image + offsets.back();
+
+    std::vector<uint64_t> addresses(sectionCount, 0);
+    for (size_t i = 0; i < sectionCount; ++i) {
+        const auto& section = sections[i];
+        if (!(section.sh_flags & SHF_ALLOC)) {
+            continue;
+        }
+        addresses[i] = reinterpret_cast<uint64_t>(image + offsets[i]);
+        if (section.sh_type != SHT_NOBITS) {
+            std::memcpy(image + offsets[i], object.data() + section.sh_offset, section.sh_size);
+        }
+    }
+
+    // symbols not defined by the program are looked up among the functions of this process
+    std::vector<uint64_t> values(symbolCount, 0);
+    std::vector<bool> external(symbolCount, false);
+    std::vector<bool> externalData(symbolCount, false);
+    std::vector<uint64_t> symbolStubs(symbolCount, 0);
+    for (size_t i = 1; i < symbolCount; ++i) {
+        const auto& symbol = symbolEntries[i];
+        std::string name = names + symbol.st_name;
+        if (symbol.st_shndx == SHN_UNDEF && name == "_GLOBAL_OFFSET_TABLE_") {
+            // the assembler names it for GOT relocations, the stubs stand in for the table
+            continue;
+        } else if (symbol.st_shndx == SHN_UNDEF) {
+            void* address = dlsym(RTLD_DEFAULT, name.c_str());
+            if (!address) {
+                printFatal(("undefined reference to '" + name + "'").c_str());
+            }
+            values[i] = reinterpret_cast<uint64_t>(address);
+            external[i] = true;
+            Dl_info info;
+            void* entry = nullptr;
+            if (dladdr1(address, &info, &entry, RTLD_DL_SYMENT) && entry) {
+                const auto* definition = static_cast<const Elf64_Sym*>(entry);
+                int type = ELF64_ST_TYPE(definition->st_info);
+                externalData[i] = type == STT_OBJECT || type == STT_TLS;
+            }
+        } else if (symbol.st_shndx == SHN_ABS) {
+            values[i] = symbol.st_value;
+        } else if (symbol.st_shndx < sectionCount) {
+            values[i] = addresses[symbol.st_shndx] + symbol.st_value;
+        } else {
+            printFatal(("unsupported symbol '" + name + "' in the assembled object").c_str());
+        }
+        if (ELF64_ST_BIND(symbol.st_info) != STB_LOCAL && symbol.st_shndx != SHN_UNDEF) {
+            symbols[name] = values[i];
+        }
+        if (ELF64_ST_TYPE(symbol.st_info) == STT_FUNC && symbol.st_size > 0) {
+            functions.push_back({values[i], symbol.st_size, name});
+        }
+    }
+
+    for (size_t i = 0; i < sectionCount; ++i) {
+        const auto& section = sections[i];
+        if (section.sh_type != SHT_RELA || !(sections[section.sh_info].sh_flags & SHF_ALLOC)) {
+            continue;
+        }
+        const auto* relocations = reinterpret_cast<const Elf64_Rela*>(object.data() + section.sh_offset);
+        for (size_t r = 0; r < section.sh_size / sizeof(Elf64_Rela); ++r) {
+            const auto& relocation = relocations[r];
+            size_t index = ELF64_R_SYM(relocation.r_info);
+            uint64_t place = addresses[section.sh_info] + relocation.r_offset;
+            uint64_t target = values[index];
+            int64_t addend = relocation.r_addend;
+            auto slot = [&]() {
+                if (!symbolStubs[index]) {
+                    symbolStubs[index] = makeStub(target);
+                }
+                return symbolStubs[index];
+            };
+
+            int64_t value;
+            size_t width = 4;
+            switch (ELF64_R_TYPE(relocation.r_info)) {
+                case R_X86_64_NONE:
+                    continue;
+                case R_X86_64_64:
+                    value = target + addend;
+                    width = 8;
+                    break;
+                case R_X86_64_PC64:
+                    value = target + addend - place;
+                    width = 8;
+                    break;
+                case R_X86_64_PC32:
+                case R_X86_64_PLT32:
+                    // runtime functions can be far away, calls to them go through a stub next to the code,
+                    // data has to be reached where it is since a stub would be read in its place
+                    if (external[index] && (ELF64_R_TYPE(relocation.r_info) == R_X86_64_PLT32 || !externalData[index])) {
+                        target = slot();
+                    }
+                    value = target + addend - place;
+                    if (!fitsSigned32(value)) {
+                        printFatal(externalData[index]
+                            ? ("'" + std::string(names + symbolEntries[index].st_name) + "' is out of reach of the loaded code, refer to it through the GOT").c_str()
+                            : "relocation out of range while loading the program");
+                    }
+                    break;
+                case R_X86_64_GOTPCREL:
+                case R_X86_64_GOTPCRELX:
+                case R_X86_64_REX_GOTPCRELX:
+                    value = slot() + 6 + addend - place;
+                    break;
+                case R_X86_64_32:
+                    value = target + addend;
+                    if (uint64_t(value) > UINT32_MAX) {
+                        printFatal("absolute address does not fit in 32 bits, the program was not mapped low enough");
+                    }
+                    break;
+                case R_X86_64_32S:
+                    value = target + addend;
+                    if (!fitsSigned32(value)) {
+                        printFatal("absolute address does not fit in 32 bits, the program was not mapped low enough");
+                    }
+                    break;
+                default:
+                    printFatal(("unsupported relocation type " + std::to_string(ELF64_R_TYPE(relocation.r_info))).c_str());
+                    continue;
+            }
+            std::memcpy(reinterpret_cast<void*>(place), &value, width);
+        }
+    }
+
+    if (mprotect(image, executableSize, PROT_READ | PROT_EXEC) != 0) {
+        printFatal("could not make the program executable");
+    }
+}
+
+int Jit::run(const std::vector<std::string>& args) {
+    auto it = symbols.find("main");
+    if (it == symbols.end()) {
+        printFatal("the program has no main function");
+    }
+    std::vector<char*> argv;
+    for (const auto& arg : args) {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    auto entry = reinterpret_cast<int64_t (*)(int, char**)>(it->second);
+#ifdef __SANITIZE_ADDRESS__
+    // what the program allocates and never frees is its own business, not a leak in the compiler
+    __lsan::ScopedDisabler disabler;
+#endif
+    return static_cast<int>(entry(static_cast<int>(args.size()), argv.data()));
+}
+
+bool Jit::writePerfMap() const {
+    std::string path = "/tmp/perf-" + std::to_string(getpid()) + ".map";
+    FILE* file = std::fopen(path.c_str(), "w");
+    if (!file) {
+        return false;
+    }
+    for (const auto& function : functions) {
+        std::fprintf(file, "%lx %lx %s\n", static_cast<unsigned long>(function.address),
+                     static_cast<unsigned long>(function.size), function.name.c_str());
+    }
+    return std::fclose(file) == 0;
+}
+
+} // namespace EntS
@@ -0,0 +1,52 @@
+#ifndef JIT_HPP
+#define JIT_HPP
+
+#include "codegenerator.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace EntS {
+
+// In memory execution for `ents --run`. The generated assembly is turned into a relocatable
+// object without touching the disk, the object is loaded into mmap'ed memory, its relocations
+// are applied with runtime functions resolved in this process, and main is called directly.
+class Jit {
+public:
+    explicit Jit(const CodeGenerator& generator);
+    ~Jit();
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+
+    // calls main with the given argument vector and returns what it returned
+    int run(const std::vector<std::string>& args);
+
+    // writes /tmp/perf-<pid>.map so perf can name the samples that land in the loaded code
+    bool writePerfMap() const;
+
+private:
+    std::vector<unsigned char> assemble(const CodeGenerator& generator);
+    void load(const std::vector<unsigned char>& object);
+    uint64_t makeStub(uint64_t target);
+
+    unsigned char* image = nullptr;
+    size_t imageSize = 0;
+    size_t executableSize = 0;
+    unsigned char* stubs = nullptr; // jmp [rip] stubs for runtime functions, the address each holds doubles as a GOT entry
+    size_t stubCount = 0;
+    size_t stubCapacity = 0;
+    std::unordered_map<std::string, uint64_t> symbols; // global symbols defined by the program
+
+    struct FunctionRange {
+        uint64_t address;
+        uint64_t size;
+        std::string name;
+    };
+    std::vector<FunctionRange> functions; // sized function symbols, in symbol table order
+};
+
+} // namespace EntS
+
+#endif // JIT_HPP
@@ -18,7 +18,9 @@ static const std::unordered_map<std::string, Token::TokenType> keywords = {
     {"default", Token::TokenType::DEFAULT},
     {"break", Token::TokenType::BREAK},
     {"continue", Token::TokenType::CONTINUE},
+    {"asm", Token::TokenType::ASM},
     {"header", Token::TokenType::HEADER},
+    {"const", Token::TokenType::CONST},
     {"int8", Token::TokenType::INT8},
     {"int16", Token::TokenType::INT16},
     {"int32", Token::TokenType::INT32},
@@ -28,12 +30,17 @@ static const std::unordered_map<std::string, Token::TokenType> keywords = {
     {"uint32", Token::TokenType::UINT32},
     {"uint64", Token::TokenType::UINT64},
     {"float", Token::TokenType::FLOAT},
+    {"double", Token::TokenType::DOUBLE},
+    {"int32x4", Token::TokenType::INT32X4},
+    {"uint8x16", Token::TokenType::UINT8X16},
+    {"int64x2", Token::TokenType::INT64X2},
+    {"floatx4", Token::TokenType::FLOATX4},
     {"char", Token::TokenType::CHAR},
     {"bool", Token::TokenType::BOOL},
 };
 
-Lexer::Lexer(std::string_view source)
-    : source(source), start(0), current(0), line(1), column(1) {
+Lexer::Lexer(std::string_view source, std::vector<int> lineMap)
+    : source(source), start(0), current(0), line(1), column(1), lineMap(std::move(lineMap)) {
     tokens.reserve(source.size() / 4); // Estimate, to minimize resizing
 }
 
@@ -118,11 +125,15 @@ bool Lexer::match(char expected) {
 }
 
 void Lexer::addToken(Token::TokenType type, std::string_view value) {
-    tokens.emplace_back(type, std::string(value), line, column - (current - start));
+    tokens.emplace_back(type, std::string(value), sourceLine(), column - (current - start));
 }
 
 void Lexer::error(const std::string& message) {
-    std::cerr << "Error at line " << line << ", column " << column << ": " << message << std::endl;
+    std::cerr << "Error at line " << sourceLine() << ", column " << column << ": " << message << std::endl;
+}
+
+int Lexer::sourceLine() const {
+    return line >= 1 && static_cast<size_t>(line) <= lineMap.size() ? lineMap[line - 1] : line;
 }
 
 void Lexer::handleIdentifier() {
@@ -143,6 +154,9 @@ void Lexer::handleNumber() {
         while (std::isdigit(peek())) {
             advance();
         }
+        if (peek() == 'f') {
+            advance(); // single precision suffix
+        }
     }
     addToken(Token::TokenType::NUMBER, source.substr(start, current - start));
 }
@@ -153,6 +167,10 @@ void Lexer::handleString() {
             line++;
             column = 1;
         }
+        // an escaped quote does not end the string, the escapes themselves are decoded later
+        if (peek() == '\\' && current + 1 < source.length()) {
+            advance();
+        }
         advance();
     }
     if (current >= source.length()) {
@@ -11,7 +11,8 @@ namespace EntS {
 
 class Lexer {
 public:
-    explicit Lexer(std::string_view source);
+    // `lineMap` takes lines of the preprocessed source back to the file they were read from
+    explicit Lexer(std::string_view source, std::vector<int> lineMap = {});
     std::vector<Token> tokenize();
 
 private:
@@ -21,6 +22,7 @@ private:
     bool match(char expected);
     void addToken(Token::TokenType type, std::string_view value = "");
     void error(const std::string& message);
+    int sourceLine() const;
 
     void handleIdentifier();
     void handleNumber();
@@ -37,6 +39,7 @@ private:
     size_t current;
     int line;
     int column;
+    std::vector<int> lineMap;
 };
 
 } // namespace EntS
@@ -0,0 +1,293 @@
+#include "licm.hpp"
+#include "ast.hpp"
+
+namespace EntS {
+
+LoopInvariantCodeMotion::LoopInvariantCodeMotion(const std::unordered_map<std::string, std::string>& typedefs, const StructDefinitions& structs)
+    : typedefs(typedefs), structDefinitions(structs) {}
+
+void LoopInvariantCodeMotion::run(const ASTNodePtr& root) {
+    auto* program = dynamic_cast<ProgramNode*>(root.get());
+    collectGlobalTypes(program, globalTypes);
+    collectReturnTypes(program, returnTypes);
+    for (const auto& statement : program->functions) {
+        if (auto* function = dynamic_cast<FunctionNode*>(statement.get())) {
+            visitFunction(function);
+        }
+    }
+}
+
+void LoopInvariantCodeMotion::visitFunction(FunctionNode* node) {
+    functionAnalysis.emplace(node);
+    visitBlock(dynamic_cast<BlockNode*>(node->body.get()));
+    functionAnalysis.reset();
+}
+
+void LoopInvariantCodeMotion::visitBlock(BlockNode* node) {
+    if (!node) {
+        return;
+    }
+    auto& statements = node->statements;
+    for (size_t i = 0; i < statements.size(); ++i) {
+        // inner loops first, what they hoist may be invariant in the outer loop as well
+        visitNested(statements[i].get());
+        if (statements[i]->getType() != NodeType::While) {
+            continue;
+        }
+        std::vector<ASTNodePtr> preheader = hoistLoop(dynamic_cast<WhileNode*>(statements[i].get()));
+        statements.insert(statements.begin() + i, preheader.begin(), preheader.end());
+        i += preheader.size();
+    }
+}
+
+void LoopInvariantCodeMotion::visitNested(ASTNode* node) {
+    switch (node->getType()) {
+        case NodeType::If: {
+            auto* ifNode = dynamic_cast<IfNode*>(node);
+            visitBlock(dynamic_cast<BlockNode*>(ifNode->body.get()));
+            if (ifNode->else_) {
+                if (ifNode->else_->getType() == NodeType::Block) {
+                    visitBlock(dynamic_cast<BlockNode*>(ifNode->else_.get()));
+                } else {
+                    visitNested(ifNode->else_.get());
+                }
+            }
+            break;
+        }
+        case NodeType::While:
+            visitBlock(dynamic_cast<BlockNode*>(dynamic_cast<WhileNode*>(node)->body.get()));
+            break;
+        case NodeType::Switch:
+            for (auto& case_ : dynamic_cast<SwitchNode*>(node)->cases) {
+                if (auto* caseNode = dynamic_cast<CaseNode*>(case_.get())) {
+                    visitBlock(dynamic_cast<BlockNode*>(caseNode->body.get()));
+                } else if (auto* defaultNode = dynamic_cast<DefaultNode*>(case_.get())) {
+                    visitBlock(dynamic_cast<BlockNode*>(defaultNode->body.get()));
+                }
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+std::vector<ASTNodePtr> LoopInvariantCodeMotion::hoistLoop(WhileNode* node) {
+    Loop loop;
+    collectSideEffects(node, *functionAnalysis, loop.effects);
+
+    hoistTemporaries(dynamic_cast<BlockNode*>(node->body.get()), loop);
+    hoistInvariants(node->condition, loop);
+    hoistFromStatement(node->body.get(), loop);
+    return std::move(loop.preheader);
+}
+
+void LoopInvariantCodeMotion::hoistTemporaries(BlockNode* block, Loop& loop) {
+    if (!block) {
+        return;
+    }
+    // compiler temporaries are assigned exactly once, an invariant one can move as a whole
+    auto& statements = block->statements;
+    for (size_t i = 0; i < statements.size();) {
+        ASTNode* statement = statements[i].get();
+        if (const auto* decl = dynamic_cast<const VarDeclAssignNode*>(statement);
+            decl && decl->name[0] == '$' && isInvariant(decl->expression.get(), loop.effects)) {
+            loop.effects.assigned.erase(decl->name);
+            loop.preheader.push_back(std::move(statements[i]));
+            statements.erase(statements.begin() + i);
+            continue;
+        }
+
+        // temporaries left inside inner loops were not invariant there, so they are not invariant here
+        if (auto* ifNode = dynamic_cast<IfNode*>(statement)) {
+            for (IfNode* branch = ifNode; branch;) {
+                hoistTemporaries(dynamic_cast<BlockNode*>(branch->body.get()), loop);
+                if (branch->else_ && branch->else_->getType() == NodeType::Block) {
+                    hoistTemporaries(dynamic_cast<BlockNode*>(branch->else_.get()), loop);
+                }
+                branch = dynamic_cast<IfNode*>(branch->else_.get());
+            }
+        } else if (auto* switchNode = dynamic_cast<SwitchNode*>(statement)) {
+            for (auto& case_ : switchNode->cases) {
+                if (auto* caseNode = dynamic_cast<CaseNode*>(case_.get())) {
+                    hoistTemporaries(dynamic_cast<BlockNode*>(caseNode->body.get()), loop);
+                } else if (auto* defaultNode = dynamic_cast<DefaultNode*>(case_.get())) {
+                    hoistTemporaries(dynamic_cast<BlockNode*>(defaultNode->body.get()), loop);
+                }
+            }
+        }
+        ++i;
+    }
+}
+
+void LoopInvariantCodeMotion::hoistFromStatement(ASTNode* statement, Loop& loop) {
+    if (!statement) {
+        return;
+    }
+    switch (statement->getType()) {
+        case NodeType::Block:
+            for (auto& child : dynamic_cast<BlockNode*>(statement)->statements) {
+                hoistFromStatement(child.get(), loop);
+            }
+            break;
+        case NodeType::If: {
+            auto* ifNode = dynamic_cast<IfNode*>(statement);
+            hoistInvariants(ifNode->condition, loop);
+            hoistFromStatement(ifNode->body.get(), loop);
+            hoistFromStatement(ifNode->else_.get(), loop);
+            break;
+        }
+        case NodeType::While: {
+            auto* whileNode = dynamic_cast<WhileNode*>(statement);
+            hoistInvariants(whileNode->condition, loop);
+            hoistFromStatement(whileNode->body.get(), loop);
+            break;
+        }
+        case NodeType::Switch: {
+            auto* switchNode = dynamic_cast<SwitchNode*>(statement);
+            hoistInvariants(switchNode->condition, loop);
+            for (auto& case_ : switchNode->cases) {
+                if (auto* caseNode = dynamic_cast<CaseNode*>(case_.get())) {
+                    hoistFromStatement(caseNode->body.get(), loop);
+                } else if (auto* defaultNode = dynamic_cast<DefaultNode*>(case_.get())) {
+                    hoistFromStatement(defaultNode->body.get(), loop);
+                }
+            }
+            break;
+        }
+        case NodeType::StructMemberAssign:
+            // the member access on the left is a store target, not a value
+            hoistInvariants(dynamic_cast<StructMemberAssignNode*>(statement)->value, loop);
+            break;
+        default:
+            forEachChildSlot(statement, [this, &loop](ASTNodePtr& child) { hoistInvariants(child, loop); });
+            break;
+    }
+}
+
+void LoopInvariantCodeMotion::hoistInvariants(ASTNodePtr& slot, Loop& loop) {
+    if (!slot) {
+        return;
+    }
+    if (isInvariant(slot.get(), loop.effects) && isWorthHoisting(slot.get())) {
+        std::string key = structuralKey(slot.get());
+        auto found = loop.hoisted.find(key);
+        if (found == loop.hoisted.end()) {
+            std::string temporary = "$licm" + std::to_string(temporaryCounter++);
+            std::string type = temporaryType(slot.get());
+            temporaryTypes[temporary] = type;
+            loop.preheader.push_back(std::make_shared<VarDeclAssignNode>(type, temporary, slot));
+            found = loop.hoisted.emplace(key, temporary).first;
+            hoistedCount++;
+        }
+        slot = std::make_shared<IdentifierNode>(found->second);
+        return;
+    }
+    if (slot->getType() == NodeType::StructMemberAccess) {
+        return;
+    }
+    forEachChildSlot(slot.get(), [this, &loop](ASTNodePtr& child) { hoistInvariants(child, loop); });
+}
+
+bool LoopInvariantCodeMotion::isInvariant(const ASTNode* node, const SideEffects& effects) const {
+    if (!node) {
+        return false;
+    }
+    auto isStable = [&](const std::string& name) {
+        if (effects.assigned.count(name)) {
+            return false;
+        }
+        // a pointer may be dangling until the loop decides to dereference it
+        if (functionAnalysis->isPointerBacked(name)) {
+            return false;
+        }
+        return !effects.writesMemory || !functionAnalysis->isMemoryResident(name);
+    };
+
+    switch (node->getType()) {
+        case NodeType::Literal:
+            return true;
+        case NodeType::Identifier:
+            return isStable(dynamic_cast<const IdentifierNode*>(node)->name);
+        case NodeType::MemoryAddress:
+            return !effects.assigned.count(dynamic_cast<const MemoryAddressNode*>(node)->name);
+        case NodeType::StructMemberAccess:
+            return isStable(memberAccessRoot(dynamic_cast<const StructMemberAccessNode*>(node)));
+        case NodeType::Expression: {
+            const auto* expression = dynamic_cast<const ExpressionNode*>(node);
+            // division traps on zero, it stays where the program put it
+            if (expression->op == "/" || expression->op == "%") {
+                return false;
+            }
+            bool invariant = true;
+            forEachChild(node, [&](const ASTNode* child) { invariant = invariant && isInvariant(child, effects); });
+            return invariant;
+        }
+        default:
+            // indexing dereferences arbitrary memory, calls and string literals are never invariant
+            return false;
+    }
+}
+
+bool LoopInvariantCodeMotion::isWorthHoisting(const ASTNode* node) const {
+    // plain loads cost as much as reloading the temporary, and constants are folded elsewhere
+    if (node->getType() != NodeType::Expression) {
+        return false;
+    }
+    std::function<bool(const ASTNode*)> readsVariable = [&](const ASTNode* child) {
+        if (child->getType() != NodeType::Literal && child->getType() != NodeType::Expression) {
+            return true;
+        }
+        bool found = false;
+        forEachChild(child, [&](const ASTNode* grandchild) { found = found || readsVariable(grandchild); });
+        return found;
+    };
+    return readsVariable(node);
+}
+
+std::string LoopInvariantCodeMotion::structuralKey(const ASTNode* node) const {
+    switch (node->getType()) {
+        case NodeType::Literal:
+            return "#" + dynamic_cast<const LiteralNode*>(node)->value;
+        case NodeType::Identifier:
+            return dynamic_cast<const IdentifierNode*>(node)->name;
+        case NodeType::MemoryAddress:
+            return "[" + dynamic_cast<const MemoryAddressNode*>(node)->name + "]";
+        case NodeType::StructMemberAccess: {
+            const auto* access = dynamic_cast<const StructMemberAccessNode*>(node);
+            return structuralKey(access->base.get()) + "->" + access->memberName;
+        }
+        case NodeType::Expression: {
+            const auto* expression = dynamic_cast<const ExpressionNode*>(node);
+            std::string key = "(" + expression->op;
+            key += " " + (expression->left && *expression->left ? structuralKey(expression->left->get()) : "_");
+            key += " " + (expression->right && *expression->right ? structuralKey(expression->right->get()) : "_");
+            return key + ")";
+        }
+        default:
+            return "?";
+    }
+}
+
+std::string LoopInvariantCodeMotion::variableType(const std::string& name) const {
+    if (const VariableInfo* info = functionAnalysis->lookup(name)) {
+        return info->type;
+    }
+    if (auto temporary = temporaryTypes.find(name); temporary != temporaryTypes.end()) {
+        return temporary->second;
+    }
+    auto it = globalTypes.find(name);
+    return it != globalTypes.end() ? it->second : "";
+}
+
+std::string LoopInvariantCodeMotion::temporaryType(const ASTNode* node) const {
+    TypeEnvironment environment{typedefs, structDefinitions,
+        [this](const std::string& name) { return variableType(name); },
+        [this](const std::string& name) -> std::string {
+            auto it = returnTypes.find(name);
+            return it != returnTypes.end() ? it->second : "";
+        }};
+    std::string type = expressionType(node, environment);
+    return isFloatingType(type, typedefs, structDefinitions) || isVectorType(type, typedefs, structDefinitions) ? type : "int64";
+}
+
+} // namespace EntS
@@ -0,0 +1,60 @@
+#ifndef LICM_HPP
+#define LICM_HPP
+
+#include "ast.hpp"
+#include "analysis.hpp"
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace EntS {
+
+// Loop invariant code motion.
+//
+// Every `while` is a natural loop whose preheader is the position right in front of it, so hoisted
+// values become temporaries declared there. A value is invariant when nothing it reads is assigned
+// inside the loop and, for memory-resident storage, the loop does not write memory at all. Only
+// computations that cannot fault are hoisted since the loop body may never run.
+class LoopInvariantCodeMotion {
+public:
+    LoopInvariantCodeMotion(const std::unordered_map<std::string, std::string>& typedefs, const StructDefinitions& structs);
+    void run(const ASTNodePtr& root);
+    int getHoistedCount() const { return hoistedCount; }
+
+private:
+    struct Loop {
+        SideEffects effects;
+        std::vector<ASTNodePtr> preheader;
+        std::unordered_map<std::string, std::string> hoisted; // structural key -> temporary
+    };
+
+    void visitFunction(FunctionNode* node);
+    void visitBlock(BlockNode* node);
+    void visitNested(ASTNode* node);
+    std::vector<ASTNodePtr> hoistLoop(WhileNode* node);
+
+    void hoistTemporaries(BlockNode* block, Loop& loop);
+    void hoistInvariants(ASTNodePtr& slot, Loop& loop);
+    void hoistFromStatement(ASTNode* statement, Loop& loop);
+
+    bool isInvariant(const ASTNode* node, const SideEffects& effects) const;
+    bool isWorthHoisting(const ASTNode* node) const;
+    std::string structuralKey(const ASTNode* node) const;
+    std::string variableType(const std::string& name) const;
+    std::string temporaryType(const ASTNode* node) const;
+
+    const std::unordered_map<std::string, std::string>& typedefs;
+    const StructDefinitions& structDefinitions;
+    std::unordered_map<std::string, std::string> globalTypes;
+    std::unordered_map<std::string, std::string> returnTypes;
+    std::unordered_map<std::string, std::string> temporaryTypes;
+    std::optional<FunctionAnalysis> functionAnalysis;
+
+    int temporaryCounter = 0;
+    int hoistedCount = 0;
+};
+
+} // namespace EntS
+
+#endif // LICM_HPP
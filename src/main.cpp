@@ -3,14 +3,28 @@
 #include <string>
 #include <vector>
 #include <filesystem>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <thread>
+#include <functional>
+#include <cstdio>
+#include <unistd.h>
 
 #include "preprocessor.hpp"
 #include "lexer.hpp"
 #include "tokens.hpp"
 #include "formats.hpp"
 #include "ast.hpp"
+#include "analysis.hpp"
 #include "parser.hpp"
+#include "wholeprogram.hpp"
+#include "passmanager.hpp"
 #include "codegenerator.hpp"
+#include "costmodel.hpp"
+#include "jit.hpp"
+#include "bytecode.hpp"
+#include "interpreter.hpp"
 
 constexpr std::string_view ANSI_RESET = "\033[0m";
 constexpr std::string_view ANSI_BOLD_RED = "\033[1;31m";
@@ -24,11 +38,16 @@ constexpr std::string_view incDir = SYSROOT"/include/ents";
 
 using namespace EntS;
 
+// functions are compiled on several threads, the first one to fail reports and ends the process
+static std::mutex failure;
+
 void printFatal(const char* str) { 
+    failure.lock();
     std::cout << ANSI_BOLD_WHITE << "ents: " << ANSI_BOLD_RED << "fatal error: " << ANSI_RESET << str << "\n" << "compilation terminated.\n"; 
     exit(1);
 }
 void printError(const char* str) { 
+    failure.lock();
     std::cout << ANSI_BOLD_WHITE << "ents: " << ANSI_BOLD_RED << "error: " << ANSI_RESET << str << "\n"; 
     exit(1);
 }
@@ -36,6 +55,26 @@ void printWarning(const char* str) {
     std::cout << ANSI_BOLD_WHITE << "ents: " << ANSI_BOLD_YELLOW << "warning: " << ANSI_RESET << str << "\n"; 
 }
 
+// --run and --interpret find what the program calls in this process, the runtime of intlibe.a is not part of it
+static std::optional<std::string> findRuntimeCall(const ASTNode* program) {
+    std::set<std::string> defined;
+    for (const auto& statement : dynamic_cast<const ProgramNode*>(program)->functions) {
+        if (const auto* function = dynamic_cast<const FunctionNode*>(statement.get())) {
+            defined.insert(function->name);
+        }
+    }
+    std::optional<std::string> found;
+    std::function<void(const ASTNode*)> visit = [&](const ASTNode* node) {
+        const auto* call = dynamic_cast<const FunctionCallNode*>(node);
+        if (call && !found && call->name.starts_with("ents_") && !defined.count(call->name)) {
+            found = call->name;
+        }
+        forEachChild(node, visit);
+    };
+    visit(program);
+    return found;
+}
+
 void printHelp() {
     std::cout << "Usage: ents [options] <input-files>\n"
               << "Options:\n"
@@ -44,7 +83,27 @@ void printHelp() {
               << "  -o, --output <file>   Specify output file\n"
               << "  -S                    Generate assembly code only\n"
               << "  -f, --format <format> Specify output format (obj, elf; default is elf)\n"
-              << "  -I, --include <path>  Adds a specific folder into the include path\n";
+              << "  -I, --include <path>  Adds a specific folder into the include path\n"
+              << "  -j, --jobs <count>    Compile functions on <count> threads (default: one per core)\n"
+              << "  -finstrument-functions\n"
+              << "                        Count calls and cycles of every function, written to ents-profile.txt at exit\n"
+              << "  -fprofile-generate    Count branches, calls and function entries, added to ents.profdata at exit\n"
+              << "  -fprofile-use=<file>  Lay out branches, loops, switches and functions by the counts in <file>\n"
+              << "  -flto                 Compile all input files as one program, inlining and propagating across them\n"
+              << "  -fstack-usage         Write the frame size and worst call chain of every function to <input>.su\n"
+              << "  -Wframe-larger-than=<bytes>\n"
+              << "                        Warn about functions whose frame is larger than <bytes>\n"
+              << "  -O0, -O1, -O2, -Os    Optimisation level (default: -O2)\n"
+              << "  -fno-<pass>           Turn off one pass: whole-program, idioms, sroa, value-numbering, licm\n"
+              << "  --print-after=<pass>  Print the AST after <pass> has run\n"
+              << "  --pass-stats          Report the time and number of changes of every pass on stderr\n"
+              << "  --cost-report         Print a static cycle estimate per function and basic block instead of the assembly\n"
+              << "  -g                    Emit line tables and unwind information, with --run also write a perf map\n"
+              << "  --run <file> [args]   Compile <file> in memory and run it, arguments after it go to the program,\n"
+              << "                        the C library is available but not the runtime of intlibe.a\n"
+              << "  --interpret <file> [args]\n"
+              << "                        Run <file> with the bytecode interpreter, arguments after it go to the program,\n"
+              << "                        integer and pointer code only: no structs, floating point, vectors or inline assembly\n";
 }
 
 void printVersion() {
@@ -70,6 +129,18 @@ int main(int argc, char** argv) {
     bool generateAssemblyOnly = false;
     OutputFormat outputFormat = OutputFormat::ELF;
     std::vector<std::string> incPath = { std::string(incDir) };
+    unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
+    bool run = false;
+    bool interpret = false;
+    bool costReport = false;
+    bool stackUsage = false;
+    std::optional<int> frameLimit;
+    bool debugInfo = false;
+    PassOptions passOptions;
+    bool instrumentFunctions = false;
+    bool profileGenerate = false;
+    std::shared_ptr<const ProfileData> profile;
+    std::vector<std::string> programArgs;
 
     std::vector<std::string> checkDirs = { std::string(libDir) + "/crt0.o", std::string(libDir) + "/intlibe.a" };
     for (const auto& dir : checkDirs) {
@@ -99,8 +170,61 @@ int main(int argc, char** argv) {
             outputFormat = *formatOpt;
         } else if ((arg == "-I" || arg == "--include") && i + 1 < argc) {
             incPath.push_back(argv[++i]);
+        } else if ((arg == "-j" || arg == "--jobs") && i + 1 < argc) {
+            std::string count = argv[++i];
+            if (count.empty() || count.find_first_not_of("0123456789") != std::string::npos || std::stoul(count) == 0) {
+                printFatal("invalid job count");
+            }
+            jobs = std::stoul(count);
+        } else if (arg == "-finstrument-functions") {
+            instrumentFunctions = true;
+        } else if (arg == "-fprofile-generate") {
+            profileGenerate = true;
+        } else if (arg.starts_with("-fprofile-use=")) {
+            profile = std::make_shared<ProfileData>(arg.substr(std::string("-fprofile-use=").size()));
+        } else if (arg == "-fstack-usage") {
+            stackUsage = true;
+        } else if (arg.starts_with("-Wframe-larger-than=")) {
+            std::string bytes = arg.substr(std::string("-Wframe-larger-than=").size());
+            if (bytes.empty() || bytes.find_first_not_of("0123456789") != std::string::npos) {
+                printFatal("invalid frame size limit");
+            }
+            frameLimit = std::stoi(bytes);
+        } else if (arg == "-flto") {
+            passOptions.wholeProgram = true;
+        } else if (arg == "-O0") {
+            passOptions.level = OptimizationLevel::O0;
+        } else if (arg == "-O1") {
+            passOptions.level = OptimizationLevel::O1;
+        } else if (arg == "-O2") {
+            passOptions.level = OptimizationLevel::O2;
+        } else if (arg == "-Os") {
+            passOptions.level = OptimizationLevel::Os;
+        } else if (arg.starts_with("-fno-") && PassManager::isPass(arg.substr(5))) {
+            passOptions.disabled.insert(arg.substr(5));
+        } else if (arg.starts_with("--print-after=")) {
+            std::string pass = arg.substr(std::string("--print-after=").size());
+            if (!PassManager::isPass(pass)) {
+                printFatal(("unknown pass: " + pass).c_str());
+            }
+            passOptions.printAfter.insert(pass);
+        } else if (arg == "--cost-report") {
+            costReport = true;
+        } else if (arg == "--pass-stats") {
+            passOptions.statistics = true;
+        } else if (arg == "-g") {
+            debugInfo = true;
+        } else if (arg == "--run") {
+            run = true;
+        } else if (arg == "--interpret") {
+            interpret = true;
         } else if (arg[0] != '-') {
             inputFiles.push_back(arg);
+            if (run || interpret) {
+                // everything after the file belongs to the program, argv[0] is the file itself
+                programArgs.assign(argv + i, argv + argc);
+                break;
+            }
         } else {
             printWarning(("unknown flag: " + arg).c_str());
         }
@@ -109,28 +233,126 @@ int main(int argc, char** argv) {
     if (inputFiles.empty()) {
         printFatal("no input files");
     }
+    if (instrumentFunctions && (run || interpret)) {
+        printFatal("-finstrument-functions needs the runtime in intlibe.a, it cannot be combined with --run or --interpret");
+    }
+    if (costReport && (run || interpret)) {
+        printFatal("--cost-report looks at the generated assembly, it cannot be combined with --run or --interpret");
+    }
+    if (profileGenerate && (run || interpret)) {
+        printFatal("-fprofile-generate needs the runtime in intlibe.a, it cannot be combined with --run or --interpret");
+    }
+
+    // with -flto every input is parsed before anything is compiled and they make up one program
+    std::vector<std::vector<std::string>> units;
+    if (passOptions.wholeProgram) {
+        units.push_back(inputFiles);
+    } else {
+        for (const auto& inputFile : inputFiles) {
+            units.push_back({inputFile});
+        }
+    }
+
+    for (const auto& unit : units) {
+        std::vector<ASTNodePtr> programs;
+        std::unordered_map<std::string, std::string> typedefs;
+        StructDefinitions structs;
+        for (const auto& inputFile : unit) {
+            Preprocessor preprocessor(incPath);
+            auto preprocessedContent = preprocessor.preprocess(inputFile);
+            if (!preprocessedContent) {
+                printFatal(("failed to preprocess file: " + inputFile).c_str());
+            }
 
-    for (const auto& inputFile : inputFiles) {
-        Preprocessor preprocessor(incPath);
-        auto preprocessedContent = preprocessor.preprocess(inputFile);
-        if (!preprocessedContent) {
-            printFatal(("failed to preprocess file: " + inputFile).c_str());
+            Lexer lexer(*preprocessedContent, preprocessor.getLineMap());
+            auto tokens = lexer.tokenize();
+
+            Parser parser(tokens);
+            programs.push_back(parser.parse());
+            WholeProgram::mergeDefinitions(typedefs, structs, parser.getTypedefs(), parser.getStructs());
+        }
+        ASTNodePtr ast = programs.size() == 1 ? programs[0] : WholeProgram::link(programs);
+
+        if (!run && !interpret) {
+            ast->print();
+        } else if (auto runtimeCall = findRuntimeCall(ast.get())) {
+            printFatal(("'" + *runtimeCall + "' is part of the runtime in intlibe.a, programs using it cannot be run with --run or --interpret").c_str());
         }
+        PassManager passManager(typedefs, structs, passOptions);
 
-        Lexer lexer(*preprocessedContent);
-        auto tokens = lexer.tokenize();
+        // scripts start straight from the parsed program, the optimisation passes are not worth their time there
+        if (interpret) {
+            passManager.run(ast, true);
+            BytecodeCompiler bytecodeCompiler(typedefs, structs);
+            BytecodeProgram program = bytecodeCompiler.compile(ast);
+            std::vector<char*> programArgv;
+            for (auto& arg : programArgs) {
+                programArgv.push_back(arg.data());
+            }
+            programArgv.push_back(nullptr);
+            Interpreter interpreter(program);
+            return static_cast<int>(interpreter.run("main", {static_cast<int64_t>(programArgs.size()), reinterpret_cast<int64_t>(programArgv.data())}));
+        }
 
-        Parser parser(tokens);
-        auto ast = parser.parse();
+        passManager.run(ast);
 
-        ast->print();
-        CodeGenerator codeGenerator(parser.getTypedefs(), parser.getStructs());
+        CodeGenerator codeGenerator(typedefs, structs, jobs);
+        if (debugInfo) {
+            std::vector<std::string> sourceFiles;
+            for (const auto& inputFile : unit) {
+                sourceFiles.push_back(std::filesystem::absolute(inputFile).string());
+            }
+            codeGenerator.setDebugInfo(sourceFiles);
+        }
+        codeGenerator.setInstrumentFunctions(instrumentFunctions);
+        codeGenerator.setProfileGenerate(profileGenerate);
+        codeGenerator.setProfileUse(profile);
         codeGenerator.generateCode(ast);
-        std::string assemble = codeGenerator.getGeneratedCode();
+
+        if (frameLimit) {
+            for (const auto& usage : codeGenerator.getStackUsage()) {
+                if (usage.frameBytes > *frameLimit) {
+                    printWarning(("the frame of " + usage.name + " is " + std::to_string(usage.frameBytes) + " bytes, larger than " +
+                                  std::to_string(*frameLimit) + " bytes").c_str());
+                }
+            }
+        }
+        if (stackUsage) {
+            // named after the first file of the unit, like a.su for a.ent
+            std::string path = std::filesystem::path(unit.front()).stem().string() + ".su";
+            std::ofstream out(path);
+            if (!out) {
+                printFatal(("could not write " + path).c_str());
+            }
+            StackUsageReport(codeGenerator.getStackUsage()).write(out, unit);
+        }
+
+        if (run) {
+            Jit jit(codeGenerator);
+            if (debugInfo && !jit.writePerfMap()) {
+                printWarning("could not write the perf map");
+            }
+            return jit.run(programArgs);
+        }
 
         printf("\n\n");
 
-        std::cout << "Assembly:\n" << assemble << "\n\n";
+        if (costReport) {
+            CostModel costModel;
+            costModel.analyze(codeGenerator.getGeneratedCode());
+            std::cout << "Cost report:\n";
+            costModel.print(std::cout);
+            std::cout << "\n";
+            continue;
+        }
+
+        // the assembly goes out chunk by chunk, everything buffered before it has to be flushed first
+        std::cout << "Assembly:\n" << std::flush;
+        fflush(stdout);
+        if (!codeGenerator.writeGeneratedCode(STDOUT_FILENO)) {
+            printFatal("failed to write the generated assembly");
+        }
+        std::cout << "\n\n";
     }
     return 0;
 }
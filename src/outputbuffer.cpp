@@ -0,0 +1,90 @@
+#include "outputbuffer.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <sys/uio.h>
+
+namespace EntS {
+
+char* OutputBuffer::reserve(size_t bytes) {
+    if (chunks.empty() || chunks.back().capacity - chunks.back().used < bytes) {
+        size_t capacity = chunks.empty() ? firstChunkSize : std::min(chunkSize, chunks.back().capacity * 2);
+        capacity = std::max(capacity, bytes);
+        // every byte is written before it is read, there is nothing to clear
+        chunks.push_back({std::make_unique_for_overwrite<char[]>(capacity), capacity, 0});
+    }
+    return chunks.back().data.get() + chunks.back().used;
+}
+
+void OutputBuffer::append(std::string_view text) {
+    while (!text.empty()) {
+        char* cursor = reserve(1);
+        size_t count = std::min(text.size(), chunks.back().capacity - used());
+        std::memcpy(cursor, text.data(), count);
+        used() += count;
+        text.remove_prefix(count);
+    }
+}
+
+void OutputBuffer::splice(OutputBuffer&& other) {
+    for (auto& chunk : other.chunks) {
+        if (chunk.used < chunkSize) {
+            append(std::string_view(chunk.data.get(), chunk.used));
+        } else {
+            chunks.push_back(std::move(chunk));
+        }
+    }
+    other.chunks.clear();
+}
+
+size_t OutputBuffer::size() const {
+    size_t total = 0;
+    for (const auto& chunk : chunks) {
+        total += chunk.used;
+    }
+    return total;
+}
+
+std::string OutputBuffer::str() const {
+    std::string result;
+    result.reserve(size());
+    for (const auto& chunk : chunks) {
+        result.append(chunk.data.get(), chunk.used);
+    }
+    return result;
+}
+
+// one writev per IOV_MAX chunks, picking up where a short write left off
+bool OutputBuffer::writeTo(int fd) const {
+    std::vector<iovec> vectors;
+    vectors.reserve(chunks.size());
+    for (const auto& chunk : chunks) {
+        if (chunk.used > 0) {
+            vectors.push_back({chunk.data.get(), chunk.used});
+        }
+    }
+
+    size_t next = 0;
+    while (next < vectors.size()) {
+        int count = static_cast<int>(std::min<size_t>(vectors.size() - next, IOV_MAX));
+        ssize_t written = ::writev(fd, vectors.data() + next, count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        while (next < vectors.size() && static_cast<size_t>(written) >= vectors[next].iov_len) {
+            written -= vectors[next].iov_len;
+            next++;
+        }
+        if (written > 0) {
+            vectors[next].iov_base = static_cast<char*>(vectors[next].iov_base) + written;
+            vectors[next].iov_len -= written;
+        }
+    }
+    return true;
+}
+
+} // namespace EntS
@@ -0,0 +1,67 @@
+#ifndef OUTPUT_BUFFER_HPP
+#define OUTPUT_BUFFER_HPP
+
+#include <charconv>
+#include <concepts>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace EntS {
+
+// Append only text buffer the assembly is written into. Text is copied into chunks that are never
+// reallocated, integers are formatted in place, and the whole thing can be handed to writev(2)
+// without first being joined into one string. Chunks start small and double up to `chunkSize`,
+// so the buffer of a small function stays small.
+class OutputBuffer {
+public:
+    static constexpr size_t firstChunkSize = 4 * 1024;
+    static constexpr size_t chunkSize = 64 * 1024;
+
+    OutputBuffer() = default;
+    OutputBuffer(OutputBuffer&&) = default;
+    OutputBuffer& operator=(OutputBuffer&&) = default;
+
+    void append(std::string_view text);
+    void append(char c) { append(std::string_view(&c, 1)); }
+
+    template <std::integral T>
+    requires (!std::same_as<T, char> && !std::same_as<T, bool>)
+    void append(T value) {
+        char* cursor = reserve(24);
+        used() += std::to_chars(cursor, cursor + 24, value).ptr - cursor;
+    }
+
+    // appends every part followed by a newline
+    template <typename... Parts>
+    void line(const Parts&... parts) {
+        (append(parts), ...);
+        append('\n');
+    }
+
+    // moves the chunks of another buffer to the end of this one, text in chunks smaller than
+    // `chunkSize` is copied into ours so many small buffers do not leave many small chunks
+    void splice(OutputBuffer&& other);
+
+    size_t size() const;
+    std::string str() const;
+    bool writeTo(int fd) const;
+
+private:
+    struct Chunk {
+        std::unique_ptr<char[]> data;
+        size_t capacity;
+        size_t used;
+    };
+
+    // returns room for at least `bytes` more characters at the end of the last chunk
+    char* reserve(size_t bytes);
+    size_t& used() { return chunks.back().used; }
+
+    std::vector<Chunk> chunks;
+};
+
+} // namespace EntS
+
+#endif // OUTPUT_BUFFER_HPP
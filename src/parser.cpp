@@ -1,5 +1,6 @@
 #include "parser.hpp"
 #include "ast.hpp"
+#include <algorithm>
 #include <stdexcept>
 #include <sstream>
 #include <stack>
@@ -98,7 +99,9 @@ bool Parser::isStructMember(const std::string& structName, const std::string& me
     auto it = structDefinitions.find(structName);
     if (it != structDefinitions.end()) {
         const auto& members = it->second;
-        return std::find(members.begin(), members.end(), memberName) != members.end();
+        return std::find_if(members.begin(), members.end(), [&memberName](const auto& member) {
+            return member.second == memberName;
+        }) != members.end();
     }
     return false;
 }
@@ -119,6 +122,7 @@ void Parser::error(const Token& token, const std::string& message) {
 
 ASTNodePtr Parser::parse() {
     std::vector<ASTNodePtr> statements;
+    enterScope(); // global scope
     while (!check(Token::TokenType::EOF_TOKEN)) {
         if (match({Token::TokenType::HEADER})) {
             statements.push_back(parseHeader());
@@ -126,18 +130,23 @@ ASTNodePtr Parser::parse() {
             statements.push_back(parseFunction());
         } else if (check(Token::TokenType::TYPEDEF)) {
             statements.push_back(parseTypedef());
+        } else if (check(Token::TokenType::CONST)) {
+            statements.push_back(parseGlobalVarDeclAssign());
         } else if (isType(peek().value)) {
-            if (peek(2).type == Token::TokenType::SEMICOLON) {
-                statements.push_back(parseGlobalVarDecl());
-            } else if (tokens.size() > 2 && peek(2).type == Token::TokenType::ASSIGN) {
+            // `type name` or `type [name]`
+            int after = peek(1).type == Token::TokenType::LEFT_BRACKET ? 4 : 2;
+            if (peek(after).type == Token::TokenType::SEMICOLON) {
                 statements.push_back(parseGlobalVarDecl());
+            } else if (peek(after).type == Token::TokenType::ASSIGN) {
+                statements.push_back(parseGlobalVarDeclAssign());
             } else {
-                error(peek(2), "Expect ';' or '=' after type declaration.");
+                error(peek(after), "Expect ';' or '=' after type declaration.");
             }
         } else {
             error(peek(), "Expect statement.");
         }
     }
+    exitScope();
     return std::make_shared<ProgramNode>(std::move(statements));
 }
 
@@ -202,7 +211,7 @@ ASTNodePtr Parser::parseFunctionPrototype() {
 
     expect(Token::TokenType::SEMICOLON, "Expect ';' after function prototype.");
 
-    return std::make_shared<FunctionPrototypeNode>(name, return_value, std::move(parameters));
+    return std::make_shared<FunctionPrototypeNode>(return_value, name, std::move(parameters));
 }
 
 ASTNodePtr Parser::parseTypedef() {
@@ -240,7 +249,7 @@ ASTNodePtr Parser::parseTypedef() {
 
 ASTNodePtr Parser::parseStruct() {
     std::vector<ASTNodePtr> members;
-    std::vector<std::string> memberNames;
+    std::vector<std::pair<std::string, std::string>> memberNames;
 
     expect(Token::TokenType::STRUCT, "Expect 'struct' keyword.");
     expect(Token::TokenType::LEFT_BRACE, "Expect '{' after 'struct' keyword.");
@@ -261,7 +270,7 @@ ASTNodePtr Parser::parseStruct() {
         }
         used_names.push_back(name);
         members.push_back(std::make_shared<ParameterNode>(type, name));
-        memberNames.push_back(name);
+        memberNames.emplace_back(type, name);
         expect(Token::TokenType::SEMICOLON, "Expect ';' after struct member.");
     }
     expect(Token::TokenType::RIGHT_BRACE, "Expect '}' after struct members.");
@@ -281,6 +290,8 @@ ASTNodePtr Parser::parseFunction() {
     std::string return_value;
     ASTNodePtr body;
 
+    int line = peek().line;
+    int column = peek().column;
     expect(Token::TokenType::FUNCTION, "Expect 'function' keyword.");
     name = consume().value;
     if (existing_functions.end() != std::find(existing_functions.begin(), existing_functions.end(), name)) {
@@ -332,7 +343,10 @@ ASTNodePtr Parser::parseFunction() {
     exitScope();
 
     expect(Token::TokenType::SEMICOLON, "Expect ';' after function declaration.");
-    return std::make_shared<FunctionNode>(name, return_value, std::move(parameters), std::move(body));
+    auto function = std::make_shared<FunctionNode>(name, return_value, std::move(parameters), std::move(body));
+    function->line = line;
+    function->column = column;
+    return function;
 }
 
 ASTNodePtr Parser::parseBlock() {
@@ -340,7 +354,21 @@ ASTNodePtr Parser::parseBlock() {
     enterScope();
 
     while (!check(Token::TokenType::RIGHT_BRACE) && !check(Token::TokenType::EOF_TOKEN)) {
-        if (isType(peek().value) && peek(1).type == Token::TokenType::IDENTIFIER) {
+        int line = peek().line;
+        int column = peek().column;
+        size_t parsed = statements.size();
+        if (isType(peek().value) && peek(1).type == Token::TokenType::LEFT_BRACKET) {
+            // `type [name]` declarations, the name sits one token later
+            if (peek(4).type == Token::TokenType::SEMICOLON) {
+                statements.push_back(parseVarDecl());
+            } else if (peek(4).type == Token::TokenType::ASSIGN) {
+                statements.push_back(parseVarDeclAssign());
+            } else {
+                error(peek(4), "Expect ';' or '=' after variable declaration.");
+            }
+        }
+
+        else if (isType(peek().value) && peek(1).type == Token::TokenType::IDENTIFIER) {
             if (peek(2).type == Token::TokenType::SEMICOLON) {
                 statements.push_back(parseVarDecl());
             } else if (tokens.size() > 2 && peek(2).type == Token::TokenType::ASSIGN) {
@@ -378,7 +406,14 @@ ASTNodePtr Parser::parseBlock() {
             statements.push_back(parseSwitch());
         }
 
+        else if (check(Token::TokenType::ASM)) {
+            statements.push_back(parseAsm());
+        }
+
         else if (check(Token::TokenType::IDENTIFIER)) {
+            if (readOnlyGlobals.count(peek().value)) {
+                error(peek(), "Cannot assign to a const global.");
+            }
             if (isVariableDeclared(peek().value)) {
                 if (peek(1).type == Token::TokenType::PLUS && peek(2).type == Token::TokenType::PLUS) {
                     statements.push_back(std::make_shared<IncrementNode>(peek().value));
@@ -415,7 +450,8 @@ ASTNodePtr Parser::parseBlock() {
                     std::string memberName = consume().value;
                     current = std::make_shared<StructMemberAccessNode>(std::move(current), memberName);
 
-                    while (match({Token::TokenType::MINUS}) && match({Token::TokenType::GREATER})) {
+                    while (check(Token::TokenType::MINUS) && peek(1).type == Token::TokenType::GREATER) {
+                        consume(); consume(); // consume '->'
                         memberName = consume().value;
                         current = std::make_shared<StructMemberAccessNode>(std::move(current), memberName);
                     }
@@ -438,6 +474,9 @@ ASTNodePtr Parser::parseBlock() {
             }
         } else if (match({Token::TokenType::LEFT_BRACKET})) {
             std::string name = consume().value;
+            if (readOnlyGlobals.count(name)) {
+                error(previous(), "Cannot assign to a const global.");
+            }
             expect(Token::TokenType::RIGHT_BRACKET, "Expect ']' after variable name.");
             expect(Token::TokenType::ASSIGN, "Expect '=' after index.");
             ASTNodePtr value = parseExpression();
@@ -448,6 +487,11 @@ ASTNodePtr Parser::parseBlock() {
             statements.push_back(std::move(expr));
             expect(Token::TokenType::SEMICOLON, "Expect ';' after expression.");
         }
+
+        if (statements.size() > parsed) {
+            statements.back()->line = line;
+            statements.back()->column = column;
+        }
     }
 
     // Exit the scope when the block ends
@@ -499,6 +543,44 @@ ASTNodePtr Parser::parseDefault() {
     return std::make_shared<DefaultNode>(std::move(body));
 }
 
+ASTNodePtr Parser::parseAsm() {
+    std::vector<std::string> lines;
+    std::vector<std::string> inputs;
+    std::vector<std::string> outputs;
+    std::vector<std::string> clobbers;
+    expect(Token::TokenType::ASM, "Expect 'asm' keyword.");
+    expect(Token::TokenType::LEFT_BRACE, "Expect '{' after 'asm' keyword.");
+
+    while (!check(Token::TokenType::RIGHT_BRACE) && !check(Token::TokenType::EOF_TOKEN)) {
+        if (check(Token::TokenType::STRING)) {
+            lines.push_back(consume().value);
+        } else if (check(Token::TokenType::IDENTIFIER) && (peek().value == "in" || peek().value == "out")) {
+            std::vector<std::string>& operands = consume().value == "in" ? inputs : outputs;
+            do {
+                if (!check(Token::TokenType::IDENTIFIER) || !isVariableDeclared(peek().value)) {
+                    error(peek(), "Expect a variable as asm operand.");
+                }
+                operands.push_back(consume().value);
+            } while (match({Token::TokenType::COMMA}));
+        } else if (check(Token::TokenType::IDENTIFIER) && peek().value == "clobber") {
+            consume();
+            do {
+                if (!check(Token::TokenType::STRING)) {
+                    error(peek(), "Expect a register name in quotes.");
+                }
+                clobbers.push_back(consume().value);
+            } while (match({Token::TokenType::COMMA}));
+        } else {
+            error(peek(), "Expect an instruction string, 'in', 'out' or 'clobber' in asm block.");
+        }
+        expect(Token::TokenType::SEMICOLON, "Expect ';' after asm line.");
+    }
+
+    expect(Token::TokenType::RIGHT_BRACE, "Expect '}' after asm block.");
+    expect(Token::TokenType::SEMICOLON, "Expect ';' after asm block.");
+    return std::make_shared<AsmNode>(std::move(lines), std::move(inputs), std::move(outputs), std::move(clobbers));
+}
+
 ASTNodePtr Parser::parseVarDecl() {
     std::string type;
     std::string name;
@@ -597,6 +679,7 @@ ASTNodePtr Parser::parseGlobalVarDeclAssign() {
     std::string name;
     ASTNodePtr initializer;
 
+    bool readOnly = match({Token::TokenType::CONST});
     type = consume().value;
     if (!isType(type)) {
         error(previous(), "Expect global variable type.");
@@ -617,15 +700,31 @@ ASTNodePtr Parser::parseGlobalVarDeclAssign() {
     }
 
     addScopedVariable(name);
+    if (readOnly) {
+        readOnlyGlobals.insert(name);
+    }
 
     expect(Token::TokenType::ASSIGN, "Expect '=' after variable name.");
-    initializer = parseExpression();
+    initializer = check(Token::TokenType::LEFT_BRACE) ? parseInitializerList() : parseExpression();
     if (initializer == nullptr) {
         error(peek(), "ParseExpression returned nullptr.");
     }
 
     expect(Token::TokenType::SEMICOLON, "Expect ';' after global variable declaration.");
-    return std::make_shared<GlobalVarDeclAssignNode>(type, name, std::move(initializer), initByAddr);
+    return std::make_shared<GlobalVarDeclAssignNode>(type, name, std::move(initializer), initByAddr, readOnly);
+}
+
+ASTNodePtr Parser::parseInitializerList() {
+    std::vector<ASTNodePtr> elements;
+    expect(Token::TokenType::LEFT_BRACE, "Expect '{' at start of initializer list.");
+    while (!check(Token::TokenType::RIGHT_BRACE)) {
+        elements.push_back(check(Token::TokenType::LEFT_BRACE) ? parseInitializerList() : parseExpression());
+        if (!match({Token::TokenType::COMMA})) {
+            break;
+        }
+    }
+    expect(Token::TokenType::RIGHT_BRACE, "Expect '}' after initializer list.");
+    return std::make_shared<InitializerListNode>(std::move(elements));
 }
 
 ASTNodePtr Parser::parseWhile() {
@@ -822,7 +921,8 @@ ASTNodePtr Parser::parseIdentifier() {
     std::string name = previous().value;
     if (match({Token::TokenType::LEFT_BRACKET})) {
         return parseIndexing(name);
-    } else if (match({Token::TokenType::MINUS}) && match({Token::TokenType::GREATER})) {
+    } else if (check(Token::TokenType::MINUS) && peek(1).type == Token::TokenType::GREATER) {
+        consume(); consume(); // consume '->'
         return parseStructMemberAccess(name);
     } else if (isVariableDeclared(name)) {
         return std::make_shared<IdentifierNode>(name);
@@ -837,7 +937,24 @@ ASTNodePtr Parser::parseIdentifier() {
 
 ASTNodePtr Parser::parseLiteral() {
     Token token = previous();
-    return std::make_shared<LiteralNode>(token.value);
+    if (token.type != Token::TokenType::CHAR_LIT) {
+        return std::make_shared<LiteralNode>(token.value);
+    }
+
+    // character literals are lowered to their numeric value
+    const std::string& text = token.value;
+    int value = text.empty() ? 0 : static_cast<unsigned char>(text[0]);
+    if (text.size() > 1 && text[0] == '\\') {
+        switch (text[1]) {
+            case 'n': value = '\n'; break;
+            case 't': value = '\t'; break;
+            case 'r': value = '\r'; break;
+            case '0': value = 0; break;
+            case 'x': value = text.size() > 2 ? std::stoi(text.substr(2), nullptr, 16) : 0; break;
+            default: value = static_cast<unsigned char>(text[1]); break;
+        }
+    }
+    return std::make_shared<LiteralNode>(std::to_string(value));
 }
 
 ASTNodePtr Parser::parseStringLiteral() {
@@ -869,13 +986,9 @@ ASTNodePtr Parser::parseStructMemberAccess(const std::string& structName) {
     std::string memberName = consume().value;
     current = std::make_shared<StructMemberAccessNode>(std::move(current), memberName);
 
-    while (match({Token::TokenType::MINUS}) && match({Token::TokenType::GREATER})) {
+    while (check(Token::TokenType::MINUS) && peek(1).type == Token::TokenType::GREATER) {
+        consume(); consume(); // consume '->'
         memberName = consume().value;
-
-        if (!isStructMember(structName, memberName)) {
-            error(previous(), "Undefined struct member.");
-        }
-
         current = std::make_shared<StructMemberAccessNode>(std::move(current), memberName);
     }
 
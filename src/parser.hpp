@@ -22,7 +22,7 @@ public:
     std::unordered_map<std::string, std::string> getTypedefs() const {
         return typedefs;
     }
-    std::unordered_map<std::string, std::vector<std::string>> getStructs() const {
+    StructDefinitions getStructs() const {
         return structDefinitions;
     }
 
@@ -49,6 +49,7 @@ private:
     ASTNodePtr parseSwitch();
     ASTNodePtr parseCase();
     ASTNodePtr parseDefault();
+    ASTNodePtr parseAsm();
 
     ASTNodePtr parseBlock();
     ASTNodePtr parseHeader();
@@ -82,6 +83,7 @@ private:
     ASTNodePtr parseStruct();
     ASTNodePtr parseGlobalVarDecl();
     ASTNodePtr parseGlobalVarDeclAssign();
+    ASTNodePtr parseInitializerList();
 
     ASTNodePtr parseIncrement();
     ASTNodePtr parseDecrement();
@@ -98,14 +100,21 @@ private:
     const std::vector<Token>& tokens;
     size_t current = 0;
     std::vector<std::string> existing_types = {
-        "void", "char", "float", "bool", "int8", "int16", "int32", "int64", "uint8", "uint16", "uint32", "uint64"
+        "void", "char", "float", "double", "bool", "int8", "int16", "int32", "int64", "uint8", "uint16", "uint32", "uint64",
+        "int32x4", "uint8x16", "int64x2", "floatx4"
+    };
+    std::vector<std::string> existing_functions = {
+        // lowered inline by the code generator
+        "__builtin_sqrt", "__builtin_sqrtf",
+        "__builtin_memcpy", "__builtin_memset", "__builtin_memcmp", "__builtin_strlen",
+        "__builtin_lane", "__builtin_shuffle", "__builtin_movemask"
     };
-    std::vector<std::string> existing_functions;
     std::vector<std::string> prototypes;
     std::unordered_map<std::string, std::string> typedefs;
-    std::unordered_map<std::string, std::vector<std::string>> structDefinitions;
+    StructDefinitions structDefinitions;
 
     std::stack<std::set<std::string>> scopedStack;
+    std::set<std::string> readOnlyGlobals; // `const` globals, statements may not assign to them
 
     bool isType(const std::string& name);
     bool isStructMember(const std::string& structName, const std::string& memberName);
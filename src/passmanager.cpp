@@ -0,0 +1,118 @@
+#include "passmanager.hpp"
+#include "idioms.hpp"
+#include "sroa.hpp"
+#include "valuenumbering.hpp"
+#include "licm.hpp"
+#include "wholeprogram.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+
+namespace EntS {
+
+// in the order they run
+static const std::vector<std::string> names = {"whole-program", "idioms", "sroa", "value-numbering", "licm"};
+
+// the lowest level a pass runs at, -Os is handled on its own
+static OptimizationLevel minimumLevel(const std::string& name) {
+    if (name == "whole-program" || name == "sroa" || name == "value-numbering") {
+        return OptimizationLevel::O1;
+    }
+    return OptimizationLevel::O2;
+}
+
+static bool enabledAt(const std::string& name, OptimizationLevel level) {
+    switch (level) {
+        case OptimizationLevel::O0:
+            return false;
+        case OptimizationLevel::O1:
+            return minimumLevel(name) == OptimizationLevel::O1;
+        case OptimizationLevel::O2:
+            return true;
+        case OptimizationLevel::Os:
+            // hoisted values each add a temporary and a store in front of the loop
+            return name != "licm";
+    }
+    return false;
+}
+
+PassManager::PassManager(const std::unordered_map<std::string, std::string>& typedefs, const StructDefinitions& structs, const PassOptions& options)
+    : typedefs(typedefs), structDefinitions(structs), options(options) {
+    auto add = [this, &options](const std::string& name, bool beforeInterpreter, std::function<int(const ASTNodePtr&)> run) {
+        bool enabled = enabledAt(name, options.level) && options.disabled.count(name) == 0;
+        passes.push_back({name, enabled, beforeInterpreter, std::move(run)});
+    };
+
+    add("whole-program", true, [this](const ASTNodePtr& root) {
+        WholeProgram pass(this->typedefs, structDefinitions);
+        pass.setInlining(this->options.level != OptimizationLevel::Os);
+        pass.run(root);
+        return pass.getPropagatedCount() + pass.getInlinedCount() + pass.getRemovedCount();
+    });
+    add("idioms", false, [this](const ASTNodePtr& root) {
+        IdiomRecognition pass(this->typedefs, structDefinitions);
+        pass.run(root);
+        return pass.getRewrittenCount();
+    });
+    add("sroa", false, [this](const ASTNodePtr& root) {
+        ScalarReplacement pass(this->typedefs, structDefinitions);
+        pass.run(root);
+        return pass.getReplacedCount();
+    });
+    add("value-numbering", false, [this](const ASTNodePtr& root) {
+        ValueNumbering pass(this->typedefs, structDefinitions);
+        pass.run(root);
+        return pass.getEliminatedCount();
+    });
+    add("licm", false, [this](const ASTNodePtr& root) {
+        LoopInvariantCodeMotion pass(this->typedefs, structDefinitions);
+        pass.run(root);
+        return pass.getHoistedCount();
+    });
+
+    // a single file is already one program
+    if (!options.wholeProgram) {
+        passes.front().enabled = false;
+    }
+}
+
+bool PassManager::isPass(const std::string& name) {
+    return std::find(names.begin(), names.end(), name) != names.end();
+}
+
+void PassManager::run(const ASTNodePtr& root, bool interpreting) {
+    std::vector<Statistics> statistics;
+    for (const Pass& pass : passes) {
+        if (!pass.enabled || (interpreting && !pass.beforeInterpreter)) {
+            continue;
+        }
+        auto start = std::chrono::steady_clock::now();
+        int changes = pass.run(root);
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        statistics.push_back({pass.name, changes, elapsed.count()});
+
+        if (options.printAfter.count(pass.name)) {
+            std::cout << "AST after " << pass.name << ":\n";
+            root->print();
+        }
+    }
+    if (options.statistics) {
+        printStatistics(statistics);
+    }
+}
+
+// goes to stderr, stdout carries the AST and the assembly
+void PassManager::printStatistics(const std::vector<Statistics>& statistics) const {
+    double total = 0;
+    int changes = 0;
+    std::fprintf(stderr, "%-20s %10s %12s\n", "pass", "changes", "time (ms)");
+    for (const auto& entry : statistics) {
+        std::fprintf(stderr, "%-20s %10d %12.3f\n", entry.name.c_str(), entry.changes, entry.milliseconds);
+        total += entry.milliseconds;
+        changes += entry.changes;
+    }
+    std::fprintf(stderr, "%-20s %10d %12.3f\n", "total", changes, total);
+}
+
+} // namespace EntS
@@ -0,0 +1,65 @@
+#ifndef PASS_MANAGER_HPP
+#define PASS_MANAGER_HPP
+
+#include "ast.hpp"
+#include "analysis.hpp"
+#include <functional>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace EntS {
+
+enum class OptimizationLevel { O0, O1, O2, Os };
+
+struct PassOptions {
+    OptimizationLevel level = OptimizationLevel::O2;
+    bool wholeProgram = false;           // -flto, the whole-program pass only runs with it
+    std::set<std::string> disabled;      // -fno-<pass>
+    std::set<std::string> printAfter;    // --print-after=<pass>
+    bool statistics = false;             // --pass-stats
+};
+
+// Runs the AST passes in their fixed order, picked by the optimisation level:
+//
+//   -O0  nothing
+//   -O1  whole-program, sroa, value-numbering
+//   -O2  every pass (the default)
+//   -Os  -O2 without licm and without inlining in whole-program, only passes that do not add code
+//
+// -fno-<pass> turns a single pass off on top of the level.
+class PassManager {
+public:
+    PassManager(const std::unordered_map<std::string, std::string>& typedefs, const StructDefinitions& structs, const PassOptions& options);
+
+    // false for names no pass has, checked while the command line is read
+    static bool isPass(const std::string& name);
+
+    // the bytecode interpreter only gets the passes that make a program out of several files
+    void run(const ASTNodePtr& root, bool interpreting = false);
+
+private:
+    struct Pass {
+        std::string name;
+        bool enabled;
+        bool beforeInterpreter;
+        std::function<int(const ASTNodePtr&)> run; // returns how many changes the pass made
+    };
+    struct Statistics {
+        std::string name;
+        int changes;
+        double milliseconds;
+    };
+
+    void printStatistics(const std::vector<Statistics>& statistics) const;
+
+    const std::unordered_map<std::string, std::string>& typedefs;
+    const StructDefinitions& structDefinitions;
+    const PassOptions& options;
+    std::vector<Pass> passes;
+};
+
+} // namespace EntS
+
+#endif // PASS_MANAGER_HPP
@@ -25,8 +25,9 @@ std::optional<std::string> Preprocessor::preprocess(const std::string& filename)
     std::string currentDir = fs::path(filename).parent_path().string();
 
     while (std::getline(stream, line)) {
+        sourceLine++;
         if (line.empty()) {
-            output << "\n";
+            emitLine(output, "");
             continue;
         }
 
@@ -38,14 +39,14 @@ std::optional<std::string> Preprocessor::preprocess(const std::string& filename)
             }
         } else if (line.find("#define") == 0) {
             handleDefine(line);
-            output << "\n";
+            emitLine(output, "");
         } else if (line.find("#undef") == 0) {
             handleUndef(line);
-            output << "\n";
+            emitLine(output, "");
         } else if (line.find("header") == 0) {
             handleHeader(line, output);
         } else {
-            output << replaceMacros(line) << "\n";
+            emitLine(output, replaceMacros(line));
         }
     }
 
@@ -61,7 +62,7 @@ bool Preprocessor::handleInclude(const std::string& line, const std::string& cur
     }
 
     std::string filename = line.substr(start, end - start);
-    std::string fullPath = resolveIncludePath(filename, currentDir);
+    std::string fullPath = resolveIncludePath(filename, currentDir, line[start - 1] == '<');
     std::string fileContent = readFile(fullPath);
 
     if (fileContent.empty()) {
@@ -97,7 +98,7 @@ bool Preprocessor::handleInclude(const std::string& line, const std::string& cur
         } else if (headerLine.find("#undef") == 0) {
             handleUndef(headerLine);
         } else {
-            output << replaceMacros(headerLine) << "\n";
+            emitLine(output, replaceMacros(headerLine));
         }
     }
 
@@ -131,17 +132,23 @@ bool Preprocessor::handleUndef(const std::string& line) {
 }
 
 bool Preprocessor::handleHeader(const std::string& line, std::ostringstream& output) {
-    output << line << "\n";
+    emitLine(output, line);
     return true;
 }
 
-std::string Preprocessor::resolveIncludePath(const std::string& filename, const std::string& currentDir) {
-    if (filename.front() == '"') {
-        std::string localPath = currentDir + "/" + filename;
+void Preprocessor::emitLine(std::ostringstream& output, const std::string& line) {
+    output << line << "\n";
+    lineMap.push_back(sourceLine);
+}
+
+// `"name"` is looked for next to the including file, `<name>` in the include paths, the sysroot first
+std::string Preprocessor::resolveIncludePath(const std::string& filename, const std::string& currentDir, bool system) {
+    if (!system) {
+        std::string localPath = currentDir.empty() ? filename : currentDir + "/" + filename;
         if (fs::exists(localPath)) {
             return localPath;
         }
-    } else if (filename.front() == '<') {
+    } else {
         for (const auto& path : includePaths) {
             std::string fullPath = path + "/" + filename;
             if (fs::exists(fullPath)) {
@@ -12,18 +12,23 @@ class Preprocessor {
 public:
     Preprocessor(const std::vector<std::string>& includePaths);
     std::optional<std::string> preprocess(const std::string& filename);
+    // line of the input file every line of the output came from, lines brought in by #include map to the directive
+    const std::vector<int>& getLineMap() const { return lineMap; }
 
 private:
     bool handleInclude(const std::string& line, const std::string& currentDir, std::ostringstream& output);
     bool handleDefine(const std::string& line);
     bool handleUndef(const std::string& line);
     bool handleHeader(const std::string& line, std::ostringstream& output);
-    std::string resolveIncludePath(const std::string& filename, const std::string& currentDir);
+    std::string resolveIncludePath(const std::string& filename, const std::string& currentDir, bool system);
     std::string readFile(const std::string& filename);
     std::string replaceMacros(const std::string& line);
+    void emitLine(std::ostringstream& output, const std::string& line);
 
     std::vector<std::string> includePaths;
     std::unordered_map<std::string, std::string> macros;
+    std::vector<int> lineMap;
+    int sourceLine = 0;
 };
 
 } // namespace EntS
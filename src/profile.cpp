@@ -0,0 +1,44 @@
+#include "profile.hpp"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+extern void printFatal(const char* str);
+
+namespace EntS {
+
+ProfileData::ProfileData(const std::string& path) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        printFatal(("could not open profile: " + path).c_str());
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream fields(line);
+        std::string name;
+        size_t count = 0;
+        if (!(fields >> name >> count)) {
+            printFatal(("malformed profile: " + path).c_str());
+        }
+        std::vector<uint64_t> counters(count);
+        for (auto& counter : counters) {
+            if (!(fields >> counter)) {
+                printFatal(("malformed profile: " + path).c_str());
+            }
+        }
+        if (!counters.empty()) {
+            maxEntries = std::max(maxEntries, counters[0]);
+        }
+        functions[name] = std::move(counters);
+    }
+}
+
+const std::vector<uint64_t>* ProfileData::counters(const std::string& function) const {
+    auto it = functions.find(function);
+    return it == functions.end() ? nullptr : &it->second;
+}
+
+} // namespace EntS
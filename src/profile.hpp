@@ -0,0 +1,29 @@
+#ifndef PROFILE_HPP
+#define PROFILE_HPP
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace EntS {
+
+// Counts written by a program built with -fprofile-generate, read back for -fprofile-use.
+// The file has one line per function: its name, the number of counters and the counters.
+// Counter 0 counts entries, the rest are numbered by CodeGenerator::assignCounters.
+class ProfileData {
+public:
+    explicit ProfileData(const std::string& path);
+
+    // nullptr when the function never ran under the profile or is unknown to it
+    const std::vector<uint64_t>* counters(const std::string& function) const;
+    uint64_t maxEntryCount() const { return maxEntries; }
+
+private:
+    std::unordered_map<std::string, std::vector<uint64_t>> functions;
+    uint64_t maxEntries = 0;
+};
+
+} // namespace EntS
+
+#endif // PROFILE_HPP
@@ -0,0 +1,543 @@
+#include "sroa.hpp"
+#include "ast.hpp"
+
+namespace EntS {
+
+ScalarReplacement::ScalarReplacement(const std::unordered_map<std::string, std::string>& typedefs, const StructDefinitions& structs)
+    : typedefs(typedefs), structDefinitions(structs) {}
+
+void ScalarReplacement::run(const ASTNodePtr& root) {
+    auto* program = dynamic_cast<ProgramNode*>(root.get());
+    collectGlobalTypes(program, globalTypes);
+    collectReturnTypes(program, returnTypes);
+    collectParameterTypes(program, parameterTypes);
+
+    for (const auto& statement : program->functions) {
+        if (auto* function = dynamic_cast<FunctionNode*>(statement.get())) {
+            visitFunction(function);
+        }
+    }
+}
+
+void ScalarReplacement::visitFunction(FunctionNode* node) {
+    functionAnalysis.emplace(node);
+    candidates.clear();
+    currentReturnType = node->returnType;
+
+    std::unordered_map<std::string, int> declarations;
+    collectCandidates(node->body.get(), declarations);
+    for (auto it = candidates.begin(); it != candidates.end();) {
+        // sibling scopes reusing the name would share the scalars
+        const VariableInfo* info = functionAnalysis->lookup(*it);
+        bool escapes = !info || info->isParameter || info->byAddr || info->readdressed || info->addressTaken || info->indexed;
+        it = (escapes || declarations[*it] != 1) ? candidates.erase(it) : std::next(it);
+    }
+
+    checkStatement(node->body.get());
+    if (!candidates.empty()) {
+        rewriteBlock(dynamic_cast<BlockNode*>(node->body.get()));
+    }
+    functionAnalysis.reset();
+}
+
+void ScalarReplacement::collectCandidates(const ASTNode* node, std::unordered_map<std::string, int>& declarations) {
+    if (const auto* decl = dynamic_cast<const VarDeclNode*>(node)) {
+        declarations[decl->name]++;
+        if (isStruct(decl->type) && !decl->initByAddr) {
+            candidates.insert(decl->name);
+        }
+    } else if (const auto* decl = dynamic_cast<const VarDeclAssignNode*>(node)) {
+        declarations[decl->name]++;
+        if (isStruct(decl->type) && !decl->initByAddr) {
+            candidates.insert(decl->name);
+        }
+    }
+    forEachChild(node, [&](const ASTNode* child) { collectCandidates(child, declarations); });
+}
+
+// Drops every candidate used in a way that needs its storage.
+void ScalarReplacement::checkStatement(const ASTNode* node) {
+    if (!node) {
+        return;
+    }
+    switch (node->getType()) {
+        case NodeType::Block:
+            for (const auto& statement : dynamic_cast<const BlockNode*>(node)->statements) {
+                checkStatement(statement.get());
+            }
+            break;
+        case NodeType::VarDecl:
+            break;
+        case NodeType::VarDeclAssign: {
+            const auto* decl = dynamic_cast<const VarDeclAssignNode*>(node);
+            if (isStruct(decl->type) && !decl->initByAddr) {
+                Path destination{decl->name, {}};
+                checkCopy(decl->type, &destination, decl->expression.get());
+            } else {
+                checkExpression(decl->expression.get());
+            }
+            break;
+        }
+        case NodeType::Assign: {
+            const auto* assign = dynamic_cast<const AssignNode*>(node);
+            std::string type = variableType(assign->name);
+            if (isStruct(type)) {
+                Path destination{assign->name, {}};
+                checkCopy(type, &destination, assign->expression.get());
+            } else {
+                checkExpression(assign->expression.get());
+            }
+            break;
+        }
+        case NodeType::StructMemberAssign: {
+            const auto* assign = dynamic_cast<const StructMemberAssignNode*>(node);
+            Path destination = *asPath(assign->memberAccess.get());
+            std::string type = pathType(destination);
+            if (isStruct(type)) {
+                checkCopy(type, &destination, assign->value.get());
+            } else {
+                checkExpression(assign->value.get());
+            }
+            break;
+        }
+        case NodeType::Return: {
+            // a struct returned by value is rebuilt from its scalars
+            const ASTNode* value = dynamic_cast<const ReturnNode*>(node)->expression.get();
+            std::optional<Path> path = asPath(value);
+            if (!path || !isStruct(pathType(*path)) || !sameType(pathType(*path), currentReturnType)) {
+                checkExpression(value);
+            }
+            break;
+        }
+        case NodeType::Increment:
+            candidates.erase(dynamic_cast<const IncrementNode*>(node)->variable);
+            break;
+        case NodeType::Decrement:
+            candidates.erase(dynamic_cast<const DecrementNode*>(node)->variable);
+            break;
+        case NodeType::If: {
+            const auto* ifNode = dynamic_cast<const IfNode*>(node);
+            checkExpression(ifNode->condition.get());
+            checkStatement(ifNode->body.get());
+            checkStatement(ifNode->else_.get());
+            break;
+        }
+        case NodeType::While: {
+            const auto* whileNode = dynamic_cast<const WhileNode*>(node);
+            checkExpression(whileNode->condition.get());
+            checkStatement(whileNode->body.get());
+            break;
+        }
+        case NodeType::Switch: {
+            const auto* switchNode = dynamic_cast<const SwitchNode*>(node);
+            checkExpression(switchNode->condition.get());
+            for (const auto& case_ : switchNode->cases) {
+                if (const auto* caseNode = dynamic_cast<const CaseNode*>(case_.get())) {
+                    checkExpression(caseNode->case_.get());
+                    checkStatement(caseNode->body.get());
+                } else if (const auto* defaultNode = dynamic_cast<const DefaultNode*>(case_.get())) {
+                    checkStatement(defaultNode->body.get());
+                }
+            }
+            break;
+        }
+        case NodeType::Expression:
+        case NodeType::FunctionCall:
+            checkExpression(node);
+            break;
+        case NodeType::Asm: {
+            // operands are bound to registers by name
+            const auto* asmNode = dynamic_cast<const AsmNode*>(node);
+            for (const auto& name : asmNode->inputs) {
+                candidates.erase(name);
+            }
+            for (const auto& name : asmNode->outputs) {
+                candidates.erase(name);
+            }
+            break;
+        }
+        default:
+            forEachChild(node, [this](const ASTNode* child) { checkExpression(child); });
+            break;
+    }
+}
+
+void ScalarReplacement::checkCopy(const std::string& destinationType, const Path* destination, const ASTNode* source) {
+    std::optional<Path> sourcePath = asPath(source);
+    if (!sourcePath) {
+        // the result of a call is copied out member by member, anything else producing a struct
+        // hands us an address
+        if (!returnsType(source, destinationType)) {
+            candidates.erase(destination->root);
+        }
+        checkExpression(source);
+        return;
+    }
+    if (!sameType(pathType(*sourcePath), destinationType)) {
+        candidates.erase(destination->root);
+        candidates.erase(sourcePath->root);
+    }
+}
+
+void ScalarReplacement::checkExpression(const ASTNode* node) {
+    if (!node) {
+        return;
+    }
+    if (const auto* identifier = dynamic_cast<const IdentifierNode*>(node)) {
+        // a struct used as a value evaluates to its address
+        candidates.erase(identifier->name);
+        return;
+    }
+    if (node->getType() == NodeType::StructMemberAccess) {
+        Path path = *asPath(node);
+        if (isStruct(pathType(path))) {
+            candidates.erase(path.root);
+        }
+        return;
+    }
+    if (const auto* call = dynamic_cast<const FunctionCallNode*>(node)) {
+        for (size_t i = 0; i < call->arguments.size(); ++i) {
+            if (!passedByValue(call, i)) {
+                checkExpression(call->arguments[i].get());
+            }
+        }
+        return;
+    }
+    forEachChild(node, [this](const ASTNode* child) { checkExpression(child); });
+}
+
+// True when the argument is a struct the callee takes by value, rather than an address
+bool ScalarReplacement::passedByValue(const FunctionCallNode* call, size_t index) const {
+    std::optional<Path> path = asPath(call->arguments[index].get());
+    auto params = parameterTypes.find(call->name);
+    if (!path || params == parameterTypes.end() || index >= params->second.size()) {
+        return false;
+    }
+    std::string type = pathType(*path);
+    return isStruct(type) && sameType(type, params->second[index]);
+}
+
+bool ScalarReplacement::returnsType(const ASTNode* node, const std::string& type) const {
+    const auto* call = dynamic_cast<const FunctionCallNode*>(node);
+    if (!call) {
+        return false;
+    }
+    auto returnType = returnTypes.find(call->name);
+    return returnType != returnTypes.end() && sameType(returnType->second, type);
+}
+
+void ScalarReplacement::rewriteBlock(BlockNode* node) {
+    if (!node) {
+        return;
+    }
+    std::vector<ASTNodePtr> statements;
+    statements.reserve(node->statements.size());
+    for (const auto& statement : node->statements) {
+        std::vector<ASTNodePtr> rewritten = rewriteStatement(statement);
+        statements.insert(statements.end(), rewritten.begin(), rewritten.end());
+    }
+    node->statements = std::move(statements);
+}
+
+std::vector<ASTNodePtr> ScalarReplacement::rewriteStatement(const ASTNodePtr& statement) {
+    switch (statement->getType()) {
+        case NodeType::VarDecl: {
+            const auto* decl = dynamic_cast<const VarDeclNode*>(statement.get());
+            if (!candidates.count(decl->name)) {
+                break;
+            }
+            std::vector<Leaf> leaves;
+            std::vector<std::string> prefix;
+            collectLeaves(decl->type, prefix, leaves);
+
+            std::vector<ASTNodePtr> scalars;
+            Path path{decl->name, {}};
+            for (const auto& leaf : leaves) {
+                scalars.push_back(std::make_shared<VarDeclNode>(leaf.type, scalarName(path, leaf)));
+            }
+            replaced++;
+            return scalars;
+        }
+        case NodeType::VarDeclAssign: {
+            auto* decl = dynamic_cast<VarDeclAssignNode*>(statement.get());
+            std::optional<Path> source = asPath(decl->expression.get());
+            if (!source && candidates.count(decl->name) && isStruct(decl->type) && !decl->initByAddr) {
+                return copyFromCall({decl->name, {}}, decl->expression, decl->type, true);
+            }
+            if (!isStruct(decl->type) || decl->initByAddr || !source || (!candidates.count(decl->name) && !candidates.count(source->root))) {
+                rewriteExpression(decl->expression);
+                break;
+            }
+
+            Path destination{decl->name, {}};
+            if (candidates.count(decl->name)) {
+                std::vector<Leaf> leaves;
+                std::vector<std::string> prefix;
+                collectLeaves(decl->type, prefix, leaves);
+
+                std::vector<ASTNodePtr> scalars;
+                for (const auto& leaf : leaves) {
+                    scalars.push_back(std::make_shared<VarDeclAssignNode>(leaf.type, scalarName(destination, leaf), readLeaf(*source, leaf)));
+                }
+                replaced++;
+                return scalars;
+            }
+
+            std::vector<ASTNodePtr> statements = {std::make_shared<VarDeclNode>(decl->type, decl->name)};
+            std::vector<ASTNodePtr> copy = copyAggregate(destination, *source, decl->type);
+            statements.insert(statements.end(), copy.begin(), copy.end());
+            return statements;
+        }
+        case NodeType::Assign: {
+            auto* assign = dynamic_cast<AssignNode*>(statement.get());
+            std::string type = variableType(assign->name);
+            std::optional<Path> source = asPath(assign->expression.get());
+            if (isStruct(type) && source && (candidates.count(assign->name) || candidates.count(source->root))) {
+                return copyAggregate({assign->name, {}}, *source, type);
+            }
+            if (isStruct(type) && !source && candidates.count(assign->name)) {
+                return copyFromCall({assign->name, {}}, assign->expression, type, false);
+            }
+            rewriteExpression(assign->expression);
+            break;
+        }
+        case NodeType::StructMemberAssign: {
+            auto* assign = dynamic_cast<StructMemberAssignNode*>(statement.get());
+            Path destination = *asPath(assign->memberAccess.get());
+            std::string type = pathType(destination);
+            if (isStruct(type)) {
+                std::optional<Path> source = asPath(assign->value.get());
+                if (source && (candidates.count(destination.root) || candidates.count(source->root))) {
+                    return copyAggregate(destination, *source, type);
+                }
+                if (!source && candidates.count(destination.root)) {
+                    return copyFromCall(destination, assign->value, type, false);
+                }
+                rewriteExpression(assign->value);
+                break;
+            }
+
+            rewriteExpression(assign->value);
+            if (candidates.count(destination.root)) {
+                return {writeLeaf(destination, {{}, type}, assign->value)};
+            }
+            break;
+        }
+        case NodeType::Return: {
+            auto* returnNode = dynamic_cast<ReturnNode*>(statement.get());
+            std::optional<Path> path = asPath(returnNode->expression.get());
+            if (path && candidates.count(path->root) && isStruct(pathType(*path))) {
+                returnNode->expression = aggregateValue(*path, pathType(*path));
+                break;
+            }
+            rewriteExpression(returnNode->expression);
+            break;
+        }
+        case NodeType::If: {
+            auto* ifNode = dynamic_cast<IfNode*>(statement.get());
+            rewriteExpression(ifNode->condition);
+            rewriteBlock(dynamic_cast<BlockNode*>(ifNode->body.get()));
+            if (ifNode->else_ && ifNode->else_->getType() == NodeType::Block) {
+                rewriteBlock(dynamic_cast<BlockNode*>(ifNode->else_.get()));
+            } else if (ifNode->else_) {
+                rewriteStatement(ifNode->else_);
+            }
+            break;
+        }
+        case NodeType::While: {
+            auto* whileNode = dynamic_cast<WhileNode*>(statement.get());
+            rewriteExpression(whileNode->condition);
+            rewriteBlock(dynamic_cast<BlockNode*>(whileNode->body.get()));
+            break;
+        }
+        case NodeType::Switch: {
+            auto* switchNode = dynamic_cast<SwitchNode*>(statement.get());
+            rewriteExpression(switchNode->condition);
+            for (auto& case_ : switchNode->cases) {
+                if (auto* caseNode = dynamic_cast<CaseNode*>(case_.get())) {
+                    rewriteExpression(caseNode->case_);
+                    rewriteBlock(dynamic_cast<BlockNode*>(caseNode->body.get()));
+                } else if (auto* defaultNode = dynamic_cast<DefaultNode*>(case_.get())) {
+                    rewriteBlock(dynamic_cast<BlockNode*>(defaultNode->body.get()));
+                }
+            }
+            break;
+        }
+        default:
+            forEachChildSlot(statement.get(), [this](ASTNodePtr& child) { rewriteExpression(child); });
+            break;
+    }
+    return {statement};
+}
+
+void ScalarReplacement::rewriteExpression(ASTNodePtr& slot) {
+    if (!slot) {
+        return;
+    }
+    if (slot->getType() == NodeType::StructMemberAccess) {
+        Path path = *asPath(slot.get());
+        if (candidates.count(path.root)) {
+            slot = readLeaf(path, {{}, pathType(path)});
+        }
+        return;
+    }
+    if (auto* call = dynamic_cast<FunctionCallNode*>(slot.get())) {
+        for (size_t i = 0; i < call->arguments.size(); ++i) {
+            std::optional<Path> path = asPath(call->arguments[i].get());
+            if (path && candidates.count(path->root) && passedByValue(call, i)) {
+                call->arguments[i] = aggregateValue(*path, pathType(*path));
+            } else {
+                rewriteExpression(call->arguments[i]);
+            }
+        }
+        return;
+    }
+    forEachChildSlot(slot.get(), [this](ASTNodePtr& child) { rewriteExpression(child); });
+}
+
+std::vector<ASTNodePtr> ScalarReplacement::copyAggregate(const Path& destination, const Path& source, const std::string& type) {
+    std::vector<Leaf> leaves;
+    std::vector<std::string> prefix;
+    collectLeaves(type, prefix, leaves);
+
+    std::vector<ASTNodePtr> statements;
+    for (const auto& leaf : leaves) {
+        statements.push_back(writeLeaf(destination, leaf, readLeaf(source, leaf)));
+    }
+    return statements;
+}
+
+// The result lands in a temporary struct, `declare` declares the scalars of the destination
+std::vector<ASTNodePtr> ScalarReplacement::copyFromCall(const Path& destination, ASTNodePtr call, const std::string& type, bool declare) {
+    rewriteExpression(call);
+    Path result{destination.root + ".call" + std::to_string(temporaries++), {}};
+    std::vector<ASTNodePtr> statements = {std::make_shared<VarDeclAssignNode>(type, result.root, std::move(call))};
+
+    std::vector<Leaf> leaves;
+    std::vector<std::string> prefix;
+    collectLeaves(type, prefix, leaves);
+    for (const auto& leaf : leaves) {
+        if (declare) {
+            statements.push_back(std::make_shared<VarDeclAssignNode>(leaf.type, scalarName(destination, leaf), readLeaf(result, leaf)));
+        } else {
+            statements.push_back(writeLeaf(destination, leaf, readLeaf(result, leaf)));
+        }
+    }
+    if (declare) {
+        replaced++;
+    }
+    return statements;
+}
+
+// `{s.a, s.b, {s.c.x, s.c.y}}`, the value of the struct at `path` built from its scalars
+ASTNodePtr ScalarReplacement::aggregateValue(const Path& path, const std::string& type) const {
+    std::vector<ASTNodePtr> elements;
+    for (const auto& member : structDefinitions.at(resolveTypeName(type, typedefs, structDefinitions))) {
+        Path memberPath = path;
+        memberPath.members.push_back(member.second);
+        if (isStruct(member.first)) {
+            elements.push_back(aggregateValue(memberPath, member.first));
+        } else {
+            elements.push_back(readLeaf(memberPath, {{}, member.first}));
+        }
+    }
+    return std::make_shared<InitializerListNode>(std::move(elements));
+}
+
+std::optional<ScalarReplacement::Path> ScalarReplacement::asPath(const ASTNode* node) const {
+    if (!node) {
+        return std::nullopt;
+    }
+    if (const auto* identifier = dynamic_cast<const IdentifierNode*>(node)) {
+        return Path{identifier->name, {}};
+    }
+    if (const auto* access = dynamic_cast<const StructMemberAccessNode*>(node)) {
+        std::optional<Path> path = asPath(access->base.get());
+        if (path) {
+            path->members.push_back(access->memberName);
+        }
+        return path;
+    }
+    return std::nullopt;
+}
+
+std::string ScalarReplacement::pathType(const Path& path) const {
+    std::string type = variableType(path.root);
+    for (const auto& memberName : path.members) {
+        auto structDef = structDefinitions.find(resolveTypeName(type, typedefs, structDefinitions));
+        if (structDef == structDefinitions.end()) {
+            return "";
+        }
+        type.clear();
+        for (const auto& member : structDef->second) {
+            if (member.second == memberName) {
+                type = member.first;
+                break;
+            }
+        }
+    }
+    return type;
+}
+
+std::string ScalarReplacement::variableType(const std::string& name) const {
+    if (const VariableInfo* info = functionAnalysis->lookup(name)) {
+        return info->type;
+    }
+    auto it = globalTypes.find(name);
+    return it != globalTypes.end() ? it->second : "";
+}
+
+bool ScalarReplacement::isStruct(const std::string& type) const {
+    return structDefinitions.count(resolveTypeName(type, typedefs, structDefinitions)) != 0;
+}
+
+bool ScalarReplacement::sameType(const std::string& a, const std::string& b) const {
+    return resolveTypeName(a, typedefs, structDefinitions) == resolveTypeName(b, typedefs, structDefinitions);
+}
+
+void ScalarReplacement::collectLeaves(const std::string& type, std::vector<std::string>& prefix, std::vector<Leaf>& leaves) const {
+    const auto& members = structDefinitions.at(resolveTypeName(type, typedefs, structDefinitions));
+    for (const auto& member : members) {
+        prefix.push_back(member.second);
+        if (isStruct(member.first)) {
+            collectLeaves(member.first, prefix, leaves);
+        } else {
+            leaves.push_back({prefix, member.first});
+        }
+        prefix.pop_back();
+    }
+}
+
+std::string ScalarReplacement::scalarName(const Path& path, const Leaf& leaf) const {
+    std::string name = path.root;
+    for (const auto& member : path.members) {
+        name += "." + member;
+    }
+    for (const auto& member : leaf.members) {
+        name += "." + member;
+    }
+    return name;
+}
+
+ASTNodePtr ScalarReplacement::readLeaf(const Path& path, const Leaf& leaf) const {
+    if (candidates.count(path.root)) {
+        return std::make_shared<IdentifierNode>(scalarName(path, leaf));
+    }
+    ASTNodePtr node = std::make_shared<IdentifierNode>(path.root);
+    for (const auto& member : path.members) {
+        node = std::make_shared<StructMemberAccessNode>(node, member);
+    }
+    for (const auto& member : leaf.members) {
+        node = std::make_shared<StructMemberAccessNode>(node, member);
+    }
+    return node;
+}
+
+ASTNodePtr ScalarReplacement::writeLeaf(const Path& path, const Leaf& leaf, ASTNodePtr value) const {
+    if (candidates.count(path.root)) {
+        return std::make_shared<AssignNode>(scalarName(path, leaf), std::move(value));
+    }
+    return std::make_shared<StructMemberAssignNode>(readLeaf(path, leaf), std::move(value));
+}
+
+} // namespace EntS
@@ -0,0 +1,78 @@
+#ifndef SROA_HPP
+#define SROA_HPP
+
+#include "ast.hpp"
+#include "analysis.hpp"
+#include <optional>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace EntS {
+
+// Scalar replacement of aggregates.
+//
+// A struct local whose storage never escapes is only ever touched through `s->a->b` paths, so every
+// scalar leaf can become a variable of its own named `s.a.b`. Whole struct copies between paths are
+// expanded leaf by leaf. A struct returned or passed by value is rebuilt from its scalars as an
+// initializer list, one assigned from a call is copied out of a temporary holding the result. A
+// struct that is indexed, addressed or passed where a pointer is expected keeps its storage.
+class ScalarReplacement {
+public:
+    ScalarReplacement(const std::unordered_map<std::string, std::string>& typedefs, const StructDefinitions& structs);
+    void run(const ASTNodePtr& root);
+    int getReplacedCount() const { return replaced; }
+
+private:
+    struct Path {
+        std::string root;
+        std::vector<std::string> members;
+    };
+
+    struct Leaf {
+        std::vector<std::string> members;
+        std::string type;
+    };
+
+    void visitFunction(FunctionNode* node);
+    void collectCandidates(const ASTNode* node, std::unordered_map<std::string, int>& declarations);
+    void checkStatement(const ASTNode* node);
+    void checkCopy(const std::string& destinationType, const Path* destination, const ASTNode* source);
+    void checkExpression(const ASTNode* node);
+    bool passedByValue(const FunctionCallNode* call, size_t index) const;
+    bool returnsType(const ASTNode* node, const std::string& type) const;
+
+    void rewriteBlock(BlockNode* node);
+    std::vector<ASTNodePtr> rewriteStatement(const ASTNodePtr& statement);
+    void rewriteExpression(ASTNodePtr& slot);
+    std::vector<ASTNodePtr> copyAggregate(const Path& destination, const Path& source, const std::string& type);
+    std::vector<ASTNodePtr> copyFromCall(const Path& destination, ASTNodePtr call, const std::string& type, bool declare);
+    ASTNodePtr aggregateValue(const Path& path, const std::string& type) const;
+
+    std::optional<Path> asPath(const ASTNode* node) const;
+    std::string pathType(const Path& path) const;
+    std::string variableType(const std::string& name) const;
+    bool isStruct(const std::string& type) const;
+    bool sameType(const std::string& a, const std::string& b) const;
+    void collectLeaves(const std::string& type, std::vector<std::string>& prefix, std::vector<Leaf>& leaves) const;
+    std::string scalarName(const Path& path, const Leaf& leaf) const;
+    ASTNodePtr readLeaf(const Path& path, const Leaf& leaf) const;
+    ASTNodePtr writeLeaf(const Path& path, const Leaf& leaf, ASTNodePtr value) const;
+
+    const std::unordered_map<std::string, std::string>& typedefs;
+    const StructDefinitions& structDefinitions;
+    std::unordered_map<std::string, std::string> globalTypes;
+    std::unordered_map<std::string, std::string> returnTypes;
+    std::unordered_map<std::string, std::vector<std::string>> parameterTypes;
+    std::string currentReturnType;
+    std::optional<FunctionAnalysis> functionAnalysis;
+    std::set<std::string> candidates;
+
+    int replaced = 0;
+    int temporaries = 0;
+};
+
+} // namespace EntS
+
+#endif // SROA_HPP
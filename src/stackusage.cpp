@@ -0,0 +1,117 @@
+#include "stackusage.hpp"
+#include <algorithm>
+
+namespace EntS {
+
+StackUsageReport::StackUsageReport(const std::vector<FunctionStackUsage>& functions) : functions(functions) {
+    for (const auto& function : functions) {
+        byName[function.name] = &function;
+    }
+    for (const auto& function : functions) {
+        if (!index.count(function.name)) {
+            visit(function.name);
+        }
+    }
+}
+
+void StackUsageReport::visit(const std::string& name) {
+    int number = index.size();
+    index[name] = lowLink[name] = number;
+    stack.push_back(name);
+    onStack.insert(name);
+
+    for (const auto& callee : byName.at(name)->callees) {
+        if (!byName.count(callee)) {
+            continue;
+        }
+        if (!index.count(callee)) {
+            visit(callee);
+            lowLink[name] = std::min(lowLink[name], lowLink[callee]);
+        } else if (onStack.count(callee)) {
+            lowLink[name] = std::min(lowLink[name], index[callee]);
+        }
+    }
+
+    if (lowLink[name] == index[name]) {
+        std::vector<std::string> component;
+        std::string member;
+        do {
+            member = stack.back();
+            stack.pop_back();
+            onStack.erase(member);
+            component.push_back(member);
+        } while (member != name);
+        addComponent(component);
+    }
+}
+
+// every callee outside the component already has its chain
+void StackUsageReport::addComponent(const std::vector<std::string>& component) {
+    std::set<std::string> members(component.begin(), component.end());
+    bool recursive = component.size() > 1 || byName.at(component[0])->callees.count(component[0]);
+
+    for (const auto& name : component) {
+        const FunctionStackUsage* function = byName.at(name);
+        Chain chain;
+        int deepest = 0;
+        if (recursive) {
+            chain.bounded = false;
+            chain.recursion = members;
+        }
+        for (const auto& callee : function->callees) {
+            if (!byName.count(callee)) {
+                chain.external.insert(callee);
+                continue;
+            }
+            if (members.count(callee)) {
+                continue;
+            }
+            const Chain& inner = chains.at(callee);
+            deepest = std::max(deepest, inner.bytes);
+            chain.bounded = chain.bounded && inner.bounded;
+            chain.recursion.insert(inner.recursion.begin(), inner.recursion.end());
+            chain.external.insert(inner.external.begin(), inner.external.end());
+        }
+        chain.bytes = function->frameBytes + deepest;
+        chains[name] = std::move(chain);
+    }
+
+    // the members of a cycle can call each other, each gets the deepest one trip around finds
+    if (recursive) {
+        int bytes = 0;
+        for (const auto& name : component) {
+            bytes += byName.at(name)->frameBytes;
+        }
+        int deepest = 0;
+        for (const auto& name : component) {
+            deepest = std::max(deepest, chains[name].bytes - byName.at(name)->frameBytes);
+        }
+        for (const auto& name : component) {
+            chains[name].bytes = bytes + deepest;
+        }
+    }
+}
+
+void StackUsageReport::write(std::ostream& out, const std::vector<std::string>& files) const {
+    for (const auto& function : functions) {
+        const Chain& chain = chains.at(function.name);
+        const std::string& file = static_cast<size_t>(function.file) < files.size() ? files[function.file] : files.front();
+        out << file << ":" << function.line << ":" << function.column << ":" << function.name << "\t" << function.frameBytes
+            << "\tstatic\t" << chain.bytes << "\t" << (chain.bounded ? "bounded" : "unbounded");
+        if (!chain.recursion.empty()) {
+            out << "\trecursive:";
+            for (const auto& name : chain.recursion) {
+                out << " " << name;
+            }
+        }
+        if (!chain.external.empty()) {
+            out << "\tnot counting:";
+            for (const auto& name : chain.external) {
+                out << " " << name;
+            }
+        }
+        out << "\n";
+    }
+}
+
+} // namespace EntS
@@ -0,0 +1,60 @@
+#ifndef STACK_USAGE_HPP
+#define STACK_USAGE_HPP
+
+#include <map>
+#include <ostream>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace EntS {
+
+// What the code generator knows about the stack of one function. EntS has no alloca or variable
+// length arrays, every frame has a size known at compile time.
+struct FunctionStackUsage {
+    std::string name;
+    int file = 0; // index into the files of the unit, as in FunctionNode::file
+    int line = 0;
+    int column = 0;
+    int frameBytes = 0; // return address, saved rbp, locals and the deepest temporaries and call arguments
+    std::set<std::string> callees;
+};
+
+// -fstack-usage: the frame of each function and the deepest call chain starting at it.
+//
+// A chain is the sum of the frames along the call graph, worked out over its strongly connected
+// components callees first. A function in a component with a cycle is recursive, its chain and
+// that of every caller are unbounded and the bytes count one trip around the cycle. Functions the
+// program does not define add nothing, their names are listed instead.
+class StackUsageReport {
+public:
+    explicit StackUsageReport(const std::vector<FunctionStackUsage>& functions);
+
+    // one line per function: file:line:column:function, frame bytes, static, chain bytes, bounded
+    void write(std::ostream& out, const std::vector<std::string>& files) const;
+
+private:
+    struct Chain {
+        int bytes = 0;
+        bool bounded = true;
+        std::set<std::string> recursion; // the recursive functions the chain reaches
+        std::set<std::string> external;
+    };
+
+    // Tarjan's algorithm, components come out callees first
+    void visit(const std::string& name);
+    void addComponent(const std::vector<std::string>& component);
+
+    const std::vector<FunctionStackUsage>& functions;
+    std::map<std::string, const FunctionStackUsage*> byName;
+    std::map<std::string, Chain> chains;
+
+    std::map<std::string, int> index;
+    std::map<std::string, int> lowLink;
+    std::vector<std::string> stack;
+    std::set<std::string> onStack;
+};
+
+} // namespace EntS
+
+#endif // STACK_USAGE_HPP
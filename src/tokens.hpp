@@ -8,9 +8,10 @@ namespace EntS {
     struct Token {
         enum class TokenType {
             FUNCTION, RETURN, VOID, TYPEDEF, STRUCT,
-            IF, ELSE, WHILE, SWITCH, CASE, DEFAULT, BREAK, CONTINUE,
-            HEADER,
-            INT8, INT16, INT32, INT64, UINT8, UINT16, UINT32, UINT64, FLOAT, CHAR, BOOL,
+            IF, ELSE, WHILE, SWITCH, CASE, DEFAULT, BREAK, CONTINUE, ASM,
+            HEADER, CONST,
+            INT8, INT16, INT32, INT64, UINT8, UINT16, UINT32, UINT64, FLOAT, DOUBLE, CHAR, BOOL,
+            INT32X4, UINT8X16, INT64X2, FLOATX4,
             LEFT_PAREN, RIGHT_PAREN, LEFT_BRACE, RIGHT_BRACE, LEFT_BRACKET, RIGHT_BRACKET,
             SEMICOLON, COMMA, ASSIGN, EQUAL, NOT_EQUAL, LESS, LESS_EQUAL, GREATER, GREATER_EQUAL,
             PLUS, MINUS, STAR, SLASH, PERCENT, AMPERSAND, PIPE, EXCLAMATION,
@@ -36,12 +37,14 @@ namespace EntS {
                 case TokenType::IF: result = "IF"; break;
                 case TokenType::ELSE: result = "ELSE"; break;
                 case TokenType::WHILE: result = "WHILE"; break;
+                case TokenType::ASM: result = "ASM"; break;
                 case TokenType::SWITCH: result = "SWITCH"; break;
                 case TokenType::CASE: result = "CASE"; break;
                 case TokenType::DEFAULT: result = "DEFAULT"; break;
                 case TokenType::BREAK: result = "BREAK"; break;
                 case TokenType::CONTINUE: result = "CONTINUE"; break;
                 case TokenType::HEADER: result = "HEADER"; break;
+                case TokenType::CONST: result = "CONST"; break;
                 case TokenType::INT8: result = "INT8"; break;
                 case TokenType::INT16: result = "INT16"; break;
                 case TokenType::INT32: result = "INT32"; break;
@@ -51,6 +54,11 @@ namespace EntS {
                 case TokenType::UINT32: result = "UINT32"; break;
                 case TokenType::UINT64: result = "UINT64"; break;
                 case TokenType::FLOAT: result = "FLOAT"; break;
+                case TokenType::DOUBLE: result = "DOUBLE"; break;
+                case TokenType::INT32X4: result = "INT32X4"; break;
+                case TokenType::UINT8X16: result = "UINT8X16"; break;
+                case TokenType::INT64X2: result = "INT64X2"; break;
+                case TokenType::FLOATX4: result = "FLOATX4"; break;
                 case TokenType::CHAR: result = "CHAR"; break;
                 case TokenType::BOOL: result = "BOOL"; break;
                 case TokenType::LEFT_PAREN: result = "LEFT_PAREN"; break;
@@ -96,12 +104,14 @@ namespace EntS {
                 case TokenType::IF: result = "if"; break;
                 case TokenType::ELSE: result = "else"; break;
                 case TokenType::WHILE: result = "while"; break;
+                case TokenType::ASM: result = "asm"; break;
                 case TokenType::SWITCH: result = "switch"; break;
                 case TokenType::CASE: result = "case"; break;
                 case TokenType::DEFAULT: result = "default"; break;
                 case TokenType::BREAK: result = "break"; break;
                 case TokenType::CONTINUE: result = "continue"; break;
                 case TokenType::HEADER: result = "header"; break;
+                case TokenType::CONST: result = "const"; break;
                 case TokenType::INT8: result = "int8"; break;
                 case TokenType::INT16: result = "int16"; break;
                 case TokenType::INT32: result = "int32"; break;
@@ -111,6 +121,11 @@ namespace EntS {
                 case TokenType::UINT32: result = "uint32"; break;
                 case TokenType::UINT64: result = "uint64"; break;
                 case TokenType::FLOAT: result = "float"; break;
+                case TokenType::DOUBLE: result = "double"; break;
+                case TokenType::INT32X4: result = "int32x4"; break;
+                case TokenType::UINT8X16: result = "uint8x16"; break;
+                case TokenType::INT64X2: result = "int64x2"; break;
+                case TokenType::FLOATX4: result = "floatx4"; break;
                 case TokenType::CHAR: result = "char"; break;
                 case TokenType::BOOL: result = "bool"; break;
                 case TokenType::LEFT_PAREN: result = "("; break;
@@ -0,0 +1,447 @@
+#include "valuenumbering.hpp"
+#include "ast.hpp"
+#include <algorithm>
+
+namespace EntS {
+
+static bool isCommutative(const std::string& op) {
+    return op == "+" || op == "*" || op == "&" || op == "|" || op == "==" || op == "!=" || op == "&&" || op == "||";
+}
+
+ValueNumbering::ValueNumbering(const std::unordered_map<std::string, std::string>& typedefs, const StructDefinitions& structs)
+    : typedefs(typedefs), structDefinitions(structs) {}
+
+void ValueNumbering::run(const ASTNodePtr& root) {
+    auto* program = dynamic_cast<ProgramNode*>(root.get());
+    collectGlobalTypes(program, globalTypes);
+    collectReturnTypes(program, returnTypes);
+
+    for (const auto& statement : program->functions) {
+        if (auto* function = dynamic_cast<FunctionNode*>(statement.get())) {
+            visitFunction(function);
+        }
+    }
+}
+
+void ValueNumbering::visitFunction(FunctionNode* node) {
+    functionAnalysis.emplace(node);
+    valueTable.clear();
+    availableStack.clear();
+    pendingDecls.clear();
+    state = State();
+
+    for (const auto& param : node->params) {
+        writeVariable(dynamic_cast<const ParameterNode*>(param.get())->name);
+    }
+    visitBlock(dynamic_cast<BlockNode*>(node->body.get()));
+    functionAnalysis.reset();
+}
+
+void ValueNumbering::visitBlock(BlockNode* node) {
+    if (!node) {
+        return;
+    }
+    BlockNode* savedBlock = currentBlock;
+    const ASTNode* savedAnchor = currentAnchor;
+    bool savedDefinable = definable;
+    bool savedCallSeen = callSeen;
+
+    availableStack.push_back({});
+    currentBlock = node;
+    for (auto& statement : node->statements) {
+        currentAnchor = statement.get();
+        definable = true;
+        callSeen = false;
+        visitStatement(statement);
+    }
+    availableStack.pop_back();
+
+    // declare the temporaries in front of the statements holding their first occurrence
+    auto pending = pendingDecls.find(node);
+    if (pending != pendingDecls.end()) {
+        std::stable_sort(pending->second.begin(), pending->second.end(), [](const PendingDecl& a, const PendingDecl& b) {
+            return a.sequence < b.sequence;
+        });
+        std::vector<ASTNodePtr> statements;
+        statements.reserve(node->statements.size() + pending->second.size());
+        for (auto& statement : node->statements) {
+            for (const auto& decl : pending->second) {
+                if (decl.anchor == statement.get()) {
+                    statements.push_back(decl.decl);
+                }
+            }
+            statements.push_back(std::move(statement));
+        }
+        node->statements = std::move(statements);
+        pendingDecls.erase(pending);
+    }
+
+    currentBlock = savedBlock;
+    currentAnchor = savedAnchor;
+    definable = savedDefinable;
+    callSeen = savedCallSeen;
+}
+
+void ValueNumbering::visitStatement(ASTNodePtr& statement) {
+    switch (statement->getType()) {
+        case NodeType::VarDecl:
+            writeVariable(dynamic_cast<VarDeclNode*>(statement.get())->name);
+            break;
+        case NodeType::VarDeclAssign: {
+            auto* decl = dynamic_cast<VarDeclAssignNode*>(statement.get());
+            number(decl->expression, true);
+            writeVariable(decl->name);
+            break;
+        }
+        case NodeType::Assign: {
+            auto* assign = dynamic_cast<AssignNode*>(statement.get());
+            number(assign->expression, true);
+            writeVariable(assign->name);
+            break;
+        }
+        case NodeType::IndexationAssign: {
+            auto* assign = dynamic_cast<IndexationAssignNode*>(statement.get());
+            number(assign->expression, true);
+            number(assign->index, true);
+            writeVariable(assign->name);
+            clobberMemory();
+            break;
+        }
+        case NodeType::MemoryAssign: {
+            auto* assign = dynamic_cast<MemoryAssignNode*>(statement.get());
+            number(assign->expression, true);
+            writeVariable(assign->name);
+            break;
+        }
+        case NodeType::StructMemberAssign: {
+            auto* assign = dynamic_cast<StructMemberAssignNode*>(statement.get());
+            number(assign->value, true);
+            writeVariable(memberAccessRoot(dynamic_cast<const StructMemberAccessNode*>(assign->memberAccess.get())));
+            break;
+        }
+        case NodeType::Increment:
+            writeVariable(dynamic_cast<IncrementNode*>(statement.get())->variable);
+            break;
+        case NodeType::Decrement:
+            writeVariable(dynamic_cast<DecrementNode*>(statement.get())->variable);
+            break;
+        case NodeType::Return: {
+            auto* returnNode = dynamic_cast<ReturnNode*>(statement.get());
+            if (returnNode->expression) {
+                number(returnNode->expression, true);
+            }
+            break;
+        }
+        case NodeType::If:
+            visitIf(dynamic_cast<IfNode*>(statement.get()));
+            break;
+        case NodeType::While:
+            visitWhile(dynamic_cast<WhileNode*>(statement.get()));
+            break;
+        case NodeType::Switch:
+            visitSwitch(dynamic_cast<SwitchNode*>(statement.get()));
+            break;
+        case NodeType::FunctionCall:
+            number(statement, true);
+            break;
+        case NodeType::Asm:
+            // the instructions may store anywhere, outputs get new values
+            for (const auto& name : dynamic_cast<AsmNode*>(statement.get())->outputs) {
+                writeVariable(name);
+            }
+            clobberMemory();
+            break;
+        case NodeType::Expression:
+            // the result is dropped, only the operands are worth numbering
+            forEachChildSlot(statement.get(), [this](ASTNodePtr& child) { number(child, true); });
+            break;
+        default:
+            break;
+    }
+}
+
+void ValueNumbering::visitIf(IfNode* node) {
+    number(node->condition, true);
+
+    State entry = state;
+    visitBlock(dynamic_cast<BlockNode*>(node->body.get()));
+    state = entry;
+    if (node->else_ && node->else_->getType() == NodeType::Block) {
+        visitBlock(dynamic_cast<BlockNode*>(node->else_.get()));
+    } else if (node->else_ && node->else_->getType() == NodeType::If) {
+        // an else if condition only runs when ours failed, it cannot be hoisted above us
+        bool savedDefinable = definable;
+        definable = false;
+        visitIf(dynamic_cast<IfNode*>(node->else_.get()));
+        definable = savedDefinable;
+    }
+
+    // whatever either branch changed is unknown at the join
+    state = entry;
+    invalidate(node->body.get());
+    invalidate(node->else_.get());
+}
+
+void ValueNumbering::visitWhile(WhileNode* node) {
+    // the header is also reached from the back edge, forget everything the loop changes
+    invalidate(node);
+
+    bool savedDefinable = definable;
+    definable = false;
+    number(node->condition, true);
+    definable = savedDefinable;
+
+    State header = state;
+    visitBlock(dynamic_cast<BlockNode*>(node->body.get()));
+
+    // the exit is reached from the header and from any break in the body
+    state = header;
+    invalidate(node);
+}
+
+void ValueNumbering::visitSwitch(SwitchNode* node) {
+    number(node->condition, true);
+
+    // cases fall through into each other, so every body starts from the same pessimistic state
+    invalidate(node);
+    bool savedDefinable = definable;
+    definable = false;
+    for (auto& case_ : node->cases) {
+        if (auto* caseNode = dynamic_cast<CaseNode*>(case_.get())) {
+            number(caseNode->case_, true);
+        }
+    }
+    definable = savedDefinable;
+
+    State dispatch = state;
+    for (auto& case_ : node->cases) {
+        state = dispatch;
+        if (auto* caseNode = dynamic_cast<CaseNode*>(case_.get())) {
+            visitBlock(dynamic_cast<BlockNode*>(caseNode->body.get()));
+        } else if (auto* defaultNode = dynamic_cast<DefaultNode*>(case_.get())) {
+            visitBlock(dynamic_cast<BlockNode*>(defaultNode->body.get()));
+        }
+    }
+    state = dispatch;
+}
+
+int ValueNumbering::number(ASTNodePtr& slot, bool record) {
+    ASTNode* node = slot.get();
+    if (!node) {
+        return fresh();
+    }
+
+    // try the whole tree first so a redundant expression is replaced as one
+    if (record && isCandidate(node) && !containsCall(node)) {
+        int value = number(slot, false);
+        if (tryReuse(slot, value)) {
+            return value;
+        }
+    }
+
+    int value;
+    switch (node->getType()) {
+        case NodeType::Literal:
+            value = lookupOrAdd("lit " + dynamic_cast<LiteralNode*>(node)->value);
+            break;
+        case NodeType::Identifier: {
+            const std::string& name = dynamic_cast<IdentifierNode*>(node)->name;
+            if (functionAnalysis->isMemoryResident(name)) {
+                value = lookupOrAdd("ld " + name + " " + variableVersion(name));
+            } else {
+                value = readVariable(name);
+            }
+            break;
+        }
+        case NodeType::MemoryAddress: {
+            const std::string& name = dynamic_cast<MemoryAddressNode*>(node)->name;
+            value = lookupOrAdd("addr " + name + " " + std::to_string(readVariable(name)));
+            break;
+        }
+        case NodeType::Expression: {
+            auto* expression = dynamic_cast<ExpressionNode*>(node);
+            std::string left = expression->left && *expression->left ? std::to_string(number(*expression->left, record)) : "_";
+            std::string right = expression->right && *expression->right ? std::to_string(number(*expression->right, record)) : "_";
+            if (isCommutative(expression->op) && left > right) {
+                std::swap(left, right);
+            }
+            value = lookupOrAdd(expression->op + " " + left + " " + right);
+            break;
+        }
+        case NodeType::StructMemberAccess: {
+            auto* access = dynamic_cast<StructMemberAccessNode*>(node);
+            std::string path = access->memberName;
+            const ASTNode* base = access->base.get();
+            while (base->getType() == NodeType::StructMemberAccess) {
+                const auto* parent = dynamic_cast<const StructMemberAccessNode*>(base);
+                path = parent->memberName + "->" + path;
+                base = parent->base.get();
+            }
+            const std::string& root = dynamic_cast<const IdentifierNode*>(base)->name;
+            value = lookupOrAdd("mem " + root + "->" + path + " " + variableVersion(root));
+            break;
+        }
+        case NodeType::Index: {
+            auto* index = dynamic_cast<IndexNode*>(node);
+            int indexValue = number(index->index, record);
+            // indexing may leave the variable's storage, always key on the memory version
+            value = lookupOrAdd("idx " + index->name + " " + variableVersion(index->name) + " " +
+                                std::to_string(indexValue) + " @" + std::to_string(state.memory));
+            break;
+        }
+        case NodeType::FunctionCall: {
+            auto& arguments = dynamic_cast<FunctionCallNode*>(node)->arguments;
+            for (auto it = arguments.rbegin(); it != arguments.rend(); ++it) {
+                number(*it, record);
+            }
+            if (record) {
+                clobberMemory();
+                callSeen = true;
+            }
+            value = fresh();
+            break;
+        }
+        default:
+            // string literals get a pool of their own later on, never merge them here
+            value = fresh();
+            break;
+    }
+
+    if (record && isCandidate(node)) {
+        recordAvailable(slot, value);
+    }
+    return value;
+}
+
+bool ValueNumbering::isCandidate(const ASTNode* node) const {
+    switch (node->getType()) {
+        case NodeType::Expression:
+        case NodeType::Index:
+            return true;
+        case NodeType::StructMemberAccess: {
+            // intermediate struct values are only addresses, the generator folds those already
+            std::string type = memberType(dynamic_cast<const StructMemberAccessNode*>(node));
+            return !type.empty() && !structDefinitions.count(resolveTypeName(type, typedefs, structDefinitions));
+        }
+        case NodeType::Identifier:
+            // loading through a pointer slot costs two loads
+            return functionAnalysis->isPointerBacked(dynamic_cast<const IdentifierNode*>(node)->name);
+        default:
+            return false;
+    }
+}
+
+bool ValueNumbering::tryReuse(ASTNodePtr& slot, int value) {
+    for (auto scope = availableStack.rbegin(); scope != availableStack.rend(); ++scope) {
+        auto found = scope->find(value);
+        if (found == scope->end()) {
+            continue;
+        }
+
+        Available& available = found->second;
+        if (available.temporary.empty()) {
+            if (!available.definable) {
+                return false;
+            }
+            available.temporary = "$vn" + std::to_string(temporaryCounter++);
+            std::string type = temporaryType(available.slot->get());
+            temporaryTypes[available.temporary] = type;
+            auto decl = std::make_shared<VarDeclAssignNode>(type, available.temporary, *available.slot);
+            *available.slot = std::make_shared<IdentifierNode>(available.temporary);
+            pendingDecls[available.block].push_back({available.anchor, available.sequence, decl});
+            state.variables[available.temporary] = value;
+        }
+
+        slot = std::make_shared<IdentifierNode>(available.temporary);
+        eliminated++;
+        return true;
+    }
+    return false;
+}
+
+void ValueNumbering::recordAvailable(ASTNodePtr& slot, int value) {
+    availableStack.back()[value] = {sequence++, &slot, currentAnchor, currentBlock, "", definable && !callSeen};
+}
+
+int ValueNumbering::lookupOrAdd(const std::string& key) {
+    auto [it, inserted] = valueTable.try_emplace(key, nextValue);
+    if (inserted) {
+        nextValue++;
+    }
+    return it->second;
+}
+
+int ValueNumbering::fresh() {
+    return nextValue++;
+}
+
+int ValueNumbering::readVariable(const std::string& name) {
+    auto it = state.variables.find(name);
+    if (it == state.variables.end()) {
+        it = state.variables.emplace(name, fresh()).first;
+    }
+    return it->second;
+}
+
+void ValueNumbering::writeVariable(const std::string& name) {
+    state.variables[name] = fresh();
+    if (functionAnalysis->isMemoryResident(name)) {
+        // someone may hold its address
+        clobberMemory();
+    }
+}
+
+std::string ValueNumbering::variableVersion(const std::string& name) {
+    std::string version = std::to_string(readVariable(name));
+    if (functionAnalysis->isMemoryResident(name)) {
+        version += "@" + std::to_string(state.memory);
+    }
+    return version;
+}
+
+void ValueNumbering::clobberMemory() {
+    state.memory = fresh();
+}
+
+void ValueNumbering::invalidate(const ASTNode* region) {
+    if (!region) {
+        return;
+    }
+    SideEffects effects;
+    collectSideEffects(region, *functionAnalysis, effects);
+    for (const auto& name : effects.assigned) {
+        state.variables[name] = fresh();
+    }
+    if (effects.writesMemory) {
+        clobberMemory();
+    }
+}
+
+std::string ValueNumbering::variableType(const std::string& name) const {
+    if (const VariableInfo* info = functionAnalysis->lookup(name)) {
+        return info->type;
+    }
+    if (auto temporary = temporaryTypes.find(name); temporary != temporaryTypes.end()) {
+        return temporary->second;
+    }
+    auto it = globalTypes.find(name);
+    return it != globalTypes.end() ? it->second : "";
+}
+
+std::string ValueNumbering::memberType(const StructMemberAccessNode* node) const {
+    return memberAccessType(node, variableType(memberAccessRoot(node)), typedefs, structDefinitions);
+}
+
+std::string ValueNumbering::temporaryType(const ASTNode* node) const {
+    TypeEnvironment environment{typedefs, structDefinitions,
+        [this](const std::string& name) { return variableType(name); },
+        [this](const std::string& name) -> std::string {
+            auto it = returnTypes.find(name);
+            return it != returnTypes.end() ? it->second : "";
+        }};
+    // struct values are their address, only floating point values need a temporary of their own kind
+    std::string type = expressionType(node, environment);
+    return isFloatingType(type, typedefs, structDefinitions) || isVectorType(type, typedefs, structDefinitions) ? type : "int64";
+}
+
+} // namespace EntS
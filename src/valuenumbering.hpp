@@ -0,0 +1,97 @@
+#ifndef VALUE_NUMBERING_HPP
+#define VALUE_NUMBERING_HPP
+
+#include "ast.hpp"
+#include "analysis.hpp"
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace EntS {
+
+// Dominator based value numbering over the structured AST.
+//
+// EntS only has structured control flow, so a statement dominates everything that follows it in
+// its block, including nested blocks. Values are numbered bottom up, a repeated value that is still
+// available gets computed once into a temporary declared right before the statement holding its
+// first occurrence. Loads are keyed on the version of the variable they read and, for memory that
+// may be reached through pointers, on the current memory version, so stores and calls invalidate
+// them simply by bumping a version.
+class ValueNumbering {
+public:
+    ValueNumbering(const std::unordered_map<std::string, std::string>& typedefs, const StructDefinitions& structs);
+    void run(const ASTNodePtr& root);
+    int getEliminatedCount() const { return eliminated; }
+
+private:
+    struct Available {
+        int sequence;
+        ASTNodePtr* slot;      // first occurrence, replaced by the temporary once it is reused
+        const ASTNode* anchor; // statement the temporary gets declared in front of
+        BlockNode* block;
+        std::string temporary;
+        bool definable;        // false when the first occurrence may not be hoisted in front of its statement
+    };
+
+    struct State {
+        std::unordered_map<std::string, int> variables;
+        int memory = 0;
+    };
+
+    struct PendingDecl {
+        const ASTNode* anchor;
+        int sequence;
+        ASTNodePtr decl;
+    };
+
+    void visitFunction(FunctionNode* node);
+    void visitBlock(BlockNode* node);
+    void visitStatement(ASTNodePtr& statement);
+    void visitIf(IfNode* node);
+    void visitWhile(WhileNode* node);
+    void visitSwitch(SwitchNode* node);
+
+    int number(ASTNodePtr& slot, bool record);
+    bool isCandidate(const ASTNode* node) const;
+    bool tryReuse(ASTNodePtr& slot, int value);
+    void recordAvailable(ASTNodePtr& slot, int value);
+
+    int lookupOrAdd(const std::string& key);
+    int fresh();
+    int readVariable(const std::string& name);
+    void writeVariable(const std::string& name);
+    std::string variableVersion(const std::string& name);
+    void clobberMemory();
+    void invalidate(const ASTNode* region);
+
+    std::string variableType(const std::string& name) const;
+    std::string memberType(const StructMemberAccessNode* node) const;
+    std::string temporaryType(const ASTNode* node) const;
+
+    const std::unordered_map<std::string, std::string>& typedefs;
+    const StructDefinitions& structDefinitions;
+    std::unordered_map<std::string, std::string> globalTypes;
+    std::unordered_map<std::string, std::string> returnTypes;
+    std::unordered_map<std::string, std::string> temporaryTypes;
+
+    std::optional<FunctionAnalysis> functionAnalysis;
+    std::unordered_map<std::string, int> valueTable;
+    std::vector<std::unordered_map<int, Available>> availableStack;
+    std::unordered_map<BlockNode*, std::vector<PendingDecl>> pendingDecls;
+    State state;
+
+    BlockNode* currentBlock = nullptr;
+    const ASTNode* currentAnchor = nullptr;
+    bool definable = false;
+    bool callSeen = false;
+
+    int nextValue = 0;
+    int sequence = 0;
+    int temporaryCounter = 0;
+    int eliminated = 0;
+};
+
+} // namespace EntS
+
+#endif // VALUE_NUMBERING_HPP
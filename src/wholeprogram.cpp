@@ -0,0 +1,452 @@
+#include "wholeprogram.hpp"
+#include <charconv>
+#include <functional>
+#include <limits>
+#include <set>
+
+extern void printFatal(const char* str);
+
+namespace EntS {
+
+// Calls `callback` on the node and everything below it
+static void visitAll(const ASTNode* node, const std::function<void(const ASTNode*)>& callback) {
+    callback(node);
+    forEachChild(node, [&callback](const ASTNode* child) { visitAll(child, callback); });
+}
+
+static bool isIntegerType(const std::string& resolvedType) {
+    static const std::set<std::string> integers = {"int8", "int16", "int32", "int64", "uint8", "uint16", "uint32", "uint64"};
+    return integers.count(resolvedType) != 0;
+}
+
+// Parses a decimal integer literal, nothing else is propagated
+static std::optional<int64_t> integerLiteral(const ASTNode* node) {
+    const auto* literal = dynamic_cast<const LiteralNode*>(node);
+    if (!literal) {
+        return std::nullopt;
+    }
+    const std::string& text = literal->value;
+    int64_t value;
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (error != std::errc() || end != text.data() + text.size()) {
+        return std::nullopt;
+    }
+    return value;
+}
+
+// True when passing `value` to a parameter of the type leaves it unchanged
+static bool fitsType(int64_t value, const std::string& resolvedType) {
+    auto within = [value](int64_t low, int64_t high) { return value >= low && value <= high; };
+    if (resolvedType == "int8") return within(INT8_MIN, INT8_MAX);
+    if (resolvedType == "int16") return within(INT16_MIN, INT16_MAX);
+    if (resolvedType == "int32") return within(INT32_MIN, INT32_MAX);
+    if (resolvedType == "uint8") return within(0, UINT8_MAX);
+    if (resolvedType == "uint16") return within(0, UINT16_MAX);
+    if (resolvedType == "uint32") return within(0, UINT32_MAX);
+    if (resolvedType == "uint64") return value >= 0;
+    return resolvedType == "int64";
+}
+
+static ASTNodePtr cloneExpression(const ASTNode* node, const std::unordered_map<std::string, const ASTNode*>& arguments) {
+    switch (node->getType()) {
+        case NodeType::Identifier: {
+            const std::string& name = dynamic_cast<const IdentifierNode*>(node)->name;
+            auto it = arguments.find(name);
+            return it != arguments.end() ? cloneExpression(it->second, {}) : std::make_shared<IdentifierNode>(name);
+        }
+        case NodeType::Literal:
+            return std::make_shared<LiteralNode>(dynamic_cast<const LiteralNode*>(node)->value);
+        case NodeType::MemoryAddress:
+            return std::make_shared<MemoryAddressNode>(dynamic_cast<const MemoryAddressNode*>(node)->name);
+        case NodeType::Index: {
+            const auto* index = dynamic_cast<const IndexNode*>(node);
+            return std::make_shared<IndexNode>(index->name, cloneExpression(index->index.get(), arguments));
+        }
+        case NodeType::FunctionCall: {
+            const auto* call = dynamic_cast<const FunctionCallNode*>(node);
+            std::vector<ASTNodePtr> callArguments;
+            for (const auto& argument : call->arguments) {
+                callArguments.push_back(cloneExpression(argument.get(), arguments));
+            }
+            return std::make_shared<FunctionCallNode>(call->name, std::move(callArguments));
+        }
+        case NodeType::Expression: {
+            const auto* expression = dynamic_cast<const ExpressionNode*>(node);
+            std::optional<ASTNodePtr> left;
+            std::optional<ASTNodePtr> right;
+            if (expression->left && *expression->left) {
+                left = cloneExpression(expression->left->get(), arguments);
+            }
+            if (expression->right && *expression->right) {
+                right = cloneExpression(expression->right->get(), arguments);
+            }
+            return std::make_shared<ExpressionNode>(std::move(left), expression->op, std::move(right));
+        }
+        default:
+            printFatal("cannot copy this expression for inlining");
+            return nullptr;
+    }
+}
+
+static void replaceIdentifier(ASTNodePtr& slot, const std::string& name, const std::string& value) {
+    if (const auto* identifier = dynamic_cast<const IdentifierNode*>(slot.get()); identifier && identifier->name == name) {
+        slot = std::make_shared<LiteralNode>(value);
+        return;
+    }
+    forEachChildSlot(slot.get(), [&](ASTNodePtr& child) { replaceIdentifier(child, name, value); });
+}
+
+WholeProgram::WholeProgram(const std::unordered_map<std::string, std::string>& typedefs, const StructDefinitions& structs)
+    : typedefs(typedefs), structDefinitions(structs) {}
+
+ASTNodePtr WholeProgram::link(const std::vector<ASTNodePtr>& programs) {
+    std::set<std::string> definedFunctions;
+    std::set<std::string> definedGlobals;
+    for (size_t file = 0; file < programs.size(); ++file) {
+        for (const auto& statement : dynamic_cast<ProgramNode*>(programs[file].get())->functions) {
+            std::string global;
+            if (auto* function = dynamic_cast<FunctionNode*>(statement.get())) {
+                if (!definedFunctions.insert(function->name).second) {
+                    printFatal(("function " + function->name + " is defined in more than one file").c_str());
+                }
+                function->file = file;
+            } else if (const auto* declaration = dynamic_cast<const GlobalVarDeclNode*>(statement.get())) {
+                global = declaration->name;
+            } else if (const auto* declaration = dynamic_cast<const GlobalVarDeclAssignNode*>(statement.get())) {
+                global = declaration->name;
+            }
+            // globals are private to their file, in one program two of them would clash
+            if (!global.empty() && !definedGlobals.insert(global).second) {
+                printFatal(("global " + global + " is defined in more than one file, whole program mode needs distinct names").c_str());
+            }
+        }
+    }
+
+    // prototypes of what the program now defines itself go, the rest still name outside symbols
+    std::vector<ASTNodePtr> statements;
+    for (const auto& program : programs) {
+        for (const auto& statement : dynamic_cast<ProgramNode*>(program.get())->functions) {
+            const auto* header = dynamic_cast<const HeaderNode*>(statement.get());
+            if (!header) {
+                statements.push_back(statement);
+                continue;
+            }
+            std::vector<ASTNodePtr> prototypes;
+            for (const auto& prototype : header->prototypes) {
+                const auto* function = dynamic_cast<const FunctionPrototypeNode*>(prototype.get());
+                const auto* global = dynamic_cast<const GlobalVarDeclNode*>(prototype.get());
+                if ((function && definedFunctions.count(function->name)) || (global && definedGlobals.count(global->name))) {
+                    continue;
+                }
+                prototypes.push_back(prototype);
+            }
+            if (!prototypes.empty()) {
+                statements.push_back(std::make_shared<HeaderNode>(std::move(prototypes)));
+            }
+        }
+    }
+    return std::make_shared<ProgramNode>(std::move(statements));
+}
+
+void WholeProgram::mergeDefinitions(std::unordered_map<std::string, std::string>& typedefs, StructDefinitions& structs,
+                                    const std::unordered_map<std::string, std::string>& unitTypedefs, const StructDefinitions& unitStructs) {
+    for (const auto& [name, type] : unitTypedefs) {
+        auto [it, inserted] = typedefs.emplace(name, type);
+        if (!inserted && it->second != type) {
+            printFatal(("typedef " + name + " differs between files").c_str());
+        }
+    }
+    for (const auto& [name, members] : unitStructs) {
+        auto [it, inserted] = structs.emplace(name, members);
+        if (!inserted && it->second != members) {
+            printFatal(("struct " + name + " differs between files").c_str());
+        }
+    }
+}
+
+void WholeProgram::run(const ASTNodePtr& root) {
+    auto* program = dynamic_cast<ProgramNode*>(root.get());
+    collectGlobalTypes(program, globalTypes);
+    collectReturnTypes(program, returnTypes);
+
+    collectFunctions(program);
+    collectCallSites();
+    propagateArguments();
+    // inlined bodies may hold calls that can be inlined in turn
+    for (int round = 0; inlining && round < 4 && inlineCalls(); ++round) {
+    }
+    removeDeadFunctions(program);
+}
+
+void WholeProgram::collectFunctions(ProgramNode* program) {
+    functions.clear();
+    order.clear();
+    for (const auto& statement : program->functions) {
+        if (auto* function = dynamic_cast<FunctionNode*>(statement.get())) {
+            functions[function->name] = function;
+            order.push_back(function);
+        }
+    }
+}
+
+void WholeProgram::collectCallSites() {
+    callSites.clear();
+    escaped.clear();
+    for (const FunctionNode* function : order) {
+        visitAll(function->body.get(), [this](const ASTNode* node) {
+            if (const auto* call = dynamic_cast<const FunctionCallNode*>(node)) {
+                callSites[call->name].push_back(call);
+            } else if (const auto* identifier = dynamic_cast<const IdentifierNode*>(node); identifier && functions.count(identifier->name)) {
+                escaped.insert(identifier->name);
+            } else if (const auto* address = dynamic_cast<const MemoryAddressNode*>(node); address && functions.count(address->name)) {
+                escaped.insert(address->name);
+            }
+        });
+    }
+}
+
+// A parameter that is never written keeps the value it was called with, when every call site
+// passes the same literal the body can use the literal instead.
+void WholeProgram::propagateArguments() {
+    for (FunctionNode* function : order) {
+        const auto& sites = callSites[function->name];
+        if (function->name == "main" || escaped.count(function->name) || sites.empty()) {
+            continue;
+        }
+        FunctionAnalysis analysis(function);
+        SideEffects effects;
+        collectSideEffects(function->body.get(), analysis, effects);
+
+        for (size_t i = 0; i < function->params.size(); ++i) {
+            const auto* param = dynamic_cast<const ParameterNode*>(function->params[i].get());
+            std::string type = resolveType(param->type);
+            const VariableInfo* info = analysis.lookup(param->name);
+            if (!isIntegerType(type) || !info || info->byAddr || info->readdressed || info->addressTaken || info->indexed
+                || effects.assigned.count(param->name)) {
+                continue;
+            }
+            std::optional<int64_t> value;
+            bool constant = true;
+            for (const FunctionCallNode* site : sites) {
+                std::optional<int64_t> argument = site->arguments.size() == function->params.size()
+                    ? integerLiteral(site->arguments[i].get()) : std::nullopt;
+                if (!argument || (value && *value != *argument) || !fitsType(*argument, type)) {
+                    constant = false;
+                    break;
+                }
+                value = argument;
+            }
+            if (constant && value) {
+                replaceIdentifier(function->body, param->name, std::to_string(*value));
+                propagated++;
+            }
+        }
+    }
+}
+
+bool WholeProgram::inlineCalls() {
+    bool changed = false;
+    for (FunctionNode* function : order) {
+        FunctionAnalysis caller(function);
+        inlineInto(function->body, caller, changed);
+    }
+    if (changed) {
+        collectCallSites();
+    }
+    return changed;
+}
+
+void WholeProgram::inlineInto(ASTNodePtr& slot, const FunctionAnalysis& caller, bool& changed) {
+    auto recurse = [&](ASTNodePtr& child) { inlineInto(child, caller, changed); };
+    if (auto* block = dynamic_cast<BlockNode*>(slot.get())) {
+        // a call standing as a statement has no expression to become, only its arguments are looked at
+        for (auto& statement : block->statements) {
+            if (statement->getType() == NodeType::FunctionCall) {
+                forEachChildSlot(statement.get(), recurse);
+            } else {
+                recurse(statement);
+            }
+        }
+        return;
+    }
+    forEachChildSlot(slot.get(), recurse);
+
+    const auto* call = dynamic_cast<const FunctionCallNode*>(slot.get());
+    auto callee = call ? functions.find(call->name) : functions.end();
+    if (callee == functions.end()) {
+        return;
+    }
+    const FunctionNode* function = callee->second;
+    const ASTNode* body = inlineBody(function);
+    if (!body || call->arguments.size() != function->params.size()) {
+        return;
+    }
+
+    bool calleeCalls = containsCall(body);
+    std::unordered_map<std::string, const ASTNode*> arguments;
+    for (size_t i = 0; i < function->params.size(); ++i) {
+        const auto* param = dynamic_cast<const ParameterNode*>(function->params[i].get());
+        if (!canSubstitute(call->arguments[i].get(), param->type, caller, calleeCalls)) {
+            return;
+        }
+        arguments[param->name] = call->arguments[i].get();
+    }
+    // the globals the callee names must not be hidden by locals of the caller
+    bool captured = false;
+    visitAll(body, [&](const ASTNode* node) {
+        std::string name;
+        if (const auto* identifier = dynamic_cast<const IdentifierNode*>(node)) {
+            name = identifier->name;
+        } else if (const auto* index = dynamic_cast<const IndexNode*>(node)) {
+            name = index->name;
+        } else if (const auto* address = dynamic_cast<const MemoryAddressNode*>(node)) {
+            name = address->name;
+        }
+        if (!name.empty() && !arguments.count(name) && caller.isLocal(name)) {
+            captured = true;
+        }
+    });
+    if (captured) {
+        return;
+    }
+
+    slot = cloneExpression(body, arguments);
+    inlined++;
+    changed = true;
+}
+
+// The returned expression of a function whose body is `return <expression>;`, when every use of a
+// parameter in it is a plain read and it evaluates to a signed integer, nullptr otherwise.
+const ASTNode* WholeProgram::inlineBody(const FunctionNode* function) const {
+    static const int sizeLimit = 32;
+    const auto* block = dynamic_cast<const BlockNode*>(function->body.get());
+    if (!block || block->statements.size() != 1 || resolveType(function->returnType) != "int64") {
+        return nullptr;
+    }
+    const auto* ret = dynamic_cast<const ReturnNode*>(block->statements[0].get());
+    if (!ret || !ret->expression) {
+        return nullptr;
+    }
+
+    std::unordered_map<std::string, std::string> params;
+    for (const auto& param : function->params) {
+        const auto* parameter = dynamic_cast<const ParameterNode*>(param.get());
+        if (!isIntegerType(resolveType(parameter->type))) {
+            return nullptr;
+        }
+        params[parameter->name] = parameter->type;
+    }
+
+    bool suitable = true;
+    int size = 0;
+    visitAll(ret->expression.get(), [&](const ASTNode* node) {
+        size++;
+        switch (node->getType()) {
+            case NodeType::Identifier:
+            case NodeType::Literal:
+            case NodeType::Expression:
+                break;
+            case NodeType::FunctionCall:
+                suitable = suitable && dynamic_cast<const FunctionCallNode*>(node)->name != function->name;
+                break;
+            case NodeType::Index:
+                suitable = suitable && !params.count(dynamic_cast<const IndexNode*>(node)->name);
+                break;
+            case NodeType::MemoryAddress:
+                suitable = suitable && !params.count(dynamic_cast<const MemoryAddressNode*>(node)->name);
+                break;
+            default:
+                suitable = false;
+                break;
+        }
+    });
+    if (!suitable || size > sizeLimit) {
+        return nullptr;
+    }
+
+    TypeEnvironment environment{typedefs, structDefinitions,
+        [&](const std::string& name) -> std::string {
+            auto param = params.find(name);
+            if (param != params.end()) {
+                return param->second;
+            }
+            auto global = globalTypes.find(name);
+            return global != globalTypes.end() ? global->second : "";
+        },
+        [this](const std::string& name) -> std::string {
+            auto it = returnTypes.find(name);
+            return it != returnTypes.end() ? it->second : "";
+        }};
+    std::string type = resolveType(expressionType(ret->expression.get(), environment));
+    if (!isIntegerType(type) || type.starts_with("uint")) {
+        return nullptr;
+    }
+    return ret->expression.get();
+}
+
+// An argument can take the place of the parameter when reading it where the parameter is read
+// gives the value the call would have passed.
+bool WholeProgram::canSubstitute(const ASTNode* argument, const std::string& parameterType, const FunctionAnalysis& caller, bool calleeCalls) const {
+    std::string type = resolveType(parameterType);
+    if (std::optional<int64_t> value = integerLiteral(argument)) {
+        return fitsType(*value, type);
+    }
+    const auto* identifier = dynamic_cast<const IdentifierNode*>(argument);
+    if (!identifier) {
+        return false;
+    }
+    // a call in the callee could change memory the variable lives in before it is read
+    if (calleeCalls && caller.isMemoryResident(identifier->name)) {
+        return false;
+    }
+    std::string argumentType;
+    if (const VariableInfo* info = caller.lookup(identifier->name)) {
+        argumentType = info->type;
+    } else if (auto global = globalTypes.find(identifier->name); global != globalTypes.end()) {
+        argumentType = global->second;
+    }
+    return !argumentType.empty() && resolveType(argumentType) == type;
+}
+
+void WholeProgram::removeDeadFunctions(ProgramNode* program) {
+    if (!functions.count("main")) {
+        return;
+    }
+    std::set<std::string> reachable = {"main"};
+    std::vector<const FunctionNode*> work = {functions.at("main")};
+    while (!work.empty()) {
+        const FunctionNode* function = work.back();
+        work.pop_back();
+        visitAll(function->body.get(), [&](const ASTNode* node) {
+            std::string name;
+            if (const auto* call = dynamic_cast<const FunctionCallNode*>(node)) {
+                name = call->name;
+            } else if (const auto* identifier = dynamic_cast<const IdentifierNode*>(node)) {
+                name = identifier->name;
+            } else if (const auto* address = dynamic_cast<const MemoryAddressNode*>(node)) {
+                name = address->name;
+            }
+            auto it = functions.find(name);
+            if (it != functions.end() && reachable.insert(name).second) {
+                work.push_back(it->second);
+            }
+        });
+    }
+
+    std::vector<ASTNodePtr> statements;
+    for (auto& statement : program->functions) {
+        const auto* function = dynamic_cast<const FunctionNode*>(statement.get());
+        if (function && !reachable.count(function->name)) {
+            removed++;
+            continue;
+        }
+        statements.push_back(std::move(statement));
+    }
+    program->functions = std::move(statements);
+}
+
+std::string WholeProgram::resolveType(const std::string& type) const {
+    return resolveTypeName(type, typedefs, structDefinitions);
+}
+
+} // namespace EntS
@@ -0,0 +1,76 @@
+#ifndef WHOLE_PROGRAM_HPP
+#define WHOLE_PROGRAM_HPP
+
+#include "ast.hpp"
+#include "analysis.hpp"
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace EntS {
+
+// Whole program optimisation for -flto.
+//
+// The programs of every input file are linked into one AST, a function definition replaces the
+// header prototypes other files reached it through. Over the combined program:
+//
+//   - a parameter that gets the same integer literal at every call site becomes that literal
+//   - calls to functions whose body is a single `return <expression>;` are replaced by the
+//     expression, with the arguments substituted for the parameters
+//   - functions main cannot reach are removed
+//
+// Only main is assumed to be called from outside, the result is meant to be linked as a program.
+//
+// Inlining does not look at -fprofile-use counts. Counters are numbered over the bodies this pass
+// leaves behind, so inlining a call the instrumented build kept, or keeping one it inlined, would
+// make the profile of every caller stop matching its source.
+class WholeProgram {
+public:
+    WholeProgram(const std::unordered_map<std::string, std::string>& typedefs, const StructDefinitions& structs);
+
+    // joins the programs parsed from each input file, functions remember the index of their file
+    static ASTNodePtr link(const std::vector<ASTNodePtr>& programs);
+    // adds the typedefs and structs of one file to those of the whole program
+    static void mergeDefinitions(std::unordered_map<std::string, std::string>& typedefs, StructDefinitions& structs,
+                                 const std::unordered_map<std::string, std::string>& unitTypedefs, const StructDefinitions& unitStructs);
+
+    // -Os keeps the propagation and dead function removal but not the inlining
+    void setInlining(bool enabled) { inlining = enabled; }
+
+    void run(const ASTNodePtr& root);
+    int getPropagatedCount() const { return propagated; }
+    int getInlinedCount() const { return inlined; }
+    int getRemovedCount() const { return removed; }
+
+private:
+    void collectFunctions(ProgramNode* program);
+    void collectCallSites();
+    void propagateArguments();
+    bool inlineCalls();
+    void inlineInto(ASTNodePtr& slot, const FunctionAnalysis& caller, bool& changed);
+    void removeDeadFunctions(ProgramNode* program);
+
+    const ASTNode* inlineBody(const FunctionNode* function) const;
+    bool canSubstitute(const ASTNode* argument, const std::string& parameterType, const FunctionAnalysis& caller, bool calleeCalls) const;
+    std::string resolveType(const std::string& type) const;
+
+    const std::unordered_map<std::string, std::string>& typedefs;
+    const StructDefinitions& structDefinitions;
+    std::unordered_map<std::string, std::string> globalTypes;
+    std::unordered_map<std::string, std::string> returnTypes;
+
+    std::unordered_map<std::string, FunctionNode*> functions;
+    std::vector<FunctionNode*> order; // functions in program order, keeps the result deterministic
+    std::unordered_map<std::string, std::vector<const FunctionCallNode*>> callSites;
+    std::set<std::string> escaped; // named other than by a call, callers are unknown
+
+    bool inlining = true;
+    int propagated = 0;
+    int inlined = 0;
+    int removed = 0;
+};
+
+} // namespace EntS
+
+#endif // WHOLE_PROGRAM_HPP
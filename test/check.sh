@@ -0,0 +1,61 @@
+#!/bin/sh
+# Builds every program in test/regress at -O0, -O2 and -flto, links it against the runtime and
+# runs it, then runs it once more with --run. Each program names the exit code it has to end with
+# in a `// expect: <code>` line, `// check: --interpret` runs it with the interpreter as well. A
+# directory holds a program made of several files, --run only takes one file so those are checked
+# natively.
+ENT="${ENT:-./ent}"
+DIR="$(dirname "$0")"
+RUNTIME="$DIR/../sysroot/lib/ents/intlibe.a"
+WORK="$(mktemp -d)"
+trap 'rm -rf "$WORK"' EXIT
+
+# `ent` prints the AST and then the assembly of every unit, each unit goes to a file of its own
+build() {
+    rm -f "$WORK"/*.s "$WORK/program"
+    "$ENT" "$@" > "$WORK/output" || return 1
+    awk -v dir="$WORK" '/^Program:$/ { p = 0 } p { print > (dir "/unit" n ".s") } /^Assembly:$/ { p = 1; n++ }' "$WORK/output"
+    gcc -o "$WORK/program" "$WORK"/*.s "$RUNTIME"
+}
+
+status=0
+count=0
+for program in "$DIR"/regress/*; do
+    name="$(basename "$program" .ent)"
+    if [ -d "$program" ]; then
+        files="$(ls "$program"/*.ent)"
+    else
+        files="$program"
+    fi
+    expected="$(sed -n 's|^// expect: \([0-9]*\)$|\1|p' $files)"
+    if [ -z "$expected" ]; then
+        echo "$name: no expect line"
+        status=1
+        continue
+    fi
+    for flags in -O0 -O2 -flto; do
+        if build $flags $files; then
+            "$WORK/program"
+            result=$?
+        else
+            result="a build failure"
+        fi
+        if [ "$result" != "$expected" ]; then
+            echo "$name $flags: expected $expected, got $result"
+            status=1
+        fi
+    done
+    if [ ! -d "$program" ]; then
+        for mode in --run $(sed -n 's|^// check: \(.*\)$|\1|p' "$program"); do
+            "$ENT" $mode "$program" > /dev/null
+            result=$?
+            if [ "$result" != "$expected" ]; then
+                echo "$name $mode: expected $expected, got $result"
+                status=1
+            fi
+        done
+    fi
+    count=$((count + 1))
+done
+[ $status = 0 ] && echo "$count programs passed"
+exit $status